@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "device.h"
+#include "bench.h"
+#include "cl_program_dir.h"
+
+#define DEFAULT_WARMUP 2
+#define DEFAULT_ITERS 10
+#define DEFAULT_OUTPUT "bench_results.jsonl"
+
+typedef struct bench_entry_t {
+	const char *name;
+	int (*fn)(bench_t *b);
+} bench_entry_t;
+
+static const bench_entry_t benches[] = {
+	{ "vec_add", bench_vec_add },
+	{ "convolve", bench_convolve },
+	{ "cast_rays", bench_cast_rays },
+	{ "bvh", bench_bvh },
+	{ "sphere_layout", bench_sphere_layout },
+	{ "file_load", bench_file_load },
+	{ "buffer_pool", bench_buffer_pool },
+	{ "elementwise", bench_elementwise },
+	{ "primitives", bench_primitives },
+	{ "wavefront", bench_wavefront },
+	{ "conv_batch", bench_conv_batch },
+	{ "conv_types", bench_conv_types },
+	{ "conv_image", bench_conv_image },
+	{ "task_graph", bench_task_graph }
+};
+
+cl_program bench_program(bench_t *b, const char *path, const char *options){
+	char full_path[1024];
+	snprintf(full_path, sizeof(full_path), "%s%s", CL_PROGRAM_DIR, path);
+	char *src = read_file(full_path, NULL);
+	if (!src){
+		return NULL;
+	}
+	cl_program program = build_program(src, b->context, b->device, options);
+	free(src);
+	return program;
+}
+int bench_time(bench_t *b, bench_run_fn run, void *arg, double *times){
+	for (int i = 0; i < b->warmup + b->iters; ++i){
+		double start = wall_time();
+		cl_int err = run(arg);
+		err |= clFinish(b->queue);
+		if (check_cl_err(err, "benchmark run failed")){
+			return 1;
+		}
+		if (i >= b->warmup){
+			times[i - b->warmup] = (wall_time() - start) * 1000.0;
+		}
+	}
+	return 0;
+}
+static int cmp_double(const void *a, const void *b){
+	double da = *(const double*)a, db = *(const double*)b;
+	return da < db ? -1 : da > db ? 1 : 0;
+}
+void bench_record(bench_t *b, const char *kernel, const char *size, double items, double bytes,
+	double *times, int valid)
+{
+	qsort(times, b->iters, sizeof(double), cmp_double);
+	double median = b->iters % 2 ? times[b->iters / 2]
+		: (times[b->iters / 2 - 1] + times[b->iters / 2]) / 2;
+	//Nearest-rank p95
+	double p95 = times[(b->iters * 95 + 99) / 100 - 1];
+	double gbps = bytes / (median * 1e-3) * 1e-9;
+	double items_per_sec = items / (median * 1e-3);
+	printf("%-24s %-20s %10.3f %10.3f %10.2f %14.4g %s\n", kernel, size, median, p95, gbps,
+		items_per_sec, valid ? "ok" : "MISMATCH");
+	if (!valid){
+		++b->failures;
+	}
+	fprintf(b->out, "{\"device\":\"%s\",\"driver\":\"%s\",\"kernel\":\"%s\",\"size\":\"%s\","
+		"\"items\":%.0f,\"bytes\":%.0f,\"iters\":%d,\"median_ms\":%.6f,\"p95_ms\":%.6f,"
+		"\"gb_per_s\":%.4f,\"items_per_s\":%.6g,\"valid\":%s}\n", b->device_name,
+		b->driver_version, kernel, size, items, bytes, b->iters, median, p95, gbps,
+		items_per_sec, valid ? "true" : "false");
+	fflush(b->out);
+}
+
+int main(int argc, char **argv){
+	bench_t b = {
+		.warmup = DEFAULT_WARMUP,
+		.iters = DEFAULT_ITERS
+	};
+	const char *output = DEFAULT_OUTPUT;
+	const char *filter = NULL;
+	for (int i = 1; i < argc; ++i){
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc){
+			output = argv[++i];
+		}
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc){
+			b.iters = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc){
+			b.warmup = atoi(argv[++i]);
+		}
+		else if (argv[i][0] != '-'){
+			filter = argv[i];
+		}
+		else {
+			fprintf(stderr, "Usage: %s [-o output.jsonl] [-n iters] [-w warmup] [benchmark]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (b.iters < 1 || b.warmup < 0){
+		fprintf(stderr, "Need at least one timed iteration\n");
+		return 1;
+	}
+	b.context = select_device(&b.device);
+	if (!b.context){
+		return 1;
+	}
+	cl_int err;
+	b.queue = clCreateCommandQueue(b.context, b.device, 0, &err);
+	if (check_cl_err(err, "failed to create command queue")){
+		return 1;
+	}
+	clGetDeviceInfo(b.device, CL_DEVICE_NAME, sizeof(b.device_name), b.device_name, NULL);
+	clGetDeviceInfo(b.device, CL_DRIVER_VERSION, sizeof(b.driver_version), b.driver_version, NULL);
+	b.out = fopen(output, "w");
+	if (!b.out){
+		fprintf(stderr, "Failed to open %s\n", output);
+		return 1;
+	}
+
+	printf("%-24s %-20s %10s %10s %10s %14s\n", "kernel", "size", "median ms", "p95 ms",
+		"GB/s", "items/s");
+	int failed = 0;
+	for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i){
+		if (filter && !strstr(benches[i].name, filter)){
+			continue;
+		}
+		if (benches[i].fn(&b)){
+			fprintf(stderr, "Benchmark %s failed to run\n", benches[i].name);
+			failed = 1;
+		}
+	}
+	fclose(b.out);
+	printf("Results written to %s\n", output);
+	if (b.failures){
+		fprintf(stderr, "%d results didn't match the host reference\n", b.failures);
+	}
+
+	clReleaseCommandQueue(b.queue);
+	clReleaseContext(b.context);
+	return failed || b.failures;
+}
+
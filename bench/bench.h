@@ -0,0 +1,71 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+/*
+ * Shared state for the benchmarks, each one sweeps its problem sizes running on
+ * the selected device and records its results through bench_record
+ */
+typedef struct bench_t {
+	cl_context context;
+	cl_device_id device;
+	cl_command_queue queue;
+	char device_name[128];
+	char driver_version[128];
+	//Untimed warm up runs and timed runs for each problem size
+	int warmup, iters;
+	//JSON lines output, one object per result
+	FILE *out;
+	//Number of results that didn't match the host reference
+	int failures;
+} bench_t;
+
+//Run one iteration of the benchmark, returning the first OpenCL error hit
+typedef cl_int (*bench_run_fn)(void *arg);
+
+/*
+ * Load and build a program from the repo source tree, path is relative to the root
+ * returns NULL on failure
+ */
+cl_program bench_program(bench_t *b, const char *path, const char *options);
+/*
+ * Time run after the warm up runs, finishing the queue after each run so the
+ * times are end-to-end latencies. times must hold b->iters entries, in ms
+ * returns 1 if a run failed
+ */
+int bench_time(bench_t *b, bench_run_fn run, void *arg, double *times);
+/*
+ * Print and write out the result for one kernel and problem size, computing the
+ * median and p95 latency of the times along with the effective bandwidth for
+ * bytes moved and throughput for items processed per run
+ */
+void bench_record(bench_t *b, const char *kernel, const char *size, double items, double bytes,
+	double *times, int valid);
+
+/*
+ * The benchmarks, returning 1 if they failed to run
+ */
+int bench_vec_add(bench_t *b);
+int bench_convolve(bench_t *b);
+int bench_cast_rays(bench_t *b);
+int bench_bvh(bench_t *b);
+int bench_sphere_layout(bench_t *b);
+int bench_file_load(bench_t *b);
+int bench_buffer_pool(bench_t *b);
+int bench_elementwise(bench_t *b);
+int bench_primitives(bench_t *b);
+int bench_wavefront(bench_t *b);
+int bench_conv_batch(bench_t *b);
+int bench_conv_types(bench_t *b);
+int bench_conv_image(bench_t *b);
+int bench_task_graph(bench_t *b);
+
+#endif
+
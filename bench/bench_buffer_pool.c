@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "buffer_pool.h"
+#include "convolve.h"
+#include "bench.h"
+
+//Convolutions run per timed run, each on a slightly different image size
+#define CYCLES 64
+#define BASE_DIM 1000
+#define MAX_DIM (BASE_DIM + 100)
+#define MASK_DIM 5
+#define SLAB_MB 64
+
+enum { ALLOC_CREATE, ALLOC_POOL, ALLOC_POOL_SLAB, NUM_ALLOCATORS };
+static const char *alloc_names[NUM_ALLOCATORS] = {
+	"alloc_create", "alloc_pool", "alloc_pool_slab"
+};
+
+typedef struct pool_bench_t {
+	cl_command_queue queue;
+	cl_kernel kernel;
+	cl_mem mask;
+	//NULL to create and release the buffers each cycle
+	buffer_pool_t *pool;
+	const cl_uint *in;
+	cl_uint *result;
+	size_t local_size[2];
+} pool_bench_t;
+
+static void cycle_dims(int cycle, int *width, int *height){
+	*width = BASE_DIM + (cycle * 37) % (MAX_DIM - BASE_DIM + 1);
+	*height = BASE_DIM + (cycle * 61) % (MAX_DIM - BASE_DIM + 1);
+}
+static cl_mem get_buffer(pool_bench_t *p, cl_context context, size_t size, cl_mem_flags flags,
+	cl_int *err)
+{
+	if (p->pool){
+		return buffer_pool_get(p->pool, size, flags, err);
+	}
+	return clCreateBuffer(context, flags, size, NULL, err);
+}
+static void put_buffer(pool_bench_t *p, cl_mem mem){
+	if (!mem){
+		return;
+	}
+	if (p->pool){
+		buffer_pool_put(p->pool, mem);
+	}
+	else {
+		clReleaseMemObject(mem);
+	}
+}
+/*
+ * Upload, convolve and release the buffers for each cycle's image size the way an
+ * iterative workload would, reading back the last cycle's output
+ */
+static cl_int run_cycles(void *arg){
+	pool_bench_t *p = arg;
+	cl_context context;
+	cl_int err = clGetCommandQueueInfo(p->queue, CL_QUEUE_CONTEXT, sizeof(cl_context), &context,
+		NULL);
+	for (int i = 0; i < CYCLES && err == CL_SUCCESS; ++i){
+		int width, height;
+		cycle_dims(i, &width, &height);
+		const size_t out_count = (size_t)CONV_OUT_DIM(width, MASK_DIM) * CONV_OUT_DIM(height, MASK_DIM);
+		cl_int mem_err = CL_SUCCESS;
+		cl_mem in = get_buffer(p, context, sizeof(cl_uint) * width * height, CL_MEM_READ_ONLY,
+			&mem_err);
+		cl_mem out = in ? get_buffer(p, context, sizeof(cl_uint) * out_count, CL_MEM_WRITE_ONLY,
+			&mem_err) : NULL;
+		err = mem_err;
+		if (err == CL_SUCCESS){
+			err = clEnqueueWriteBuffer(p->queue, in, CL_FALSE, 0, sizeof(cl_uint) * width * height,
+				p->in, 0, NULL, NULL);
+			err |= enqueue_convolve(p->queue, p->kernel, in, p->mask, out, width, height, MASK_DIM,
+				p->local_size, NULL);
+			if (i == CYCLES - 1){
+				err |= clEnqueueReadBuffer(p->queue, out, CL_TRUE, 0, sizeof(cl_uint) * out_count,
+					p->result, 0, NULL, NULL);
+			}
+		}
+		//The queue's in order, so the next cycle can't overwrite the buffers before they're used
+		put_buffer(p, in);
+		put_buffer(p, out);
+	}
+	return err;
+}
+int bench_buffer_pool(bench_t *b){
+	cl_program program = bench_program(b,
+		"opencl_programming_guide/ch2_simple_convolution/convolution.cl", NULL);
+	if (!program){
+		return 1;
+	}
+	cl_int err;
+	pool_bench_t p = { .queue = b->queue, .local_size = { 8, 8 } };
+	p.kernel = clCreateKernel(program, "convolve", &err);
+	if (check_cl_err(err, "failed to create convolution kernel")){
+		clReleaseProgram(program);
+		return 1;
+	}
+	cl_uint mask[MASK_DIM * MASK_DIM];
+	for (int i = 0; i < MASK_DIM * MASK_DIM; ++i){
+		mask[i] = 1 + i % 3;
+	}
+	p.mask = clCreateBuffer(b->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(mask),
+		mask, &err);
+	if (check_cl_err(err, "failed to create mask buffer")){
+		clReleaseKernel(p.kernel);
+		clReleaseProgram(program);
+		return 1;
+	}
+	cl_uint *in = malloc(sizeof(cl_uint) * MAX_DIM * MAX_DIM);
+	srand(1);
+	for (size_t i = 0; i < (size_t)MAX_DIM * MAX_DIM; ++i){
+		in[i] = rand() % 256;
+	}
+	//Every cycle reads its image from the front of the same input
+	int width, height;
+	cycle_dims(CYCLES - 1, &width, &height);
+	const size_t out_count = (size_t)CONV_OUT_DIM(width, MASK_DIM) * CONV_OUT_DIM(height, MASK_DIM);
+	cl_uint *expect = malloc(sizeof(cl_uint) * out_count);
+	p.result = malloc(sizeof(cl_uint) * out_count);
+	p.in = in;
+	convolve_host(in, width, height, mask, MASK_DIM, expect);
+
+	double bytes = 0, items = 0;
+	for (int i = 0; i < CYCLES; ++i){
+		int w, h;
+		cycle_dims(i, &w, &h);
+		items += (double)CONV_OUT_DIM(w, MASK_DIM) * CONV_OUT_DIM(h, MASK_DIM);
+		bytes += sizeof(cl_uint) * ((double)w * h + (double)CONV_OUT_DIM(w, MASK_DIM)
+			* CONV_OUT_DIM(h, MASK_DIM));
+	}
+	char size[32];
+	snprintf(size, sizeof(size), "%dx~%d k%d", CYCLES, BASE_DIM, MASK_DIM);
+	double *times = malloc(sizeof(double) * b->iters);
+	int ret = 0;
+	for (int a = 0; a < NUM_ALLOCATORS && !ret; ++a){
+		p.pool = NULL;
+		if (a != ALLOC_CREATE){
+			p.pool = buffer_pool_create(b->context, b->device,
+				a == ALLOC_POOL_SLAB ? (size_t)SLAB_MB * 1024 * 1024 : 0);
+			if (!p.pool){
+				ret = 1;
+				break;
+			}
+		}
+		memset(p.result, 0, sizeof(cl_uint) * out_count);
+		if (bench_time(b, run_cycles, &p, times)){
+			ret = 1;
+		}
+		else {
+			int valid = memcmp(p.result, expect, sizeof(cl_uint) * out_count) == 0;
+			bench_record(b, alloc_names[a], size, items, bytes, times, valid);
+		}
+		if (p.pool && !ret){
+			buffer_pool_stats_t stats = buffer_pool_stats(p.pool);
+			printf("%s: %.1f MB live, %.1f MB high water, %.1f MB cached, %.1f%% hit rate, "
+				"%zu allocations over %d cycles\n", alloc_names[a],
+				stats.live_bytes / (1024.0 * 1024.0), stats.high_water / (1024.0 * 1024.0),
+				stats.cached_bytes / (1024.0 * 1024.0), 100 * stats.hit_rate, stats.allocations,
+				(b->warmup + b->iters) * CYCLES);
+		}
+		clFinish(b->queue);
+		buffer_pool_destroy(p.pool);
+	}
+	free(in);
+	free(expect);
+	free(p.result);
+	free(times);
+	clReleaseMemObject(p.mask);
+	clReleaseKernel(p.kernel);
+	clReleaseProgram(program);
+	return ret;
+}
+
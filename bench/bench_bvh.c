@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "scene.h"
+#include "bvh.h"
+#include "bench.h"
+
+#define DIM 512
+static const size_t sphere_counts[] = { 16, 64, 256, 1024, 4096, 16384, 65536 };
+//Skip the brute force kernel past this many ray-sphere tests per frame, it only gets slower
+#define MAX_BRUTE_FORCE_TESTS (1ull << 30)
+//See bench_cast_rays.c
+#define MISMATCH_TOLERANCE 1e-3
+
+typedef struct bvh_bench_t {
+	cl_command_queue queue;
+	cl_kernel kernel;
+	cl_mem img;
+	size_t global_size[2];
+} bvh_bench_t;
+
+static cl_int run_kernel(void *arg){
+	bvh_bench_t *r = arg;
+	cl_char background = ' ';
+	cl_int err = clEnqueueFillBuffer(r->queue, r->img, &background, sizeof(cl_char), 0,
+		r->global_size[0] * r->global_size[1], 0, NULL, NULL);
+	err |= clEnqueueNDRangeKernel(r->queue, r->kernel, 2, NULL, r->global_size, NULL, 0,
+		NULL, NULL);
+	return err;
+}
+//Run and check one of the kernels, returns the median time in ms or a negative value on failure
+static double time_kernel(bench_t *b, bvh_bench_t *r, const char *name, const char *size,
+	const char *expect, double bytes, double *times)
+{
+	const size_t n_px = r->global_size[0] * r->global_size[1];
+	if (bench_time(b, run_kernel, r, times)){
+		return -1;
+	}
+	char *img = malloc(n_px);
+	cl_int err = clEnqueueReadBuffer(b->queue, r->img, CL_TRUE, 0, n_px, img, 0, NULL, NULL);
+	size_t mismatches = 0;
+	for (size_t i = 0; i < n_px; ++i){
+		mismatches += img[i] != expect[i];
+	}
+	free(img);
+	bench_record(b, name, size, n_px, bytes, times, err == CL_SUCCESS
+		&& mismatches <= MISMATCH_TOLERANCE * n_px);
+	//bench_record leaves the times sorted
+	return times[b->iters / 2];
+}
+int bench_bvh(bench_t *b){
+	cl_program program = bench_program(b, "ray_test/ray_test.cl", NULL);
+	if (!program){
+		return 1;
+	}
+	cl_int err, mem_err;
+	bvh_bench_t brute = { .queue = b->queue, .global_size = { DIM, DIM } };
+	bvh_bench_t bvh = brute;
+	const size_t n_px = (size_t)DIM * DIM;
+	brute.kernel = clCreateKernel(program, "cast_rays", &err);
+	bvh.kernel = clCreateKernel(program, "cast_rays_bvh", &mem_err);
+	err |= mem_err;
+	brute.img = clCreateBuffer(b->context, CL_MEM_WRITE_ONLY, n_px, NULL, &mem_err);
+	err |= mem_err;
+	bvh.img = brute.img;
+	//Failures fall through to the cleanup at the end so nothing leaks
+	int ret = check_cl_err(err, "failed to create ray casting kernels and image buffer");
+	char *expect = malloc(n_px);
+	double *times = malloc(sizeof(double) * b->iters);
+	camera_t camera;
+	grid_camera(&camera, DIM, DIM);
+	size_t crossover = 0;
+	for (size_t s = 0; s < sizeof(sphere_counts) / sizeof(sphere_counts[0]) && !ret; ++s){
+		const size_t n_objs = sphere_counts[s];
+		sphere_t *spheres = malloc(sizeof(sphere_t) * n_objs);
+		sphere_t *sorted = malloc(sizeof(sphere_t) * n_objs);
+		random_spheres(spheres, n_objs, DIM, DIM, 1);
+		char size[32];
+		snprintf(size, sizeof(size), "%dx%d s%lu", DIM, DIM, (unsigned long)n_objs);
+
+		//The build reorders the spheres so each run gets a fresh copy
+		bvh_node_t *nodes = NULL;
+		size_t n_nodes = 0;
+		for (int i = 0; i < b->warmup + b->iters; ++i){
+			memcpy(sorted, spheres, sizeof(sphere_t) * n_objs);
+			free(nodes);
+			double start = wall_time();
+			n_nodes = bvh_build(sorted, n_objs, &nodes);
+			if (i >= b->warmup){
+				times[i - b->warmup] = (wall_time() - start) * 1000.0;
+			}
+		}
+		bench_record(b, "bvh_build", size, n_objs, 0, times, 1);
+
+		//Traversing the BVH finds the same closest hits as testing every sphere
+		memset(expect, ' ', n_px);
+		cast_rays_bvh_host(&camera, sorted, nodes, expect, DIM, DIM);
+
+		cl_mem mem_spheres = clCreateBuffer(b->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			sizeof(sphere_t) * n_objs, sorted, &err);
+		cl_mem mem_nodes = clCreateBuffer(b->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			sizeof(bvh_node_t) * n_nodes, nodes, &mem_err);
+		err |= mem_err;
+		cl_uint n = n_objs;
+		cl_uint2 img_dim = {{ DIM, DIM }};
+		err |= clSetKernelArg(brute.kernel, 0, sizeof(camera_t), &camera);
+		err |= clSetKernelArg(brute.kernel, 1, sizeof(cl_mem), &mem_spheres);
+		err |= clSetKernelArg(brute.kernel, 2, sizeof(cl_uint), &n);
+		err |= clSetKernelArg(brute.kernel, 3, sizeof(cl_mem), &brute.img);
+		err |= clSetKernelArg(brute.kernel, 4, sizeof(cl_uint2), &img_dim);
+		err |= clSetKernelArg(bvh.kernel, 0, sizeof(camera_t), &camera);
+		err |= clSetKernelArg(bvh.kernel, 1, sizeof(cl_mem), &mem_spheres);
+		err |= clSetKernelArg(bvh.kernel, 2, sizeof(cl_uint), &n);
+		err |= clSetKernelArg(bvh.kernel, 3, sizeof(cl_mem), &mem_nodes);
+		err |= clSetKernelArg(bvh.kernel, 4, sizeof(cl_mem), &bvh.img);
+		err |= clSetKernelArg(bvh.kernel, 5, sizeof(cl_uint2), &img_dim);
+		if (check_cl_err(err, "failed to set up ray casting kernels")){
+			ret = 1;
+		}
+		else {
+			double brute_ms = -1;
+			if (n_objs * n_px <= MAX_BRUTE_FORCE_TESTS){
+				brute_ms = time_kernel(b, &brute, "cast_rays", size, expect,
+					n_px * (1.0 + sizeof(sphere_t) * n_objs), times);
+				ret = brute_ms < 0;
+			}
+			//Only an estimate of the traffic since it depends on how many nodes each ray visits
+			double bvh_ms = ret ? -1 : time_kernel(b, &bvh, "cast_rays_bvh", size, expect,
+				n_px + sizeof(sphere_t) * n_objs
+				+ sizeof(bvh_node_t) * n_nodes, times);
+			ret |= bvh_ms < 0;
+			if (!ret && !crossover && (brute_ms < 0 || bvh_ms < brute_ms)){
+				crossover = n_objs;
+			}
+		}
+		if (mem_spheres){
+			clReleaseMemObject(mem_spheres);
+		}
+		if (mem_nodes){
+			clReleaseMemObject(mem_nodes);
+		}
+		free(nodes);
+		free(spheres);
+		free(sorted);
+	}
+	if (!ret){
+		if (crossover){
+			printf("cast_rays_bvh is faster than cast_rays from %lu spheres\n",
+				(unsigned long)crossover);
+		}
+		else {
+			printf("cast_rays_bvh was never faster than cast_rays\n");
+		}
+	}
+	if (brute.img){
+		clReleaseMemObject(brute.img);
+	}
+	free(expect);
+	free(times);
+	if (brute.kernel){
+		clReleaseKernel(brute.kernel);
+	}
+	if (bvh.kernel){
+		clReleaseKernel(bvh.kernel);
+	}
+	clReleaseProgram(program);
+	return ret;
+}
+
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "scene.h"
+#include "bench.h"
+
+static const int dims[] = { 64, 256, 1024 };
+static const size_t sphere_counts[] = { 16, 256 };
+/*
+ * The device's pow and sqrt may round differently from the host so rays grazing a
+ * sphere's silhouette can disagree, allow this fraction of pixels to differ
+ */
+#define MISMATCH_TOLERANCE 1e-3
+
+typedef struct rays_bench_t {
+	cl_command_queue queue;
+	cl_kernel kernel;
+	cl_mem img;
+	size_t global_size[2];
+} rays_bench_t;
+
+//The host backend's cast_rays, the native baseline for the kernel
+typedef struct host_rays_bench_t {
+	thread_pool_t *pool;
+	const camera_t *camera;
+	const sphere_t *spheres;
+	size_t n_objs;
+	char *img;
+	int dim;
+} host_rays_bench_t;
+
+static cl_int run_host_simd(void *arg){
+	host_rays_bench_t *h = arg;
+	memset(h->img, ' ', (size_t)h->dim * h->dim);
+	cast_rays_host_simd(h->pool, h->camera, h->spheres, h->n_objs, h->img, h->dim, h->dim);
+	return CL_SUCCESS;
+}
+static cl_int run_cast_rays(void *arg){
+	rays_bench_t *r = arg;
+	cl_char background = ' ';
+	cl_int err = clEnqueueFillBuffer(r->queue, r->img, &background, sizeof(cl_char), 0,
+		r->global_size[0] * r->global_size[1], 0, NULL, NULL);
+	err |= clEnqueueNDRangeKernel(r->queue, r->kernel, 2, NULL, r->global_size, NULL, 0,
+		NULL, NULL);
+	return err;
+}
+int bench_cast_rays(bench_t *b){
+	cl_program program = bench_program(b, "ray_test/ray_test.cl", NULL);
+	if (!program){
+		return 1;
+	}
+	cl_int err;
+	rays_bench_t r = { .queue = b->queue };
+	r.kernel = clCreateKernel(program, "cast_rays", &err);
+	if (check_cl_err(err, "failed to create cast_rays kernel")){
+		clReleaseProgram(program);
+		return 1;
+	}
+	double *times = malloc(sizeof(double) * b->iters);
+	thread_pool_t *pool = thread_pool_create(0);
+	char host_name[32];
+	snprintf(host_name, sizeof(host_name), "cast_rays_host_%s", simd_level_name(simd_level()));
+	int ret = 0;
+	for (size_t d = 0; d < sizeof(dims) / sizeof(dims[0]) && !ret; ++d){
+		for (size_t s = 0; s < sizeof(sphere_counts) / sizeof(sphere_counts[0]) && !ret; ++s){
+			const int dim = dims[d];
+			const size_t n_px = (size_t)dim * dim;
+			cl_uint n_objs = sphere_counts[s];
+			sphere_t *spheres = malloc(sizeof(sphere_t) * n_objs);
+			char *expect = malloc(n_px);
+			char *img = malloc(n_px);
+			camera_t camera;
+			grid_camera(&camera, dim, dim);
+			random_spheres(spheres, n_objs, dim, dim, 1);
+			memset(expect, ' ', n_px);
+			cast_rays_host(&camera, spheres, n_objs, expect, dim, dim);
+
+			cl_mem mem_spheres = clCreateBuffer(b->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				sizeof(sphere_t) * n_objs, spheres, &err);
+			r.img = clCreateBuffer(b->context, CL_MEM_WRITE_ONLY, n_px, NULL, &err);
+			cl_uint2 img_dim = {{ dim, dim }};
+			err |= clSetKernelArg(r.kernel, 0, sizeof(camera_t), &camera);
+			err |= clSetKernelArg(r.kernel, 1, sizeof(cl_mem), &mem_spheres);
+			err |= clSetKernelArg(r.kernel, 2, sizeof(cl_uint), &n_objs);
+			err |= clSetKernelArg(r.kernel, 3, sizeof(cl_mem), &r.img);
+			err |= clSetKernelArg(r.kernel, 4, sizeof(cl_uint2), &img_dim);
+			r.global_size[0] = dim;
+			r.global_size[1] = dim;
+			if (check_cl_err(err, "failed to set up cast_rays")
+				|| bench_time(b, run_cast_rays, &r, times))
+			{
+				ret = 1;
+			}
+			else {
+				err = clEnqueueReadBuffer(b->queue, r.img, CL_TRUE, 0, n_px, img, 0, NULL, NULL);
+				size_t mismatches = 0;
+				for (size_t i = 0; i < n_px; ++i){
+					mismatches += img[i] != expect[i];
+				}
+				int valid = err == CL_SUCCESS && mismatches <= MISMATCH_TOLERANCE * n_px;
+				char size[32];
+				snprintf(size, sizeof(size), "%dx%d s%lu", dim, dim, (unsigned long)n_objs);
+				//Each ray reads every sphere and writes a pixel
+				double bytes = n_px * (1.0 + sizeof(sphere_t) * n_objs);
+				bench_record(b, "cast_rays", size, n_px, bytes, times, valid);
+
+				host_rays_bench_t h = {
+					.pool = pool,
+					.camera = &camera,
+					.spheres = spheres,
+					.n_objs = n_objs,
+					.img = img,
+					.dim = dim
+				};
+				if (bench_time(b, run_host_simd, &h, times)){
+					ret = 1;
+				}
+				else {
+					bench_record(b, host_name, size, n_px, bytes, times,
+						memcmp(img, expect, n_px) == 0);
+				}
+			}
+			clReleaseMemObject(mem_spheres);
+			clReleaseMemObject(r.img);
+			free(spheres);
+			free(expect);
+			free(img);
+		}
+	}
+	free(times);
+	thread_pool_destroy(pool);
+	clReleaseKernel(r.kernel);
+	clReleaseProgram(program);
+	return ret;
+}
+
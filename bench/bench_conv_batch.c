@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "convolve.h"
+#include "conv_batch.h"
+#include "bench.h"
+
+//Jobs cycle through sizes from 64x64 to 256x256
+#define MIN_DIM 64
+#define MAX_DIM 256
+#define MASK_DIM 5
+//Jobs run one at a time per timed run of the unbatched baseline
+#define PER_JOB_RUNS 16
+static const int windows[] = { 1, 16, 64, 256 };
+#define MAX_WINDOW 256
+
+typedef struct batch_bench_t {
+	cl_context context;
+	cl_command_queue queue;
+	//The plain convolve kernel and its mask for the one job at a time baseline
+	cl_kernel kernel;
+	cl_mem mask_mem;
+	conv_batch_t *batch;
+	int window;
+	const cl_uint *in, *mask;
+	cl_uint *results[MAX_WINDOW];
+} batch_bench_t;
+
+static void job_dims(int job, int *width, int *height){
+	*width = MIN_DIM + (job * 37) % (MAX_DIM - MIN_DIM + 1);
+	*height = MIN_DIM + (job * 61) % (MAX_DIM - MIN_DIM + 1);
+}
+static size_t job_out_count(int job){
+	int width, height;
+	job_dims(job, &width, &height);
+	return (size_t)CONV_OUT_DIM(width, MASK_DIM) * CONV_OUT_DIM(height, MASK_DIM);
+}
+/*
+ * Run each job the way the ch2 flow does, with its own buffers, launch and blocking map.
+ * Every job reads its image from the front of the same input
+ */
+static cl_int run_per_job(void *arg){
+	batch_bench_t *p = arg;
+	const size_t local_size[2] = { 8, 8 };
+	cl_int err = CL_SUCCESS;
+	for (int i = 0; i < PER_JOB_RUNS && err == CL_SUCCESS; ++i){
+		int width, height;
+		job_dims(i, &width, &height);
+		const size_t out_count = job_out_count(i);
+		cl_int mem_err;
+		cl_mem in = clCreateBuffer(p->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			sizeof(cl_uint) * width * height, (void*)p->in, &err);
+		cl_mem out = clCreateBuffer(p->context, CL_MEM_WRITE_ONLY, sizeof(cl_uint) * out_count,
+			NULL, &mem_err);
+		err |= mem_err;
+		if (err == CL_SUCCESS){
+			err = enqueue_convolve(p->queue, p->kernel, in, p->mask_mem, out, width, height,
+				MASK_DIM, local_size, NULL);
+			cl_uint *mapped = clEnqueueMapBuffer(p->queue, out, CL_TRUE, CL_MAP_READ, 0,
+				sizeof(cl_uint) * out_count, 0, NULL, NULL, &mem_err);
+			err |= mem_err;
+			if (err == CL_SUCCESS){
+				memcpy(p->results[i], mapped, sizeof(cl_uint) * out_count);
+				err = clEnqueueUnmapMemObject(p->queue, out, mapped, 0, NULL, NULL);
+			}
+		}
+		if (in){
+			clReleaseMemObject(in);
+		}
+		if (out){
+			clReleaseMemObject(out);
+		}
+	}
+	return err;
+}
+//Pack a window of jobs into one batch and run it, the latency a job sees once its window fills
+static cl_int run_batch(void *arg){
+	batch_bench_t *p = arg;
+	for (int i = 0; i < p->window; ++i){
+		int width, height;
+		job_dims(i, &width, &height);
+		conv_batch_add(p->batch, p->in, width, height, p->mask, MASK_DIM, p->results[i]);
+	}
+	return conv_batch_run(p->batch) ? CL_INVALID_OPERATION : CL_SUCCESS;
+}
+//Check the first n jobs' results against the host
+static int check_results(const batch_bench_t *p, int n){
+	cl_uint *expect = malloc(sizeof(cl_uint) * CONV_OUT_DIM(MAX_DIM, MASK_DIM)
+		* CONV_OUT_DIM(MAX_DIM, MASK_DIM));
+	int valid = 1;
+	for (int i = 0; i < n && valid; ++i){
+		int width, height;
+		job_dims(i, &width, &height);
+		convolve_host(p->in, width, height, p->mask, MASK_DIM, expect);
+		valid = memcmp(expect, p->results[i], sizeof(cl_uint) * job_out_count(i)) == 0;
+	}
+	free(expect);
+	return valid;
+}
+int bench_conv_batch(bench_t *b){
+	cl_program program = bench_program(b,
+		"opencl_programming_guide/ch2_simple_convolution/convolution.cl", NULL);
+	if (!program){
+		return 1;
+	}
+	cl_uint mask[MASK_DIM * MASK_DIM];
+	for (int i = 0; i < MASK_DIM * MASK_DIM; ++i){
+		mask[i] = 1 + i % 3;
+	}
+	cl_int err, mem_err;
+	batch_bench_t p = { .context = b->context, .queue = b->queue, .mask = mask };
+	p.kernel = clCreateKernel(program, "convolve", &err);
+	p.mask_mem = clCreateBuffer(b->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(mask),
+		mask, &mem_err);
+	err |= mem_err;
+	p.batch = conv_batch_create(b->context, b->queue, program);
+	if (check_cl_err(err, "failed to set up batch benchmark") || !p.batch){
+		conv_batch_destroy(p.batch);
+		if (p.mask_mem){
+			clReleaseMemObject(p.mask_mem);
+		}
+		if (p.kernel){
+			clReleaseKernel(p.kernel);
+		}
+		clReleaseProgram(program);
+		return 1;
+	}
+	cl_uint *in = malloc(sizeof(cl_uint) * MAX_DIM * MAX_DIM);
+	srand(1);
+	for (size_t i = 0; i < (size_t)MAX_DIM * MAX_DIM; ++i){
+		in[i] = rand() % 256;
+	}
+	p.in = in;
+	for (int i = 0; i < MAX_WINDOW; ++i){
+		p.results[i] = malloc(sizeof(cl_uint) * job_out_count(i));
+	}
+	double *times = malloc(sizeof(double) * b->iters);
+	char size[32];
+	snprintf(size, sizeof(size), "x%d %d-%d k%d", PER_JOB_RUNS, MIN_DIM, MAX_DIM, MASK_DIM);
+	int ret = bench_time(b, run_per_job, &p, times);
+	if (!ret){
+		bench_record(b, "conv_per_job", size, PER_JOB_RUNS, 0, times,
+			check_results(&p, PER_JOB_RUNS));
+	}
+	for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]) && !ret; ++w){
+		p.window = windows[w];
+		ret = bench_time(b, run_batch, &p, times);
+		if (!ret){
+			char name[32];
+			snprintf(name, sizeof(name), "conv_batch_w%d", p.window);
+			snprintf(size, sizeof(size), "x%d %d-%d k%d", p.window, MIN_DIM, MAX_DIM, MASK_DIM);
+			//Throughput is in jobs and the times are each batch's latency
+			bench_record(b, name, size, p.window, 0, times, check_results(&p, p.window));
+		}
+	}
+	for (int i = 0; i < MAX_WINDOW; ++i){
+		free(p.results[i]);
+	}
+	free(in);
+	free(times);
+	conv_batch_destroy(p.batch);
+	clReleaseMemObject(p.mask_mem);
+	clReleaseKernel(p.kernel);
+	clReleaseProgram(program);
+	return ret;
+}
+
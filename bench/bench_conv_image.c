@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "conv_image.h"
+#include "bench.h"
+
+static const int dims[] = { 512, 2048 };
+static const conv_border_t borders[] = { CONV_BORDER_CLAMP, CONV_BORDER_MIRROR };
+#define MASK_DIM 5
+
+typedef struct image_bench_t {
+	conv_image_t *conv;
+	conv_path_t path;
+	const cl_uint *in;
+	cl_uint *out;
+} image_bench_t;
+
+//Convolve from the host input to the host output, including the padding for the buffer path
+static cl_int run_path(void *arg){
+	image_bench_t *p = arg;
+	return conv_image_run(p->conv, p->path, p->in, p->out);
+}
+int bench_conv_image(bench_t *b){
+	cl_program program = bench_program(b,
+		"opencl_programming_guide/ch2_simple_convolution/convolution.cl", NULL);
+	if (!program){
+		return 1;
+	}
+	cl_uint mask[MASK_DIM * MASK_DIM];
+	for (int i = 0; i < MASK_DIM * MASK_DIM; ++i){
+		mask[i] = 1 + i % 3;
+	}
+	const int max_dim = dims[sizeof(dims) / sizeof(dims[0]) - 1];
+	cl_uint *in = malloc(sizeof(cl_uint) * max_dim * max_dim);
+	cl_uint *expect = malloc(sizeof(cl_uint) * max_dim * max_dim);
+	cl_uint *out = malloc(sizeof(cl_uint) * max_dim * max_dim);
+	double *times = malloc(sizeof(double) * b->iters);
+	srand(1);
+	for (size_t i = 0; i < (size_t)max_dim * max_dim; ++i){
+		in[i] = rand() % 256;
+	}
+	int ret = 0;
+	for (size_t d = 0; d < sizeof(dims) / sizeof(dims[0]) && !ret; ++d){
+		for (size_t m = 0; m < sizeof(borders) / sizeof(borders[0]) && !ret; ++m){
+			const int dim = dims[d];
+			const size_t count = (size_t)dim * dim;
+			image_bench_t p = { .in = in, .out = out };
+			p.conv = conv_image_create(b->context, b->queue, program, mask, MASK_DIM, dim, dim,
+				borders[m]);
+			if (!p.conv){
+				ret = 1;
+				break;
+			}
+			convolve_host_border(in, dim, dim, mask, MASK_DIM, borders[m], expect);
+			char size[32];
+			snprintf(size, sizeof(size), "%dx%d k%d %s", dim, dim, MASK_DIM,
+				conv_border_name(borders[m]));
+			for (int path = 0; path < CONV_NUM_PATHS && !ret; ++path){
+				if (!conv_image_has_path(p.conv, path)){
+					printf("convolve_border_%s isn't supported on the device\n",
+						conv_path_name(path));
+					continue;
+				}
+				p.path = path;
+				ret = bench_time(b, run_path, &p, times);
+				if (!ret){
+					char name[32];
+					snprintf(name, sizeof(name), "convolve_border_%s", conv_path_name(path));
+					//The buffer path uploads the padded input
+					const size_t in_count = path == CONV_PATH_BUFFER
+						? (size_t)(dim + MASK_DIM - 1) * (dim + MASK_DIM - 1) : count;
+					bench_record(b, name, size, count, sizeof(cl_uint) * (in_count + count), times,
+						memcmp(out, expect, sizeof(cl_uint) * count) == 0);
+				}
+			}
+			if (!ret){
+				printf("%s picks the %s path\n", size,
+					conv_path_name(conv_image_pick(p.conv, in, out)));
+			}
+			conv_image_destroy(p.conv);
+		}
+	}
+	free(in);
+	free(expect);
+	free(out);
+	free(times);
+	clReleaseProgram(program);
+	return ret;
+}
+
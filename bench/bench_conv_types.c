@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "convolve.h"
+#include "conv_typed.h"
+#include "cl_program_dir.h"
+#include "bench.h"
+
+#define DIM 2048
+#define MASK_DIM 5
+//Input and output types of each variant, u32 -> u32 is the same traffic as the uint kernels
+static const conv_type_t pairs[][2] = {
+	{ CONV_U32, CONV_U32 }, { CONV_U16, CONV_U16 }, { CONV_U8, CONV_U8 },
+	{ CONV_U8, CONV_F32 }, { CONV_F16, CONV_F16 }, { CONV_F32, CONV_F32 }
+};
+
+typedef struct types_bench_t {
+	cl_command_queue queue;
+	conv_typed_t *typed;
+	conv_type_t in_type, out_type;
+	cl_mem in, mask, out;
+	const void *host_in;
+	void *host_out;
+	size_t in_bytes, out_bytes;
+} types_bench_t;
+
+//Upload the input, convolve it and read back the result, the traffic narrow types cut down
+static cl_int run_typed(void *arg){
+	types_bench_t *t = arg;
+	const size_t local_size[2] = { 8, 8 };
+	cl_int err = clEnqueueWriteBuffer(t->queue, t->in, CL_FALSE, 0, t->in_bytes, t->host_in, 0,
+		NULL, NULL);
+	err |= enqueue_convolve_typed(t->queue, t->typed, t->in_type, t->out_type, 1, t->in, t->mask,
+		t->out, DIM, DIM, MASK_DIM, local_size, NULL);
+	err |= clEnqueueReadBuffer(t->queue, t->out, CL_TRUE, 0, t->out_bytes, t->host_out, 0, NULL,
+		NULL);
+	return err;
+}
+int bench_conv_types(bench_t *b){
+	char *src = read_file(CL_PROGRAM("opencl_programming_guide/ch2_simple_convolution/"
+		"convolution.cl"), NULL);
+	if (!src){
+		return 1;
+	}
+	types_bench_t t = { .queue = b->queue };
+	t.typed = conv_typed_create(b->context, b->device, src);
+	free(src);
+
+	const size_t in_count = (size_t)DIM * DIM;
+	const size_t out_count = (size_t)CONV_OUT_DIM(DIM, MASK_DIM) * CONV_OUT_DIM(DIM, MASK_DIM);
+	cl_uint mask[MASK_DIM * MASK_DIM];
+	cl_int mask_typed[MASK_DIM * MASK_DIM];
+	for (int i = 0; i < MASK_DIM * MASK_DIM; ++i){
+		mask[i] = 1 + i % 3;
+	}
+	cl_uint *in = malloc(sizeof(cl_uint) * in_count);
+	cl_uint *expect = malloc(sizeof(cl_uint) * out_count);
+	srand(1);
+	for (size_t i = 0; i < in_count; ++i){
+		in[i] = rand() % 256;
+	}
+	convolve_host(in, DIM, DIM, mask, MASK_DIM, expect);
+	//Big enough for the widest type
+	void *in_typed = malloc(sizeof(cl_uint) * in_count);
+	void *expect_typed = malloc(sizeof(cl_uint) * out_count);
+	void *out_typed = malloc(sizeof(cl_uint) * out_count);
+	double *times = malloc(sizeof(double) * b->iters);
+	char size[32];
+	snprintf(size, sizeof(size), "%dx%d k%d", DIM, DIM, MASK_DIM);
+
+	int ret = 0;
+	for (size_t p = 0; p < sizeof(pairs) / sizeof(pairs[0]) && !ret; ++p){
+		t.in_type = pairs[p][0];
+		t.out_type = pairs[p][1];
+		if (!conv_typed_kernel(t.typed, t.in_type, t.out_type, 1)){
+			ret = 1;
+			break;
+		}
+		const int saturate = conv_typed_saturates(t.in_type, t.out_type, 1);
+		t.in_bytes = conv_type_size(t.in_type) * in_count;
+		t.out_bytes = conv_type_size(t.out_type) * out_count;
+		convert_to_type(in, in_count, t.in_type, saturate, in_typed);
+		convert_to_type(expect, out_count, t.out_type, saturate, expect_typed);
+		convolve_typed_mask(mask, MASK_DIM, t.in_type, mask_typed);
+		t.host_in = in_typed;
+		t.host_out = out_typed;
+
+		cl_int err, mem_err;
+		t.in = clCreateBuffer(b->context, CL_MEM_READ_ONLY, t.in_bytes, NULL, &err);
+		t.mask = clCreateBuffer(b->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			sizeof(mask_typed), mask_typed, &mem_err);
+		err |= mem_err;
+		t.out = clCreateBuffer(b->context, CL_MEM_WRITE_ONLY, t.out_bytes, NULL, &mem_err);
+		err |= mem_err;
+		ret = check_cl_err(err, "failed to create typed convolution buffers")
+			|| bench_time(b, run_typed, &t, times);
+		if (!ret){
+			char name[32];
+			snprintf(name, sizeof(name), "convolve_%s_%s", conv_type_name(t.in_type),
+				conv_type_name(t.out_type));
+			bench_record(b, name, size, out_count, t.in_bytes + t.out_bytes, times,
+				memcmp(out_typed, expect_typed, t.out_bytes) == 0);
+		}
+		cl_mem mems[3] = { t.in, t.mask, t.out };
+		for (int i = 0; i < 3; ++i){
+			if (mems[i]){
+				clReleaseMemObject(mems[i]);
+			}
+		}
+	}
+	free(in);
+	free(expect);
+	free(in_typed);
+	free(expect_typed);
+	free(out_typed);
+	free(times);
+	conv_typed_destroy(t.typed);
+	return ret;
+}
+
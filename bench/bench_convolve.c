@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "convolve.h"
+#include "conv_fft.h"
+#include "bench.h"
+
+static const int dims[] = { 256, 1024, 2048 };
+static const int mask_dims[] = { 3, 7, 31 };
+
+enum { DIRECT, TILED, ROWS, COLS, NUM_KERNELS };
+static const char *kernel_names[NUM_KERNELS] = {
+	"convolve", "convolve_tiled", "convolve_rows", "convolve_cols"
+};
+
+typedef struct conv_bench_t {
+	cl_command_queue queue;
+	cl_kernel kernels[NUM_KERNELS];
+	cl_mem in, mask, row, col, tmp, out;
+	int dim, mask_dim;
+	size_t local_size[2];
+	conv_fft_t *fft;
+} conv_bench_t;
+
+static cl_int run_direct(void *arg){
+	conv_bench_t *c = arg;
+	return enqueue_convolve(c->queue, c->kernels[DIRECT], c->in, c->mask, c->out, c->dim, c->dim,
+		c->mask_dim, c->local_size, NULL);
+}
+static cl_int run_tiled(void *arg){
+	conv_bench_t *c = arg;
+	return enqueue_convolve_tiled(c->queue, c->kernels[TILED], c->in, c->mask, c->out, c->dim,
+		c->dim, c->mask_dim, c->local_size, NULL);
+}
+static cl_int run_separable(void *arg){
+	conv_bench_t *c = arg;
+	return enqueue_convolve_separable(c->queue, c->kernels[ROWS], c->kernels[COLS], c->in, c->row,
+		c->col, c->tmp, c->out, c->dim, c->dim, c->mask_dim, c->local_size, NULL);
+}
+static cl_int run_fft(void *arg){
+	conv_bench_t *c = arg;
+	return conv_fft_enqueue(c->fft, c->in, c->out, NULL);
+}
+//The host backend's convolution, the native baseline for the kernels
+typedef struct host_conv_bench_t {
+	thread_pool_t *pool;
+	const cl_uint *in, *mask;
+	cl_uint *out;
+	int dim, mask_dim;
+} host_conv_bench_t;
+
+static cl_int run_host_simd(void *arg){
+	host_conv_bench_t *h = arg;
+	convolve_host_simd(h->pool, h->in, h->dim, h->dim, h->mask, h->mask_dim, h->out);
+	return CL_SUCCESS;
+}
+/*
+ * Time one of the methods and check its output against the host result, exactly or
+ * within tolerance of the largest output if it's not 0
+ */
+static int bench_method(bench_t *b, conv_bench_t *c, const char *name, bench_run_fn run,
+	const cl_uint *expect, cl_uint *result, double tolerance, double *times)
+{
+	size_t out_count = (size_t)CONV_OUT_DIM(c->dim, c->mask_dim) * CONV_OUT_DIM(c->dim, c->mask_dim);
+	if (bench_time(b, run, c, times)){
+		return 1;
+	}
+	cl_int err = clEnqueueReadBuffer(c->queue, c->out, CL_TRUE, 0, sizeof(cl_uint) * out_count,
+		result, 0, NULL, NULL);
+	int valid = err == CL_SUCCESS && (tolerance > 0
+		? convolve_fft_error(result, expect, out_count) <= tolerance
+		: memcmp(result, expect, sizeof(cl_uint) * out_count) == 0);
+	char size[32];
+	snprintf(size, sizeof(size), "%dx%d k%d", c->dim, c->dim, c->mask_dim);
+	//Effective bandwidth counts the compulsory input and output traffic
+	double bytes = sizeof(cl_uint) * ((double)c->dim * c->dim + out_count);
+	bench_record(b, name, size, out_count, bytes, times, valid);
+	return 0;
+}
+int bench_convolve(bench_t *b){
+	cl_program program = bench_program(b,
+		"opencl_programming_guide/ch2_simple_convolution/convolution.cl", NULL);
+	if (!program){
+		return 1;
+	}
+	cl_int err;
+	conv_bench_t c = { .queue = b->queue };
+	for (int i = 0; i < NUM_KERNELS; ++i){
+		c.kernels[i] = clCreateKernel(program, kernel_names[i], &err);
+		if (check_cl_err(err, "failed to create convolution kernel")){
+			return 1;
+		}
+	}
+	double *times = malloc(sizeof(double) * b->iters);
+	thread_pool_t *pool = thread_pool_create(0);
+	char host_name[32];
+	snprintf(host_name, sizeof(host_name), "convolve_host_%s", simd_level_name(simd_level()));
+	int ret = 0;
+	for (size_t d = 0; d < sizeof(dims) / sizeof(dims[0]) && !ret; ++d){
+		for (size_t m = 0; m < sizeof(mask_dims) / sizeof(mask_dims[0]) && !ret; ++m){
+			c.dim = dims[d];
+			c.mask_dim = mask_dims[m];
+			const size_t in_count = (size_t)c.dim * c.dim;
+			const int out_dim = CONV_OUT_DIM(c.dim, c.mask_dim);
+			const size_t out_count = (size_t)out_dim * out_dim;
+			cl_uint *in = malloc(sizeof(cl_uint) * in_count);
+			cl_uint *expect = malloc(sizeof(cl_uint) * out_count);
+			cl_uint *result = malloc(sizeof(cl_uint) * out_count);
+			cl_uint *mask = malloc(sizeof(cl_uint) * c.mask_dim * c.mask_dim);
+			cl_uint *row = malloc(sizeof(cl_uint) * c.mask_dim);
+			cl_uint *col = malloc(sizeof(cl_uint) * c.mask_dim);
+			srand(1);
+			for (size_t i = 0; i < in_count; ++i){
+				in[i] = rand() % 256;
+			}
+			//A tent mask, which is separable so every method can run
+			for (int r = 0; r < c.mask_dim; ++r){
+				for (int k = 0; k < c.mask_dim; ++k){
+					int wr = c.mask_dim / 2 + 1 - abs(r - c.mask_dim / 2);
+					int wc = c.mask_dim / 2 + 1 - abs(k - c.mask_dim / 2);
+					mask[r * c.mask_dim + k] = wr * wc;
+				}
+			}
+			mask_separable(mask, c.mask_dim, row, col);
+			convolve_host(in, c.dim, c.dim, mask, c.mask_dim, expect);
+
+			c.in = clCreateBuffer(b->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				sizeof(cl_uint) * in_count, in, &err);
+			c.mask = clCreateBuffer(b->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				sizeof(cl_uint) * c.mask_dim * c.mask_dim, mask, &err);
+			c.row = clCreateBuffer(b->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				sizeof(cl_uint) * c.mask_dim, row, &err);
+			c.col = clCreateBuffer(b->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				sizeof(cl_uint) * c.mask_dim, col, &err);
+			c.tmp = clCreateBuffer(b->context, CL_MEM_READ_WRITE,
+				sizeof(cl_uint) * out_dim * c.dim, NULL, &err);
+			c.out = clCreateBuffer(b->context, CL_MEM_WRITE_ONLY, sizeof(cl_uint) * out_count,
+				NULL, &err);
+			if (check_cl_err(err, "failed to create convolution buffers")
+				|| convolve_tiled_local_size(c.kernels[TILED], b->device, c.mask_dim, c.local_size))
+			{
+				ret = 1;
+			}
+			else {
+				ret = bench_method(b, &c, "convolve", run_direct, expect, result, 0, times)
+					|| bench_method(b, &c, "convolve_tiled", run_tiled, expect, result, 0, times)
+					|| bench_method(b, &c, "convolve_separable", run_separable, expect, result, 0,
+						times);
+			}
+			//FFT with the cost model's tile size, which doesn't depend on being separable
+			int tile_dim;
+			if (!ret && convolve_fft_cost(c.dim, c.dim, c.mask_dim, &tile_dim) >= 0){
+				c.fft = conv_fft_create(b->context, b->queue, program, mask, c.mask_dim, c.dim,
+					c.dim, tile_dim);
+				ret = !c.fft || bench_method(b, &c, "convolve_fft", run_fft, expect, result,
+					CONV_FFT_TOLERANCE, times);
+				conv_fft_destroy(c.fft);
+			}
+			if (!ret){
+				host_conv_bench_t h = {
+					.pool = pool,
+					.in = in,
+					.mask = mask,
+					.out = result,
+					.dim = c.dim,
+					.mask_dim = c.mask_dim
+				};
+				ret = bench_time(b, run_host_simd, &h, times);
+				if (!ret){
+					char size[32];
+					snprintf(size, sizeof(size), "%dx%d k%d", c.dim, c.dim, c.mask_dim);
+					double bytes = sizeof(cl_uint) * ((double)in_count + out_count);
+					bench_record(b, host_name, size, out_count, bytes, times,
+						memcmp(result, expect, sizeof(cl_uint) * out_count) == 0);
+				}
+			}
+			clReleaseMemObject(c.in);
+			clReleaseMemObject(c.mask);
+			clReleaseMemObject(c.row);
+			clReleaseMemObject(c.col);
+			clReleaseMemObject(c.tmp);
+			clReleaseMemObject(c.out);
+			free(in);
+			free(expect);
+			free(result);
+			free(mask);
+			free(row);
+			free(col);
+		}
+	}
+	free(times);
+	thread_pool_destroy(pool);
+	for (int i = 0; i < NUM_KERNELS; ++i){
+		clReleaseKernel(c.kernels[i]);
+	}
+	clReleaseProgram(program);
+	return ret;
+}
+
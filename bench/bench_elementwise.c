@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "elementwise.h"
+#include "bench.h"
+
+static const size_t sizes[] = { 1 << 14, 1 << 18, 1 << 22, 1 << 24 };
+
+typedef struct elementwise_run_t {
+	cl_command_queue queue;
+	const elementwise_kernel_t *mul, *add, *fused;
+	//a, b, c, d and the temporary for the unfused chain
+	cl_mem mem[5];
+	size_t n;
+} elementwise_run_t;
+
+//d = a*b + c as two launches through a temporary, like chaining hello_world style kernels
+static cl_int run_chain(void *arg){
+	elementwise_run_t *e = arg;
+	const cl_mem mul_args[3] = { e->mem[4], e->mem[0], e->mem[1] };
+	const cl_mem add_args[3] = { e->mem[3], e->mem[4], e->mem[2] };
+	cl_int err = elementwise_enqueue(e->queue, e->mul, mul_args, NULL, e->n, NULL);
+	err |= elementwise_enqueue(e->queue, e->add, add_args, NULL, e->n, NULL);
+	return err;
+}
+static cl_int run_fused(void *arg){
+	elementwise_run_t *e = arg;
+	const cl_mem args[4] = { e->mem[3], e->mem[0], e->mem[1], e->mem[2] };
+	return elementwise_enqueue(e->queue, e->fused, args, NULL, e->n, NULL);
+}
+//Read back d and compare it to the host, the inputs are small integers so it's exact
+static int check_result(bench_t *b, const elementwise_run_t *e, float **host){
+	cl_int err = clEnqueueReadBuffer(b->queue, e->mem[3], CL_TRUE, 0, sizeof(float) * e->n,
+		host[3], 0, NULL, NULL);
+	int valid = err == CL_SUCCESS;
+	for (size_t i = 0; i < e->n && valid; ++i){
+		valid = host[3][i] == host[0][i] * host[1][i] + host[2][i];
+	}
+	return valid;
+}
+int bench_elementwise(bench_t *b){
+	elementwise_cache_t *cache = elementwise_cache_create(b->context, b->device);
+	if (!cache){
+		return 1;
+	}
+	elementwise_run_t e = {
+		.queue = b->queue,
+		.mul = elementwise_get(cache, "t = a*b", NULL),
+		.add = elementwise_get(cache, "d = t + c", NULL),
+		.fused = elementwise_get(cache, "d = a*b + c", NULL)
+	};
+	if (!e.mul || !e.add || !e.fused){
+		elementwise_cache_destroy(cache);
+		return 1;
+	}
+	double *times = malloc(sizeof(double) * b->iters);
+	int ret = 0;
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && !ret; ++s){
+		e.n = sizes[s];
+		float *host[4];
+		for (int i = 0; i < 4; ++i){
+			host[i] = malloc(sizeof(float) * e.n);
+		}
+		for (size_t i = 0; i < e.n; ++i){
+			host[0][i] = (float)(i % 1024);
+			host[1][i] = (float)(i % 7);
+			host[2][i] = (float)(i % 13);
+		}
+		cl_int err = CL_SUCCESS;
+		for (int i = 0; i < 3; ++i){
+			cl_int buf_err;
+			e.mem[i] = clCreateBuffer(b->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				sizeof(float) * e.n, host[i], &buf_err);
+			err |= buf_err;
+		}
+		for (int i = 3; i < 5; ++i){
+			cl_int buf_err;
+			e.mem[i] = clCreateBuffer(b->context, CL_MEM_READ_WRITE, sizeof(float) * e.n, NULL,
+				&buf_err);
+			err |= buf_err;
+		}
+		char size[32];
+		snprintf(size, sizeof(size), "%lu", (unsigned long)e.n);
+		if (check_cl_err(err, "failed to create elementwise buffers")
+			|| bench_time(b, run_chain, &e, times))
+		{
+			ret = 1;
+		}
+		else {
+			//The chain reads a, b, writes t, then reads t, c and writes d
+			bench_record(b, "elementwise_chain", size, e.n, 6.0 * sizeof(float) * e.n, times,
+				check_result(b, &e, host));
+			//Clear d so the fused check doesn't see the chain's result
+			const cl_float zero = 0;
+			err = clEnqueueFillBuffer(b->queue, e.mem[3], &zero, sizeof(zero), 0,
+				sizeof(float) * e.n, 0, NULL, NULL);
+			ret = check_cl_err(err, "failed to clear elementwise output")
+				|| bench_time(b, run_fused, &e, times);
+		}
+		if (!ret){
+			bench_record(b, "elementwise_fused", size, e.n, 4.0 * sizeof(float) * e.n, times,
+				check_result(b, &e, host));
+		}
+		for (int i = 0; i < 5; ++i){
+			clReleaseMemObject(e.mem[i]);
+		}
+		for (int i = 0; i < 4; ++i){
+			free(host[i]);
+		}
+	}
+	free(times);
+	elementwise_cache_destroy(cache);
+	return ret;
+}
+
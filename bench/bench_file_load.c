@@ -0,0 +1,164 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "bench.h"
+
+#define FILE_MB 256
+#define BENCH_FILE "bench_file_load.tmp"
+//Number of uints each work-item sums
+#define CHUNK 1024
+
+static const char *sum_src =
+	"kernel void sum_chunks(const global uint *in, const uint chunk, global uint *out){\n"
+	"	size_t id = get_global_id(0);\n"
+	"	uint sum = 0;\n"
+	"	for (uint i = 0; i < chunk; ++i){\n"
+	"		sum += in[id * chunk + i];\n"
+	"	}\n"
+	"	out[id] = sum;\n"
+	"}\n";
+
+typedef struct load_bench_t {
+	bench_t *b;
+	cl_kernel kernel;
+	cl_mem out;
+	size_t n_out;
+	int mapped;
+} load_bench_t;
+
+//Get the peak resident set size of the process so far in MB, or -1 if it can't be read
+static double peak_resident_mb(void){
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage)){
+		return -1;
+	}
+#ifdef __APPLE__
+	return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+	return usage.ru_maxrss / 1024.0;
+#endif
+}
+//Load the file and run the kernel over it, the time to the first kernel finishing
+static cl_int run_load(void *arg){
+	load_bench_t *l = arg;
+	cl_int err = CL_SUCCESS;
+	cl_mem in = NULL;
+	mapped_file_t file = { 0 };
+	char *data = NULL;
+	if (l->mapped){
+		if (map_file(BENCH_FILE, &file)){
+			return CL_INVALID_VALUE;
+		}
+		in = create_file_buffer(l->b->context, l->b->device, &file, &err);
+	}
+	else {
+		size_t size;
+		data = read_file(BENCH_FILE, &size);
+		if (!data){
+			return CL_INVALID_VALUE;
+		}
+		in = clCreateBuffer(l->b->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, size, data,
+			&err);
+	}
+	cl_uint chunk = CHUNK;
+	err |= clSetKernelArg(l->kernel, 0, sizeof(cl_mem), &in);
+	err |= clSetKernelArg(l->kernel, 1, sizeof(cl_uint), &chunk);
+	err |= clSetKernelArg(l->kernel, 2, sizeof(cl_mem), &l->out);
+	err |= clEnqueueNDRangeKernel(l->b->queue, l->kernel, 1, NULL, &l->n_out, NULL, 0, NULL, NULL);
+	err |= clFinish(l->b->queue);
+	if (in){
+		clReleaseMemObject(in);
+	}
+	free(data);
+	unmap_file(&file);
+	return err;
+}
+//Write the input file, filling expect with the sum of each chunk. returns 1 on failure
+static int write_input(cl_uint *expect, size_t n_out){
+	FILE *f = fopen(BENCH_FILE, "wb");
+	if (!f){
+		fprintf(stderr, "Failed to create %s\n", BENCH_FILE);
+		return 1;
+	}
+	cl_uint chunk[CHUNK];
+	int failed = 0;
+	for (size_t i = 0; i < n_out && !failed; ++i){
+		expect[i] = 0;
+		for (size_t j = 0; j < CHUNK; ++j){
+			chunk[j] = (cl_uint)((i * CHUNK + j) * 2654435761u);
+			expect[i] += chunk[j];
+		}
+		failed = fwrite(chunk, sizeof(cl_uint), CHUNK, f) != CHUNK;
+	}
+	failed |= fclose(f) != 0;
+	if (failed){
+		fprintf(stderr, "Failed to write %s\n", BENCH_FILE);
+	}
+	return failed;
+}
+int bench_file_load(bench_t *b){
+	cl_program program = build_program(sum_src, b->context, b->device, NULL);
+	if (!program){
+		return 1;
+	}
+	cl_int err, mem_err;
+	load_bench_t l = { .b = b, .n_out = (size_t)FILE_MB * 1024 * 1024 / sizeof(cl_uint) / CHUNK };
+	l.kernel = clCreateKernel(program, "sum_chunks", &err);
+	l.out = clCreateBuffer(b->context, CL_MEM_WRITE_ONLY, sizeof(cl_uint) * l.n_out, NULL,
+		&mem_err);
+	err |= mem_err;
+	if (check_cl_err(err, "failed to set up file load benchmark")){
+		clReleaseProgram(program);
+		return 1;
+	}
+	cl_uint *expect = malloc(sizeof(cl_uint) * l.n_out);
+	cl_uint *result = malloc(sizeof(cl_uint) * l.n_out);
+	double *times = malloc(sizeof(double) * b->iters);
+	int ret = write_input(expect, l.n_out);
+
+	cl_bool unified = CL_FALSE;
+	clGetDeviceInfo(b->device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &unified, NULL);
+	const char *names[2] = { unified ? "load_mmap_zero_copy" : "load_mmap_copy", "load_read_file" };
+	//The peak only ever grows, so the mapped path runs first to keep the read_file copies
+	//from hiding its peak
+	double rss[3] = { peak_resident_mb(), -1, -1 };
+	char size[32];
+	snprintf(size, sizeof(size), "%dMB", FILE_MB);
+	//The file was just written so both paths read it from the page cache
+	for (int m = 0; m < 2 && !ret; ++m){
+		l.mapped = m == 0;
+		if (bench_time(b, run_load, &l, times)){
+			ret = 1;
+			break;
+		}
+		err = clEnqueueReadBuffer(b->queue, l.out, CL_TRUE, 0, sizeof(cl_uint) * l.n_out, result,
+			0, NULL, NULL);
+		int valid = err == CL_SUCCESS && memcmp(result, expect, sizeof(cl_uint) * l.n_out) == 0;
+		bench_record(b, names[m], size, (double)FILE_MB * 1024 * 1024, (double)FILE_MB * 1024 * 1024,
+			times, valid);
+		rss[m + 1] = peak_resident_mb();
+	}
+	if (!ret){
+		printf("Peak resident memory: %.1f MB before loading, %.1f MB after %s, %.1f MB after %s\n",
+			rss[0], rss[1], names[0], rss[2], names[1]);
+	}
+	remove(BENCH_FILE);
+	free(expect);
+	free(result);
+	free(times);
+	clReleaseMemObject(l.out);
+	clReleaseKernel(l.kernel);
+	clReleaseProgram(program);
+	return ret;
+}
+
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "primitives.h"
+#include "bench.h"
+
+static const size_t sizes[] = { 1 << 14, 1 << 18, 1 << 22, 1 << 24 };
+
+typedef struct prim_bench_t {
+	cl_command_queue queue;
+	primitives_t *prim;
+	cl_mem in, flags, out, count;
+	size_t n;
+	//Host copies of the input and flags and the host loops' output
+	const cl_uint *host_in, *host_flags;
+	cl_uint *host_out;
+	cl_uint host_result;
+} prim_bench_t;
+
+static cl_int run_reduce(void *arg){
+	prim_bench_t *p = arg;
+	return primitives_reduce(p->prim, p->queue, PRIM_UINT, PRIM_SUM, p->in, p->n, p->out, NULL);
+}
+static cl_int run_scan(void *arg){
+	prim_bench_t *p = arg;
+	return primitives_scan(p->prim, p->queue, PRIM_UINT, p->in, p->n, p->out, 0, NULL);
+}
+static cl_int run_compact(void *arg){
+	prim_bench_t *p = arg;
+	return primitives_compact(p->prim, p->queue, PRIM_UINT, p->in, p->flags, p->n, p->out,
+		p->count, NULL);
+}
+//The single threaded host loops the kernels are compared against
+static cl_int run_reduce_host(void *arg){
+	prim_bench_t *p = arg;
+	cl_uint sum = 0;
+	for (size_t i = 0; i < p->n; ++i){
+		sum += p->host_in[i];
+	}
+	p->host_result = sum;
+	return CL_SUCCESS;
+}
+static cl_int run_scan_host(void *arg){
+	prim_bench_t *p = arg;
+	cl_uint sum = 0;
+	for (size_t i = 0; i < p->n; ++i){
+		p->host_out[i] = sum;
+		sum += p->host_in[i];
+	}
+	return CL_SUCCESS;
+}
+static cl_int run_compact_host(void *arg){
+	prim_bench_t *p = arg;
+	cl_uint count = 0;
+	for (size_t i = 0; i < p->n; ++i){
+		if (p->host_flags[i]){
+			p->host_out[count++] = p->host_in[i];
+		}
+	}
+	p->host_result = count;
+	return CL_SUCCESS;
+}
+//Read back the first n outputs and compare them to expect
+static int check_output(prim_bench_t *p, const cl_uint *expect, size_t n, cl_uint *result){
+	cl_int err = clEnqueueReadBuffer(p->queue, p->out, CL_TRUE, 0, sizeof(cl_uint) * n, result,
+		0, NULL, NULL);
+	return err == CL_SUCCESS && memcmp(result, expect, sizeof(cl_uint) * n) == 0;
+}
+//Time the kernel then the host loop, the host loop's output is the reference
+static int bench_pair(bench_t *b, prim_bench_t *p, const char *name, bench_run_fn run,
+	bench_run_fn run_host, double bytes, double *times)
+{
+	char size[32], host_name[32];
+	snprintf(size, sizeof(size), "%lu", (unsigned long)p->n);
+	snprintf(host_name, sizeof(host_name), "%s_host", name);
+	if (bench_time(b, run_host, p, times)){
+		return 1;
+	}
+	bench_record(b, host_name, size, p->n, bytes, times, 1);
+	if (bench_time(b, run, p, times)){
+		return 1;
+	}
+	cl_uint *result = malloc(sizeof(cl_uint) * p->n);
+	int valid;
+	if (run == run_reduce){
+		valid = check_output(p, &p->host_result, 1, result);
+	}
+	else if (run == run_scan){
+		valid = check_output(p, p->host_out, p->n, result);
+	}
+	else {
+		cl_uint count = 0;
+		valid = clEnqueueReadBuffer(p->queue, p->count, CL_TRUE, 0, sizeof(cl_uint), &count, 0,
+			NULL, NULL) == CL_SUCCESS && count == p->host_result
+			&& check_output(p, p->host_out, count, result);
+	}
+	free(result);
+	bench_record(b, name, size, p->n, bytes, times, valid);
+	return 0;
+}
+int bench_primitives(bench_t *b){
+	prim_bench_t p = { .queue = b->queue };
+	p.prim = primitives_create(b->context, b->device);
+	if (!p.prim){
+		return 1;
+	}
+	double *times = malloc(sizeof(double) * b->iters);
+	int ret = 0;
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && !ret; ++s){
+		p.n = sizes[s];
+		cl_uint *in = malloc(sizeof(cl_uint) * p.n);
+		cl_uint *flags = malloc(sizeof(cl_uint) * p.n);
+		p.host_out = malloc(sizeof(cl_uint) * p.n);
+		for (size_t i = 0; i < p.n; ++i){
+			in[i] = (cl_uint)(i * 2654435761u) >> 20;
+			flags[i] = in[i] % 3 == 0;
+		}
+		p.host_in = in;
+		p.host_flags = flags;
+		cl_int err, buf_err;
+		p.in = clCreateBuffer(b->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			sizeof(cl_uint) * p.n, in, &err);
+		p.flags = clCreateBuffer(b->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			sizeof(cl_uint) * p.n, flags, &buf_err);
+		err |= buf_err;
+		p.out = clCreateBuffer(b->context, CL_MEM_READ_WRITE, sizeof(cl_uint) * p.n, NULL,
+			&buf_err);
+		err |= buf_err;
+		p.count = clCreateBuffer(b->context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, &buf_err);
+		err |= buf_err;
+		//Reduce reads the input, scan reads it and writes the output, compact reads the
+		//input, flags and positions and writes the positions and what's kept
+		const double bytes = sizeof(cl_uint) * (double)p.n;
+		ret = check_cl_err(err, "failed to create primitives buffers")
+			|| bench_pair(b, &p, "reduce_sum", run_reduce, run_reduce_host, bytes, times)
+			|| bench_pair(b, &p, "scan_exclusive", run_scan, run_scan_host, 2 * bytes, times)
+			|| bench_pair(b, &p, "compact", run_compact, run_compact_host, 4 * bytes, times);
+		clReleaseMemObject(p.in);
+		clReleaseMemObject(p.flags);
+		clReleaseMemObject(p.out);
+		clReleaseMemObject(p.count);
+		free(in);
+		free(flags);
+		free(p.host_out);
+	}
+	free(times);
+	primitives_destroy(p.prim);
+	return ret;
+}
+
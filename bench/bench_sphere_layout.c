@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "scene.h"
+#include "bvh.h"
+#include "bench.h"
+
+#define DIM 128
+static const size_t sphere_counts[] = { 4096, 16384, 65536 };
+static const sphere_layout_t layouts[] = { SPHERE_AOS, SPHERE_PACKED, SPHERE_SOA };
+#define N_LAYOUTS (sizeof(layouts) / sizeof(layouts[0]))
+//See bench_cast_rays.c
+#define MISMATCH_TOLERANCE 1e-3
+
+typedef struct layout_bench_t {
+	cl_command_queue queue;
+	cl_kernel kernel;
+	cl_mem img;
+	size_t global_size[2];
+} layout_bench_t;
+
+static cl_int run_cast_rays(void *arg){
+	layout_bench_t *r = arg;
+	cl_char background = ' ';
+	cl_int err = clEnqueueFillBuffer(r->queue, r->img, &background, sizeof(cl_char), 0,
+		r->global_size[0] * r->global_size[1], 0, NULL, NULL);
+	err |= clEnqueueNDRangeKernel(r->queue, r->kernel, 2, NULL, r->global_size, NULL, 0,
+		NULL, NULL);
+	return err;
+}
+int bench_sphere_layout(bench_t *b){
+	cl_program programs[N_LAYOUTS] = { 0 };
+	cl_kernel kernels[N_LAYOUTS] = { 0 };
+	cl_int err = CL_SUCCESS;
+	int ret = 0;
+	for (size_t l = 0; l < N_LAYOUTS && !ret; ++l){
+		programs[l] = bench_program(b, "ray_test/ray_test.cl", sphere_layout_options(layouts[l]));
+		if (!programs[l]){
+			ret = 1;
+			break;
+		}
+		kernels[l] = clCreateKernel(programs[l], "cast_rays", &err);
+		ret = check_cl_err(err, "failed to create cast_rays kernel");
+	}
+	const size_t n_px = (size_t)DIM * DIM;
+	char *expect = malloc(n_px);
+	char *img = malloc(n_px);
+	double *times = malloc(sizeof(double) * b->iters);
+	camera_t camera;
+	grid_camera(&camera, DIM, DIM);
+	layout_bench_t r = { .queue = b->queue, .global_size = { DIM, DIM } };
+	if (!ret){
+		r.img = clCreateBuffer(b->context, CL_MEM_WRITE_ONLY, n_px, NULL, &err);
+		ret = check_cl_err(err, "failed to create image buffer");
+	}
+	for (size_t s = 0; s < sizeof(sphere_counts) / sizeof(sphere_counts[0]) && !ret; ++s){
+		const size_t n_objs = sphere_counts[s];
+		sphere_t *spheres = malloc(sizeof(sphere_t) * n_objs);
+		random_spheres(spheres, n_objs, DIM, DIM, 1);
+		//Testing every sphere per pixel on the host is too slow at these counts, the BVH
+		//finds the same closest hits. The reordered spheres are used for every layout
+		bvh_node_t *nodes = NULL;
+		bvh_build(spheres, n_objs, &nodes);
+		memset(expect, ' ', n_px);
+		cast_rays_bvh_host(&camera, spheres, nodes, expect, DIM, DIM);
+		free(nodes);
+
+		for (size_t l = 0; l < N_LAYOUTS && !ret; ++l){
+			const size_t scene_size = sphere_buffer_size(layouts[l], n_objs);
+			void *scene = malloc(scene_size);
+			pack_spheres(spheres, n_objs, layouts[l], scene);
+			cl_mem mem_scene = clCreateBuffer(b->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				scene_size, scene, &err);
+			free(scene);
+			cl_uint n = n_objs;
+			cl_uint2 img_dim = {{ DIM, DIM }};
+			r.kernel = kernels[l];
+			err |= clSetKernelArg(r.kernel, 0, sizeof(camera_t), &camera);
+			err |= clSetKernelArg(r.kernel, 1, sizeof(cl_mem), &mem_scene);
+			err |= clSetKernelArg(r.kernel, 2, sizeof(cl_uint), &n);
+			err |= clSetKernelArg(r.kernel, 3, sizeof(cl_mem), &r.img);
+			err |= clSetKernelArg(r.kernel, 4, sizeof(cl_uint2), &img_dim);
+			if (check_cl_err(err, "failed to set up cast_rays")
+				|| bench_time(b, run_cast_rays, &r, times))
+			{
+				ret = 1;
+			}
+			else {
+				err = clEnqueueReadBuffer(b->queue, r.img, CL_TRUE, 0, n_px, img, 0, NULL, NULL);
+				size_t mismatches = 0;
+				for (size_t i = 0; i < n_px; ++i){
+					mismatches += img[i] != expect[i];
+				}
+				int valid = err == CL_SUCCESS && mismatches <= MISMATCH_TOLERANCE * n_px;
+				char kernel[32], size[32];
+				snprintf(kernel, sizeof(kernel), "cast_rays_%s", sphere_layout_name(layouts[l]));
+				snprintf(size, sizeof(size), "%dx%d s%lu", DIM, DIM, (unsigned long)n_objs);
+				//Every ray streams the whole scene so its size dominates the traffic
+				double bytes = n_px * (1.0 + scene_size);
+				bench_record(b, kernel, size, n_px, bytes, times, valid);
+			}
+			clReleaseMemObject(mem_scene);
+		}
+		free(spheres);
+	}
+	if (r.img){
+		clReleaseMemObject(r.img);
+	}
+	for (size_t l = 0; l < N_LAYOUTS; ++l){
+		if (kernels[l]){
+			clReleaseKernel(kernels[l]);
+		}
+		if (programs[l]){
+			clReleaseProgram(programs[l]);
+		}
+	}
+	free(expect);
+	free(img);
+	free(times);
+	return ret;
+}
+
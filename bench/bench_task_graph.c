@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "task_graph.h"
+#include "convolve.h"
+#include "bench.h"
+
+#define DIM 1024
+#define MASK_DIM 5
+//Independent upload, convolve and read back chains per run
+#define JOBS 4
+//Queues for each graph, 1 is the serialized baseline and 0 is out-of-order if available
+static const int graph_queues[] = { 1, 0, TASK_GRAPH_QUEUES };
+
+typedef struct graph_bench_t {
+	task_graph_t *graph;
+	cl_kernel kernel;
+	cl_mem mask, in[JOBS], out[JOBS];
+	const cl_uint *host_in;
+	cl_uint *host_out[JOBS];
+} graph_bench_t;
+
+static cl_int run_pipeline(void *arg){
+	graph_bench_t *p = arg;
+	const size_t local_size[2] = { 8, 8 };
+	const size_t global_size[2] = {
+		round_up(CONV_OUT_DIM(DIM, MASK_DIM), 8), round_up(CONV_OUT_DIM(DIM, MASK_DIM), 8)
+	};
+	const size_t out_bytes = sizeof(cl_uint) * CONV_OUT_DIM(DIM, MASK_DIM)
+		* CONV_OUT_DIM(DIM, MASK_DIM);
+	const cl_int2 in_dim = {{ DIM, DIM }};
+	const cl_int mask_dim = MASK_DIM;
+	task_graph_reset(p->graph);
+	cl_int err = CL_SUCCESS;
+	for (int j = 0; j < JOBS && err == CL_SUCCESS; ++j){
+		const cl_mem reads[2] = { p->in[j], p->mask };
+		err = clSetKernelArg(p->kernel, 0, sizeof(cl_mem), &p->in[j]);
+		err |= clSetKernelArg(p->kernel, 1, sizeof(cl_mem), &p->mask);
+		err |= clSetKernelArg(p->kernel, 2, sizeof(cl_mem), &p->out[j]);
+		err |= clSetKernelArg(p->kernel, 3, sizeof(cl_int2), &in_dim);
+		err |= clSetKernelArg(p->kernel, 4, sizeof(cl_int), &mask_dim);
+		if (err != CL_SUCCESS
+			|| task_graph_write(p->graph, p->in[j], 0, sizeof(cl_uint) * DIM * DIM, p->host_in,
+				"write in") < 0
+			|| task_graph_kernel(p->graph, p->kernel, 2, global_size, local_size, reads, 2,
+				&p->out[j], 1, "convolve") < 0
+			|| task_graph_read(p->graph, p->out[j], 0, out_bytes, p->host_out[j], "read out") < 0)
+		{
+			err = err != CL_SUCCESS ? err : CL_INVALID_OPERATION;
+		}
+	}
+	err |= task_graph_finish(p->graph);
+	return err;
+}
+int bench_task_graph(bench_t *b){
+	cl_program program = bench_program(b,
+		"opencl_programming_guide/ch2_simple_convolution/convolution.cl", NULL);
+	if (!program){
+		return 1;
+	}
+	const size_t out_count = (size_t)CONV_OUT_DIM(DIM, MASK_DIM) * CONV_OUT_DIM(DIM, MASK_DIM);
+	cl_uint mask[MASK_DIM * MASK_DIM];
+	for (int i = 0; i < MASK_DIM * MASK_DIM; ++i){
+		mask[i] = 1 + i % 3;
+	}
+	cl_uint *in = malloc(sizeof(cl_uint) * DIM * DIM);
+	cl_uint *expect = malloc(sizeof(cl_uint) * out_count);
+	srand(1);
+	for (size_t i = 0; i < (size_t)DIM * DIM; ++i){
+		in[i] = rand() % 256;
+	}
+	convolve_host(in, DIM, DIM, mask, MASK_DIM, expect);
+
+	cl_int err, mem_err;
+	graph_bench_t p = { .host_in = in };
+	p.kernel = clCreateKernel(program, "convolve", &err);
+	p.mask = clCreateBuffer(b->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(mask),
+		mask, &mem_err);
+	err |= mem_err;
+	for (int j = 0; j < JOBS; ++j){
+		p.in[j] = clCreateBuffer(b->context, CL_MEM_READ_ONLY, sizeof(cl_uint) * DIM * DIM, NULL,
+			&mem_err);
+		err |= mem_err;
+		p.out[j] = clCreateBuffer(b->context, CL_MEM_WRITE_ONLY, sizeof(cl_uint) * out_count,
+			NULL, &mem_err);
+		err |= mem_err;
+		p.host_out[j] = malloc(sizeof(cl_uint) * out_count);
+	}
+	int ret = check_cl_err(err, "failed to set up task graph benchmark");
+	double *times = malloc(sizeof(double) * b->iters);
+	char size[32];
+	snprintf(size, sizeof(size), "x%d %dx%d k%d", JOBS, DIM, DIM, MASK_DIM);
+	for (size_t q = 0; q < sizeof(graph_queues) / sizeof(graph_queues[0]) && !ret; ++q){
+		p.graph = task_graph_create(b->context, b->device, graph_queues[q]);
+		if (!p.graph){
+			ret = 1;
+			break;
+		}
+		//Without out-of-order queues the default graph is the same as the last one
+		if (graph_queues[q] == 0 && !task_graph_out_of_order(p.graph)){
+			printf("The device doesn't have out-of-order queues\n");
+			task_graph_destroy(p.graph);
+			continue;
+		}
+		ret = bench_time(b, run_pipeline, &p, times);
+		if (!ret){
+			int valid = 1;
+			for (int j = 0; j < JOBS && valid; ++j){
+				valid = memcmp(p.host_out[j], expect, sizeof(cl_uint) * out_count) == 0;
+			}
+			char name[32];
+			if (task_graph_out_of_order(p.graph)){
+				snprintf(name, sizeof(name), "task_graph_ooo");
+			}
+			else {
+				snprintf(name, sizeof(name), "task_graph_q%d", task_graph_queues(p.graph));
+			}
+			bench_record(b, name, size, JOBS, (double)JOBS * sizeof(cl_uint)
+				* ((double)DIM * DIM + out_count), times, valid);
+			//The overlap of the last run
+			task_graph_stats_t stats = task_graph_stats(p.graph);
+			task_graph_print_stats(p.graph, &stats);
+		}
+		task_graph_destroy(p.graph);
+	}
+	for (int j = 0; j < JOBS; ++j){
+		if (p.in[j]){
+			clReleaseMemObject(p.in[j]);
+		}
+		if (p.out[j]){
+			clReleaseMemObject(p.out[j]);
+		}
+		free(p.host_out[j]);
+	}
+	if (p.mask){
+		clReleaseMemObject(p.mask);
+	}
+	if (p.kernel){
+		clReleaseKernel(p.kernel);
+	}
+	free(in);
+	free(expect);
+	free(times);
+	clReleaseProgram(program);
+	return ret;
+}
+
@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "bench.h"
+
+static const size_t sizes[] = { 1 << 10, 1 << 14, 1 << 18, 1 << 22, 1 << 24 };
+
+typedef struct vec_add_t {
+	cl_command_queue queue;
+	cl_kernel kernel;
+	size_t n;
+} vec_add_t;
+
+static cl_int run_vec_add(void *arg){
+	vec_add_t *v = arg;
+	return clEnqueueNDRangeKernel(v->queue, v->kernel, 1, NULL, &v->n, NULL, 0, NULL, NULL);
+}
+int bench_vec_add(bench_t *b){
+	cl_program program = bench_program(b, "opencl_programming_guide/hello_world/hello_world.cl",
+		NULL);
+	if (!program){
+		return 1;
+	}
+	cl_int err;
+	vec_add_t v = { .queue = b->queue };
+	v.kernel = clCreateKernel(program, "hello_world", &err);
+	if (check_cl_err(err, "failed to create hello_world kernel")){
+		clReleaseProgram(program);
+		return 1;
+	}
+	double *times = malloc(sizeof(double) * b->iters);
+	int ret = 0;
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && !ret; ++s){
+		v.n = sizes[s];
+		float *host[3];
+		for (int i = 0; i < 3; ++i){
+			host[i] = malloc(sizeof(float) * v.n);
+		}
+		for (size_t i = 0; i < v.n; ++i){
+			host[0][i] = i * 0.5f;
+			host[1][i] = (float)(v.n - i);
+		}
+		cl_mem mem[3];
+		mem[0] = clCreateBuffer(b->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			sizeof(float) * v.n, host[0], &err);
+		mem[1] = clCreateBuffer(b->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			sizeof(float) * v.n, host[1], &err);
+		mem[2] = clCreateBuffer(b->context, CL_MEM_WRITE_ONLY, sizeof(float) * v.n, NULL, &err);
+		cl_int n = (cl_int)v.n;
+		for (int i = 0; i < 3; ++i){
+			err |= clSetKernelArg(v.kernel, i, sizeof(cl_mem), &mem[i]);
+		}
+		err |= clSetKernelArg(v.kernel, 3, sizeof(cl_int), &n);
+		if (check_cl_err(err, "failed to set up vec_add buffers")
+			|| bench_time(b, run_vec_add, &v, times))
+		{
+			ret = 1;
+		}
+		else {
+			err = clEnqueueReadBuffer(b->queue, mem[2], CL_TRUE, 0, sizeof(float) * v.n, host[2],
+				0, NULL, NULL);
+			int valid = err == CL_SUCCESS;
+			for (size_t i = 0; i < v.n && valid; ++i){
+				valid = host[2][i] == host[0][i] + host[1][i];
+			}
+			char size[32];
+			snprintf(size, sizeof(size), "%lu", (unsigned long)v.n);
+			bench_record(b, "vec_add", size, v.n, 3.0 * sizeof(float) * v.n, times, valid);
+		}
+		for (int i = 0; i < 3; ++i){
+			clReleaseMemObject(mem[i]);
+			free(host[i]);
+		}
+	}
+	free(times);
+	clReleaseKernel(v.kernel);
+	clReleaseProgram(program);
+	return ret;
+}
+
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "scene.h"
+#include "bvh.h"
+#include "render.h"
+#include "wavefront.h"
+#include "bench.h"
+
+#define DIM 1024
+#define N_SPHERES 4096
+static const int bounce_counts[] = { 1, 2, 4, 8 };
+//The kernels are compiled separately so their colors can differ in the last bits
+#define COLOR_TOLERANCE 1e-4f
+
+typedef struct wavefront_bench_t {
+	cl_context context;
+	cl_device_id device;
+	cl_command_queue queue;
+	cl_program program;
+	primitives_t *prim;
+	render_scene_t scene;
+	//The single kernel baseline and its output
+	cl_kernel kernel;
+	cl_mem img;
+	int bounces;
+	cl_float4 *result;
+	wavefront_stats_t stats;
+} wavefront_bench_t;
+
+static cl_int run_single_kernel(void *arg){
+	wavefront_bench_t *w = arg;
+	const size_t global_size[2] = { DIM, DIM };
+	return clEnqueueNDRangeKernel(w->queue, w->kernel, 2, NULL, global_size, NULL, 0, NULL, NULL);
+}
+static cl_int run_wavefront(void *arg){
+	wavefront_bench_t *w = arg;
+	return render_wavefront(w->context, w->device, w->queue, w->program, w->prim, &w->scene, DIM,
+		DIM, w->bounces, IMAGE_PFM, w->result, &w->stats) ? CL_INVALID_OPERATION : CL_SUCCESS;
+}
+/*
+ * A single bounce should match the baseline and more bounces only add reflected light,
+ * so check the result against it
+ */
+static int check_result(const cl_float4 *expect, const cl_float4 *result, int bounces){
+	for (size_t i = 0; i < (size_t)DIM * DIM; ++i){
+		for (int c = 0; c < 3; ++c){
+			const float diff = result[i].s[c] - expect[i].s[c];
+			if (diff < -COLOR_TOLERANCE || (bounces == 1 && diff > COLOR_TOLERANCE)){
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+int bench_wavefront(bench_t *b){
+	wavefront_bench_t w = {
+		.context = b->context,
+		.device = b->device,
+		.queue = b->queue,
+		.scene = { .n_objs = N_SPHERES }
+	};
+	w.program = bench_program(b, "ray_test/ray_test.cl", NULL);
+	if (!w.program){
+		return 1;
+	}
+	sphere_t *spheres = malloc(sizeof(sphere_t) * N_SPHERES);
+	random_spheres(spheres, N_SPHERES, DIM, DIM, 1);
+	bvh_node_t *nodes = NULL;
+	size_t n_nodes = bvh_build(spheres, N_SPHERES, &nodes);
+	void *packed = malloc(sphere_buffer_size(SPHERE_AOS, N_SPHERES));
+	pack_spheres(spheres, N_SPHERES, SPHERE_AOS, packed);
+	const float pos[3] = { DIM / 2.0f, DIM / 2.0f, -DIM };
+	const float target[3] = { DIM / 2.0f, DIM / 2.0f, 0 };
+	const float up[3] = { 0, 1, 0 };
+	look_at_camera(&w.scene.camera, CAMERA_PINHOLE, pos, target, up, 60, DIM, DIM);
+
+	cl_int err, buf_err;
+	w.scene.objects = clCreateBuffer(b->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+		sphere_buffer_size(SPHERE_AOS, N_SPHERES), packed, &err);
+	w.scene.nodes = clCreateBuffer(b->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+		sizeof(bvh_node_t) * n_nodes, nodes, &buf_err);
+	err |= buf_err;
+	w.img = clCreateBuffer(b->context, CL_MEM_WRITE_ONLY, sizeof(cl_float4) * DIM * DIM, NULL,
+		&buf_err);
+	err |= buf_err;
+	w.kernel = clCreateKernel(w.program, "render_tile_f32", &buf_err);
+	err |= buf_err;
+	free(spheres);
+	free(nodes);
+	free(packed);
+	const cl_uint2 offset = {{ 0, 0 }}, tile_dim = {{ DIM, DIM }};
+	if (err == CL_SUCCESS){
+		err = clSetKernelArg(w.kernel, 0, sizeof(camera_t), &w.scene.camera);
+		err |= clSetKernelArg(w.kernel, 1, sizeof(cl_mem), &w.scene.objects);
+		err |= clSetKernelArg(w.kernel, 2, sizeof(cl_uint), &w.scene.n_objs);
+		err |= clSetKernelArg(w.kernel, 3, sizeof(cl_mem), &w.scene.nodes);
+		err |= clSetKernelArg(w.kernel, 4, sizeof(cl_mem), &w.img);
+		err |= clSetKernelArg(w.kernel, 5, sizeof(cl_uint2), &offset);
+		err |= clSetKernelArg(w.kernel, 6, sizeof(cl_uint2), &tile_dim);
+	}
+	w.prim = primitives_create(b->context, b->device);
+	cl_float4 *expect = malloc(sizeof(cl_float4) * DIM * DIM);
+	w.result = malloc(sizeof(cl_float4) * DIM * DIM);
+	double *times = malloc(sizeof(double) * b->iters);
+	char size[32];
+	snprintf(size, sizeof(size), "%dx%d n%d", DIM, DIM, N_SPHERES);
+	int ret = check_cl_err(err, "failed to set up wavefront benchmark") || !w.prim
+		|| bench_time(b, run_single_kernel, &w, times);
+	if (!ret){
+		err = clEnqueueReadBuffer(b->queue, w.img, CL_TRUE, 0, sizeof(cl_float4) * DIM * DIM,
+			expect, 0, NULL, NULL);
+		bench_record(b, "render_tile_f32", size, DIM * DIM, 0, times, err == CL_SUCCESS);
+		ret = err != CL_SUCCESS;
+	}
+	for (size_t i = 0; i < sizeof(bounce_counts) / sizeof(bounce_counts[0]) && !ret; ++i){
+		w.bounces = bounce_counts[i];
+		ret = bench_time(b, run_wavefront, &w, times);
+		if (!ret){
+			char name[32];
+			snprintf(name, sizeof(name), "wavefront_b%d", w.bounces);
+			//Throughput is in rays, which drops off with each bounce as rays miss
+			bench_record(b, name, size, w.stats.rays, 0, times,
+				check_result(expect, w.result, w.bounces));
+		}
+	}
+	free(times);
+	free(expect);
+	free(w.result);
+	primitives_destroy(w.prim);
+	clReleaseKernel(w.kernel);
+	clReleaseMemObject(w.img);
+	clReleaseMemObject(w.scene.objects);
+	clReleaseMemObject(w.scene.nodes);
+	clReleaseProgram(w.program);
+	return ret;
+}
+
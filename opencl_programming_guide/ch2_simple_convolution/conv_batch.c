@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "profile.h"
+#include "tune.h"
+#include "convolve.h"
+#include "conv_batch.h"
+
+//Host staging for one of the arenas and the device buffer it's copied to or from
+typedef struct arena_t {
+	cl_uint *host;
+	size_t size, capacity;
+	cl_mem mem;
+	size_t mem_capacity;
+} arena_t;
+
+struct conv_batch_t {
+	cl_context context;
+	cl_command_queue queue;
+	cl_kernel kernel;
+	//Tuned on the first batch run, 0 until then
+	size_t local_size[2];
+	//Largest output in the batch being run
+	size_t max_dim[2];
+	arena_t in, masks, out;
+	conv_batch_job_t *jobs;
+	cl_uint **results;
+	int n_jobs, jobs_capacity;
+	cl_mem job_table;
+	size_t table_capacity;
+};
+
+//Make room for count more uints on the host, returns the offset they start at
+static size_t arena_reserve(arena_t *arena, size_t count){
+	if (arena->size + count > arena->capacity){
+		arena->capacity = arena->capacity * 2 > arena->size + count ? arena->capacity * 2
+			: arena->size + count;
+		arena->host = realloc(arena->host, sizeof(cl_uint) * arena->capacity);
+	}
+	const size_t offset = arena->size;
+	arena->size += count;
+	return offset;
+}
+//Make sure the device buffer can hold size bytes, replacing it with a bigger one if not
+static cl_int grow_buffer(cl_context context, cl_mem *mem, size_t *capacity, size_t size,
+	cl_mem_flags flags)
+{
+	if (*mem && *capacity >= size){
+		return CL_SUCCESS;
+	}
+	if (*mem){
+		clReleaseMemObject(*mem);
+	}
+	cl_int err;
+	*capacity = size;
+	*mem = clCreateBuffer(context, flags, size, NULL, &err);
+	if (err != CL_SUCCESS){
+		*mem = NULL;
+		*capacity = 0;
+	}
+	return err;
+}
+static void release_arena(arena_t *arena){
+	if (arena->mem){
+		clReleaseMemObject(arena->mem);
+	}
+	free(arena->host);
+}
+static void clear_batch(conv_batch_t *batch){
+	batch->in.size = 0;
+	batch->masks.size = 0;
+	batch->out.size = 0;
+	batch->n_jobs = 0;
+}
+//Launch the kernel over the batch's largest output by the number of jobs
+static cl_int launch_batch(conv_batch_t *batch, cl_command_queue queue, const size_t *local_size,
+	cl_event *evt)
+{
+	const size_t global_size[3] = {
+		round_up(batch->max_dim[0], local_size[0]), round_up(batch->max_dim[1], local_size[1]),
+		batch->n_jobs
+	};
+	const size_t local_3d[3] = { local_size[0], local_size[1], 1 };
+	return clEnqueueNDRangeKernel(queue, batch->kernel, 3, NULL, global_size, local_3d, 0, NULL,
+		evt);
+}
+static cl_int tune_launch(void *arg, cl_command_queue queue, cl_kernel kernel,
+	const size_t *local_size, cl_event *evt)
+{
+	(void)kernel;
+	return launch_batch(arg, queue, local_size, evt);
+}
+conv_batch_t* conv_batch_create(cl_context context, cl_command_queue queue, cl_program program){
+	cl_int err;
+	conv_batch_t *batch = calloc(1, sizeof(conv_batch_t));
+	batch->context = context;
+	batch->queue = queue;
+	batch->kernel = clCreateKernel(program, "convolve_batch", &err);
+	if (check_cl_err(err, "failed to create batch kernel")){
+		conv_batch_destroy(batch);
+		return NULL;
+	}
+	return batch;
+}
+int conv_batch_add(conv_batch_t *batch, const cl_uint *in, int width, int height,
+	const cl_uint *mask, int mask_dim, cl_uint *out)
+{
+	if (batch->n_jobs == batch->jobs_capacity){
+		batch->jobs_capacity = batch->jobs_capacity ? batch->jobs_capacity * 2 : 64;
+		batch->jobs = realloc(batch->jobs, sizeof(conv_batch_job_t) * batch->jobs_capacity);
+		batch->results = realloc(batch->results, sizeof(cl_uint*) * batch->jobs_capacity);
+	}
+	conv_batch_job_t *job = &batch->jobs[batch->n_jobs];
+	const size_t in_count = (size_t)width * height;
+	const size_t mask_count = (size_t)mask_dim * mask_dim;
+	job->width = width;
+	job->height = height;
+	job->mask_dim = mask_dim;
+	job->in_offset = arena_reserve(&batch->in, in_count);
+	memcpy(batch->in.host + job->in_offset, in, sizeof(cl_uint) * in_count);
+	//Jobs in a stream usually share their mask so only keep one copy of a run of them
+	const conv_batch_job_t *prev = batch->n_jobs > 0 ? job - 1 : NULL;
+	if (prev && prev->mask_dim == mask_dim
+		&& memcmp(batch->masks.host + prev->mask_offset, mask, sizeof(cl_uint) * mask_count) == 0)
+	{
+		job->mask_offset = prev->mask_offset;
+	}
+	else {
+		job->mask_offset = arena_reserve(&batch->masks, mask_count);
+		memcpy(batch->masks.host + job->mask_offset, mask, sizeof(cl_uint) * mask_count);
+	}
+	job->out_offset = arena_reserve(&batch->out,
+		(size_t)CONV_OUT_DIM(width, mask_dim) * CONV_OUT_DIM(height, mask_dim));
+	batch->results[batch->n_jobs] = out;
+	return batch->n_jobs++;
+}
+int conv_batch_pending(const conv_batch_t *batch){
+	return batch->n_jobs;
+}
+int conv_batch_run(conv_batch_t *batch){
+	if (batch->n_jobs == 0){
+		return 0;
+	}
+	//Cover the largest output, smaller jobs leave the rest of their slice idle
+	size_t *max_dim = batch->max_dim;
+	max_dim[0] = max_dim[1] = 0;
+	for (int i = 0; i < batch->n_jobs; ++i){
+		const conv_batch_job_t *job = &batch->jobs[i];
+		const size_t out_w = CONV_OUT_DIM(job->width, job->mask_dim);
+		const size_t out_h = CONV_OUT_DIM(job->height, job->mask_dim);
+		max_dim[0] = out_w > max_dim[0] ? out_w : max_dim[0];
+		max_dim[1] = out_h > max_dim[1] ? out_h : max_dim[1];
+	}
+	const size_t table_size = sizeof(conv_batch_job_t) * batch->n_jobs;
+
+	arena_t *arenas[3] = { &batch->in, &batch->masks, &batch->out };
+	const cl_mem_flags flags[3] = { CL_MEM_READ_ONLY, CL_MEM_READ_ONLY, CL_MEM_WRITE_ONLY };
+	cl_int err = CL_SUCCESS;
+	for (int i = 0; i < 3; ++i){
+		err |= grow_buffer(batch->context, &arenas[i]->mem, &arenas[i]->mem_capacity,
+			sizeof(cl_uint) * arenas[i]->size, flags[i]);
+	}
+	err |= grow_buffer(batch->context, &batch->job_table, &batch->table_capacity, table_size,
+		CL_MEM_READ_ONLY);
+	if (err == CL_SUCCESS){
+		//The queue's in order, so the staging arenas are free again once the read returns
+		err = clEnqueueWriteBuffer(batch->queue, batch->in.mem, CL_FALSE, 0,
+			sizeof(cl_uint) * batch->in.size, batch->in.host, 0, NULL,
+			profile_event("upload batch"));
+		err |= clEnqueueWriteBuffer(batch->queue, batch->masks.mem, CL_FALSE, 0,
+			sizeof(cl_uint) * batch->masks.size, batch->masks.host, 0, NULL,
+			profile_event("upload masks"));
+		err |= clEnqueueWriteBuffer(batch->queue, batch->job_table, CL_FALSE, 0, table_size,
+			batch->jobs, 0, NULL, profile_event("upload job table"));
+		err |= clSetKernelArg(batch->kernel, 0, sizeof(cl_mem), &batch->in.mem);
+		err |= clSetKernelArg(batch->kernel, 1, sizeof(cl_mem), &batch->masks.mem);
+		err |= clSetKernelArg(batch->kernel, 2, sizeof(cl_mem), &batch->out.mem);
+		err |= clSetKernelArg(batch->kernel, 3, sizeof(cl_mem), &batch->job_table);
+		//The first batch is taken as representative of the rest, tune_local_size stores the
+		//result so later runs on the device just look it up
+		if (err == CL_SUCCESS && batch->local_size[0] == 0 && tune_local_size(batch->queue,
+			batch->kernel, 2, max_dim, tune_launch, batch, batch->local_size))
+		{
+			err = CL_INVALID_WORK_GROUP_SIZE;
+		}
+		if (err == CL_SUCCESS){
+			err = launch_batch(batch, batch->queue, batch->local_size,
+				profile_event("convolve_batch"));
+		}
+		err |= clEnqueueReadBuffer(batch->queue, batch->out.mem, CL_TRUE, 0,
+			sizeof(cl_uint) * batch->out.size, batch->out.host, 0, NULL,
+			profile_event("read batch"));
+	}
+	if (check_cl_err(err, "failed to run convolution batch")){
+		clear_batch(batch);
+		return 1;
+	}
+	for (int i = 0; i < batch->n_jobs; ++i){
+		const conv_batch_job_t *job = &batch->jobs[i];
+		const size_t out_count = (size_t)CONV_OUT_DIM(job->width, job->mask_dim)
+			* CONV_OUT_DIM(job->height, job->mask_dim);
+		memcpy(batch->results[i], batch->out.host + job->out_offset, sizeof(cl_uint) * out_count);
+	}
+	clear_batch(batch);
+	return 0;
+}
+void conv_batch_destroy(conv_batch_t *batch){
+	if (!batch){
+		return;
+	}
+	if (batch->kernel){
+		clReleaseKernel(batch->kernel);
+	}
+	if (batch->job_table){
+		clReleaseMemObject(batch->job_table);
+	}
+	release_arena(&batch->in);
+	release_arena(&batch->masks);
+	release_arena(&batch->out);
+	free(batch->jobs);
+	free(batch->results);
+	free(batch);
+}
+
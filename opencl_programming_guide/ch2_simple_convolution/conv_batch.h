@@ -0,0 +1,62 @@
+#ifndef CONV_BATCH_H
+#define CONV_BATCH_H
+
+#include <stddef.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+/*
+ * One job of a batch as the convolve_batch kernel reads it from the job table, offsets
+ * are in uints from the start of the input, output and mask arenas
+ */
+typedef struct conv_batch_job_t {
+	cl_int in_offset, out_offset, mask_offset;
+	cl_int width, height, mask_dim;
+} conv_batch_job_t;
+
+/*
+ * Many small convolutions packed into one launch. Adding a job copies its input and mask
+ * to the end of host staging arenas, reusing the previous job's mask if it's the same,
+ * and conv_batch_run uploads the arenas and the job table with one write each, convolves
+ * every job with a single 3D NDRange of the largest output in the batch by the number of
+ * jobs, and reads the output arena back with one blocking read, scattering each job's
+ * output to where it was added with. The device arenas only grow, so they're reused by
+ * later batches of the same or smaller size
+ */
+typedef struct conv_batch_t conv_batch_t;
+
+/*
+ * Set up batching with the program's convolve_batch kernel. Its local size is tuned with
+ * tune_local_size on the first batch that's run
+ * returns NULL on failure
+ */
+conv_batch_t* conv_batch_create(cl_context context, cl_command_queue queue, cl_program program);
+/*
+ * Add a job convolving the width x height input with the mask_dim x mask_dim mask to the
+ * batch, the result is written to out when the batch is run. The input and mask are copied
+ * so they can be freed right away, out must stay valid until the batch has run
+ * returns the job's index in the batch
+ */
+int conv_batch_add(conv_batch_t *batch, const cl_uint *in, int width, int height,
+	const cl_uint *mask, int mask_dim, cl_uint *out);
+/*
+ * Get the number of jobs added since the batch was last run
+ */
+int conv_batch_pending(const conv_batch_t *batch);
+/*
+ * Convolve all the pending jobs and write their results out, then clear the batch.
+ * Running an empty batch does nothing
+ * returns 1 on failure
+ */
+int conv_batch_run(conv_batch_t *batch);
+/*
+ * Release the kernel and arenas and free the batch
+ */
+void conv_batch_destroy(conv_batch_t *batch);
+
+#endif
+
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "profile.h"
+#include "convolve.h"
+#include "conv_fft.h"
+
+//Device memory for the complex tiles being transformed
+#define FFT_BUDGET (64 * 1024 * 1024)
+
+struct conv_fft_t {
+	cl_command_queue queue;
+	cl_kernel load, lines, multiply, store;
+	//The tiles being transformed and the spectrum of the flipped mask
+	cl_mem tiles, mask;
+	int width, height, mask_dim;
+	//Tiles are n x n and start every stride inputs
+	int n, stride, tiles_x, tiles_y;
+	int chunk_tiles;
+};
+
+//Transform count tiles of the data along their rows and then their columns
+static cl_int enqueue_fft_2d(const conv_fft_t *fft, cl_mem data, int count, float sign){
+	const size_t local_size[2] = { fft->n / 4, 1 };
+	const size_t global_size[2] = { fft->n / 4, (size_t)fft->n * count };
+	cl_int err = clSetKernelArg(fft->lines, 0, sizeof(cl_mem), &data);
+	err |= clSetKernelArg(fft->lines, 1, sizeof(cl_int), &fft->n);
+	err |= clSetKernelArg(fft->lines, 4, sizeof(cl_float), &sign);
+	err |= clSetKernelArg(fft->lines, 5, sizeof(cl_float2) * 2 * fft->n, NULL);
+	//Rows are line_stride n apart with contiguous elements, columns are the other way around
+	const cl_int strides[2][2] = { { fft->n, 1 }, { 1, fft->n } };
+	for (int pass = 0; pass < 2 && err == CL_SUCCESS; ++pass){
+		err = clSetKernelArg(fft->lines, 2, sizeof(cl_int), &strides[pass][0]);
+		err |= clSetKernelArg(fft->lines, 3, sizeof(cl_int), &strides[pass][1]);
+		err |= clEnqueueNDRangeKernel(fft->queue, fft->lines, 2, NULL, global_size, local_size, 0,
+			NULL, profile_event(pass ? "fft_cols" : "fft_rows"));
+	}
+	return err;
+}
+conv_fft_t* conv_fft_create(cl_context context, cl_command_queue queue, cl_program program,
+	const cl_uint *mask, int mask_dim, int width, int height, int tile_dim)
+{
+	if (tile_dim < 4 || (tile_dim & (tile_dim - 1)) || tile_dim < mask_dim){
+		fprintf(stderr, "FFT tiles must be a power of two of at least 4 and the mask's size\n");
+		return NULL;
+	}
+	conv_fft_t *fft = calloc(1, sizeof(conv_fft_t));
+	fft->queue = queue;
+	fft->width = width;
+	fft->height = height;
+	fft->mask_dim = mask_dim;
+	fft->n = tile_dim;
+	fft->stride = tile_dim - mask_dim + 1;
+	fft->tiles_x = (CONV_OUT_DIM(width, mask_dim) + fft->stride - 1) / fft->stride;
+	fft->tiles_y = (CONV_OUT_DIM(height, mask_dim) + fft->stride - 1) / fft->stride;
+	const size_t tile_bytes = sizeof(cl_float2) * tile_dim * tile_dim;
+	const int n_tiles = fft->tiles_x * fft->tiles_y;
+	fft->chunk_tiles = FFT_BUDGET / tile_bytes;
+	fft->chunk_tiles = fft->chunk_tiles < 1 ? 1
+		: fft->chunk_tiles > n_tiles ? n_tiles : fft->chunk_tiles;
+
+	cl_int err = CL_SUCCESS, kernel_err;
+	fft->load = clCreateKernel(program, "fft_load_tiles", &kernel_err);
+	err |= kernel_err;
+	fft->lines = clCreateKernel(program, "fft_lines", &kernel_err);
+	err |= kernel_err;
+	fft->multiply = clCreateKernel(program, "fft_multiply", &kernel_err);
+	err |= kernel_err;
+	fft->store = clCreateKernel(program, "fft_store_tiles", &kernel_err);
+	err |= kernel_err;
+	if (check_cl_err(err, "failed to create FFT kernels")){
+		conv_fft_destroy(fft);
+		return NULL;
+	}
+	cl_device_id device;
+	size_t max_group = 0;
+	err = clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device, NULL);
+	err |= clGetKernelWorkGroupInfo(fft->lines, device, CL_KERNEL_WORK_GROUP_SIZE,
+		sizeof(max_group), &max_group, NULL);
+	if (check_cl_err(err, "failed to query FFT kernel limits") || (size_t)tile_dim / 4 > max_group){
+		fprintf(stderr, "%dx%d FFT tiles are too big for the device\n", tile_dim, tile_dim);
+		conv_fft_destroy(fft);
+		return NULL;
+	}
+
+	//The kernels correlate, which is convolving with the mask flipped in both directions
+	cl_float2 *padded = calloc(tile_dim * tile_dim, sizeof(cl_float2));
+	for (int r = 0; r < mask_dim; ++r){
+		for (int c = 0; c < mask_dim; ++c){
+			const cl_uint m = mask[(mask_dim - 1 - r) * mask_dim + mask_dim - 1 - c];
+			padded[r * tile_dim + c].s[0] = (cl_float)(cl_int)m;
+		}
+	}
+	cl_int buf_err;
+	fft->mask = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, tile_bytes,
+		padded, &err);
+	fft->tiles = clCreateBuffer(context, CL_MEM_READ_WRITE, tile_bytes * fft->chunk_tiles, NULL,
+		&buf_err);
+	err |= buf_err;
+	free(padded);
+	if (err == CL_SUCCESS){
+		err = enqueue_fft_2d(fft, fft->mask, 1, -1);
+	}
+	const cl_float scale = 1.0f / ((cl_float)tile_dim * tile_dim);
+	const cl_int2 in_dim = {{ width, height }};
+	err |= clSetKernelArg(fft->load, 1, sizeof(cl_mem), &fft->tiles);
+	err |= clSetKernelArg(fft->load, 2, sizeof(cl_int2), &in_dim);
+	err |= clSetKernelArg(fft->load, 3, sizeof(cl_int), &fft->n);
+	err |= clSetKernelArg(fft->load, 4, sizeof(cl_int), &fft->stride);
+	err |= clSetKernelArg(fft->load, 5, sizeof(cl_int), &fft->tiles_x);
+	err |= clSetKernelArg(fft->multiply, 0, sizeof(cl_mem), &fft->tiles);
+	err |= clSetKernelArg(fft->multiply, 1, sizeof(cl_mem), &fft->mask);
+	err |= clSetKernelArg(fft->multiply, 2, sizeof(cl_float), &scale);
+	err |= clSetKernelArg(fft->store, 0, sizeof(cl_mem), &fft->tiles);
+	err |= clSetKernelArg(fft->store, 2, sizeof(cl_int2), &in_dim);
+	err |= clSetKernelArg(fft->store, 3, sizeof(cl_int), &fft->mask_dim);
+	err |= clSetKernelArg(fft->store, 4, sizeof(cl_int), &fft->n);
+	err |= clSetKernelArg(fft->store, 5, sizeof(cl_int), &fft->stride);
+	err |= clSetKernelArg(fft->store, 6, sizeof(cl_int), &fft->tiles_x);
+	if (check_cl_err(err, "failed to set up FFT convolution")){
+		conv_fft_destroy(fft);
+		return NULL;
+	}
+	return fft;
+}
+cl_int conv_fft_enqueue(conv_fft_t *fft, cl_mem in, cl_mem out, cl_event *evt){
+	const int n_tiles = fft->tiles_x * fft->tiles_y;
+	cl_int err = clSetKernelArg(fft->load, 0, sizeof(cl_mem), &in);
+	err |= clSetKernelArg(fft->store, 1, sizeof(cl_mem), &out);
+	for (int first = 0; first < n_tiles && err == CL_SUCCESS; first += fft->chunk_tiles){
+		const int count = first + fft->chunk_tiles > n_tiles ? n_tiles - first : fft->chunk_tiles;
+		const size_t load_size[3] = { fft->n, fft->n, count };
+		const size_t multiply_size[2] = { (size_t)fft->n * fft->n, count };
+		const size_t store_size[3] = { fft->stride, fft->stride, count };
+		err = clSetKernelArg(fft->load, 6, sizeof(cl_int), &first);
+		err |= clSetKernelArg(fft->store, 7, sizeof(cl_int), &first);
+		err |= clEnqueueNDRangeKernel(fft->queue, fft->load, 3, NULL, load_size, NULL, 0, NULL,
+			profile_event("fft_load_tiles"));
+		err |= enqueue_fft_2d(fft, fft->tiles, count, -1);
+		err |= clEnqueueNDRangeKernel(fft->queue, fft->multiply, 2, NULL, multiply_size, NULL, 0,
+			NULL, profile_event("fft_multiply"));
+		err |= enqueue_fft_2d(fft, fft->tiles, count, 1);
+		err |= clEnqueueNDRangeKernel(fft->queue, fft->store, 3, NULL, store_size, NULL, 0, NULL,
+			first + count == n_tiles ? evt : profile_event("fft_store_tiles"));
+	}
+	return err;
+}
+double convolve_fft_error(const cl_uint *result, const cl_uint *expect, size_t count){
+	double max_diff = 0, max_val = 0;
+	for (size_t i = 0; i < count; ++i){
+		const double diff = fabs((double)(cl_int)(result[i] - expect[i]));
+		const double val = fabs((double)(cl_int)expect[i]);
+		max_diff = diff > max_diff ? diff : max_diff;
+		max_val = val > max_val ? val : max_val;
+	}
+	return max_val > 0 ? max_diff / max_val : max_diff;
+}
+void conv_fft_destroy(conv_fft_t *fft){
+	if (!fft){
+		return;
+	}
+	cl_kernel kernels[4] = { fft->load, fft->lines, fft->multiply, fft->store };
+	for (int i = 0; i < 4; ++i){
+		if (kernels[i]){
+			clReleaseKernel(kernels[i]);
+		}
+	}
+	if (fft->tiles){
+		clReleaseMemObject(fft->tiles);
+	}
+	if (fft->mask){
+		clReleaseMemObject(fft->mask);
+	}
+	free(fft);
+}
+
@@ -0,0 +1,55 @@
+#ifndef CONV_FFT_H
+#define CONV_FFT_H
+
+#include <stddef.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+/*
+ * Largest difference from the integer kernels the FFT convolution's results are allowed,
+ * relative to the largest magnitude output. The math is done in float so outputs beyond
+ * 2^24 or with large partial sums can be off by rounding
+ */
+#define CONV_FFT_TOLERANCE 1e-5
+
+/*
+ * Overlap-save FFT convolution of a width x height input with one mask. The input is cut
+ * into tile_dim x tile_dim tiles overlapping by mask_dim - 1, the tiles are loaded into
+ * complex floats, transformed with the fft_lines kernel over their rows and then columns,
+ * multiplied by the spectrum of the flipped mask computed when the plan is made and
+ * transformed back, and the valid (tile_dim - mask_dim + 1)^2 block of each is written
+ * out. The tiles are done in chunks that fit a 64MB buffer on the device
+ */
+typedef struct conv_fft_t conv_fft_t;
+
+/*
+ * Make a plan for convolving width x height inputs with the mask, tile_dim is a power of
+ * two from 4 up to 4 times the fft_lines kernel's work-group size limit that's bigger than
+ * mask_dim - 1, see convolve_fft_cost for picking one. The mask's spectrum is computed on
+ * the queue
+ * returns NULL on failure
+ */
+conv_fft_t* conv_fft_create(cl_context context, cl_command_queue queue, cl_program program,
+	const cl_uint *mask, int mask_dim, int width, int height, int tile_dim);
+/*
+ * Enqueue the convolution of in into out, giving the same valid region as the convolve
+ * kernel within CONV_FFT_TOLERANCE. evt may be NULL and is set for the last pass
+ * returns the error code of the first call that failed
+ */
+cl_int conv_fft_enqueue(conv_fft_t *fft, cl_mem in, cl_mem out, cl_event *evt);
+/*
+ * Largest difference between the result and the expected output, treating both as signed,
+ * relative to the largest magnitude expected output or absolute if they're all 0
+ */
+double convolve_fft_error(const cl_uint *result, const cl_uint *expect, size_t count);
+/*
+ * Release the plan's kernels and buffers and free it
+ */
+void conv_fft_destroy(conv_fft_t *fft);
+
+#endif
+
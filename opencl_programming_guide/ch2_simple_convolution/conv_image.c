@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "profile.h"
+#include "tune.h"
+#include "convolve.h"
+#include "conv_image.h"
+
+static const char *border_names[CONV_NUM_BORDERS] = { "zero", "clamp", "repeat", "mirror" };
+static const cl_addressing_mode border_modes[CONV_NUM_BORDERS] = {
+	CL_ADDRESS_CLAMP, CL_ADDRESS_CLAMP_TO_EDGE, CL_ADDRESS_REPEAT, CL_ADDRESS_MIRRORED_REPEAT
+};
+static const char *path_names[CONV_NUM_PATHS] = { "buffer", "image" };
+
+struct conv_image_t {
+	cl_command_queue queue;
+	cl_kernel kernels[CONV_NUM_PATHS];
+	cl_mem mask;
+	//The padded input and output of the buffer path
+	cl_mem padded_in, buffer_out;
+	//The input and output of the image path, NULL if the device can't use them
+	cl_mem image_in, image_out;
+	cl_sampler sampler;
+	cl_uint *padded;
+	int width, height, mask_dim;
+	conv_border_t border;
+	//The tuned local size of each path
+	size_t local_sizes[CONV_NUM_PATHS][2];
+};
+
+const char* conv_border_name(conv_border_t border){
+	return border_names[border];
+}
+int conv_border_parse(const char *name){
+	for (int i = 0; i < CONV_NUM_BORDERS; ++i){
+		if (strcmp(name, border_names[i]) == 0){
+			return i;
+		}
+	}
+	return -1;
+}
+const char* conv_path_name(conv_path_t path){
+	return path_names[path];
+}
+int conv_border_index(int i, int n, conv_border_t border){
+	if (i >= 0 && i < n){
+		return i;
+	}
+	if (border == CONV_BORDER_CLAMP){
+		return i < 0 ? 0 : n - 1;
+	}
+	if (border == CONV_BORDER_REPEAT){
+		return (i % n + n) % n;
+	}
+	if (border == CONV_BORDER_MIRROR){
+		//The image and its mirror repeat every 2n pixels
+		const int m = (i % (2 * n) + 2 * n) % (2 * n);
+		return m < n ? m : 2 * n - 1 - m;
+	}
+	return -1;
+}
+void convolve_host_border(const cl_uint *in, int width, int height, const cl_uint *mask,
+	int mask_dim, conv_border_t border, cl_uint *out)
+{
+	for (int y = 0; y < height; ++y){
+		for (int x = 0; x < width; ++x){
+			cl_uint sum = 0;
+			for (int r = 0; r < mask_dim; ++r){
+				const int iy = conv_border_index(y + r - mask_dim / 2, height, border);
+				for (int c = 0; c < mask_dim && iy >= 0; ++c){
+					const int ix = conv_border_index(x + c - mask_dim / 2, width, border);
+					if (ix >= 0){
+						sum += mask[r * mask_dim + c] * in[(size_t)iy * width + ix];
+					}
+				}
+			}
+			out[(size_t)y * width + x] = sum;
+		}
+	}
+}
+void convolve_pad_border(const cl_uint *in, int width, int height, int mask_dim,
+	conv_border_t border, cl_uint *padded)
+{
+	const int padded_w = width + mask_dim - 1, padded_h = height + mask_dim - 1;
+	for (int y = 0; y < padded_h; ++y){
+		const int iy = conv_border_index(y - mask_dim / 2, height, border);
+		cl_uint *row = padded + (size_t)y * padded_w;
+		for (int x = 0; x < padded_w; ++x){
+			const int ix = conv_border_index(x - mask_dim / 2, width, border);
+			row[x] = iy < 0 || ix < 0 ? 0 : in[(size_t)iy * width + ix];
+		}
+	}
+}
+//Check if the device can hold the input as a single channel uint image
+static int image_supported(cl_context context, cl_device_id device, int width, int height){
+	cl_bool images = CL_FALSE;
+	size_t max_width = 0, max_height = 0;
+	cl_int err = clGetDeviceInfo(device, CL_DEVICE_IMAGE_SUPPORT, sizeof(images), &images, NULL);
+	err |= clGetDeviceInfo(device, CL_DEVICE_IMAGE2D_MAX_WIDTH, sizeof(max_width), &max_width,
+		NULL);
+	err |= clGetDeviceInfo(device, CL_DEVICE_IMAGE2D_MAX_HEIGHT, sizeof(max_height), &max_height,
+		NULL);
+	if (err != CL_SUCCESS || !images || (size_t)width > max_width || (size_t)height > max_height){
+		return 0;
+	}
+	//CL_R isn't one of the formats every device has to support
+	cl_uint n_formats = 0;
+	err = clGetSupportedImageFormats(context, CL_MEM_READ_WRITE, CL_MEM_OBJECT_IMAGE2D, 0, NULL,
+		&n_formats);
+	cl_image_format *formats = malloc(sizeof(cl_image_format) * (n_formats ? n_formats : 1));
+	err |= clGetSupportedImageFormats(context, CL_MEM_READ_WRITE, CL_MEM_OBJECT_IMAGE2D,
+		n_formats, formats, NULL);
+	int found = 0;
+	for (cl_uint i = 0; i < n_formats && err == CL_SUCCESS && !found; ++i){
+		found = formats[i].image_channel_order == CL_R
+			&& formats[i].image_channel_data_type == CL_UNSIGNED_INT32;
+	}
+	free(formats);
+	return found;
+}
+static cl_mem create_image(cl_context context, cl_mem_flags flags, int width, int height,
+	cl_int *err)
+{
+	const cl_image_format format = { CL_R, CL_UNSIGNED_INT32 };
+	cl_image_desc desc;
+	memset(&desc, 0, sizeof(desc));
+	desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+	desc.image_width = width;
+	desc.image_height = height;
+	return clCreateImage(context, flags, &format, &desc, NULL, err);
+}
+//Release whatever the image path created, leaving the buffer path to run on its own
+static void release_image_path(conv_image_t *conv){
+	if (conv->kernels[CONV_PATH_IMAGE]){
+		clReleaseKernel(conv->kernels[CONV_PATH_IMAGE]);
+		conv->kernels[CONV_PATH_IMAGE] = NULL;
+	}
+	if (conv->image_in){
+		clReleaseMemObject(conv->image_in);
+		conv->image_in = NULL;
+	}
+	if (conv->image_out){
+		clReleaseMemObject(conv->image_out);
+		conv->image_out = NULL;
+	}
+	if (conv->sampler){
+		clReleaseSampler(conv->sampler);
+		conv->sampler = NULL;
+	}
+}
+//Run the buffer path's kernel on the padded input with the local size being tuned
+static cl_int tune_buffer_path(void *arg, cl_command_queue queue, cl_kernel kernel,
+	const size_t *local_size, cl_event *evt)
+{
+	const conv_image_t *conv = arg;
+	return enqueue_convolve(queue, kernel, conv->padded_in, conv->mask, conv->buffer_out,
+		conv->width + conv->mask_dim - 1, conv->height + conv->mask_dim - 1, conv->mask_dim,
+		local_size, evt);
+}
+conv_image_t* conv_image_create(cl_context context, cl_command_queue queue, cl_program program,
+	const cl_uint *mask, int mask_dim, int width, int height, conv_border_t border)
+{
+	cl_device_id device;
+	cl_int err = clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(device), &device, NULL);
+	if (check_cl_err(err, "failed to get queue device")){
+		return NULL;
+	}
+	conv_image_t *conv = calloc(1, sizeof(conv_image_t));
+	conv->queue = queue;
+	conv->width = width;
+	conv->height = height;
+	conv->mask_dim = mask_dim;
+	conv->border = border;
+	const size_t padded_count = (size_t)(width + mask_dim - 1) * (height + mask_dim - 1);
+	conv->padded = malloc(sizeof(cl_uint) * padded_count);
+
+	cl_int mem_err;
+	conv->kernels[CONV_PATH_BUFFER] = clCreateKernel(program, "convolve", &err);
+	conv->mask = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+		sizeof(cl_uint) * mask_dim * mask_dim, (void*)mask, &mem_err);
+	err |= mem_err;
+	conv->padded_in = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(cl_uint) * padded_count,
+		NULL, &mem_err);
+	err |= mem_err;
+	conv->buffer_out = clCreateBuffer(context, CL_MEM_WRITE_ONLY,
+		sizeof(cl_uint) * width * height, NULL, &mem_err);
+	err |= mem_err;
+	//Both paths output width x height, so the buffer path shares the local size tuned for
+	//convolve elsewhere on outputs of this size
+	const size_t dims[2] = { width, height };
+	if (check_cl_err(err, "failed to set up buffer convolution")
+		|| tune_local_size(queue, conv->kernels[CONV_PATH_BUFFER], 2, dims, tune_buffer_path, conv,
+			conv->local_sizes[CONV_PATH_BUFFER]))
+	{
+		conv_image_destroy(conv);
+		return NULL;
+	}
+	//Devices without the images we need just run the buffer path
+	if (image_supported(context, device, width, height)){
+		conv->kernels[CONV_PATH_IMAGE] = clCreateKernel(program, "convolve_image", &err);
+		conv->image_in = create_image(context, CL_MEM_READ_ONLY, width, height, &mem_err);
+		err |= mem_err;
+		conv->image_out = create_image(context, CL_MEM_WRITE_ONLY, width, height, &mem_err);
+		err |= mem_err;
+		conv->sampler = clCreateSampler(context, CL_TRUE, border_modes[border], CL_FILTER_NEAREST,
+			&mem_err);
+		err |= mem_err;
+		err |= clSetKernelArg(conv->kernels[CONV_PATH_IMAGE], 0, sizeof(cl_mem), &conv->image_in);
+		err |= clSetKernelArg(conv->kernels[CONV_PATH_IMAGE], 1, sizeof(cl_mem), &conv->mask);
+		err |= clSetKernelArg(conv->kernels[CONV_PATH_IMAGE], 2, sizeof(cl_mem), &conv->image_out);
+		err |= clSetKernelArg(conv->kernels[CONV_PATH_IMAGE], 3, sizeof(cl_int), &mask_dim);
+		err |= clSetKernelArg(conv->kernels[CONV_PATH_IMAGE], 4, sizeof(cl_sampler),
+			&conv->sampler);
+		if (check_cl_err(err, "failed to set up image convolution, using buffers only")
+			|| tune_local_size(queue, conv->kernels[CONV_PATH_IMAGE], 2, dims, NULL, NULL,
+				conv->local_sizes[CONV_PATH_IMAGE]))
+		{
+			release_image_path(conv);
+		}
+	}
+	return conv;
+}
+int conv_image_has_path(const conv_image_t *conv, conv_path_t path){
+	return conv->kernels[path] != NULL;
+}
+cl_int conv_image_run(conv_image_t *conv, conv_path_t path, const cl_uint *in, cl_uint *out){
+	const int width = conv->width, height = conv->height, mask_dim = conv->mask_dim;
+	if (!conv_image_has_path(conv, path)){
+		return CL_INVALID_OPERATION;
+	}
+	const size_t *local_size = conv->local_sizes[path];
+	cl_int err;
+	if (path == CONV_PATH_BUFFER){
+		//The padding copy on the host is part of the cost of this path
+		const int padded_w = width + mask_dim - 1, padded_h = height + mask_dim - 1;
+		convolve_pad_border(in, width, height, mask_dim, conv->border, conv->padded);
+		err = clEnqueueWriteBuffer(conv->queue, conv->padded_in, CL_FALSE, 0,
+			sizeof(cl_uint) * padded_w * padded_h, conv->padded, 0, NULL,
+			profile_event("write padded"));
+		err |= enqueue_convolve(conv->queue, conv->kernels[path], conv->padded_in, conv->mask,
+			conv->buffer_out, padded_w, padded_h, mask_dim, local_size,
+			profile_event("convolve"));
+		err |= clEnqueueReadBuffer(conv->queue, conv->buffer_out, CL_TRUE, 0,
+			sizeof(cl_uint) * width * height, out, 0, NULL, profile_event("read out"));
+		return err;
+	}
+	const size_t origin[3] = { 0, 0, 0 };
+	const size_t region[3] = { width, height, 1 };
+	size_t global_size[2];
+	const size_t dims[2] = { width, height };
+	pad_global_size(2, dims, local_size, global_size);
+	err = clEnqueueWriteImage(conv->queue, conv->image_in, CL_FALSE, origin, region, 0, 0, in,
+		0, NULL, profile_event("write image"));
+	err |= clEnqueueNDRangeKernel(conv->queue, conv->kernels[path], 2, NULL, global_size,
+		local_size, 0, NULL, profile_event("convolve_image"));
+	err |= clEnqueueReadImage(conv->queue, conv->image_out, CL_TRUE, origin, region, 0, 0, out,
+		0, NULL, profile_event("read image"));
+	return err;
+}
+//Where the paths being timed by conv_image_pick read and write
+typedef struct pick_args_t {
+	conv_image_t *conv;
+	const cl_uint *in;
+	cl_uint *out;
+} pick_args_t;
+
+static cl_int run_path(void *arg, cl_command_queue queue, int variant){
+	//The paths run on the queue conv was made with, which is the one being tuned on
+	(void)queue;
+	pick_args_t *p = arg;
+	return conv_image_run(p->conv, variant, p->in, p->out);
+}
+conv_path_t conv_image_pick(conv_image_t *conv, const cl_uint *in, cl_uint *out){
+	if (!conv_image_has_path(conv, CONV_PATH_IMAGE)){
+		return CONV_PATH_BUFFER;
+	}
+	char name[128];
+	snprintf(name, sizeof(name), "convolve_border %s %dx%d k%d", border_names[conv->border],
+		conv->width, conv->height, conv->mask_dim);
+	pick_args_t p = { conv, in, out };
+	const int path = tune_variant(conv->queue, name, CONV_NUM_PATHS, run_path, &p);
+	return path < 0 ? CONV_PATH_BUFFER : path;
+}
+void conv_image_destroy(conv_image_t *conv){
+	if (!conv){
+		return;
+	}
+	for (int i = 0; i < CONV_NUM_PATHS; ++i){
+		if (conv->kernels[i]){
+			clReleaseKernel(conv->kernels[i]);
+		}
+	}
+	cl_mem mems[5] = { conv->mask, conv->padded_in, conv->buffer_out, conv->image_in,
+		conv->image_out };
+	for (int i = 0; i < 5; ++i){
+		if (mems[i]){
+			clReleaseMemObject(mems[i]);
+		}
+	}
+	if (conv->sampler){
+		clReleaseSampler(conv->sampler);
+	}
+	free(conv->padded);
+	free(conv);
+}
+
@@ -0,0 +1,97 @@
+#ifndef CONV_IMAGE_H
+#define CONV_IMAGE_H
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+/*
+ * How reads past the edge of the input are handled when computing a same size output:
+ * zero padding, clamping to the edge, repeating the image or mirroring it with the edge
+ * pixel repeated, matching the sampler addressing modes CL_ADDRESS_CLAMP,
+ * CL_ADDRESS_CLAMP_TO_EDGE, CL_ADDRESS_REPEAT and CL_ADDRESS_MIRRORED_REPEAT
+ */
+typedef enum conv_border_t {
+	CONV_BORDER_ZERO, CONV_BORDER_CLAMP, CONV_BORDER_REPEAT, CONV_BORDER_MIRROR,
+	CONV_NUM_BORDERS
+} conv_border_t;
+
+/*
+ * The ways of convolving with borders: padding the input on the host and running the
+ * convolve kernel on buffers, or binding the input to an image read through a sampler
+ * with the convolve_image kernel
+ */
+typedef enum conv_path_t { CONV_PATH_BUFFER, CONV_PATH_IMAGE, CONV_NUM_PATHS } conv_path_t;
+
+/*
+ * Get the name of the border mode, zero, clamp, repeat or mirror
+ */
+const char* conv_border_name(conv_border_t border);
+/*
+ * Look up a border mode by its name
+ * returns -1 if the name is unknown
+ */
+int conv_border_parse(const char *name);
+/*
+ * Get the name of the path, buffer or image
+ */
+const char* conv_path_name(conv_path_t path);
+/*
+ * Map coordinate i on an axis of n pixels into the input with the border mode
+ * returns -1 for zero padded reads outside the input
+ */
+int conv_border_index(int i, int n, conv_border_t border);
+/*
+ * Convolve the input with the mask centered on each pixel, starting mask_dim / 2 before
+ * it, into a same size width x height output on the host, for checking the kernels' results
+ */
+void convolve_host_border(const cl_uint *in, int width, int height, const cl_uint *mask,
+	int mask_dim, conv_border_t border, cl_uint *out);
+/*
+ * Pad the input by mask_dim - 1 pixels with the border mode, mask_dim / 2 of them on the
+ * top and left, into padded, which holds (width + mask_dim - 1) x (height + mask_dim - 1)
+ * uints. The valid region of the padded input is the same as convolve_host_border's output
+ */
+void convolve_pad_border(const cl_uint *in, int width, int height, int mask_dim,
+	conv_border_t border, cl_uint *padded);
+
+/*
+ * Convolution of width x height inputs with one mask and border mode, to same size
+ * outputs, through either path. The buffer path is always there, the image path is only
+ * set up if the device supports single channel uint images of the size
+ */
+typedef struct conv_image_t conv_image_t;
+
+/*
+ * Set up both paths for the mask and border mode on the queue, tuning the local size of
+ * each with tune_local_size. If the image path can't be set up only the buffer path is used
+ * returns NULL if the buffer path can't be set up
+ */
+conv_image_t* conv_image_create(cl_context context, cl_command_queue queue, cl_program program,
+	const cl_uint *mask, int mask_dim, int width, int height, conv_border_t border);
+/*
+ * Check if the path was set up for the device
+ */
+int conv_image_has_path(const conv_image_t *conv, conv_path_t path);
+/*
+ * Convolve the host input to the host output through the path, including padding the
+ * input for the buffer path and the uploads and read back. Blocks until out is written
+ * returns the error code of the first call that failed
+ */
+cl_int conv_image_run(conv_image_t *conv, conv_path_t path, const cl_uint *in, cl_uint *out);
+/*
+ * Pick the faster path on the device with tune_variant, timing both on the input the
+ * first time this size, mask size and border mode is seen on the device. out is
+ * overwritten while timing
+ * returns the buffer path if the image path isn't set up or neither could run
+ */
+conv_path_t conv_image_pick(conv_image_t *conv, const cl_uint *in, cl_uint *out);
+/*
+ * Release the kernels, buffers, images and sampler and free the convolution
+ */
+void conv_image_destroy(conv_image_t *conv);
+
+#endif
+
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "profile.h"
+#include "convolve.h"
+#include "conv_stream.h"
+
+//One of the two sets of buffers a strip goes through
+typedef struct strip_buf_t {
+	cl_mem in, out;
+	cl_uint *host_in, *host_out;
+	//The last upload, kernel and download using these buffers, NULL if none yet
+	cl_event uploaded, convolved, downloaded;
+	int rows;
+} strip_buf_t;
+
+static void release_event(cl_event *evt){
+	if (*evt){
+		clReleaseEvent(*evt);
+		*evt = NULL;
+	}
+}
+int convolve_stream_strip_rows(int width, int height, int mask_dim, size_t budget){
+	const size_t out_w = CONV_OUT_DIM(width, mask_dim);
+	const size_t halo = sizeof(cl_uint) * width * (mask_dim - 1);
+	//Each output row needs an input row and an output row in both sets of buffers
+	const size_t row_bytes = 2 * sizeof(cl_uint) * (width + out_w);
+	const int out_h = CONV_OUT_DIM(height, mask_dim);
+	size_t rows = budget > 2 * halo ? (budget - 2 * halo) / row_bytes : 1;
+	return rows < 1 ? 1 : rows > (size_t)out_h ? out_h : (int)rows;
+}
+int convolve_stream(cl_context context, const conv_stream_t *stream, FILE *in, FILE *out){
+	const int width = stream->width, mask_dim = stream->mask_dim;
+	const int out_w = CONV_OUT_DIM(width, mask_dim), out_h = CONV_OUT_DIM(stream->height, mask_dim);
+	const int n_strips = (out_h + stream->strip_rows - 1) / stream->strip_rows;
+	const size_t in_strip = (size_t)width * (stream->strip_rows + mask_dim - 1);
+	const size_t out_strip = (size_t)out_w * stream->strip_rows;
+	const size_t halo = (size_t)width * (mask_dim - 1);
+
+	cl_int err = CL_SUCCESS, mem_err;
+	strip_buf_t bufs[2];
+	memset(bufs, 0, sizeof(bufs));
+	int failed = 0;
+	for (int i = 0; i < 2; ++i){
+		bufs[i].in = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(cl_uint) * in_strip, NULL,
+			&mem_err);
+		err |= mem_err;
+		bufs[i].out = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(cl_uint) * out_strip, NULL,
+			&mem_err);
+		err |= mem_err;
+		bufs[i].host_in = malloc(sizeof(cl_uint) * in_strip);
+		bufs[i].host_out = malloc(sizeof(cl_uint) * out_strip);
+		failed |= !bufs[i].host_in || !bufs[i].host_out;
+	}
+	if (failed){
+		fprintf(stderr, "Failed to allocate host strip buffers\n");
+	}
+	failed |= check_cl_err(err, "failed to create strip buffers");
+	for (int s = 0; s <= n_strips && !failed; ++s){
+		if (s < n_strips){
+			strip_buf_t *buf = &bufs[s % 2];
+			const strip_buf_t *prev = &bufs[(s + 1) % 2];
+			buf->rows = (s + 1) * stream->strip_rows > out_h ? out_h - s * stream->strip_rows
+				: stream->strip_rows;
+			//The host input is free once its last upload is done
+			if (buf->uploaded){
+				err = clWaitForEvents(1, &buf->uploaded);
+			}
+			//Neighbouring strips share the halo rows so they're only read from disk once
+			size_t have = 0;
+			if (s > 0){
+				memcpy(buf->host_in, prev->host_in + (size_t)width * prev->rows,
+					sizeof(cl_uint) * halo);
+				have = halo;
+			}
+			const size_t need = (size_t)width * (buf->rows + mask_dim - 1) - have;
+			if (fread(buf->host_in + have, sizeof(cl_uint), need, in) != need){
+				fprintf(stderr, "Input ended before strip %d was read\n", s);
+				failed = 1;
+				break;
+			}
+			//The device input is free once the kernel that last read it is done
+			cl_event upload_evt = NULL, kernel_evt = NULL, download_evt = NULL;
+			err |= clEnqueueWriteBuffer(stream->upload, buf->in, CL_FALSE, 0,
+				sizeof(cl_uint) * (have + need), buf->host_in, buf->convolved ? 1 : 0,
+				buf->convolved ? &buf->convolved : NULL, &upload_evt);
+			release_event(&buf->uploaded);
+			buf->uploaded = upload_evt;
+			profile_record(upload_evt, "upload strip");
+
+			//Wait for the upload and for the last download from the output to be done
+			cl_event wait[2] = { upload_evt, buf->downloaded };
+			err |= clEnqueueBarrierWithWaitList(stream->compute, buf->downloaded ? 2 : 1, wait, NULL);
+			err |= stream->enqueue(stream->compute, stream->kernel, buf->in, stream->mask, buf->out,
+				width, buf->rows + mask_dim - 1, mask_dim, stream->local_size, &kernel_evt);
+			release_event(&buf->convolved);
+			buf->convolved = kernel_evt;
+			profile_record(kernel_evt, "convolve strip");
+
+			err |= clEnqueueReadBuffer(stream->download, buf->out, CL_FALSE, 0,
+				sizeof(cl_uint) * out_w * buf->rows, buf->host_out, 1, &kernel_evt, &download_evt);
+			release_event(&buf->downloaded);
+			buf->downloaded = download_evt;
+			profile_record(download_evt, "download strip");
+
+			err |= clFlush(stream->upload);
+			err |= clFlush(stream->compute);
+			err |= clFlush(stream->download);
+			if (check_cl_err(err, "failed to enqueue strip")){
+				failed = 1;
+				break;
+			}
+		}
+		//Write out the previous strip while this one is in flight
+		if (s > 0){
+			strip_buf_t *prev = &bufs[(s - 1) % 2];
+			err = clWaitForEvents(1, &prev->downloaded);
+			if (check_cl_err(err, "failed to download strip")){
+				failed = 1;
+			}
+			else if (fwrite(prev->host_out, sizeof(cl_uint), (size_t)out_w * prev->rows, out)
+				!= (size_t)out_w * prev->rows)
+			{
+				fprintf(stderr, "Failed to write output strip %d\n", s - 1);
+				failed = 1;
+			}
+		}
+	}
+	clFinish(stream->upload);
+	clFinish(stream->compute);
+	clFinish(stream->download);
+	for (int i = 0; i < 2; ++i){
+		release_event(&bufs[i].uploaded);
+		release_event(&bufs[i].convolved);
+		release_event(&bufs[i].downloaded);
+		if (bufs[i].in){
+			clReleaseMemObject(bufs[i].in);
+		}
+		if (bufs[i].out){
+			clReleaseMemObject(bufs[i].out);
+		}
+		free(bufs[i].host_in);
+		free(bufs[i].host_out);
+	}
+	return failed;
+}
+
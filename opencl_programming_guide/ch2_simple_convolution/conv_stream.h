@@ -0,0 +1,52 @@
+#ifndef CONV_STREAM_H
+#define CONV_STREAM_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+/*
+ * Enqueue one of the 2D convolution kernels, enqueue_convolve or enqueue_convolve_tiled
+ */
+typedef cl_int (*conv_enqueue_fn)(cl_command_queue queue, cl_kernel kernel, cl_mem in,
+	cl_mem mask, cl_mem out, int width, int height, int mask_dim, const size_t local_size[2],
+	cl_event *evt);
+
+/*
+ * Streaming convolution of an image too big to keep on the device. The input is read in
+ * horizontal strips of strip_rows output rows plus the mask_dim - 1 row halo below them,
+ * and each strip is uploaded, convolved and downloaded on its own queue with double
+ * buffered device memory, so uploading strip N + 1, convolving strip N and downloading
+ * strip N - 1 can all overlap
+ */
+typedef struct conv_stream_t {
+	cl_command_queue upload, compute, download;
+	cl_kernel kernel;
+	conv_enqueue_fn enqueue;
+	cl_mem mask;
+	int width, height, mask_dim;
+	int strip_rows;
+	size_t local_size[2];
+} conv_stream_t;
+
+/*
+ * Pick the number of output rows per strip so the two input and two output strip
+ * buffers take at most budget bytes of device memory, at least one row
+ */
+int convolve_stream_strip_rows(int width, int height, int mask_dim, size_t budget);
+/*
+ * Convolve the width x height image of uints read from in, writing each strip's
+ * (width - mask_dim + 1) wide output rows to out as soon as it's downloaded. Both files
+ * hold the rows top to bottom as raw native endian uints. Only two input and two output
+ * strips are ever held on the host or device
+ * returns 1 on failure
+ */
+int convolve_stream(cl_context context, const conv_stream_t *stream, FILE *in, FILE *out);
+
+#endif
+
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "device.h"
+#include "convolve.h"
+#include "conv_typed.h"
+
+typedef struct type_info_t {
+	const char *name;
+	//The type's name in OpenCL C
+	const char *cl_name;
+	size_t size;
+	int is_float;
+	//Range of the integer types
+	double min, max;
+} type_info_t;
+
+static const type_info_t types[CONV_NUM_TYPES] = {
+	{ "u8", "uchar", 1, 0, 0, 255.0 },
+	{ "u16", "ushort", 2, 0, 0, 65535.0 },
+	{ "u32", "uint", 4, 0, 0, 4294967295.0 },
+	{ "f16", "half", 2, 1, 0, 0 },
+	{ "f32", "float", 4, 1, 0, 0 }
+};
+
+struct conv_typed_t {
+	cl_context context;
+	cl_device_id device;
+	char *src;
+	//Indexed by input type, output type and whether the output saturates
+	cl_program programs[CONV_NUM_TYPES][CONV_NUM_TYPES][2];
+	cl_kernel kernels[CONV_NUM_TYPES][CONV_NUM_TYPES][2];
+};
+
+size_t conv_type_size(conv_type_t type){
+	return types[type].size;
+}
+const char* conv_type_name(conv_type_t type){
+	return types[type].name;
+}
+int conv_type_parse(const char *name){
+	for (int i = 0; i < CONV_NUM_TYPES; ++i){
+		if (strcmp(name, types[i].name) == 0){
+			return i;
+		}
+	}
+	return -1;
+}
+int conv_typed_saturates(conv_type_t in_type, conv_type_t out_type, int saturate){
+	return !types[out_type].is_float && (saturate || types[in_type].is_float);
+}
+void convolve_typed_options(cl_device_id device, conv_type_t in_type, conv_type_t out_type,
+	int saturate, char *options, size_t size)
+{
+	const int float_sum = types[in_type].is_float;
+	const int fp16 = (in_type == CONV_F16 || out_type == CONV_F16)
+		&& device_has_extension(device, "cl_khr_fp16");
+	const int sat = conv_typed_saturates(in_type, out_type, saturate);
+	//Float to integer conversions round to nearest instead of truncating
+	char convert[32];
+	snprintf(convert, sizeof(convert), "convert_%s%s%s", types[out_type].cl_name,
+		sat ? "_sat" : "", sat && float_sum ? "_rte" : "");
+	snprintf(options, size, "-DCONV_IN_T=%s -DCONV_SUM_T=%s -DCONV_OUT_T=%s "
+		"-DCONV_CONVERT_OUT=%s%s%s%s", types[in_type].cl_name, float_sum ? "float" : "int",
+		types[out_type].cl_name, convert, in_type == CONV_F16 ? " -DCONV_IN_HALF" : "",
+		out_type == CONV_F16 ? " -DCONV_OUT_HALF" : "", fp16 ? " -DCONV_FP16" : "");
+}
+void convolve_typed_mask(const cl_uint *mask, int mask_dim, conv_type_t in_type, void *out){
+	for (int i = 0; i < mask_dim * mask_dim; ++i){
+		if (types[in_type].is_float){
+			((cl_float*)out)[i] = (cl_float)(cl_int)mask[i];
+		}
+		else {
+			((cl_int*)out)[i] = (cl_int)mask[i];
+		}
+	}
+}
+void convert_to_type(const cl_uint *values, size_t n, conv_type_t type, int saturate,
+	void *out)
+{
+	const type_info_t *t = &types[type];
+	for (size_t i = 0; i < n; ++i){
+		const double v = (cl_int)values[i];
+		if (type == CONV_F16){
+			((cl_half*)out)[i] = float_to_half((float)v);
+		}
+		else if (type == CONV_F32){
+			((cl_float*)out)[i] = (cl_float)v;
+		}
+		else {
+			//Without saturation the low bits are kept, as the wrapped uint sum has them
+			const cl_uint u = saturate ? (cl_uint)(v < t->min ? t->min : v > t->max ? t->max : v)
+				: values[i];
+			if (type == CONV_U8){
+				((cl_uchar*)out)[i] = (cl_uchar)u;
+			}
+			else if (type == CONV_U16){
+				((cl_ushort*)out)[i] = (cl_ushort)u;
+			}
+			else {
+				((cl_uint*)out)[i] = u;
+			}
+		}
+	}
+}
+conv_typed_t* conv_typed_create(cl_context context, cl_device_id device, const char *src){
+	conv_typed_t *typed = calloc(1, sizeof(conv_typed_t));
+	typed->context = context;
+	typed->device = device;
+	typed->src = malloc(strlen(src) + 1);
+	strcpy(typed->src, src);
+	return typed;
+}
+cl_kernel conv_typed_kernel(conv_typed_t *typed, conv_type_t in_type, conv_type_t out_type,
+	int saturate)
+{
+	const int sat = conv_typed_saturates(in_type, out_type, saturate);
+	cl_kernel *kernel = &typed->kernels[in_type][out_type][sat];
+	if (*kernel){
+		return *kernel;
+	}
+	cl_program *program = &typed->programs[in_type][out_type][sat];
+	if (!*program){
+		char options[256];
+		convolve_typed_options(typed->device, in_type, out_type, saturate, options,
+			sizeof(options));
+		*program = build_program(typed->src, typed->context, typed->device, options);
+		if (!*program){
+			return NULL;
+		}
+	}
+	cl_int err;
+	*kernel = clCreateKernel(*program, "convolve_typed", &err);
+	if (check_cl_err(err, "failed to create typed convolution kernel")){
+		*kernel = NULL;
+	}
+	return *kernel;
+}
+cl_int enqueue_convolve_typed(cl_command_queue queue, conv_typed_t *typed, conv_type_t in_type,
+	conv_type_t out_type, int saturate, cl_mem in, cl_mem mask, cl_mem out, int width,
+	int height, int mask_dim, const size_t local_size[2], cl_event *evt)
+{
+	cl_kernel kernel = conv_typed_kernel(typed, in_type, out_type, saturate);
+	if (!kernel){
+		return CL_BUILD_PROGRAM_FAILURE;
+	}
+	//The variants take the same arguments as convolve
+	return enqueue_convolve(queue, kernel, in, mask, out, width, height, mask_dim, local_size,
+		evt);
+}
+void conv_typed_destroy(conv_typed_t *typed){
+	if (!typed){
+		return;
+	}
+	for (int i = 0; i < CONV_NUM_TYPES; ++i){
+		for (int o = 0; o < CONV_NUM_TYPES; ++o){
+			for (int s = 0; s < 2; ++s){
+				if (typed->kernels[i][o][s]){
+					clReleaseKernel(typed->kernels[i][o][s]);
+				}
+				if (typed->programs[i][o][s]){
+					clReleaseProgram(typed->programs[i][o][s]);
+				}
+			}
+		}
+	}
+	free(typed->src);
+	free(typed);
+}
+
@@ -0,0 +1,90 @@
+#ifndef CONV_TYPED_H
+#define CONV_TYPED_H
+
+#include <stddef.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+/*
+ * Data types the convolve_typed kernel can be built for. Integer inputs are convolved
+ * with an int mask into int sums and half and float inputs with a float mask into float
+ * sums, the output can be any of the types
+ */
+typedef enum conv_type_t {
+	CONV_U8, CONV_U16, CONV_U32, CONV_F16, CONV_F32, CONV_NUM_TYPES
+} conv_type_t;
+
+/*
+ * Get the size of one element of the type in bytes
+ */
+size_t conv_type_size(conv_type_t type);
+/*
+ * Get the short name of the type, u8, u16, u32, f16 or f32
+ */
+const char* conv_type_name(conv_type_t type);
+/*
+ * Look up a type by its short name
+ * returns -1 if the name is unknown
+ */
+int conv_type_parse(const char *name);
+/*
+ * Check if sums are saturated when converted to the output type. Integer outputs saturate
+ * if asked to and always do from float sums, where out of range conversions are undefined
+ * otherwise. Without saturation integer sums wrap around like the uint kernels' do
+ */
+int conv_typed_saturates(conv_type_t in_type, conv_type_t out_type, int saturate);
+/*
+ * Write the build options for the convolve_typed variant reading in_type and writing
+ * out_type, using half directly if the device has cl_khr_fp16 and through vload_half and
+ * vstore_half otherwise
+ */
+void convolve_typed_options(cl_device_id device, conv_type_t in_type, conv_type_t out_type,
+	int saturate, char *options, size_t size);
+/*
+ * Convert the mask to the sum type of the variants reading in_type, out holds mask_dim^2
+ * cl_ints or cl_floats. Entries are treated as signed like mask_separable does
+ */
+void convolve_typed_mask(const cl_uint *mask, int mask_dim, conv_type_t in_type, void *out);
+/*
+ * Convert n values, treated as signed int sums, to the type the way the kernel converts
+ * its sums, for making typed inputs and the expected outputs from convolve_host's.
+ * Results are exact as long as the sums fit in a float's 24 bit mantissa
+ */
+void convert_to_type(const cl_uint *values, size_t n, conv_type_t type, int saturate,
+	void *out);
+
+/*
+ * The convolve_typed variants for a device, each one is built from the source with its
+ * options the first time it's used and kept for later calls
+ */
+typedef struct conv_typed_t conv_typed_t;
+
+/*
+ * Set up building variants of the convolution.cl source for the device
+ */
+conv_typed_t* conv_typed_create(cl_context context, cl_device_id device, const char *src);
+/*
+ * Get the variant reading in_type and writing out_type, building it if needed
+ * returns NULL if it failed to build
+ */
+cl_kernel conv_typed_kernel(conv_typed_t *typed, conv_type_t in_type, conv_type_t out_type,
+	int saturate);
+/*
+ * Convolve with the variant matching the caller's input and output buffers, the mask must
+ * be converted with convolve_typed_mask for in_type. Arguments are as for enqueue_convolve
+ * returns the error code of the first call that failed
+ */
+cl_int enqueue_convolve_typed(cl_command_queue queue, conv_typed_t *typed, conv_type_t in_type,
+	conv_type_t out_type, int saturate, cl_mem in, cl_mem mask, cl_mem out, int width,
+	int height, int mask_dim, const size_t local_size[2], cl_event *evt);
+/*
+ * Release the built variants and free the cache
+ */
+void conv_typed_destroy(conv_typed_t *typed);
+
+#endif
+
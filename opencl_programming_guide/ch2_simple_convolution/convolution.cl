@@ -1,15 +1,325 @@
+/*
+ * Convolve the in_dim.x * in_dim.y input with the mask_dim * mask_dim mask, computing the
+ * "valid" region of in_dim - mask_dim + 1 outputs in each dimension. Each input is read
+ * from global memory once for each mask element it's under
+ */
 __kernel void convolve(const __global uint * const in, __constant uint * const mask,
-	__global uint * const out, const int in_dim, const int mask_dim)
+	__global uint * const out, const int2 in_dim, const int mask_dim)
 {
 	const int2 pos = (int2)(get_global_id(0), get_global_id(1));
+	const int2 out_dim = in_dim - mask_dim + 1;
+	//The global size is padded to a multiple of the local size so check we're in the output
+	if (pos.x >= out_dim.x || pos.y >= out_dim.y){
+		return;
+	}
 	uint sum = 0;
 	for (int r = 0; r < mask_dim; ++r){
 		//Find the location of the top-left corner of the mask in the signal
-		const int idx = (pos.y + r) * in_dim + pos.x;
+		const int idx = (pos.y + r) * in_dim.x + pos.x;
 		for (int c = 0; c < mask_dim; ++c){
 			sum += mask[r * mask_dim + c] * in[idx + c];
 		}
 	}
-	out[pos.y * get_global_size(0) + pos.x] = sum;
+	out[pos.y * out_dim.x + pos.x] = sum;
+}
+/*
+ * Same as convolve but each work-group first loads the input under its block of outputs,
+ * plus the mask_dim - 1 halo to the right and below, into local memory and computes the
+ * outputs from that tile so each input is only read from global memory about once.
+ * tile must be (local_size.x + mask_dim - 1) * (local_size.y + mask_dim - 1) uints
+ */
+__kernel void convolve_tiled(const __global uint * const in, __constant uint * const mask,
+	__global uint * const out, const int2 in_dim, const int mask_dim, __local uint *tile)
+{
+	const int2 pos = (int2)(get_global_id(0), get_global_id(1));
+	const int2 lid = (int2)(get_local_id(0), get_local_id(1));
+	const int2 lsize = (int2)(get_local_size(0), get_local_size(1));
+	const int2 origin = (int2)(get_group_id(0), get_group_id(1)) * lsize;
+	const int2 out_dim = in_dim - mask_dim + 1;
+	const int2 tile_dim = lsize + mask_dim - 1;
+
+	//Stride over the tile with the work-group, inputs past the edge of the image are
+	//only under outputs we don't compute so just fill them with 0
+	for (int y = lid.y; y < tile_dim.y; y += lsize.y){
+		const int in_y = origin.y + y;
+		for (int x = lid.x; x < tile_dim.x; x += lsize.x){
+			const int in_x = origin.x + x;
+			tile[y * tile_dim.x + x] = in_x < in_dim.x && in_y < in_dim.y
+				? in[in_y * in_dim.x + in_x] : 0;
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//Everyone has to hit the barrier so we can only drop out of edge tiles after loading
+	if (pos.x >= out_dim.x || pos.y >= out_dim.y){
+		return;
+	}
+	uint sum = 0;
+	for (int r = 0; r < mask_dim; ++r){
+		const int idx = (lid.y + r) * tile_dim.x + lid.x;
+		for (int c = 0; c < mask_dim; ++c){
+			sum += mask[r * mask_dim + c] * tile[idx + c];
+		}
+	}
+	out[pos.y * out_dim.x + pos.x] = sum;
+}
+/*
+ * First pass of a separable convolution, convolve each row of the input with the
+ * mask_dim row vector giving an (in_dim.x - mask_dim + 1) * in_dim.y intermediate
+ */
+__kernel void convolve_rows(const __global uint * const in, __constant uint * const row,
+	__global uint * const tmp, const int2 in_dim, const int mask_dim)
+{
+	const int2 pos = (int2)(get_global_id(0), get_global_id(1));
+	const int tmp_w = in_dim.x - mask_dim + 1;
+	if (pos.x >= tmp_w || pos.y >= in_dim.y){
+		return;
+	}
+	const int idx = pos.y * in_dim.x + pos.x;
+	uint sum = 0;
+	for (int c = 0; c < mask_dim; ++c){
+		sum += row[c] * in[idx + c];
+	}
+	tmp[pos.y * tmp_w + pos.x] = sum;
+}
+/*
+ * Second pass of a separable convolution, convolve each column of the intermediate
+ * from convolve_rows with the mask_dim column vector. in_dim is the size of the
+ * original input, the output is the same valid region as convolve gives
+ */
+__kernel void convolve_cols(const __global uint * const tmp, __constant uint * const col,
+	__global uint * const out, const int2 in_dim, const int mask_dim)
+{
+	const int2 pos = (int2)(get_global_id(0), get_global_id(1));
+	const int2 out_dim = in_dim - mask_dim + 1;
+	if (pos.x >= out_dim.x || pos.y >= out_dim.y){
+		return;
+	}
+	uint sum = 0;
+	for (int r = 0; r < mask_dim; ++r){
+		sum += col[r] * tmp[(pos.y + r) * out_dim.x + pos.x];
+	}
+	out[pos.y * out_dim.x + pos.x] = sum;
+}
+/*
+ * One job of a batch, offsets are in uints from the start of the input, output and mask
+ * arenas. Matches conv_batch_job_t in conv_batch.h
+ */
+typedef struct conv_batch_job_t {
+	int in_offset, out_offset, mask_offset;
+	int width, height, mask_dim;
+} conv_batch_job_t;
+/*
+ * Convolve a batch of images packed one after another in shared arenas, each with its
+ * own size and mask. The third dimension of the global size is the index of the job in
+ * the jobs table and the first two cover the largest output in the batch, so work-items
+ * past the edge of a smaller job's output drop out
+ */
+__kernel void convolve_batch(const __global uint * const in, const __global uint * const masks,
+	__global uint * const out, const __global conv_batch_job_t * const jobs)
+{
+	const conv_batch_job_t job = jobs[get_global_id(2)];
+	const int2 pos = (int2)(get_global_id(0), get_global_id(1));
+	const int2 out_dim = (int2)(job.width, job.height) - job.mask_dim + 1;
+	if (pos.x >= out_dim.x || pos.y >= out_dim.y){
+		return;
+	}
+	const __global uint *signal = in + job.in_offset;
+	const __global uint *mask = masks + job.mask_offset;
+	uint sum = 0;
+	for (int r = 0; r < job.mask_dim; ++r){
+		const int idx = (pos.y + r) * job.width + pos.x;
+		for (int c = 0; c < job.mask_dim; ++c){
+			sum += mask[r * job.mask_dim + c] * signal[idx + c];
+		}
+	}
+	out[job.out_offset + pos.y * out_dim.x + pos.x] = sum;
+}
+
+/*
+ * Complex helpers for the FFT kernels, values are (real, imaginary) float2s
+ */
+float2 cmul(const float2 a, const float2 b){
+	return (float2)(a.x * b.x - a.y * b.y, a.x * b.y + a.y * b.x);
+}
+float2 twiddle(const float angle){
+	float c;
+	const float s = sincos(angle, &c);
+	return (float2)(c, s);
+}
+/*
+ * Copy the tiles for overlap-save FFT convolution into complex tiles of n x n floats, the
+ * third dimension is the tile index from first_tile. Tiles start every stride inputs and
+ * overlap by n - stride, which must be at least mask_dim - 1, inputs past the edge are 0
+ */
+__kernel void fft_load_tiles(const __global uint * const in, __global float2 * const tiles,
+	const int2 in_dim, const int n, const int stride, const int tiles_x, const int first_tile)
+{
+	const int2 pos = (int2)(get_global_id(0), get_global_id(1));
+	const int tile = first_tile + get_global_id(2);
+	const int2 src = (int2)(tile % tiles_x, tile / tiles_x) * stride + pos;
+	const float v = src.x < in_dim.x && src.y < in_dim.y ? in[src.y * in_dim.x + src.x] : 0;
+	tiles[get_global_id(2) * n * n + pos.y * n + pos.x] = (float2)(v, 0);
 }
+/*
+ * FFT of lines of n complex values in square n x n tiles, n a power of two of at least 4.
+ * Each work-group transforms one line with n / 4 work-items, the line index is the second
+ * dimension. The lines are the rows of the tiles when line_stride is n and elem_stride 1,
+ * or the columns when line_stride is 1 and elem_stride n. sign is -1 for the forward
+ * transform and 1 for the unscaled inverse. The line is copied to local memory and
+ * transformed with the Stockham auto-sort algorithm in radix-4 passes, with a radix-2 pass
+ * first if n is an odd power of two. buf must be 2 * n float2s
+ */
+__kernel void fft_lines(__global float2 * const data, const int n, const int line_stride,
+	const int elem_stride, const float sign, __local float2 *buf)
+{
+	const int lid = get_local_id(0);
+	const int quarter = get_local_size(0);
+	const int l = get_global_id(1);
+	__global float2 *line = data + (l / n) * n * n + (l % n) * line_stride;
+	__local float2 *src = buf;
+	__local float2 *dst = buf + n;
+	for (int i = lid; i < n; i += quarter){
+		src[i] = line[i * elem_stride];
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
 
+	int ns = 1;
+	if (popcount(n - 1) & 1){
+		//The first pass has no twiddles, each work-item does two of the n / 2 butterflies
+		for (int j = lid; j < n / 2; j += quarter){
+			const float2 a = src[j];
+			const float2 b = src[j + n / 2];
+			dst[2 * j] = a + b;
+			dst[2 * j + 1] = a - b;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+		__local float2 *tmp = src;
+		src = dst;
+		dst = tmp;
+		ns = 2;
+	}
+	for (; ns < n; ns *= 4){
+		const int k = lid & (ns - 1);
+		const float angle = sign * 2 * M_PI_F * k / (ns * 4);
+		const float2 v0 = src[lid];
+		const float2 v1 = cmul(src[lid + quarter], twiddle(angle));
+		const float2 v2 = cmul(src[lid + 2 * quarter], twiddle(2 * angle));
+		const float2 v3 = cmul(src[lid + 3 * quarter], twiddle(3 * angle));
+		const float2 a0 = v0 + v2;
+		const float2 a1 = v0 - v2;
+		const float2 a2 = v1 + v3;
+		//(v1 - v3) turned by a quarter the way the transform goes
+		const float2 a3 = sign * (float2)(v3.y - v1.y, v1.x - v3.x);
+		const int idx = (lid / ns) * ns * 4 + k;
+		dst[idx] = a0 + a2;
+		dst[idx + ns] = a1 + a3;
+		dst[idx + 2 * ns] = a0 - a2;
+		dst[idx + 3 * ns] = a1 - a3;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		__local float2 *tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+	for (int i = lid; i < n; i += quarter){
+		line[i * elem_stride] = src[i];
+	}
+}
+/*
+ * Multiply each of the tiles' spectra by the mask's, the first dimension is the element
+ * and the second the tile. scale is applied too, to normalize the inverse transform
+ */
+__kernel void fft_multiply(__global float2 * const tiles, const __global float2 * const mask,
+	const float scale)
+{
+	const int i = get_global_id(0);
+	const int t = get_global_id(1) * get_global_size(0) + i;
+	tiles[t] = cmul(tiles[t], mask[i]) * scale;
+}
+/*
+ * Write out the valid stride x stride block of outputs of each tile after the inverse
+ * transform, the tile's circular convolution with the flipped mask wraps around in its
+ * first mask_dim - 1 rows and columns so they're skipped. Outputs are rounded to the
+ * nearest integer, negative sums wrap around like the integer kernels' do
+ */
+__kernel void fft_store_tiles(const __global float2 * const tiles, __global uint * const out,
+	const int2 in_dim, const int mask_dim, const int n, const int stride, const int tiles_x,
+	const int first_tile)
+{
+	const int2 pos = (int2)(get_global_id(0), get_global_id(1));
+	const int tile = first_tile + get_global_id(2);
+	const int2 dst = (int2)(tile % tiles_x, tile / tiles_x) * stride + pos;
+	const int2 out_dim = in_dim - mask_dim + 1;
+	if (dst.x >= out_dim.x || dst.y >= out_dim.y){
+		return;
+	}
+	const float v = tiles[get_global_id(2) * n * n + (pos.y + mask_dim - 1) * n + pos.x
+		+ mask_dim - 1].x;
+	out[dst.y * out_dim.x + dst.x] = (uint)convert_int_rte(v);
+}
+/*
+ * Convolve the input image with the mask centered on each pixel, starting mask_dim / 2
+ * before it, writing a same size output image. Reads outside the input are handled by the
+ * sampler's addressing mode, so the border is zero, clamped, repeated or mirrored without
+ * padding the input. Coordinates are normalized since the repeat and mirror modes need them
+ */
+__kernel void convolve_image(__read_only image2d_t in, __constant uint * const mask,
+	__write_only image2d_t out, const int mask_dim, const sampler_t sampler)
+{
+	const int2 pos = (int2)(get_global_id(0), get_global_id(1));
+	const int2 dim = get_image_dim(in);
+	if (pos.x >= dim.x || pos.y >= dim.y){
+		return;
+	}
+	//Sample at pixel centers so nearest filtering lands on the pixel we want
+	const float2 inv_dim = 1.0f / convert_float2(dim);
+	const int2 corner = pos - mask_dim / 2;
+	uint sum = 0;
+	for (int r = 0; r < mask_dim; ++r){
+		for (int c = 0; c < mask_dim; ++c){
+			const float2 coord = (convert_float2(corner + (int2)(c, r)) + 0.5f) * inv_dim;
+			sum += mask[r * mask_dim + c] * read_imageui(in, sampler, coord).x;
+		}
+	}
+	write_imageui(out, pos, (uint4)(sum, 0, 0, 0));
+}
+#ifdef CONV_IN_T
+#ifdef CONV_FP16
+#pragma OPENCL EXTENSION cl_khr_fp16 : enable
+#endif
+//Half data goes through vload_half and vstore_half unless the device has cl_khr_fp16
+#if defined(CONV_IN_HALF) && !defined(CONV_FP16)
+#define CONV_LOAD(p, i) vload_half(i, p)
+#else
+#define CONV_LOAD(p, i) ((CONV_SUM_T)(p)[i])
+#endif
+#if defined(CONV_OUT_HALF) && !defined(CONV_FP16)
+#define CONV_STORE(p, i, v) vstore_half((float)(v), i, p)
+#else
+#define CONV_STORE(p, i, v) ((p)[i] = CONV_CONVERT_OUT(v))
+#endif
+/*
+ * convolve built for other data types, only compiled when the build options from
+ * convolve_typed_options pick the input, sum and output types. The mask is the sum type,
+ * int for integer inputs and float for half and float ones, and CONV_CONVERT_OUT turns the
+ * sums into outputs, saturating or not
+ */
+__kernel void convolve_typed(const __global CONV_IN_T * const in,
+	__constant CONV_SUM_T * const mask, __global CONV_OUT_T * const out, const int2 in_dim,
+	const int mask_dim)
+{
+	const int2 pos = (int2)(get_global_id(0), get_global_id(1));
+	const int2 out_dim = in_dim - mask_dim + 1;
+	if (pos.x >= out_dim.x || pos.y >= out_dim.y){
+		return;
+	}
+	CONV_SUM_T sum = 0;
+	for (int r = 0; r < mask_dim; ++r){
+		const int idx = (pos.y + r) * in_dim.x + pos.x;
+		for (int c = 0; c < mask_dim; ++c){
+			sum += mask[r * mask_dim + c] * CONV_LOAD(in, idx + c);
+		}
+	}
+	CONV_STORE(out, pos.y * out_dim.x + pos.x, sum);
+}
+#endif
@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "convolve.h"
+
+#define MAX_TILE_LOCAL 16
+//Smallest and largest FFT tiles the cost model considers
+#define MIN_FFT_TILE 16
+#define MAX_FFT_TILE 512
+//Flops counted for each sincos fft_lines does for its twiddles, a range reduction and a
+//short polynomial for each of sin and cos
+#define SINCOS_FLOPS 20
+
+void convolve_host(const cl_uint *in, int width, int height, const cl_uint *mask,
+	int mask_dim, cl_uint *out)
+{
+	const int out_w = CONV_OUT_DIM(width, mask_dim), out_h = CONV_OUT_DIM(height, mask_dim);
+	for (int y = 0; y < out_h; ++y){
+		for (int x = 0; x < out_w; ++x){
+			cl_uint sum = 0;
+			for (int r = 0; r < mask_dim; ++r){
+				const cl_uint *row = in + (size_t)(y + r) * width + x;
+				for (int c = 0; c < mask_dim; ++c){
+					sum += mask[r * mask_dim + c] * row[c];
+				}
+			}
+			out[(size_t)y * out_w + x] = sum;
+		}
+	}
+}
+//Set the arguments shared by all the kernels and get the padded output global size
+static cl_int set_conv_args(cl_kernel kernel, cl_mem in, cl_mem mask, cl_mem out, int width,
+	int height, int mask_dim, const size_t local_size[2], size_t global_size[2])
+{
+	cl_int2 in_dim = {{ width, height }};
+	cl_int err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &in);
+	err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &mask);
+	err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &out);
+	err |= clSetKernelArg(kernel, 3, sizeof(cl_int2), &in_dim);
+	err |= clSetKernelArg(kernel, 4, sizeof(cl_int), &mask_dim);
+	global_size[0] = round_up(CONV_OUT_DIM(width, mask_dim), local_size[0]);
+	global_size[1] = round_up(CONV_OUT_DIM(height, mask_dim), local_size[1]);
+	return err;
+}
+cl_int enqueue_convolve(cl_command_queue queue, cl_kernel kernel, cl_mem in, cl_mem mask,
+	cl_mem out, int width, int height, int mask_dim, const size_t local_size[2], cl_event *evt)
+{
+	size_t global_size[2];
+	cl_int err = set_conv_args(kernel, in, mask, out, width, height, mask_dim, local_size,
+		global_size);
+	if (err != CL_SUCCESS){
+		return err;
+	}
+	return clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global_size, local_size, 0, NULL, evt);
+}
+cl_int enqueue_convolve_tiled(cl_command_queue queue, cl_kernel kernel, cl_mem in, cl_mem mask,
+	cl_mem out, int width, int height, int mask_dim, const size_t local_size[2], cl_event *evt)
+{
+	size_t global_size[2];
+	cl_int err = set_conv_args(kernel, in, mask, out, width, height, mask_dim, local_size,
+		global_size);
+	size_t tile_bytes = (local_size[0] + mask_dim - 1) * (local_size[1] + mask_dim - 1)
+		* sizeof(cl_uint);
+	err |= clSetKernelArg(kernel, 5, tile_bytes, NULL);
+	if (err != CL_SUCCESS){
+		return err;
+	}
+	return clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global_size, local_size, 0, NULL, evt);
+}
+static long long gcd(long long a, long long b){
+	a = a < 0 ? -a : a;
+	b = b < 0 ? -b : b;
+	while (b){
+		long long t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+int mask_separable(const cl_uint *mask, int mask_dim, cl_uint *row, cl_uint *col){
+	//Take the first row with a non-zero entry, divided by the gcd of its entries, as the
+	//row vector. If the mask has integer factors this one will have them too
+	int r0 = -1, c0 = -1;
+	for (int i = 0; i < mask_dim * mask_dim && r0 < 0; ++i){
+		if (mask[i] != 0){
+			r0 = i / mask_dim;
+			c0 = i % mask_dim;
+		}
+	}
+	if (r0 < 0){
+		for (int i = 0; i < mask_dim; ++i){
+			row[i] = 0;
+			col[i] = 1;
+		}
+		return 1;
+	}
+	long long g = 0;
+	for (int c = 0; c < mask_dim; ++c){
+		g = gcd(g, (cl_int)mask[r0 * mask_dim + c]);
+	}
+	for (int c = 0; c < mask_dim; ++c){
+		row[c] = (cl_uint)((cl_int)mask[r0 * mask_dim + c] / g);
+	}
+	const long long pivot = (cl_int)row[c0];
+	for (int r = 0; r < mask_dim; ++r){
+		const long long m = (cl_int)mask[r * mask_dim + c0];
+		if (m % pivot != 0){
+			return 0;
+		}
+		col[r] = (cl_uint)(m / pivot);
+		for (int c = 0; c < mask_dim; ++c){
+			if ((long long)(cl_int)col[r] * (cl_int)row[c] != (cl_int)mask[r * mask_dim + c]){
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+cl_int enqueue_convolve_separable(cl_command_queue queue, cl_kernel rows_kernel,
+	cl_kernel cols_kernel, cl_mem in, cl_mem row, cl_mem col, cl_mem tmp, cl_mem out,
+	int width, int height, int mask_dim, const size_t local_size[2], cl_event *evt)
+{
+	size_t global_size[2];
+	cl_int err = set_conv_args(rows_kernel, in, row, tmp, width, height, mask_dim, local_size,
+		global_size);
+	if (err != CL_SUCCESS){
+		return err;
+	}
+	//The row pass produces every row of the input, not just the valid ones
+	global_size[1] = round_up(height, local_size[1]);
+	err = clEnqueueNDRangeKernel(queue, rows_kernel, 2, NULL, global_size, local_size, 0,
+		NULL, NULL);
+	if (err != CL_SUCCESS){
+		return err;
+	}
+	err = set_conv_args(cols_kernel, tmp, col, out, width, height, mask_dim, local_size,
+		global_size);
+	if (err != CL_SUCCESS){
+		return err;
+	}
+	return clEnqueueNDRangeKernel(queue, cols_kernel, 2, NULL, global_size, local_size, 0,
+		NULL, evt);
+}
+int convolve_tiled_local_size(cl_kernel kernel, cl_device_id device, int mask_dim,
+	size_t local_size[2])
+{
+	size_t max_group;
+	cl_ulong local_mem, kernel_local_mem;
+	cl_int err = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+		sizeof(max_group), &max_group, NULL);
+	err |= clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_LOCAL_MEM_SIZE,
+		sizeof(kernel_local_mem), &kernel_local_mem, NULL);
+	err |= clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_mem), &local_mem, NULL);
+	if (check_cl_err(err, "failed to query tiled kernel limits")){
+		return 1;
+	}
+	for (size_t n = MAX_TILE_LOCAL; n > 0; n /= 2){
+		size_t tile_bytes = (n + mask_dim - 1) * (n + mask_dim - 1) * sizeof(cl_uint);
+		if (n * n <= max_group && tile_bytes + kernel_local_mem <= local_mem){
+			local_size[0] = n;
+			local_size[1] = n;
+			return 0;
+		}
+	}
+	return 1;
+}
+double convolve_global_reads(int width, int height, int mask_dim){
+	return (double)CONV_OUT_DIM(width, mask_dim) * CONV_OUT_DIM(height, mask_dim)
+		* mask_dim * mask_dim;
+}
+//Sum of the in-bounds extents of the tiles along one dimension
+static double tile_extent(int in_dim, int out_dim, int mask_dim, size_t local){
+	double total = 0;
+	for (size_t origin = 0; origin < (size_t)out_dim; origin += local){
+		size_t extent = local + mask_dim - 1;
+		if (origin + extent > (size_t)in_dim){
+			extent = in_dim - origin;
+		}
+		total += extent;
+	}
+	return total;
+}
+double convolve_tiled_global_reads(int width, int height, int mask_dim,
+	const size_t local_size[2])
+{
+	//Tile loads are separable, each column of tiles reads the same rows
+	return tile_extent(width, CONV_OUT_DIM(width, mask_dim), mask_dim, local_size[0])
+		* tile_extent(height, CONV_OUT_DIM(height, mask_dim), mask_dim, local_size[1]);
+}
+
+/*
+ * Flops fft_lines does to transform one line of n = 2^log_n values. Each radix-4 butterfly
+ * works out its three twiddle angles (7) and their sincos, three complex products (18),
+ * seven complex adds (14) and the signed quarter turn (4). Each radix-2 butterfly is two
+ * complex adds
+ */
+static double fft_line_flops(int n, int log_n){
+	const int radix2 = log_n & 1;
+	const int radix4_passes = (log_n - radix2) / 2;
+	const double radix4 = 7 + 3 * SINCOS_FLOPS + 18 + 14 + 4;
+	return n / 4.0 * radix4_passes * radix4 + radix2 * n / 2.0 * 4;
+}
+double convolve_direct_cost(int mask_dim){
+	return 2.0 * mask_dim * mask_dim;
+}
+double convolve_separable_cost(int mask_dim){
+	return 4.0 * mask_dim;
+}
+double convolve_fft_cost(int width, int height, int mask_dim, int *tile_dim){
+	const int out_w = CONV_OUT_DIM(width, mask_dim), out_h = CONV_OUT_DIM(height, mask_dim);
+	double best = -1;
+	*tile_dim = 0;
+	for (int n = MIN_FFT_TILE, log_n = 4; n <= MAX_FFT_TILE; n *= 2, ++log_n){
+		const int stride = n - mask_dim + 1;
+		if (stride < 1){
+			continue;
+		}
+		//A 2D transform is 2n lines, done forward and inverse, plus the scaled complex
+		//product of every element
+		const double tile_flops = 2 * 2.0 * n * fft_line_flops(n, log_n) + 8.0 * n * n;
+		const double tiles = (double)((out_w + stride - 1) / stride)
+			* ((out_h + stride - 1) / stride);
+		const double cost = tile_flops * tiles / ((double)out_w * out_h);
+		if (best < 0 || cost < best){
+			best = cost;
+			*tile_dim = n;
+		}
+	}
+	return best;
+}
+conv_method_t convolve_pick_method(int width, int height, int mask_dim, int separable,
+	int *tile_dim)
+{
+	conv_method_t method = CONV_DIRECT;
+	double best = convolve_direct_cost(mask_dim);
+	if (separable && convolve_separable_cost(mask_dim) < best){
+		method = CONV_SEPARABLE;
+		best = convolve_separable_cost(mask_dim);
+	}
+	const double fft = convolve_fft_cost(width, height, mask_dim, tile_dim);
+	if (fft >= 0 && fft < best){
+		method = CONV_FFT;
+	}
+	return method;
+}
+const char* conv_method_name(conv_method_t method){
+	static const char *names[3] = { "direct", "separable", "fft" };
+	return names[method];
+}
+const char* conv_method_kernel(conv_method_t method){
+	static const char *kernels[3] = { "convolve_tiled", "convolve_separable", "convolve_fft" };
+	return kernels[method];
+}
+
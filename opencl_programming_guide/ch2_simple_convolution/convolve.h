@@ -0,0 +1,113 @@
+#ifndef CONVOLVE_H
+#define CONVOLVE_H
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "thread_pool.h"
+
+/*
+ * Host side helpers for the kernels in convolution.cl. All of them compute the "valid"
+ * region of the convolution, so a width x height input convolved with a mask_dim x mask_dim
+ * mask gives a (width - mask_dim + 1) x (height - mask_dim + 1) output
+ */
+#define CONV_OUT_DIM(in, mask) ((in) - (mask) + 1)
+
+/*
+ * The ways the host driver can run a convolution, the direct kernels, the two 1D passes
+ * for separable masks or overlap-save FFT convolution from conv_fft.h
+ */
+typedef enum conv_method_t { CONV_DIRECT, CONV_SEPARABLE, CONV_FFT } conv_method_t;
+
+/*
+ * Convolve the input with the mask on the host, for checking the kernels' results
+ */
+void convolve_host(const cl_uint *in, int width, int height, const cl_uint *mask,
+	int mask_dim, cl_uint *out);
+/*
+ * The host backend's convolution, for when there's no OpenCL device and as a native
+ * baseline for the kernels. Rows are split across the pool's threads, or run on the
+ * caller if pool is NULL, and each row is done 8 pixels at a time with AVX2 or SSE4.1
+ * as simd_level picks. The result is the same as convolve_host
+ */
+void convolve_host_simd(thread_pool_t *pool, const cl_uint *in, int width, int height,
+	const cl_uint *mask, int mask_dim, cl_uint *out);
+/*
+ * Set the arguments for the convolve kernel and enqueue it, the global size is padded
+ * up to a multiple of local_size. evt may be NULL
+ * returns the error code of the first call that failed
+ */
+cl_int enqueue_convolve(cl_command_queue queue, cl_kernel kernel, cl_mem in, cl_mem mask,
+	cl_mem out, int width, int height, int mask_dim, const size_t local_size[2], cl_event *evt);
+/*
+ * Set the arguments for the convolve_tiled kernel, including its local memory tile, and
+ * enqueue it, the global size is padded up to a multiple of local_size. evt may be NULL
+ * returns the error code of the first call that failed
+ */
+cl_int enqueue_convolve_tiled(cl_command_queue queue, cl_kernel kernel, cl_mem in, cl_mem mask,
+	cl_mem out, int width, int height, int mask_dim, const size_t local_size[2], cl_event *evt);
+/*
+ * Pick the local size for the tiled kernel on the device, the largest square block up to
+ * 16x16 whose tile fits in local memory and the kernel's work-group size limit
+ * returns 1 if no size fits
+ */
+int convolve_tiled_local_size(cl_kernel kernel, cl_device_id device, int mask_dim,
+	size_t local_size[2]);
+/*
+ * Check if the mask is rank-1, ie. mask[r][c] == col[r] * row[c] for some integer vectors,
+ * treating the entries as signed so masks like Sobel are found too. If it is the factors
+ * are written to row and col, which must hold mask_dim entries each
+ * returns 1 if the mask is separable
+ */
+int mask_separable(const cl_uint *mask, int mask_dim, cl_uint *row, cl_uint *col);
+/*
+ * Enqueue the two passes of a separable convolution, convolve_rows with the row vector
+ * into tmp and then convolve_cols with the column vector into out. tmp must hold
+ * (width - mask_dim + 1) * height uints. evt may be NULL and is set for the second pass
+ * returns the error code of the first call that failed
+ */
+cl_int enqueue_convolve_separable(cl_command_queue queue, cl_kernel rows_kernel,
+	cl_kernel cols_kernel, cl_mem in, cl_mem row, cl_mem col, cl_mem tmp, cl_mem out,
+	int width, int height, int mask_dim, const size_t local_size[2], cl_event *evt);
+/*
+ * Number of input elements read from global memory by the convolve kernel
+ */
+double convolve_global_reads(int width, int height, int mask_dim);
+/*
+ * Number of input elements read from global memory by the convolve_tiled kernel
+ * with the local size passed
+ */
+double convolve_tiled_global_reads(int width, int height, int mask_dim,
+	const size_t local_size[2]);
+/*
+ * Estimated cost per output of each method in flops. Direct and separable are their
+ * multiply-adds, FFT is the flops the fft_lines kernel does for the forward and inverse
+ * transforms plus the product of each tile spread over its valid outputs, so it falls
+ * with mask size as long as the tiles are big enough. The FFT cost is for the power of
+ * two tile size up to 512 with the lowest cost, written to tile_dim
+ * returns -1 from convolve_fft_cost if the mask is too big for any tile
+ */
+double convolve_direct_cost(int mask_dim);
+double convolve_separable_cost(int mask_dim);
+double convolve_fft_cost(int width, int height, int mask_dim, int *tile_dim);
+/*
+ * Pick the method with the lowest estimated cost, only picking separable if the mask is.
+ * tile_dim is set to the FFT tile size to use if FFT is picked
+ */
+conv_method_t convolve_pick_method(int width, int height, int mask_dim, int separable,
+	int *tile_dim);
+/*
+ * Get the name of the method: direct, separable or fft
+ */
+const char* conv_method_name(conv_method_t method);
+/*
+ * Get the name of the kernel the driver runs for the method, the direct method runs
+ * convolve_tiled
+ */
+const char* conv_method_kernel(conv_method_t method);
+
+#endif
+
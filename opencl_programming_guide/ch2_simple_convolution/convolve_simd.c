@@ -0,0 +1,120 @@
+#include <stdlib.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "simd.h"
+#include "thread_pool.h"
+#include "convolve.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86_SIMD
+#include <immintrin.h>
+#endif
+
+//Output rows handed to a thread at a time
+#define ROW_GRAIN 4
+
+typedef struct conv_rows_t {
+	const cl_uint *in, *mask;
+	cl_uint *out;
+	int width, mask_dim, out_w;
+	simd_level_t level;
+} conv_rows_t;
+
+//Convolve output row y from pixel x on one pixel at a time, for what the vectors don't cover
+static void conv_row_scalar(const conv_rows_t *c, int y, int x){
+	for (; x < c->out_w; ++x){
+		cl_uint sum = 0;
+		for (int r = 0; r < c->mask_dim; ++r){
+			const cl_uint *row = c->in + (size_t)(y + r) * c->width + x;
+			for (int k = 0; k < c->mask_dim; ++k){
+				sum += c->mask[r * c->mask_dim + k] * row[k];
+			}
+		}
+		c->out[(size_t)y * c->out_w + x] = sum;
+	}
+}
+#ifdef X86_SIMD
+//8 output pixels at a time, each mask entry is multiplied across 8 neighbouring inputs
+__attribute__((target("avx2")))
+static void conv_row_avx2(const conv_rows_t *c, int y){
+	cl_uint *out = c->out + (size_t)y * c->out_w;
+	int x = 0;
+	for (; x + 8 <= c->out_w; x += 8){
+		__m256i sum = _mm256_setzero_si256();
+		for (int r = 0; r < c->mask_dim; ++r){
+			const cl_uint *row = c->in + (size_t)(y + r) * c->width + x;
+			for (int k = 0; k < c->mask_dim; ++k){
+				__m256i m = _mm256_set1_epi32((int)c->mask[r * c->mask_dim + k]);
+				__m256i v = _mm256_loadu_si256((const __m256i*)(row + k));
+				sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(v, m));
+			}
+		}
+		_mm256_storeu_si256((__m256i*)(out + x), sum);
+	}
+	conv_row_scalar(c, y, x);
+}
+//The same 8 pixels at a time as two halves, SSE4.1 is needed for the 32 bit multiply
+__attribute__((target("sse4.1")))
+static void conv_row_sse41(const conv_rows_t *c, int y){
+	cl_uint *out = c->out + (size_t)y * c->out_w;
+	int x = 0;
+	for (; x + 8 <= c->out_w; x += 8){
+		__m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+		for (int r = 0; r < c->mask_dim; ++r){
+			const cl_uint *row = c->in + (size_t)(y + r) * c->width + x;
+			for (int k = 0; k < c->mask_dim; ++k){
+				__m128i m = _mm_set1_epi32((int)c->mask[r * c->mask_dim + k]);
+				__m128i v_lo = _mm_loadu_si128((const __m128i*)(row + k));
+				__m128i v_hi = _mm_loadu_si128((const __m128i*)(row + k + 4));
+				lo = _mm_add_epi32(lo, _mm_mullo_epi32(v_lo, m));
+				hi = _mm_add_epi32(hi, _mm_mullo_epi32(v_hi, m));
+			}
+		}
+		_mm_storeu_si128((__m128i*)(out + x), lo);
+		_mm_storeu_si128((__m128i*)(out + x + 4), hi);
+	}
+	conv_row_scalar(c, y, x);
+}
+#endif
+static void conv_rows(void *arg, size_t begin, size_t end){
+	const conv_rows_t *c = arg;
+	for (size_t y = begin; y < end; ++y){
+#ifdef X86_SIMD
+		if (c->level == SIMD_AVX2){
+			conv_row_avx2(c, y);
+			continue;
+		}
+		if (c->level == SIMD_SSE41){
+			conv_row_sse41(c, y);
+			continue;
+		}
+#endif
+		conv_row_scalar(c, y, 0);
+	}
+}
+void convolve_host_simd(thread_pool_t *pool, const cl_uint *in, int width, int height,
+	const cl_uint *mask, int mask_dim, cl_uint *out)
+{
+	conv_rows_t c = {
+		.in = in,
+		.mask = mask,
+		.out = out,
+		.width = width,
+		.mask_dim = mask_dim,
+		.out_w = CONV_OUT_DIM(width, mask_dim),
+		.level = simd_level()
+	};
+	const size_t out_h = CONV_OUT_DIM(height, mask_dim);
+	if (pool){
+		thread_pool_run(pool, out_h, ROW_GRAIN, conv_rows, &c);
+	}
+	else {
+		conv_rows(&c, 0, out_h);
+	}
+}
+
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef __APPLE__
 #include <OpenCL/cl.h>
@@ -8,187 +9,1158 @@
 #endif
 
 #include "util.h"
+#include "device.h"
+#include "profile.h"
+#include "prog_cache.h"
+#include "convolve.h"
+#include "conv_stream.h"
+#include "conv_batch.h"
+#include "conv_fft.h"
+#include "conv_typed.h"
+#include "conv_image.h"
+#include "thread_pool.h"
+#include "tune.h"
 #include "cl_program_dir.h"
 
-#define IN_DIM 8
-#define MASK_DIM 3
-#define OUT_DIM 6
+#define DEMO_DIM 8
+#define DEMO_MASK_DIM 3
+//Number of timed runs of each kernel, the fastest is reported
+#define RUNS 5
+//Only print results small enough to read
+#define PRINT_MAX_DIM 16
+//Device memory for the strip buffers in streaming mode
+#define STREAM_BUDGET (64 * 1024 * 1024)
+//Only check streamed results against the host if the whole input fits in this many uints
+#define STREAM_CHECK_MAX (1 << 26)
+//Jobs per batch in batch mode if no window is given
+#define BATCH_WINDOW 64
+//Longest path in a batch job descriptor
+#define BATCH_PATH_MAX 1024
 
-//Select the first available OpenCL platform and make a context on it
-cl_context get_first_platform();
-//Select the first platform with the desired device type
-cl_context get_platform(cl_device_type type);
-//OpenCL callback for reporting errors in the context
-void CL_CALLBACK cl_err_callback(const char *err_info, const void *priv_info, size_t cb, void *user);
-//Select the first available device and set it and its command queue up
-cl_command_queue get_first_device(cl_context context, cl_device_id *device);
+//Everything needed to enqueue one of the convolution methods
+typedef struct conv_job_t {
+	cl_command_queue queue;
+	cl_kernel kernels[2];
+	//The full mask and its row and column factors if it's separable
+	cl_mem in, mask, row, col, tmp, out;
+	int width, height, mask_dim;
+	size_t local_size[2];
+	//The FFT plan for the mask, NULL if FFT convolution isn't being run
+	conv_fft_t *fft;
+} conv_job_t;
 
-int main(int argc, char **argv){
-	cl_context context = get_platform(CL_DEVICE_TYPE_GPU);
-	cl_device_id device = 0;
-	cl_command_queue queue = get_first_device(context, &device);
-	char *prog_src = read_file(CL_PROGRAM("convolution.cl"), NULL);
-	cl_program program = build_program(prog_src, context, device, NULL);
-	free(prog_src);
-	cl_int err = CL_SUCCESS;
-	cl_kernel kernel = clCreateKernel(program, "convolve", &err);
-	check_cl_err(err, "failed to create kernel");
-
-	//Setup our input signal and mask
-	cl_uint in_signal[IN_DIM][IN_DIM] = {
-		{ 3, 1, 1, 4, 8, 2, 1, 3 },
-		{ 4, 2, 1, 1, 2, 1, 2, 3 },
-		{ 4, 4, 4, 4, 3, 2, 2, 2 },
-		{ 9, 8, 3, 8, 9, 0, 0, 0 },
-		{ 9, 3, 3, 9, 0, 0, 0, 0 },
-		{ 0, 9, 0, 8, 0, 0, 0, 0 },
-		{ 3, 0, 8, 8, 9, 4, 4, 4 },
-		{ 5, 9, 8, 1, 8, 1, 1, 1 }
+typedef cl_int (*run_conv_fn)(const conv_job_t *job, cl_event *evt);
+
+static const cl_uint demo_signal[DEMO_DIM * DEMO_DIM] = {
+	3, 1, 1, 4, 8, 2, 1, 3,
+	4, 2, 1, 1, 2, 1, 2, 3,
+	4, 4, 4, 4, 3, 2, 2, 2,
+	9, 8, 3, 8, 9, 0, 0, 0,
+	9, 3, 3, 9, 0, 0, 0, 0,
+	0, 9, 0, 8, 0, 0, 0, 0,
+	3, 0, 8, 8, 9, 4, 4, 4,
+	5, 9, 8, 1, 8, 1, 1, 1
+};
+static const cl_uint demo_mask[DEMO_MASK_DIM * DEMO_MASK_DIM] = {
+	1, 1, 1,
+	1, 0, 1,
+	1, 1, 1
+};
+
+static cl_int run_direct(const conv_job_t *job, cl_event *evt){
+	return enqueue_convolve(job->queue, job->kernels[0], job->in, job->mask, job->out,
+		job->width, job->height, job->mask_dim, job->local_size, evt);
+}
+static cl_int run_tiled(const conv_job_t *job, cl_event *evt){
+	return enqueue_convolve_tiled(job->queue, job->kernels[0], job->in, job->mask, job->out,
+		job->width, job->height, job->mask_dim, job->local_size, evt);
+}
+static cl_int run_separable(const conv_job_t *job, cl_event *evt){
+	return enqueue_convolve_separable(job->queue, job->kernels[0], job->kernels[1], job->in,
+		job->row, job->col, job->tmp, job->out, job->width, job->height, job->mask_dim,
+		job->local_size, evt);
+}
+static cl_int run_fft(const conv_job_t *job, cl_event *evt){
+	return conv_fft_enqueue(job->fft, job->in, job->out, evt);
+}
+//One of the methods with the local size the tuner is trying
+typedef struct tune_job_t {
+	run_conv_fn run;
+	conv_job_t job;
+} tune_job_t;
+
+static cl_int tune_run(void *arg, cl_command_queue queue, cl_kernel kernel,
+	const size_t *local_size, cl_event *evt)
+{
+	(void)kernel;
+	tune_job_t *t = arg;
+	t->job.queue = queue;
+	t->job.local_size[0] = local_size[0];
+	t->job.local_size[1] = local_size[1];
+	return t->run(&t->job, evt);
+}
+/*
+ * Set the job's local size to the best one for the method found by tune_local_size,
+ * keyed on the job's first kernel and output size
+ * returns 1 if no local size could run
+ */
+static int tune_method(run_conv_fn run, conv_job_t *job){
+	tune_job_t t = { run, *job };
+	const size_t out_dim[2] = {
+		CONV_OUT_DIM(job->width, job->mask_dim), CONV_OUT_DIM(job->height, job->mask_dim)
 	};
-	cl_uint mask[MASK_DIM][MASK_DIM] = {
-		{ 1, 1, 1 },
-		{ 1, 0, 1 },
-		{ 1, 1, 1 }
+	return tune_local_size(job->queue, job->kernels[0], 2, out_dim, tune_run, &t,
+		job->local_size);
+}
+//Run the convolution RUNS times after a warm up run and return the fastest in ms, or -1 on failure
+static double time_convolve(run_conv_fn run, const char *name, const conv_job_t *job){
+	double best = -1;
+	for (int i = 0; i < RUNS + 1; ++i){
+		double start = wall_time();
+		cl_int err = run(job, profile_event(name));
+		if (check_cl_err(err, "failed to enqueue convolution")){
+			return -1;
+		}
+		clFinish(job->queue);
+		double t = (wall_time() - start) * 1000.0;
+		if (i > 0 && (best < 0 || t < best)){
+			best = t;
+		}
+	}
+	return best;
+}
+/*
+ * Read back the output and compare it to the host result, exactly if tolerance is 0 or
+ * within tolerance of the largest output otherwise
+ * returns 1 if they differ
+ */
+static int check_output(cl_command_queue queue, cl_mem mem_out, const cl_uint *expect,
+	size_t out_count, const char *name, double tolerance)
+{
+	cl_int err;
+	cl_uint *out = clEnqueueMapBuffer(queue, mem_out, CL_TRUE, CL_MAP_READ, 0,
+		sizeof(cl_uint) * out_count, 0, NULL, profile_event("map out"), &err);
+	if (check_cl_err(err, "failed to map result")){
+		return 1;
+	}
+	int ret = 0;
+	if (tolerance > 0){
+		const double error = convolve_fft_error(out, expect, out_count);
+		printf("%s max error %.2g of the largest output, tolerance %.0e\n", name, error,
+			tolerance);
+		ret = error > tolerance;
+	}
+	else {
+		ret = memcmp(out, expect, sizeof(cl_uint) * out_count) != 0;
+	}
+	if (ret){
+		fprintf(stderr, "%s output doesn't match the host result\n", name);
+	}
+	clEnqueueUnmapMemObject(queue, mem_out, out, 0, NULL, profile_event("unmap out"));
+	return ret;
+}
+/*
+ * Fill the mask with one of the kinds of mask we use: random, box, gauss (binomial
+ * approximation) or sobel (binomial smoothing across a central difference)
+ * returns 1 if the kind is unknown
+ */
+static int make_mask(const char *kind, int mask_dim, cl_uint *mask){
+	if (strcmp(kind, "random") == 0){
+		for (int i = 0; i < mask_dim * mask_dim; ++i){
+			mask[i] = rand() % 4;
+		}
+		return 0;
+	}
+	//The rest are separable so build them from their row and column vectors
+	cl_int *row = malloc(sizeof(cl_int) * mask_dim);
+	cl_int *col = malloc(sizeof(cl_int) * mask_dim);
+	//Binomial coefficients for the smoothing vectors
+	row[0] = 1;
+	for (int i = 1; i < mask_dim; ++i){
+		row[i] = (cl_int)((long long)row[i - 1] * (mask_dim - i) / i);
+	}
+	int ret = 0;
+	if (strcmp(kind, "box") == 0){
+		for (int i = 0; i < mask_dim; ++i){
+			row[i] = col[i] = 1;
+		}
+	}
+	else if (strcmp(kind, "gauss") == 0){
+		memcpy(col, row, sizeof(cl_int) * mask_dim);
+	}
+	else if (strcmp(kind, "sobel") == 0){
+		for (int i = 0; i < mask_dim; ++i){
+			col[i] = i - mask_dim / 2;
+		}
+	}
+	else {
+		ret = 1;
+	}
+	for (int r = 0; r < mask_dim && !ret; ++r){
+		for (int c = 0; c < mask_dim; ++c){
+			mask[r * mask_dim + c] = (cl_uint)(col[r] * row[c]);
+		}
+	}
+	free(row);
+	free(col);
+	return ret;
+}
+
+/*
+ * Write a width x height image of random uints in [0, 256) to path a row at a time,
+ * as input for the streaming mode
+ * returns 1 on failure
+ */
+static int gen_input(const char *path, int width, int height){
+	FILE *f = fopen(path, "wb");
+	if (!f){
+		fprintf(stderr, "Failed to open %s for writing\n", path);
+		return 1;
+	}
+	cl_uint *row = malloc(sizeof(cl_uint) * width);
+	int failed = 0;
+	srand(1);
+	for (int y = 0; y < height && !failed; ++y){
+		for (int x = 0; x < width; ++x){
+			row[x] = rand() % 256;
+		}
+		failed = fwrite(row, sizeof(cl_uint), width, f) != (size_t)width;
+	}
+	free(row);
+	failed |= fclose(f) != 0;
+	if (failed){
+		fprintf(stderr, "Failed to write %s\n", path);
+	}
+	return failed;
+}
+//Read the first count uints of the file at path, returns NULL on failure
+static cl_uint* read_uints(const char *path, size_t count){
+	FILE *f = fopen(path, "rb");
+	if (!f){
+		return NULL;
+	}
+	cl_uint *data = malloc(sizeof(cl_uint) * count);
+	if (fread(data, sizeof(cl_uint), count, f) != count){
+		free(data);
+		data = NULL;
+	}
+	fclose(f);
+	return data;
+}
+/*
+ * Convolve the raw width x height image of uints at in_path with the mask in strips,
+ * writing the result to out_path. Results are checked against the host if they're small
+ * enough to load whole
+ * returns 1 on failure
+ */
+static int stream_convolve(const char *in_path, const char *out_path, int width, int height,
+	int mask_dim, const char *mask_kind)
+{
+	const size_t mask_count = (size_t)mask_dim * mask_dim;
+	cl_uint *mask = malloc(sizeof(cl_uint) * mask_count);
+	srand(1);
+	if (make_mask(mask_kind, mask_dim, mask)){
+		fprintf(stderr, "Unknown mask kind %s\n", mask_kind);
+		free(mask);
+		return 1;
+	}
+	cl_device_id device = 0;
+	cl_context context = select_device(&device);
+	if (!context){
+		free(mask);
+		return 1;
+	}
+	//Failures past here fall through to the cleanup at the end
+	cl_int err = CL_SUCCESS, mem_err;
+	conv_stream_t stream = {
+		.enqueue = enqueue_convolve_tiled,
+		.width = width,
+		.height = height,
+		.mask_dim = mask_dim
 	};
-	//0 is input, 1 is mask, 2 is output
-	cl_mem mem_objs[3];
-	mem_objs[0] = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-		sizeof(cl_uint) * IN_DIM * IN_DIM, in_signal, &err);
-	mem_objs[1] = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-		sizeof(cl_uint) * MASK_DIM * MASK_DIM, mask, &err);
-	mem_objs[2] = clCreateBuffer(context, CL_MEM_WRITE_ONLY,
-		sizeof(cl_uint) * OUT_DIM * OUT_DIM, NULL, &err);
-	check_cl_err(err, "failed to create buffers");
+	stream.upload = profile_create_queue(context, device, 0, &mem_err);
+	err |= mem_err;
+	stream.compute = profile_create_queue(context, device, 0, &mem_err);
+	err |= mem_err;
+	stream.download = profile_create_queue(context, device, 0, &mem_err);
+	err |= mem_err;
+	int failed = check_cl_err(err, "failed to create command queues");
+	cl_program program = NULL;
+	if (!failed){
+		char *prog_src = read_file(CL_PROGRAM("convolution.cl"), NULL);
+		program = build_program(prog_src, context, device, NULL);
+		free(prog_src);
+		failed = !program;
+	}
+	if (!failed){
+		stream.kernel = clCreateKernel(program, "convolve_tiled", &err);
+		failed = check_cl_err(err, "failed to create kernel")
+			|| convolve_tiled_local_size(stream.kernel, device, mask_dim, stream.local_size);
+	}
+	if (!failed){
+		stream.mask = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			sizeof(cl_uint) * mask_count, mask, &err);
+		failed = check_cl_err(err, "failed to create mask buffer");
+	}
 
-	for (int i = 0; i < 3; ++i){
-		err = clSetKernelArg(kernel, i, sizeof(cl_mem), &mem_objs[i]);
-		check_cl_err(err, "failed to set kernel argument");
-	}
-	size_t in_dim = IN_DIM, mask_dim = MASK_DIM;
-	err = clSetKernelArg(kernel, 3, sizeof(unsigned), &in_dim);
-	err = clSetKernelArg(kernel, 4, sizeof(unsigned), &mask_dim);
-	check_cl_err(err, "failed to set kernel argument");
-
-	size_t global_size[2] = { OUT_DIM, OUT_DIM };
-	size_t local_size[2] = { 2, 2 };
-	err = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global_size, local_size, 0,
-		NULL, NULL);
-	check_cl_err(err, "failed to enqueue ND range kernel");
-	
-	cl_uint* out = clEnqueueMapBuffer(queue, mem_objs[2], CL_TRUE, CL_MAP_READ, 0,
-		sizeof(cl_uint) * OUT_DIM * OUT_DIM, 0, NULL, NULL, &err);
-	check_cl_err(err, "failed to map result");
-
-	printf("Result:\n");
-	for (int i = 0; i < OUT_DIM; ++i){
-		for (int j = 0; j < OUT_DIM; ++j){
-			printf("%d ", out[i * OUT_DIM + j]);
+	FILE *in = NULL, *out = NULL;
+	if (!failed){
+		stream.strip_rows = convolve_stream_strip_rows(width, height, mask_dim, STREAM_BUDGET);
+		in = fopen(in_path, "rb");
+		out = fopen(out_path, "wb");
+		failed = !in || !out;
+		if (failed){
+			fprintf(stderr, "Failed to open %s or %s\n", in_path, out_path);
+		}
+		else {
+			printf("Streaming %dx%d input with %dx%d mask in strips of %d rows\n", width, height,
+				mask_dim, mask_dim, stream.strip_rows);
+			double start = wall_time();
+			failed = convolve_stream(context, &stream, in, out);
+			double elapsed = wall_time() - start;
+			if (!failed){
+				double bytes = sizeof(cl_uint) * ((double)width * height
+					+ (double)CONV_OUT_DIM(width, mask_dim) * CONV_OUT_DIM(height, mask_dim));
+				printf("Streamed in %.2fms, %.1f MB/s in and out\n", elapsed * 1000.0,
+					bytes / elapsed * 1e-6);
+			}
 		}
-		printf("\n");
 	}
-	printf("\n");
-	clEnqueueUnmapMemObject(queue, mem_objs[2], out, 0, 0, NULL);
+	if (in){
+		fclose(in);
+	}
+	if (out){
+		failed |= fclose(out) != 0;
+	}
 
+	const size_t out_count = (size_t)CONV_OUT_DIM(width, mask_dim) * CONV_OUT_DIM(height, mask_dim);
+	if (!failed && (size_t)width * height <= STREAM_CHECK_MAX){
+		cl_uint *in_signal = read_uints(in_path, (size_t)width * height);
+		cl_uint *result = read_uints(out_path, out_count);
+		cl_uint *expect = malloc(sizeof(cl_uint) * out_count);
+		if (in_signal && result){
+			convolve_host(in_signal, width, height, mask, mask_dim, expect);
+			failed = memcmp(result, expect, sizeof(cl_uint) * out_count) != 0;
+		}
+		else {
+			failed = 1;
+		}
+		printf("%s\n", failed ? "Results don't match the host" : "Results match the host");
+		free(in_signal);
+		free(result);
+		free(expect);
+	}
+	free(mask);
+	if (stream.mask){
+		clReleaseMemObject(stream.mask);
+	}
+	if (stream.kernel){
+		clReleaseKernel(stream.kernel);
+	}
+	if (program){
+		clReleaseProgram(program);
+	}
+	cl_command_queue queues[3] = { stream.upload, stream.compute, stream.download };
 	for (int i = 0; i < 3; ++i){
-		clReleaseMemObject(mem_objs[i]);
+		if (queues[i]){
+			clReleaseCommandQueue(queues[i]);
+		}
 	}
-	clReleaseKernel(kernel);
-	clReleaseProgram(program);
-	clReleaseCommandQueue(queue);
 	clReleaseContext(context);
+	return failed;
+}
+
+//A job read by the batch service, waiting for its batch to run
+typedef struct batch_entry_t {
+	char out_path[BATCH_PATH_MAX];
+	cl_uint *in, *mask, *out;
+	int width, height, mask_dim;
+	//When the job's descriptor was read
+	double arrival;
+} batch_entry_t;
+
+//Per job latencies and results of a batch service run
+typedef struct batch_stats_t {
+	double *latencies;
+	size_t jobs, capacity;
+	int batches, failed, mismatches;
+	//Time spent checking results on the host, left out of the throughput
+	double check_time;
+} batch_stats_t;
+
+/*
+ * Run the pending jobs as one batch, write each result to its output file and record its
+ * latency from arrival to being written, then check the results against the host
+ * returns 1 if the batch failed to run
+ */
+static int flush_batch(conv_batch_t *batch, batch_entry_t *entries, int n, batch_stats_t *stats){
+	if (n == 0){
+		return 0;
+	}
+	int failed = conv_batch_run(batch);
+	++stats->batches;
+	for (int i = 0; i < n && !failed; ++i){
+		batch_entry_t *e = &entries[i];
+		const size_t out_count = (size_t)CONV_OUT_DIM(e->width, e->mask_dim)
+			* CONV_OUT_DIM(e->height, e->mask_dim);
+		FILE *f = fopen(e->out_path, "wb");
+		int written = f && fwrite(e->out, sizeof(cl_uint), out_count, f) == out_count;
+		written &= f && fclose(f) == 0;
+		if (!written){
+			fprintf(stderr, "Failed to write %s\n", e->out_path);
+			++stats->failed;
+			continue;
+		}
+		if (stats->jobs == stats->capacity){
+			stats->capacity = stats->capacity ? stats->capacity * 2 : 256;
+			stats->latencies = realloc(stats->latencies, sizeof(double) * stats->capacity);
+		}
+		stats->latencies[stats->jobs++] = (wall_time() - e->arrival) * 1000.0;
+	}
+	double start = wall_time();
+	for (int i = 0; i < n; ++i){
+		batch_entry_t *e = &entries[i];
+		if (!failed){
+			const size_t out_count = (size_t)CONV_OUT_DIM(e->width, e->mask_dim)
+				* CONV_OUT_DIM(e->height, e->mask_dim);
+			cl_uint *expect = malloc(sizeof(cl_uint) * out_count);
+			convolve_host(e->in, e->width, e->height, e->mask, e->mask_dim, expect);
+			stats->mismatches += memcmp(expect, e->out, sizeof(cl_uint) * out_count) != 0;
+			free(expect);
+		}
+		free(e->in);
+		free(e->mask);
+		free(e->out);
+	}
+	stats->check_time += wall_time() - start;
+	return failed;
+}
+/*
+ * Read a job descriptor line, "in.raw out.raw width height mask_dim [kind]", and load its
+ * input and mask
+ * returns 1 if the line or its input is bad
+ */
+static int read_batch_job(const char *line, batch_entry_t *e){
+	char in_path[BATCH_PATH_MAX], mask_kind[16] = "random";
+	if (sscanf(line, "%1023s %1023s %d %d %d %15s", in_path, e->out_path, &e->width,
+		&e->height, &e->mask_dim, mask_kind) < 5)
+	{
+		fprintf(stderr, "Bad job: %s", line);
+		return 1;
+	}
+	if (e->mask_dim < 1 || e->width < e->mask_dim || e->height < e->mask_dim){
+		fprintf(stderr, "The input of %s must be at least as big as the mask\n", in_path);
+		return 1;
+	}
+	e->mask = malloc(sizeof(cl_uint) * e->mask_dim * e->mask_dim);
+	//Reseed so every job with a random mask gets the same one, as the streaming mode does
+	srand(1);
+	if (make_mask(mask_kind, e->mask_dim, e->mask)){
+		fprintf(stderr, "Unknown mask kind %s\n", mask_kind);
+		free(e->mask);
+		return 1;
+	}
+	e->in = read_uints(in_path, (size_t)e->width * e->height);
+	if (!e->in){
+		fprintf(stderr, "Failed to read %s\n", in_path);
+		free(e->mask);
+		return 1;
+	}
+	e->out = malloc(sizeof(cl_uint) * CONV_OUT_DIM(e->width, e->mask_dim)
+		* CONV_OUT_DIM(e->height, e->mask_dim));
 	return 0;
 }
-cl_context get_first_platform(){
-	cl_uint num_platforms;
-	cl_platform_id platform;
-	cl_int err = clGetPlatformIDs(1, &platform, &num_platforms);
-	if (check_cl_err(err, "Failed to find a platform") || num_platforms < 1){
-		return NULL;
+static int cmp_double(const void *a, const void *b){
+	double da = *(const double*)a, db = *(const double*)b;
+	return da < db ? -1 : da > db ? 1 : 0;
+}
+//Print the throughput and the nearest-rank percentiles of the job latencies
+static void print_batch_stats(batch_stats_t *stats, int window, double elapsed){
+	printf("Ran %lu jobs in %d batches of up to %d in %.2fms, %.1f jobs/s\n",
+		(unsigned long)stats->jobs, stats->batches, window, elapsed * 1000.0,
+		stats->jobs / elapsed);
+	if (stats->jobs == 0){
+		return;
+	}
+	qsort(stats->latencies, stats->jobs, sizeof(double), cmp_double);
+	const int pcts[3] = { 50, 90, 99 };
+	printf("Latency: min %.3fms", stats->latencies[0]);
+	for (int i = 0; i < 3; ++i){
+		printf(", p%d %.3fms", pcts[i],
+			stats->latencies[(stats->jobs * pcts[i] + 99) / 100 - 1]);
+	}
+	printf(", max %.3fms\n", stats->latencies[stats->jobs - 1]);
+}
+/*
+ * Serve the convolution jobs described one per line in the file at path, or stdin if
+ * it's "-". Jobs are loaded as their lines are read and run as a batch once window of
+ * them are pending, a blank line is read or the input ends, so a long-running producer
+ * can flush a partial batch. Lines starting with # are skipped
+ * returns 1 if any job failed
+ */
+static int batch_convolve(const char *path, int window){
+	FILE *jobs = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+	if (!jobs){
+		fprintf(stderr, "Failed to open %s\n", path);
+		return 1;
+	}
+	cl_device_id device = 0;
+	cl_context context = select_device(&device);
+	if (!context){
+		if (jobs != stdin){
+			fclose(jobs);
+		}
+		return 1;
+	}
+	//Failures past here fall through to the cleanup at the end
+	cl_int err = CL_SUCCESS;
+	cl_command_queue queue = profile_create_queue(context, device, 0, &err);
+	int failed = check_cl_err(err, "failed to create command queue");
+	cl_program program = NULL;
+	conv_batch_t *batch = NULL;
+	if (!failed){
+		char *prog_src = read_file(CL_PROGRAM("convolution.cl"), NULL);
+		program = build_program(prog_src, context, device, NULL);
+		free(prog_src);
+		failed = !program;
+	}
+	if (!failed){
+		batch = conv_batch_create(context, queue, program);
+		failed = !batch;
+	}
+	batch_entry_t *entries = malloc(sizeof(batch_entry_t) * window);
+	batch_stats_t stats = { NULL };
+	if (!failed){
+		int n = 0;
+		char line[3 * BATCH_PATH_MAX];
+		printf("Serving convolution jobs from %s in batches of up to %d\n",
+			jobs == stdin ? "stdin" : path, window);
+		double start = wall_time();
+		while (fgets(line, sizeof(line), jobs)){
+			if (line[0] == '#'){
+				continue;
+			}
+			if (strspn(line, " \t\r\n") == strlen(line)){
+				failed |= flush_batch(batch, entries, n, &stats);
+				n = 0;
+				continue;
+			}
+			entries[n].arrival = wall_time();
+			if (read_batch_job(line, &entries[n])){
+				++stats.failed;
+				continue;
+			}
+			conv_batch_add(batch, entries[n].in, entries[n].width, entries[n].height,
+				entries[n].mask, entries[n].mask_dim, entries[n].out);
+			if (++n == window){
+				failed |= flush_batch(batch, entries, n, &stats);
+				n = 0;
+			}
+		}
+		failed |= flush_batch(batch, entries, n, &stats);
+		double elapsed = wall_time() - start - stats.check_time;
+		print_batch_stats(&stats, window, elapsed);
+		if (stats.failed){
+			printf("%d jobs failed\n", stats.failed);
+		}
+		printf("%s\n", stats.mismatches ? "Results don't match the host"
+			: "Results match the host");
+		failed |= stats.failed || stats.mismatches;
 	}
-	char name[64];
-	err = clGetPlatformInfo(platform, CL_PLATFORM_NAME, 64, name, NULL);
-	//This error probably shouldn't happen, but check anyway
-	check_cl_err(err, "Failed to get platform name");
-	printf("Selecting platform: %s\n", name);
 
-	//Try to get a GPU context on the platform
-	cl_context_properties properties[] = {
-		CL_CONTEXT_PLATFORM, (cl_context_properties)platform, 0
-	};
-	cl_context context = clCreateContextFromType(properties, CL_DEVICE_TYPE_GPU,
-		cl_err_callback, NULL, &err);
-	if (check_cl_err(err, "Failed to create GPU context, retrying CPU")){
-		context = clCreateContextFromType(properties, CL_DEVICE_TYPE_CPU,
-			NULL, NULL, &err);
-		if (check_cl_err(err, "Failed to create a GPU or CPU context")){
-			return NULL;
-		}
-	}
-	return context;
-}
-cl_context get_platform(cl_device_type type){
-	cl_uint num_platforms;
-	cl_int err = clGetPlatformIDs(0, NULL, &num_platforms);
-	cl_platform_id *platforms = malloc(sizeof(cl_platform_id) * num_platforms);
-	err = clGetPlatformIDs(num_platforms, platforms, NULL);
-	if (check_cl_err(err, "Failed to find platforms") || num_platforms < 1){
-		return NULL;
+	if (jobs != stdin){
+		fclose(jobs);
+	}
+	free(entries);
+	free(stats.latencies);
+	conv_batch_destroy(batch);
+	if (program){
+		clReleaseProgram(program);
+	}
+	if (queue){
+		clReleaseCommandQueue(queue);
 	}
-	cl_context_properties properties[] = {
-		CL_CONTEXT_PLATFORM, 0, 0
+	clReleaseContext(context);
+	return failed;
+}
+
+/*
+ * Upload the input, run the job's kernel with enqueue_convolve and read back the result
+ * RUNS times after a warm up run
+ * returns the fastest in ms, or -1 on failure
+ */
+static double time_round_trip(const conv_job_t *job, const void *host_in, size_t in_bytes,
+	void *host_out, size_t out_bytes)
+{
+	double best = -1;
+	for (int i = 0; i < RUNS + 1; ++i){
+		double start = wall_time();
+		cl_int err = clEnqueueWriteBuffer(job->queue, job->in, CL_FALSE, 0, in_bytes, host_in, 0,
+			NULL, profile_event("write in"));
+		err |= run_direct(job, profile_event("convolve"));
+		err |= clEnqueueReadBuffer(job->queue, job->out, CL_TRUE, 0, out_bytes, host_out, 0, NULL,
+			profile_event("read out"));
+		if (check_cl_err(err, "failed to run convolution")){
+			return -1;
+		}
+		double t = (wall_time() - start) * 1000.0;
+		if (i > 0 && (best < 0 || t < best)){
+			best = t;
+		}
+	}
+	return best;
+}
+/*
+ * Convolve random [0, 256) data stored as in_type into out_type with the convolve_typed
+ * variant for them, saturating integer outputs, and compare the time taken to upload,
+ * convolve and read back the data against doing it in uints with convolve. The result
+ * must exactly match the host's sums converted the same way
+ * returns 1 on failure
+ */
+static int typed_convolve(conv_type_t in_type, conv_type_t out_type, int width, int height,
+	int mask_dim, const char *mask_kind)
+{
+	const size_t in_count = (size_t)width * height, mask_count = (size_t)mask_dim * mask_dim;
+	const size_t out_count = (size_t)CONV_OUT_DIM(width, mask_dim) * CONV_OUT_DIM(height, mask_dim);
+	cl_uint *mask = malloc(sizeof(cl_uint) * mask_count);
+	srand(1);
+	if (make_mask(mask_kind, mask_dim, mask)){
+		fprintf(stderr, "Unknown mask kind %s\n", mask_kind);
+		free(mask);
+		return 1;
+	}
+	cl_device_id device = 0;
+	cl_context context = select_device(&device);
+	if (!context){
+		free(mask);
+		return 1;
+	}
+	//Failures past here fall through to the cleanup at the end
+	cl_int err = CL_SUCCESS, mem_err;
+	cl_command_queue queue = profile_create_queue(context, device, 0, &err);
+	int failed = check_cl_err(err, "failed to create command queue");
+	cl_program program = NULL;
+	conv_typed_t *typed = NULL;
+	cl_kernel kernel = NULL, typed_kernel = NULL;
+	if (!failed){
+		char *prog_src = read_file(CL_PROGRAM("convolution.cl"), NULL);
+		program = build_program(prog_src, context, device, NULL);
+		typed = conv_typed_create(context, device, prog_src);
+		free(prog_src);
+		failed = !program || !typed;
+	}
+	if (!failed){
+		kernel = clCreateKernel(program, "convolve", &err);
+		typed_kernel = conv_typed_kernel(typed, in_type, out_type, 1);
+		failed = check_cl_err(err, "failed to create kernel") || !typed_kernel;
+	}
+	const int saturate = conv_typed_saturates(in_type, out_type, 1);
+	const size_t in_size = conv_type_size(in_type), out_size = conv_type_size(out_type);
+	cl_uint *in_signal = malloc(sizeof(cl_uint) * in_count);
+	cl_uint *expect = malloc(sizeof(cl_uint) * out_count);
+	cl_uint *result = malloc(sizeof(cl_uint) * out_count);
+	void *in_typed = malloc(in_size * in_count);
+	void *expect_typed = malloc(out_size * out_count);
+	void *result_typed = malloc(out_size * out_count);
+	cl_int *mask_typed = malloc(sizeof(cl_int) * mask_count);
+	for (size_t i = 0; i < in_count; ++i){
+		in_signal[i] = rand() % 256;
+	}
+	convolve_host(in_signal, width, height, mask, mask_dim, expect);
+	convert_to_type(in_signal, in_count, in_type, saturate, in_typed);
+	convert_to_type(expect, out_count, out_type, saturate, expect_typed);
+	convolve_typed_mask(mask, mask_dim, in_type, mask_typed);
+
+	cl_mem bufs[6] = { NULL };
+	const size_t buf_sizes[6] = { sizeof(cl_uint) * in_count, sizeof(cl_uint) * out_count,
+		in_size * in_count, out_size * out_count };
+	if (!failed){
+		for (int i = 0; i < 4; ++i){
+			bufs[i] = clCreateBuffer(context, i % 2 ? CL_MEM_WRITE_ONLY : CL_MEM_READ_ONLY,
+				buf_sizes[i], NULL, &mem_err);
+			err |= mem_err;
+		}
+		bufs[4] = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			sizeof(cl_uint) * mask_count, mask, &mem_err);
+		err |= mem_err;
+		bufs[5] = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			sizeof(cl_int) * mask_count, mask_typed, &mem_err);
+		err |= mem_err;
+		failed = check_cl_err(err, "failed to create buffers");
+	}
+	if (!failed){
+		printf("Convolving %dx%d input with %dx%d mask as %s -> %s%s\n", width, height,
+			mask_dim, mask_dim, conv_type_name(in_type), conv_type_name(out_type),
+			saturate ? ", saturating" : "");
+		//Each kernel runs with the local size tuned for it
+		conv_job_t jobs[2] = {
+			{ .queue = queue, .kernels = { kernel }, .in = bufs[0], .mask = bufs[4],
+				.out = bufs[1], .width = width, .height = height, .mask_dim = mask_dim },
+			{ .queue = queue, .kernels = { typed_kernel }, .in = bufs[2], .mask = bufs[5],
+				.out = bufs[3], .width = width, .height = height, .mask_dim = mask_dim }
+		};
+		double uint_ms = tune_method(run_direct, &jobs[0]) ? -1
+			: time_round_trip(&jobs[0], in_signal, buf_sizes[0], result, buf_sizes[1]);
+		double typed_ms = tune_method(run_direct, &jobs[1]) ? -1
+			: time_round_trip(&jobs[1], in_typed, buf_sizes[2], result_typed, buf_sizes[3]);
+		failed = uint_ms < 0 || typed_ms < 0
+			|| memcmp(result, expect, sizeof(cl_uint) * out_count) != 0
+			|| memcmp(result_typed, expect_typed, out_size * out_count) != 0;
+		const double uint_mb = (buf_sizes[0] + buf_sizes[1]) / 1e6;
+		const double typed_mb = (buf_sizes[2] + buf_sizes[3]) / 1e6;
+		printf("convolve (u32 -> u32): %10.3fms, local size %lux%lu, %.1f MB moved\n", uint_ms,
+			(unsigned long)jobs[0].local_size[0], (unsigned long)jobs[0].local_size[1], uint_mb);
+		printf("convolve_typed:        %10.3fms, local size %lux%lu, %.1f MB moved, "
+			"%.2fx less data\n", typed_ms, (unsigned long)jobs[1].local_size[0],
+			(unsigned long)jobs[1].local_size[1], typed_mb, uint_mb / typed_mb);
+		printf("%s\n", failed ? "Results don't match the host" : "Results match the host");
+	}
+
+	for (int i = 0; i < 6; ++i){
+		if (bufs[i]){
+			clReleaseMemObject(bufs[i]);
+		}
+	}
+	free(in_signal);
+	free(expect);
+	free(result);
+	free(in_typed);
+	free(expect_typed);
+	free(result_typed);
+	free(mask_typed);
+	free(mask);
+	//The typed kernel belongs to typed
+	conv_typed_destroy(typed);
+	if (kernel){
+		clReleaseKernel(kernel);
+	}
+	if (program){
+		clReleaseProgram(program);
+	}
+	if (queue){
+		clReleaseCommandQueue(queue);
+	}
+	clReleaseContext(context);
+	return failed;
+}
+
+/*
+ * Convolve random [0, 256) data to a same size output with the border mode through the
+ * padded buffer path and the image path, timing each from the host input to the host
+ * output and checking it against the host, then print the path picked for the device
+ * returns 1 on failure
+ */
+static int border_convolve(conv_border_t border, int width, int height, int mask_dim,
+	const char *mask_kind)
+{
+	const size_t count = (size_t)width * height;
+	cl_uint *mask = malloc(sizeof(cl_uint) * mask_dim * mask_dim);
+	srand(1);
+	if (make_mask(mask_kind, mask_dim, mask)){
+		fprintf(stderr, "Unknown mask kind %s\n", mask_kind);
+		free(mask);
+		return 1;
+	}
+	cl_device_id device = 0;
+	cl_context context = select_device(&device);
+	if (!context){
+		free(mask);
+		return 1;
+	}
+	//Failures past here fall through to the cleanup at the end
+	cl_int err = CL_SUCCESS;
+	cl_command_queue queue = profile_create_queue(context, device, 0, &err);
+	int failed = check_cl_err(err, "failed to create command queue");
+	cl_program program = NULL;
+	conv_image_t *conv = NULL;
+	if (!failed){
+		char *prog_src = read_file(CL_PROGRAM("convolution.cl"), NULL);
+		program = build_program(prog_src, context, device, NULL);
+		free(prog_src);
+		failed = !program;
+	}
+	if (!failed){
+		conv = conv_image_create(context, queue, program, mask, mask_dim, width, height,
+			border);
+		failed = !conv;
+	}
+	cl_uint *in = malloc(sizeof(cl_uint) * count);
+	cl_uint *expect = malloc(sizeof(cl_uint) * count);
+	cl_uint *out = malloc(sizeof(cl_uint) * count);
+	if (!failed){
+		for (size_t i = 0; i < count; ++i){
+			in[i] = rand() % 256;
+		}
+		convolve_host_border(in, width, height, mask, mask_dim, border, expect);
+
+		printf("Convolving %dx%d input with %dx%d mask, %s border\n", width, height, mask_dim,
+			mask_dim, conv_border_name(border));
+		for (int p = 0; p < CONV_NUM_PATHS; ++p){
+			if (!conv_image_has_path(conv, p)){
+				printf("%-6s path: not supported by the device\n", conv_path_name(p));
+				continue;
+			}
+			double best = -1;
+			err = CL_SUCCESS;
+			for (int i = 0; i < RUNS + 1 && err == CL_SUCCESS; ++i){
+				double start = wall_time();
+				err = conv_image_run(conv, p, in, out);
+				double t = (wall_time() - start) * 1000.0;
+				if (i > 0 && (best < 0 || t < best)){
+					best = t;
+				}
+			}
+			const int mismatch = check_cl_err(err, "failed to run convolution")
+				|| memcmp(out, expect, sizeof(cl_uint) * count) != 0;
+			printf("%-6s path: %10.3fms%s\n", conv_path_name(p), best,
+				mismatch ? ", doesn't match the host" : "");
+			failed |= mismatch;
+		}
+		printf("Picked the %s path for the device\n",
+			conv_path_name(conv_image_pick(conv, in, out)));
+		printf("%s\n", failed ? "Results don't match the host" : "Results match the host");
+	}
+
+	free(in);
+	free(expect);
+	free(out);
+	free(mask);
+	conv_image_destroy(conv);
+	if (program){
+		clReleaseProgram(program);
+	}
+	if (queue){
+		clReleaseCommandQueue(queue);
+	}
+	clReleaseContext(context);
+	return failed;
+}
+
+/*
+ * Print the output of the named method if it's given and small enough to read, then
+ * whether the methods matched the host
+ */
+static void print_result(const char *name, const cl_uint *out, int out_w, int out_h, int failed){
+	if (out && out_w <= PRINT_MAX_DIM && out_h <= PRINT_MAX_DIM){
+		printf("Result of %s:\n", name);
+		for (int i = 0; i < out_h; ++i){
+			for (int j = 0; j < out_w; ++j){
+				printf("%d ", out[i * out_w + j]);
+			}
+			printf("\n");
+		}
+		printf("\n");
+	}
+	printf("%s\n", failed ? "Results don't match the host" : "Results match the host");
+}
+/*
+ * Run the host backend's convolution RUNS times after a warm up run, printing the fastest
+ * and its output, checked against the plain host result
+ * returns 1 if they differ
+ */
+static int host_convolve(const cl_uint *in, int width, int height, const cl_uint *mask,
+	int mask_dim, const cl_uint *expect)
+{
+	const size_t out_count = (size_t)CONV_OUT_DIM(width, mask_dim) * CONV_OUT_DIM(height, mask_dim);
+	cl_uint *out = malloc(sizeof(cl_uint) * out_count);
+	thread_pool_t *pool = thread_pool_create(0);
+	double best = -1;
+	for (int i = 0; i < RUNS + 1; ++i){
+		double start = wall_time();
+		convolve_host_simd(pool, in, width, height, mask, mask_dim, out);
+		double t = (wall_time() - start) * 1000.0;
+		if (i > 0 && (best < 0 || t < best)){
+			best = t;
+		}
+	}
+	printf("Convolving %dx%d input with %dx%d mask on %d threads\n", width, height, mask_dim,
+		mask_dim, pool ? thread_pool_size(pool) : 1);
+	printf("convolve_host_simd: %10.3fms\n", best);
+	int failed = memcmp(out, expect, sizeof(cl_uint) * out_count) != 0;
+	print_result("convolve_host_simd", out, CONV_OUT_DIM(width, mask_dim),
+		CONV_OUT_DIM(height, mask_dim), failed);
+	thread_pool_destroy(pool);
+	free(out);
+	return failed;
+}
+
+int main(int argc, char **argv){
+	if (argc == 5 && strcmp(argv[1], "-gen") == 0){
+		return gen_input(argv[2], atoi(argv[3]), atoi(argv[4]));
+	}
+	if ((argc == 7 || argc == 8) && strcmp(argv[1], "-stream") == 0){
+		const int w = atoi(argv[4]), h = atoi(argv[5]), k = atoi(argv[6]);
+		if (k < 1 || w < k || h < k){
+			fprintf(stderr, "The input must be at least as big as the mask\n");
+			return 1;
+		}
+		return stream_convolve(argv[2], argv[3], w, h, k, argc == 8 ? argv[7] : "random");
+	}
+	if ((argc == 3 || argc == 4) && strcmp(argv[1], "-batch") == 0){
+		const int window = argc == 4 ? atoi(argv[3]) : BATCH_WINDOW;
+		if (window < 1){
+			fprintf(stderr, "The batch window must be at least 1 job\n");
+			return 1;
+		}
+		return batch_convolve(argv[2], window);
+	}
+	if ((argc == 7 || argc == 8) && strcmp(argv[1], "-type") == 0){
+		const int in_type = conv_type_parse(argv[2]), out_type = conv_type_parse(argv[3]);
+		const int w = atoi(argv[4]), h = atoi(argv[5]), k = atoi(argv[6]);
+		if (in_type < 0 || out_type < 0){
+			fprintf(stderr, "Types must be one of u8, u16, u32, f16 or f32\n");
+			return 1;
+		}
+		if (k < 1 || w < k || h < k){
+			fprintf(stderr, "The input must be at least as big as the mask\n");
+			return 1;
+		}
+		return typed_convolve(in_type, out_type, w, h, k, argc == 8 ? argv[7] : "random");
+	}
+	if ((argc == 6 || argc == 7) && strcmp(argv[1], "-border") == 0){
+		const int border = conv_border_parse(argv[2]);
+		const int w = atoi(argv[3]), h = atoi(argv[4]), k = atoi(argv[5]);
+		if (border < 0){
+			fprintf(stderr, "Border must be one of zero, clamp, repeat or mirror\n");
+			return 1;
+		}
+		if (k < 1 || w < 1 || h < 1){
+			fprintf(stderr, "The input and mask must be at least 1x1\n");
+			return 1;
+		}
+		return border_convolve(border, w, h, k, argc == 7 ? argv[6] : "random");
+	}
+	int width = DEMO_DIM, height = DEMO_DIM, mask_dim = DEMO_MASK_DIM;
+	const char *mask_kind = "random";
+	if (argc == 4 || argc == 5){
+		width = atoi(argv[1]);
+		height = atoi(argv[2]);
+		mask_dim = atoi(argv[3]);
+		if (argc == 5){
+			mask_kind = argv[4];
+		}
+	}
+	else if (argc != 1){
+		fprintf(stderr, "Usage: %s [width height mask_dim [random|box|gauss|sobel]]\n"
+			"       %s -gen in.raw width height\n"
+			"       %s -stream in.raw out.raw width height mask_dim [random|box|gauss|sobel]\n"
+			"       %s -batch jobs.txt|- [window]\n"
+			"       %s -type u8|u16|u32|f16|f32 u8|u16|u32|f16|f32 width height mask_dim "
+			"[random|box|gauss|sobel]\n"
+			"       %s -border zero|clamp|repeat|mirror width height mask_dim "
+			"[random|box|gauss|sobel]\n",
+			argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+		return 1;
+	}
+	if (mask_dim < 1 || width < mask_dim || height < mask_dim){
+		fprintf(stderr, "The input must be at least as big as the mask\n");
+		return 1;
+	}
+	const int out_w = CONV_OUT_DIM(width, mask_dim), out_h = CONV_OUT_DIM(height, mask_dim);
+	const size_t in_count = (size_t)width * height, out_count = (size_t)out_w * out_h;
+	const size_t mask_count = (size_t)mask_dim * mask_dim;
+
+	cl_uint *in_signal = malloc(sizeof(cl_uint) * in_count);
+	cl_uint *mask = malloc(sizeof(cl_uint) * mask_count);
+	cl_uint *row = malloc(sizeof(cl_uint) * mask_dim);
+	cl_uint *col = malloc(sizeof(cl_uint) * mask_dim);
+	cl_uint *expect = malloc(sizeof(cl_uint) * out_count);
+	if (argc == 1){
+		memcpy(in_signal, demo_signal, sizeof(demo_signal));
+		memcpy(mask, demo_mask, sizeof(demo_mask));
+	}
+	else {
+		srand(1);
+		for (size_t i = 0; i < in_count; ++i){
+			in_signal[i] = rand() % 256;
+		}
+		if (make_mask(mask_kind, mask_dim, mask)){
+			fprintf(stderr, "Unknown mask kind %s\n", mask_kind);
+			return 1;
+		}
+	}
+	const int separable = mask_separable(mask, mask_dim, row, col);
+	convolve_host(in_signal, width, height, mask, mask_dim, expect);
+
+	cl_device_id device = 0;
+	cl_context context;
+	if (select_backend(&context, &device)){
+		int failed = host_convolve(in_signal, width, height, mask, mask_dim, expect);
+		free(in_signal);
+		free(mask);
+		free(row);
+		free(col);
+		free(expect);
+		return failed;
+	}
+	cl_int err = CL_SUCCESS;
+	cl_command_queue queue = profile_create_queue(context, device, 0, &err);
+	if (check_cl_err(err, "failed to create command queue")){
+		return 1;
+	}
+	cl_ulong max_constant;
+	clGetDeviceInfo(device, CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE, sizeof(max_constant),
+		&max_constant, NULL);
+	if (sizeof(cl_uint) * mask_count > max_constant){
+		fprintf(stderr, "A %dx%d mask doesn't fit in the device's constant memory\n",
+			mask_dim, mask_dim);
+		return 1;
+	}
+	char *prog_src = read_file(CL_PROGRAM("convolution.cl"), NULL);
+	double build_start = wall_time();
+	cl_program program = build_program(prog_src, context, device, NULL);
+	prog_cache_stats_t cache_stats = prog_cache_stats();
+	printf("Program ready in %.2fms (cache hits: %lu, misses: %lu)\n",
+		(wall_time() - build_start) * 1000.0, (unsigned long)cache_stats.hits,
+		(unsigned long)cache_stats.misses);
+	free(prog_src);
+	//0 is direct, 1 is tiled, 2 and 3 are the row and column passes
+	const char *kernel_names[4] = { "convolve", "convolve_tiled", "convolve_rows", "convolve_cols" };
+	cl_kernel kernels[4];
+	for (int i = 0; i < 4; ++i){
+		kernels[i] = clCreateKernel(program, kernel_names[i], &err);
+		check_cl_err(err, "failed to create kernel");
+	}
+
+	conv_job_t job = {
+		.queue = queue,
+		.width = width,
+		.height = height,
+		.mask_dim = mask_dim
 	};
-	cl_context context = NULL;
-	for (size_t i = 0; i < num_platforms; ++i){
-		properties[1] = (cl_context_properties)platforms[i];
-		context = clCreateContextFromType(properties, type, cl_err_callback, NULL, &err);
-		if (err == CL_SUCCESS){
-			char name[64];
-			clGetPlatformInfo(platforms[i], CL_PLATFORM_NAME, 64, name, NULL);
-			printf("Selected platform: %s\n", name);
-			break;
-		}
-	}
-	free(platforms);
-	return context;
-}
-void CL_CALLBACK cl_err_callback(const char *err_info, const void *priv_info, size_t cb, void *user){
-	printf("OpenCL context error: %s\n", err_info);
-	exit(EXIT_FAILURE);
-}
-cl_command_queue get_first_device(cl_context context, cl_device_id *device){
-	size_t num_devices;
-	cl_int err = clGetContextInfo(context, CL_CONTEXT_NUM_DEVICES,
-		sizeof(num_devices), &num_devices, NULL);
-	if (check_cl_err(err, "Failed to get number of devices")){
-		return NULL;
+	job.in = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+		sizeof(cl_uint) * in_count, in_signal, &err);
+	check_cl_err(err, "failed to create input buffer");
+	job.mask = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+		sizeof(cl_uint) * mask_count, mask, &err);
+	check_cl_err(err, "failed to create mask buffer");
+	job.out = clCreateBuffer(context, CL_MEM_WRITE_ONLY,
+		sizeof(cl_uint) * out_count, NULL, &err);
+	check_cl_err(err, "failed to create output buffer");
+
+	printf("Convolving %dx%d input with %dx%d mask\n", width, height, mask_dim, mask_dim);
+	int failed = 0;
+	job.kernels[0] = kernels[0];
+	double direct_ms = tune_method(run_direct, &job) ? -1
+		: time_convolve(run_direct, "convolve", &job);
+	failed |= direct_ms < 0 || check_output(queue, job.out, expect, out_count, "convolve", 0);
+	const size_t direct_local[2] = { job.local_size[0], job.local_size[1] };
+	job.kernels[0] = kernels[1];
+	double tiled_ms = tune_method(run_tiled, &job) ? -1
+		: time_convolve(run_tiled, "convolve_tiled", &job);
+	failed |= tiled_ms < 0
+		|| check_output(queue, job.out, expect, out_count, "convolve_tiled", 0);
+
+	//The read counts are worked out from the kernels' access patterns, not measured, and
+	//don't account for any caching the device does
+	double direct_reads = convolve_global_reads(width, height, mask_dim);
+	double tiled_reads = convolve_tiled_global_reads(width, height, mask_dim, job.local_size);
+	printf("convolve:           %10.3fms, local size %lux%lu, est. %14.0f global reads (%.1f MB)\n",
+		direct_ms, (unsigned long)direct_local[0], (unsigned long)direct_local[1], direct_reads,
+		direct_reads * sizeof(cl_uint) / 1e6);
+	printf("convolve_tiled:     %10.3fms, local size %lux%lu, est. %14.0f global reads (%.1f MB), "
+		"est. %.2fx fewer reads\n", tiled_ms, (unsigned long)job.local_size[0],
+		(unsigned long)job.local_size[1], tiled_reads, tiled_reads * sizeof(cl_uint) / 1e6,
+		direct_reads / tiled_reads);
+
+	double separable_ms = -1;
+	if (separable){
+		job.row = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			sizeof(cl_uint) * mask_dim, row, &err);
+		job.col = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			sizeof(cl_uint) * mask_dim, col, &err);
+		job.tmp = clCreateBuffer(context, CL_MEM_READ_WRITE,
+			sizeof(cl_uint) * out_w * height, NULL, &err);
+		check_cl_err(err, "failed to create separable pass buffers");
+		job.kernels[0] = kernels[2];
+		job.kernels[1] = kernels[3];
+		separable_ms = tune_method(run_separable, &job) ? -1
+			: time_convolve(run_separable, "convolve_separable", &job);
+		failed |= separable_ms < 0
+			|| check_output(queue, job.out, expect, out_count, "convolve_separable", 0);
+		printf("convolve_separable: %10.3fms, local size %lux%lu, %d mults per output instead of %d\n",
+			separable_ms, (unsigned long)job.local_size[0], (unsigned long)job.local_size[1],
+			2 * mask_dim, mask_dim * mask_dim);
+		clReleaseMemObject(job.row);
+		clReleaseMemObject(job.col);
+		clReleaseMemObject(job.tmp);
 	}
-	if (num_devices < 1){
-		fprintf(stderr, "No devices available\n");
-		return NULL;
+	else {
+		printf("Mask isn't separable, using the 2D kernels only\n");
 	}
 
-	cl_device_id *devices = malloc(sizeof(cl_device_id) * num_devices);
-	err = clGetContextInfo(context, CL_CONTEXT_DEVICES, sizeof(cl_device_id) * num_devices,
-		devices, NULL);
-	if (check_cl_err(err, "Failed to get devices for context")){
-		free(devices);
-		return NULL;
+	//FFT results are rounded from float so they're only checked to within a tolerance
+	int tile_dim;
+	const conv_method_t method = convolve_pick_method(width, height, mask_dim, separable,
+		&tile_dim);
+	double fft_ms = -1;
+	if (tile_dim > 0){
+		job.fft = conv_fft_create(context, queue, program, mask, mask_dim, width, height,
+			tile_dim);
+		fft_ms = job.fft ? time_convolve(run_fft, "convolve_fft", &job) : -1;
+		printf("convolve_fft:       %10.3fms, %dx%d tiles, %d outputs per tile\n", fft_ms,
+			tile_dim, tile_dim, CONV_OUT_DIM(tile_dim, mask_dim) * CONV_OUT_DIM(tile_dim, mask_dim));
+		failed |= fft_ms < 0 || check_output(queue, job.out, expect, out_count, "convolve_fft",
+			CONV_FFT_TOLERANCE);
+		conv_fft_destroy(job.fft);
+	}
+	printf("Cost model picks %s (%s), estimated flops per output: direct %.0f",
+		conv_method_name(method), conv_method_kernel(method), convolve_direct_cost(mask_dim));
+	if (separable){
+		printf(", separable %.0f", convolve_separable_cost(mask_dim));
+	}
+	if (tile_dim > 0){
+		printf(", fft %.0f", convolve_fft_cost(width, height, mask_dim, &tile_dim));
+	}
+	printf("\n");
+	//Compare the pick to what actually ran fastest of the methods that ran, the direct
+	//method is the tiled kernel
+	const double method_ms[3] = { tiled_ms, separable_ms, fft_ms };
+	int fastest = -1;
+	for (int m = CONV_DIRECT; m <= CONV_FFT; ++m){
+		if (method_ms[m] >= 0 && (fastest < 0 || method_ms[m] < method_ms[fastest])){
+			fastest = m;
+		}
+	}
+	if (fastest >= 0){
+		printf("Fastest measured was %s (%s)\n", conv_method_name(fastest),
+			conv_method_kernel(fastest));
+	}
+	else {
+		printf("None of the methods ran\n");
 	}
 
-	//Create a command queue on the first device we can and use that device
-	for (size_t i = 0; i < num_devices; ++i){
-		cl_command_queue queue = clCreateCommandQueue(context, devices[i], 0, &err);
-		if (err == CL_SUCCESS){
-			*device = devices[i];
-			char name[64];
-			clGetDeviceInfo(*device, CL_DEVICE_NAME, 64, name, NULL);
-			printf("Selected device: %s\n", name);
-			free(devices);
-			return queue;
+	//The output buffer holds the result of the last method that ran
+	const char *shown = fft_ms >= 0 ? "convolve_fft" : separable_ms >= 0 ? "convolve_separable"
+		: tiled_ms >= 0 ? "convolve_tiled" : direct_ms >= 0 ? "convolve" : NULL;
+	cl_uint *out = NULL;
+	if (shown && out_w <= PRINT_MAX_DIM && out_h <= PRINT_MAX_DIM){
+		out = clEnqueueMapBuffer(queue, job.out, CL_TRUE, CL_MAP_READ, 0,
+			sizeof(cl_uint) * out_count, 0, NULL, profile_event("map out"), &err);
+		if (check_cl_err(err, "failed to map result")){
+			out = NULL;
+			failed = 1;
 		}
 	}
-	fprintf(stderr, "Failed to create a command queue for any device\n");
-	free(devices);
-	return NULL;
+	print_result(shown, out, out_w, out_h, failed);
+	if (out){
+		clEnqueueUnmapMemObject(queue, job.out, out, 0, NULL, profile_event("unmap out"));
+	}
+
+	clReleaseMemObject(job.in);
+	clReleaseMemObject(job.mask);
+	clReleaseMemObject(job.out);
+	free(in_signal);
+	free(mask);
+	free(row);
+	free(col);
+	free(expect);
+	for (int i = 0; i < 4; ++i){
+		clReleaseKernel(kernels[i]);
+	}
+	clReleaseProgram(program);
+	clReleaseCommandQueue(queue);
+	clReleaseContext(context);
+	return failed;
 }
 
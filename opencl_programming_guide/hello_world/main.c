@@ -8,25 +8,28 @@
 #endif
 
 #include "util.h"
+#include "device.h"
+#include "profile.h"
+#include "tune.h"
+#include "elementwise.h"
 #include "cl_program_dir.h"
 
 #define ARRAY_SIZE 16
 
-//Select the first available OpenCL platform and make a context on it
-cl_context get_first_platform();
-//OpenCL callback for reporting errors in the context
-void CL_CALLBACK cl_err_callback(const char *err_info, const void *priv_info, size_t cb, void *user);
-//Select the first available device and set it and its command queue up
-cl_command_queue get_first_device(cl_context context, cl_device_id *device);
-
 int main(int argc, char **argv){
-	cl_context context = get_first_platform();
 	cl_device_id device = 0;
-	cl_command_queue queue = get_first_device(context, &device);
+	cl_context context = select_device(&device);
+	if (!context){
+		return 1;
+	}
+	cl_int err = CL_SUCCESS;
+	cl_command_queue queue = profile_create_queue(context, device, 0, &err);
+	if (check_cl_err(err, "failed to create command queue")){
+		return 1;
+	}
 	char *prog_src = read_file(CL_PROGRAM("hello_world.cl"), NULL);
 	cl_program program = build_program(prog_src, context, device, NULL);
 	free(prog_src);
-	cl_int err = CL_SUCCESS;
 	cl_kernel kernel = clCreateKernel(program, "hello_world", &err);
 	check_cl_err(err, "failed to create kernel");
 
@@ -35,13 +38,14 @@ int main(int argc, char **argv){
 		mem_objs[i] = clCreateBuffer(context, CL_MEM_READ_ONLY, ARRAY_SIZE * sizeof(cl_float), NULL, &err);
 		check_cl_err(err, "failed to create buffer");
 	}
-	mem_objs[2] = clCreateBuffer(context, CL_MEM_WRITE_ONLY, ARRAY_SIZE * sizeof(cl_float), NULL, &err);
+	//c is also read by the fused kernel below
+	mem_objs[2] = clCreateBuffer(context, CL_MEM_READ_WRITE, ARRAY_SIZE * sizeof(cl_float), NULL, &err);
 	check_cl_err(err, "failed to create buffer");
 
 	cl_float* mem[3];
 	for (int i = 0; i < 3; ++i){
 		mem[i] = clEnqueueMapBuffer(queue, mem_objs[i], CL_FALSE, CL_MAP_WRITE, 0,
-			ARRAY_SIZE * sizeof(cl_float), 0, NULL, NULL, &err);
+			ARRAY_SIZE * sizeof(cl_float), 0, NULL, profile_event("map input"), &err);
 		check_cl_err(err, "failed to map buffer");
 	}
 	clFinish(queue);
@@ -51,24 +55,32 @@ int main(int argc, char **argv){
 		mem[2][i] = 0;
 	}
 	for (int i = 0; i < 3; ++i){
-		err = clEnqueueUnmapMemObject(queue, mem_objs[i], mem[i], 0, NULL, NULL);
+		err = clEnqueueUnmapMemObject(queue, mem_objs[i], mem[i], 0, NULL,
+			profile_event("unmap input"));
 		check_cl_err(err, "failed to unmap mem object");
 	}
 
 	size_t global_size[1] = { ARRAY_SIZE };
-	size_t local_size[1] = { 8 };
 	for (int i = 0; i < 3; ++i){
 		err = clSetKernelArg(kernel, i, sizeof(cl_mem), &mem_objs[i]);
 		check_cl_err(err, "failed to set kernel argument");
 	}
-	err = clSetKernelArg(kernel, 3, sizeof(size_t), &global_size[0]);
+	const cl_int n = ARRAY_SIZE;
+	err = clSetKernelArg(kernel, 3, sizeof(cl_int), &n);
 	check_cl_err(err, "failed to set kernel argument");
 
-	err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, global_size, local_size, 0, NULL, NULL);
+	size_t local_size[1];
+	if (tune_local_size(queue, kernel, 1, global_size, NULL, NULL, local_size)){
+		return 1;
+	}
+	size_t padded_size[1];
+	pad_global_size(1, global_size, local_size, padded_size);
+	err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, padded_size, local_size, 0, NULL,
+		profile_event("hello_world"));
 	check_cl_err(err, "failed to enqueue ND range kernel");
 	
 	mem[2] = clEnqueueMapBuffer(queue, mem_objs[2], CL_TRUE, CL_MAP_READ, 0,
-		ARRAY_SIZE * sizeof(cl_float), 0, NULL, NULL, &err);
+		ARRAY_SIZE * sizeof(cl_float), 0, NULL, profile_event("map result"), &err);
 	check_cl_err(err, "failed to map result");
 
 	printf("Result: ");
@@ -76,7 +88,31 @@ int main(int argc, char **argv){
 		printf("%.2f, ", mem[2][i]);
 	}
 	printf("\n");
-	clEnqueueUnmapMemObject(queue, mem_objs[2], mem[2], 0, 0, NULL);
+	clEnqueueUnmapMemObject(queue, mem_objs[2], mem[2], 0, NULL, profile_event("unmap result"));
+
+	//The same thing chained with a multiply as one generated kernel, c = a * b + (a + b)
+	elementwise_cache_t *fused = elementwise_cache_create(context, device);
+	const elementwise_kernel_t *fma_kernel = fused ? elementwise_get(fused, "c = a*b + c", NULL)
+		: NULL;
+	if (!fma_kernel){
+		return 1;
+	}
+	//The output comes first, then the inputs as they appear in the expression
+	const cl_mem fused_args[3] = { mem_objs[2], mem_objs[0], mem_objs[1] };
+	err = elementwise_enqueue(queue, fma_kernel, fused_args, NULL, ARRAY_SIZE,
+		profile_event("fused a*b + c"));
+	check_cl_err(err, "failed to enqueue fused kernel");
+
+	mem[2] = clEnqueueMapBuffer(queue, mem_objs[2], CL_TRUE, CL_MAP_READ, 0,
+		ARRAY_SIZE * sizeof(cl_float), 0, NULL, profile_event("map result"), &err);
+	check_cl_err(err, "failed to map result");
+	printf("Fused a*b + c: ");
+	for (int i = 0; i < ARRAY_SIZE; ++i){
+		printf("%.2f, ", mem[2][i]);
+	}
+	printf("\n");
+	clEnqueueUnmapMemObject(queue, mem_objs[2], mem[2], 0, NULL, profile_event("unmap result"));
+	elementwise_cache_destroy(fused);
 
 	for (int i = 0; i < 3; ++i){
 		clReleaseMemObject(mem_objs[i]);
@@ -87,68 +123,3 @@ int main(int argc, char **argv){
 	clReleaseContext(context);
 	return 0;
 }
-cl_context get_first_platform(){
-	cl_uint num_platforms;
-	cl_platform_id platform;
-	cl_int err = clGetPlatformIDs(1, &platform, &num_platforms);
-	if (check_cl_err(err, "Failed to find a platform") || num_platforms < 1){
-		return NULL;
-	}
-	char name[64];
-	err = clGetPlatformInfo(platform, CL_PLATFORM_NAME, 64, name, NULL);
-	//This error probably shouldn't happen, but check anyway
-	check_cl_err(err, "Failed to get platform name");
-	printf("Selecting platform: %s\n", name);
-
-	//Try to get a GPU context on the platform
-	cl_context_properties properties[] = {
-		CL_CONTEXT_PLATFORM, (cl_context_properties)platform, 0
-	};
-	cl_context context = clCreateContextFromType(properties, CL_DEVICE_TYPE_GPU,
-		cl_err_callback, NULL, &err);
-	if (check_cl_err(err, "Failed to create GPU context, retrying CPU")){
-		context = clCreateContextFromType(properties, CL_DEVICE_TYPE_CPU,
-			NULL, NULL, &err);
-		if (check_cl_err(err, "Failed to create a GPU or CPU context")){
-			return NULL;
-		}
-	}
-	return context;
-}
-void CL_CALLBACK cl_err_callback(const char *err_info, const void *priv_info, size_t cb, void *user){
-	printf("OpenCL context error: %s\n", err_info);
-}
-cl_command_queue get_first_device(cl_context context, cl_device_id *device){
-	size_t num_devices;
-	cl_int err = clGetContextInfo(context, CL_CONTEXT_NUM_DEVICES,
-		sizeof(num_devices), &num_devices, NULL);
-	if (check_cl_err(err, "Failed to get number of devices")){
-		return NULL;
-	}
-	if (num_devices < 1){
-		fprintf(stderr, "No devices available\n");
-		return NULL;
-	}
-
-	cl_device_id *devices = malloc(sizeof(cl_device_id) * num_devices);
-	err = clGetContextInfo(context, CL_CONTEXT_DEVICES, sizeof(cl_device_id) * num_devices,
-		devices, NULL);
-	if (check_cl_err(err, "Failed to get devices for context")){
-		free(devices);
-		return NULL;
-	}
-
-	//Create a command queue on the first device we can and use that device
-	for (size_t i = 0; i < num_devices; ++i){
-		cl_command_queue queue = clCreateCommandQueue(context, devices[i], 0, &err);
-		if (err == CL_SUCCESS){
-			*device = devices[i];
-			free(devices);
-			return queue;
-		}
-	}
-	fprintf(stderr, "Failed to create a command queue for any device\n");
-	free(devices);
-	return NULL;
-}
-
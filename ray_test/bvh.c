@@ -0,0 +1,273 @@
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "scene.h"
+#include "bvh.h"
+
+#define NUM_BINS 16
+//Leaves with this many spheres or fewer aren't split further
+#define MIN_LEAF 2
+//Leaves are split if it's worth it by SAH up to this size, and always past it
+#define MAX_LEAF 8
+//Relative cost of stepping through a node vs. testing a sphere
+#define TRAVERSAL_COST 1.0f
+#define INTERSECT_COST 1.0f
+
+typedef struct aabb_t {
+	float min[3], max[3];
+} aabb_t;
+
+typedef struct build_t {
+	//Bounds and centroid of each sphere, indexed by the original sphere index
+	aabb_t *bounds;
+	float (*centroids)[3];
+	//Sphere indices, partitioned in place as we build
+	size_t *indices;
+	bvh_node_t *nodes;
+	size_t n_nodes;
+} build_t;
+
+static void aabb_empty(aabb_t *b){
+	for (int i = 0; i < 3; ++i){
+		b->min[i] = FLT_MAX;
+		b->max[i] = -FLT_MAX;
+	}
+}
+static void aabb_grow(aabb_t *b, const aabb_t *o){
+	for (int i = 0; i < 3; ++i){
+		b->min[i] = o->min[i] < b->min[i] ? o->min[i] : b->min[i];
+		b->max[i] = o->max[i] > b->max[i] ? o->max[i] : b->max[i];
+	}
+}
+static float aabb_area(const aabb_t *b){
+	float d[3];
+	for (int i = 0; i < 3; ++i){
+		d[i] = b->max[i] - b->min[i];
+		if (d[i] < 0){
+			return 0;
+		}
+	}
+	return 2.0f * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+}
+static void make_leaf(bvh_node_t *node, size_t start, size_t end){
+	node->offset = start;
+	node->count = end - start;
+}
+//Find the best binned SAH split, returns 1 if splitting beats making a leaf
+static int find_split(build_t *b, size_t start, size_t end, const aabb_t *bounds, int *best_axis,
+	float *best_pos)
+{
+	const size_t count = end - start;
+	aabb_t cbounds;
+	aabb_empty(&cbounds);
+	for (size_t i = start; i < end; ++i){
+		const float *c = b->centroids[b->indices[i]];
+		aabb_t p = {{ c[0], c[1], c[2] }, { c[0], c[1], c[2] }};
+		aabb_grow(&cbounds, &p);
+	}
+	float best_cost = FLT_MAX;
+	*best_axis = -1;
+	for (int axis = 0; axis < 3; ++axis){
+		const float lo = cbounds.min[axis], extent = cbounds.max[axis] - lo;
+		if (extent <= 0){
+			continue;
+		}
+		aabb_t bins[NUM_BINS];
+		size_t counts[NUM_BINS] = { 0 };
+		for (int i = 0; i < NUM_BINS; ++i){
+			aabb_empty(&bins[i]);
+		}
+		for (size_t i = start; i < end; ++i){
+			const size_t idx = b->indices[i];
+			int bin = (int)(NUM_BINS * (b->centroids[idx][axis] - lo) / extent);
+			bin = bin >= NUM_BINS ? NUM_BINS - 1 : bin;
+			++counts[bin];
+			aabb_grow(&bins[bin], &b->bounds[idx]);
+		}
+		//Sweep from the right to get the area and count of everything right of each plane
+		float right_area[NUM_BINS];
+		size_t right_count[NUM_BINS];
+		aabb_t acc;
+		aabb_empty(&acc);
+		size_t n = 0;
+		for (int i = NUM_BINS - 1; i > 0; --i){
+			aabb_grow(&acc, &bins[i]);
+			n += counts[i];
+			right_area[i] = aabb_area(&acc);
+			right_count[i] = n;
+		}
+		aabb_empty(&acc);
+		n = 0;
+		for (int i = 0; i < NUM_BINS - 1; ++i){
+			aabb_grow(&acc, &bins[i]);
+			n += counts[i];
+			if (n == 0 || right_count[i + 1] == 0){
+				continue;
+			}
+			float cost = aabb_area(&acc) * n + right_area[i + 1] * right_count[i + 1];
+			if (cost < best_cost){
+				best_cost = cost;
+				*best_axis = axis;
+				*best_pos = lo + extent * (i + 1) / NUM_BINS;
+			}
+		}
+	}
+	if (*best_axis < 0){
+		return 0;
+	}
+	const float area = aabb_area(bounds);
+	const float split_cost = TRAVERSAL_COST + INTERSECT_COST * best_cost / (area > 0 ? area : 1);
+	return count > MAX_LEAF || split_cost < INTERSECT_COST * count;
+}
+static void build_node(build_t *b, size_t node_idx, size_t start, size_t end, int depth){
+	bvh_node_t *node = &b->nodes[node_idx];
+	aabb_t bounds;
+	aabb_empty(&bounds);
+	for (size_t i = start; i < end; ++i){
+		aabb_grow(&bounds, &b->bounds[b->indices[i]]);
+	}
+	memcpy(node->min, bounds.min, sizeof(bounds.min));
+	memcpy(node->max, bounds.max, sizeof(bounds.max));
+
+	int axis;
+	float pos;
+	//The traversal stack holds at most one node per level so we can't go past it
+	if (end - start <= MIN_LEAF || depth >= BVH_MAX_DEPTH - 1
+		|| !find_split(b, start, end, &bounds, &axis, &pos))
+	{
+		make_leaf(node, start, end);
+		return;
+	}
+	size_t mid = start;
+	for (size_t i = start; i < end; ++i){
+		if (b->centroids[b->indices[i]][axis] < pos){
+			size_t tmp = b->indices[i];
+			b->indices[i] = b->indices[mid];
+			b->indices[mid++] = tmp;
+		}
+	}
+	//Can only happen through float rounding of the bin positions, fall back to a median split
+	if (mid == start || mid == end){
+		mid = start + (end - start) / 2;
+	}
+	//Left child directly follows its parent, right child comes after the left subtree
+	const size_t left = b->n_nodes++;
+	build_node(b, left, start, mid, depth + 1);
+	const size_t right = b->n_nodes++;
+	b->nodes[node_idx].offset = right;
+	b->nodes[node_idx].count = 0;
+	build_node(b, right, mid, end, depth + 1);
+}
+size_t bvh_build(sphere_t *spheres, size_t n, bvh_node_t **nodes){
+	build_t b;
+	b.bounds = malloc(sizeof(aabb_t) * n);
+	b.centroids = malloc(sizeof(float[3]) * n);
+	b.indices = malloc(sizeof(size_t) * n);
+	//A binary tree with at least one sphere per leaf has at most 2n - 1 nodes
+	b.nodes = malloc(sizeof(bvh_node_t) * (n > 0 ? 2 * n - 1 : 1));
+	b.n_nodes = 1;
+	for (size_t i = 0; i < n; ++i){
+		for (int j = 0; j < 3; ++j){
+			b.bounds[i].min[j] = spheres[i].center.s[j] - spheres[i].radius;
+			b.bounds[i].max[j] = spheres[i].center.s[j] + spheres[i].radius;
+			b.centroids[i][j] = spheres[i].center.s[j];
+		}
+		b.indices[i] = i;
+	}
+	build_node(&b, 0, 0, n, 0);
+
+	//Put the spheres in leaf order so leaves reference contiguous ranges
+	sphere_t *sorted = malloc(sizeof(sphere_t) * n);
+	for (size_t i = 0; i < n; ++i){
+		sorted[i] = spheres[b.indices[i]];
+	}
+	memcpy(spheres, sorted, sizeof(sphere_t) * n);
+	free(sorted);
+	free(b.bounds);
+	free(b.centroids);
+	free(b.indices);
+	*nodes = b.nodes;
+	return b.n_nodes;
+}
+//Same slab test as intersect_node in ray_test.cl, returns the entry distance or FLT_MAX on a miss
+static float intersect_node(const float orig[3], const float dir[3], float t_max,
+	const bvh_node_t *node)
+{
+	float t_enter = 0, t_exit = FLT_MAX;
+	for (int i = 0; i < 3; ++i){
+		//Rays parallel to a slab never cross it so they must start inside it
+		if (dir[i] == 0){
+			if (orig[i] < node->min[i] || orig[i] > node->max[i]){
+				return FLT_MAX;
+			}
+			continue;
+		}
+		float inv_dir = 1.0f / dir[i];
+		float t0 = (node->min[i] - orig[i]) * inv_dir;
+		float t1 = (node->max[i] - orig[i]) * inv_dir;
+		t_enter = fmaxf(t_enter, fminf(t0, t1));
+		t_exit = fminf(t_exit, fmaxf(t0, t1));
+	}
+	return t_enter <= t_exit && t_enter <= t_max ? t_enter : FLT_MAX;
+}
+void cast_rays_bvh_host(const camera_t *cam, const sphere_t *spheres, const bvh_node_t *nodes,
+	char *img, int width, int height)
+{
+	for (size_t px = 0; px < (size_t)width * height; ++px){
+		float orig[3], dir[3];
+		camera_ray(cam, px % width, px / width, orig, dir);
+		float t = FLT_MAX;
+		int hit = 0;
+		size_t stack[BVH_MAX_DEPTH];
+		size_t stack_size = 0;
+		size_t current = 0;
+		if (intersect_node(orig, dir, t, &nodes[0]) == FLT_MAX){
+			continue;
+		}
+		for (;;){
+			const bvh_node_t *node = &nodes[current];
+			if (node->count > 0){
+				for (size_t i = node->offset; i < node->offset + node->count; ++i){
+					hit |= intersect_sphere(orig, dir, &t, &spheres[i]);
+				}
+			}
+			else {
+				const size_t l = current + 1, r = node->offset;
+				const float tl = intersect_node(orig, dir, t, &nodes[l]);
+				const float tr = intersect_node(orig, dir, t, &nodes[r]);
+				if (tl != FLT_MAX && tr != FLT_MAX){
+					current = tl <= tr ? l : r;
+					stack[stack_size++] = tl <= tr ? r : l;
+					continue;
+				}
+				if (tl != FLT_MAX || tr != FLT_MAX){
+					current = tl != FLT_MAX ? l : r;
+					continue;
+				}
+			}
+			//Pop until we find a node that's still closer than the closest hit
+			for (;;){
+				if (stack_size == 0){
+					goto done;
+				}
+				current = stack[--stack_size];
+				if (intersect_node(orig, dir, t, &nodes[current]) != FLT_MAX){
+					break;
+				}
+			}
+		}
+done:
+		if (hit){
+			img[px] = hit_char(t);
+		}
+	}
+}
+
@@ -0,0 +1,46 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <stddef.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "scene.h"
+
+/*
+ * Deepest the BVH is allowed to get, this is also the size of the traversal stack
+ * in cast_rays_bvh so the two must match
+ */
+#define BVH_MAX_DEPTH 32
+
+/*
+ * A node of the flattened BVH, matches bvh_node_t in ray_test.cl. Nodes are stored
+ * depth first so an interior node's left child directly follows it and offset is the
+ * index of its right child. Leaves have count > 0 and hold spheres [offset, offset + count)
+ */
+typedef struct bvh_node_t {
+	cl_float min[3];
+	cl_uint offset;
+	cl_float max[3];
+	cl_uint count;
+} bvh_node_t;
+
+/*
+ * Build a BVH over the spheres with a binned SAH builder. The spheres are reordered so
+ * each leaf's spheres are contiguous, the caller must free the returned nodes
+ * returns the number of nodes written to nodes
+ */
+size_t bvh_build(sphere_t *spheres, size_t n, bvh_node_t **nodes);
+/*
+ * Cast the rays on the host by traversing the BVH, giving the same image as
+ * cast_rays_host would for the reordered spheres
+ */
+void cast_rays_bvh_host(const camera_t *cam, const sphere_t *spheres, const bvh_node_t *nodes,
+	char *img, int width, int height);
+
+#endif
+
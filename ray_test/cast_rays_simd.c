@@ -0,0 +1,171 @@
+#include <float.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "simd.h"
+#include "thread_pool.h"
+#include "scene.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86_SIMD
+#include <immintrin.h>
+#endif
+
+//Rays traced together, one per lane for AVX2 and two groups of four for SSE4.1
+#define LANES 8
+//Image rows handed to a thread at a time
+#define ROW_GRAIN 4
+
+typedef struct rays_t {
+	const camera_t *cam;
+	const sphere_t *spheres;
+	size_t n_objs;
+	char *img;
+	int width;
+	simd_level_t level;
+} rays_t;
+
+//Rays for a group of pixels, one lane each with the components split out
+typedef struct ray_group_t {
+	float orig[3][LANES], dir[3][LANES];
+} ray_group_t;
+
+#ifdef X86_SIMD
+/*
+ * Intersect 8 rays with every sphere, writing each one's closest hit distance to t or
+ * FLT_MAX if it misses. The math is ordered the same as intersect_sphere so the hits
+ * match the host reference exactly
+ */
+__attribute__((target("avx2")))
+static void trace_avx2(const rays_t *c, const ray_group_t *g, float t[LANES]){
+	__m256 o[3], d[3];
+	for (int i = 0; i < 3; ++i){
+		o[i] = _mm256_loadu_ps(g->orig[i]);
+		d[i] = _mm256_loadu_ps(g->dir[i]);
+	}
+	const __m256 zero = _mm256_setzero_ps();
+	__m256 t_max = _mm256_set1_ps(FLT_MAX);
+	for (size_t i = 0; i < c->n_objs; ++i){
+		const sphere_t *sphere = &c->spheres[i];
+		__m256 l0 = _mm256_sub_ps(_mm256_set1_ps(sphere->center.s[0]), o[0]);
+		__m256 l1 = _mm256_sub_ps(_mm256_set1_ps(sphere->center.s[1]), o[1]);
+		__m256 l2 = _mm256_sub_ps(_mm256_set1_ps(sphere->center.s[2]), o[2]);
+		__m256 l_sqr = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(l0, l0), _mm256_mul_ps(l1, l1)),
+			_mm256_mul_ps(l2, l2));
+		__m256 s = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(l0, d[0]), _mm256_mul_ps(l1, d[1])),
+			_mm256_mul_ps(l2, d[2]));
+		__m256 r_sqr = _mm256_set1_ps(sphere->radius * sphere->radius);
+		__m256 outside = _mm256_cmp_ps(l_sqr, r_sqr, _CMP_GT_OQ);
+		__m256 m_sqr = _mm256_sub_ps(l_sqr, _mm256_mul_ps(s, s));
+		__m256 miss = _mm256_or_ps(_mm256_and_ps(_mm256_cmp_ps(s, zero, _CMP_LT_OQ), outside),
+			_mm256_cmp_ps(m_sqr, r_sqr, _CMP_GT_OQ));
+		//Lanes that missed may take the root of a negative, their NaN never compares less
+		__m256 q = _mm256_sqrt_ps(_mm256_sub_ps(r_sqr, m_sqr));
+		__m256 dist = _mm256_blendv_ps(_mm256_add_ps(s, q), _mm256_sub_ps(s, q), outside);
+		__m256 hit = _mm256_andnot_ps(miss, _mm256_cmp_ps(dist, t_max, _CMP_LT_OQ));
+		t_max = _mm256_blendv_ps(t_max, dist, hit);
+	}
+	_mm256_storeu_ps(t, t_max);
+}
+//The same for 4 rays starting at lane first, blendv needs SSE4.1
+__attribute__((target("sse4.1")))
+static void trace_sse41(const rays_t *c, const ray_group_t *g, int first, float t[LANES]){
+	__m128 o[3], d[3];
+	for (int i = 0; i < 3; ++i){
+		o[i] = _mm_loadu_ps(g->orig[i] + first);
+		d[i] = _mm_loadu_ps(g->dir[i] + first);
+	}
+	const __m128 zero = _mm_setzero_ps();
+	__m128 t_max = _mm_set1_ps(FLT_MAX);
+	for (size_t i = 0; i < c->n_objs; ++i){
+		const sphere_t *sphere = &c->spheres[i];
+		__m128 l0 = _mm_sub_ps(_mm_set1_ps(sphere->center.s[0]), o[0]);
+		__m128 l1 = _mm_sub_ps(_mm_set1_ps(sphere->center.s[1]), o[1]);
+		__m128 l2 = _mm_sub_ps(_mm_set1_ps(sphere->center.s[2]), o[2]);
+		__m128 l_sqr = _mm_add_ps(_mm_add_ps(_mm_mul_ps(l0, l0), _mm_mul_ps(l1, l1)),
+			_mm_mul_ps(l2, l2));
+		__m128 s = _mm_add_ps(_mm_add_ps(_mm_mul_ps(l0, d[0]), _mm_mul_ps(l1, d[1])),
+			_mm_mul_ps(l2, d[2]));
+		__m128 r_sqr = _mm_set1_ps(sphere->radius * sphere->radius);
+		__m128 outside = _mm_cmpgt_ps(l_sqr, r_sqr);
+		__m128 m_sqr = _mm_sub_ps(l_sqr, _mm_mul_ps(s, s));
+		__m128 miss = _mm_or_ps(_mm_and_ps(_mm_cmplt_ps(s, zero), outside),
+			_mm_cmpgt_ps(m_sqr, r_sqr));
+		__m128 q = _mm_sqrt_ps(_mm_sub_ps(r_sqr, m_sqr));
+		__m128 dist = _mm_blendv_ps(_mm_add_ps(s, q), _mm_sub_ps(s, q), outside);
+		__m128 hit = _mm_andnot_ps(miss, _mm_cmplt_ps(dist, t_max));
+		t_max = _mm_blendv_ps(t_max, dist, hit);
+	}
+	_mm_storeu_ps(t + first, t_max);
+}
+#endif
+//Trace the rays one at a time with intersect_sphere
+static void trace_scalar(const rays_t *c, const ray_group_t *g, float t[LANES]){
+	for (int l = 0; l < LANES; ++l){
+		const float orig[3] = { g->orig[0][l], g->orig[1][l], g->orig[2][l] };
+		const float dir[3] = { g->dir[0][l], g->dir[1][l], g->dir[2][l] };
+		t[l] = FLT_MAX;
+		for (size_t i = 0; i < c->n_objs; ++i){
+			intersect_sphere(orig, dir, &t[l], &c->spheres[i]);
+		}
+	}
+}
+static void cast_rows(void *arg, size_t begin, size_t end){
+	const rays_t *c = arg;
+	ray_group_t g;
+	float t[LANES];
+	for (size_t y = begin; y < end; ++y){
+		for (int x = 0; x < c->width; x += LANES){
+			//Lanes past the end of the row trace rays that are thrown away
+			for (int l = 0; l < LANES; ++l){
+				float orig[3], dir[3];
+				camera_ray(c->cam, x + l, y, orig, dir);
+				for (int i = 0; i < 3; ++i){
+					g.orig[i][l] = orig[i];
+					g.dir[i][l] = dir[i];
+				}
+			}
+#ifdef X86_SIMD
+			if (c->level == SIMD_AVX2){
+				trace_avx2(c, &g, t);
+			}
+			else if (c->level == SIMD_SSE41){
+				trace_sse41(c, &g, 0, t);
+				trace_sse41(c, &g, 4, t);
+			}
+			else
+#endif
+			{
+				trace_scalar(c, &g, t);
+			}
+			for (int l = 0; l < LANES && x + l < c->width; ++l){
+				if (t[l] < FLT_MAX){
+					c->img[y * c->width + x + l] = hit_char(t[l]);
+				}
+			}
+		}
+	}
+}
+void cast_rays_host_simd(thread_pool_t *pool, const camera_t *cam, const sphere_t *spheres,
+	size_t n_objs, char *img, int width, int height)
+{
+	rays_t c = {
+		.cam = cam,
+		.spheres = spheres,
+		.n_objs = n_objs,
+		.img = img,
+		.width = width,
+		.level = simd_level()
+	};
+	if (pool){
+		thread_pool_run(pool, height, ROW_GRAIN, cast_rows, &c);
+	}
+	else {
+		cast_rows(&c, 0, height);
+	}
+}
+
@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 
 #ifdef __APPLE__
 #include <OpenCL/cl.h>
@@ -8,53 +10,357 @@
 #endif
 
 #include "util.h"
+#include "device.h"
+#include "profile.h"
+#include "prog_cache.h"
+#include "scene.h"
+#include "bvh.h"
+#include "render.h"
+#include "tile_sched.h"
+#include "wavefront.h"
+#include "progressive.h"
+#include "tune.h"
+#include "task_graph.h"
 #include "cl_program_dir.h"
 
 #define IMG_DIM 16
 #define N_OBJS 3
+//Progressive rendering stops once the RMS change between read backs is under half an 8 bit level
+#define CONVERGED_RMS (0.5 / 255.0)
+//Set by the SPHERE_LAYOUT CMake option
+#ifndef RAY_TEST_SPHERE_LAYOUT
+#define RAY_TEST_SPHERE_LAYOUT SPHERE_PACKED
+#endif
 
-typedef struct sphere_t {
-	cl_float3 center;
-	float radius;
-} sphere_t;
+//Set up the camera looking at the random spheres for a width x height image
+static void scene_camera(camera_t *camera, int width, int height, int pinhole){
+	if (pinhole){
+		const float pos[3] = { width / 2.0f, height / 2.0f, -(width > height ? width : height) };
+		const float target[3] = { width / 2.0f, height / 2.0f, 0 };
+		const float up[3] = { 0, 1, 0 };
+		look_at_camera(camera, CAMERA_PINHOLE, pos, target, up, 60, width, height);
+	}
+	else {
+		grid_camera(camera, width, height);
+	}
+}
+/*
+ * Make n random spheres for a width x height image and build their BVH, the caller must
+ * free the nodes and the returned spheres, packed in RAY_TEST_SPHERE_LAYOUT
+ */
+static void* random_scene(size_t n, int width, int height, bvh_node_t **nodes, size_t *n_nodes){
+	sphere_t *spheres = malloc(sizeof(sphere_t) * n);
+	random_spheres(spheres, n, width, height, 1);
+	*n_nodes = bvh_build(spheres, n, nodes);
+	void *packed = malloc(sphere_buffer_size(RAY_TEST_SPHERE_LAYOUT, n));
+	pack_spheres(spheres, n, RAY_TEST_SPHERE_LAYOUT, packed);
+	free(spheres);
+	return packed;
+}
+//Options for progressive rendering, it's off when max_samples is 0
+typedef struct progressive_opts_t {
+	size_t max_samples;
+	//Samples per pixel each iteration adds and iterations between read backs
+	cl_uint spp;
+	int readback;
+} progressive_opts_t;
 
-//Select the first platform with the desired device type
-cl_context get_platform(cl_device_type type);
-//OpenCL callback for reporting errors in the context
-void CL_CALLBACK cl_err_callback(const char *err_info, const void *priv_info, size_t cb, void *user);
-//Select the first available device and set it and its command queue up
-cl_command_queue get_first_device(cl_context context, cl_device_id *device);
+//Get the RMS difference between the color channels of two n pixel images
+static double rms_diff(const cl_float4 *a, const cl_float4 *b, size_t n){
+	double sum = 0;
+	for (size_t i = 0; i < n; ++i){
+		for (int c = 0; c < 3; ++c){
+			const double d = a[i].s[c] - b[i].s[c];
+			sum += d * d;
+		}
+	}
+	return sqrt(sum / (3.0 * n));
+}
+/*
+ * Render the scene to path progressively, adding opts->spp samples per pixel an iteration
+ * until opts->max_samples have been taken or the image stops changing between read backs
+ * returns 1 on failure
+ */
+static int render_progressive_image(cl_context context, cl_command_queue queue,
+	cl_program program, const render_scene_t *scene, int width, int height,
+	const progressive_opts_t *opts, const char *path)
+{
+	image_format_t format;
+	if (image_format_from_path(path, &format)){
+		fprintf(stderr, "Can't tell the image format of %s, use .pfm or .ppm\n", path);
+		return 1;
+	}
+	progressive_t *prog = progressive_create(context, queue, program, scene, width, height);
+	if (!prog){
+		return 1;
+	}
+	const size_t n_px = (size_t)width * height;
+	cl_float4 *img = malloc(sizeof(cl_float4) * n_px);
+	cl_float4 *prev = malloc(sizeof(cl_float4) * n_px);
+	int failed = 0, have_prev = 0, converged = 0;
+	double rms = 0;
+	const double start = wall_time();
+	for (int i = 1; !failed && !converged && progressive_samples(prog) < opts->max_samples; ++i){
+		failed = progressive_step(prog, opts->spp);
+		if (failed || (i % opts->readback != 0 && progressive_samples(prog) < opts->max_samples)){
+			continue;
+		}
+		failed = progressive_read(prog, img);
+		if (!failed && have_prev){
+			rms = rms_diff(img, prev, n_px);
+			converged = rms < CONVERGED_RMS;
+		}
+		cl_float4 *tmp = prev;
+		prev = img;
+		img = tmp;
+		have_prev = 1;
+	}
+	const double elapsed = wall_time() - start;
+	if (!failed){
+		const size_t samples = progressive_samples(prog);
+		printf("Rendered %dx%d with %u spheres at %lu samples per pixel in %.2fms,"
+			" %.2fM samples/s\n", width, height, scene->n_objs, (unsigned long)samples,
+			elapsed * 1000.0, samples * n_px / elapsed * 1e-6);
+		if (converged){
+			printf("Converged after %lu samples per pixel in %.2fms, RMS change %.5f\n",
+				(unsigned long)samples, elapsed * 1000.0, rms);
+		}
+		else {
+			printf("Didn't converge, RMS change at the last read back %.5f\n", rms);
+		}
+		//prev holds the latest read back
+		if (format == IMAGE_PPM){
+			cl_uchar4 *rgba8 = (cl_uchar4*)img;
+			for (size_t p = 0; p < n_px; ++p){
+				for (int c = 0; c < 4; ++c){
+					const float v = prev[p].s[c] < 0 ? 0 : prev[p].s[c] > 1 ? 1 : prev[p].s[c];
+					rgba8[p].s[c] = (cl_uchar)(v * 255.0f + 0.5f);
+				}
+			}
+			failed = write_image(path, rgba8, width, height);
+		}
+		else {
+			failed = write_image(path, prev, width, height);
+		}
+	}
+	free(img);
+	free(prev);
+	progressive_destroy(prog);
+	return failed;
+}
+/*
+ * Render the scene to path as wavefronts with up to bounces bounces, printing the rays
+ * traced at each bounce
+ * returns 1 on failure
+ */
+static int render_wavefront_image(cl_context context, cl_device_id device,
+	cl_command_queue queue, cl_program program, const render_scene_t *scene, int width,
+	int height, int bounces, const char *path)
+{
+	image_format_t format;
+	if (image_format_from_path(path, &format)){
+		fprintf(stderr, "Can't tell the image format of %s, use .pfm or .ppm\n", path);
+		return 1;
+	}
+	primitives_t *prim = primitives_create(context, device);
+	const size_t px_size = format == IMAGE_PFM ? sizeof(cl_float4) : sizeof(cl_uchar4);
+	void *img = malloc(px_size * width * height);
+	wavefront_stats_t stats;
+	double start = wall_time();
+	int failed = !prim || render_wavefront(context, device, queue, program, prim, scene, width,
+		height, bounces, format, img, &stats);
+	if (!failed){
+		printf("Rendered %dx%d with %u spheres and %d bounces as wavefronts in %.2fms\n",
+			width, height, scene->n_objs, bounces, (wall_time() - start) * 1000.0);
+		print_wavefront_stats(&stats);
+		failed = write_image(path, img, width, height);
+	}
+	free(img);
+	primitives_destroy(prim);
+	return failed;
+}
+/*
+ * Render a width x height image of n random spheres to path through the BVH, as wavefronts
+ * with up to bounces bounces if bounces isn't 0 or progressively if progressive is on
+ * returns 1 on failure
+ */
+static int render_image(cl_context context, cl_device_id device, cl_command_queue queue,
+	cl_program program, const char *path, int width, int height, size_t n, int pinhole,
+	int bounces, const progressive_opts_t *progressive)
+{
+	bvh_node_t *nodes = NULL;
+	size_t n_nodes;
+	void *packed = random_scene(n, width, height, &nodes, &n_nodes);
 
-int main(int argc, char **argv){
-	cl_context context = get_platform(CL_DEVICE_TYPE_GPU);
-	cl_device_id device = 0;
-	cl_command_queue queue = get_first_device(context, &device);
+	render_scene_t scene = { .n_objs = n };
+	scene_camera(&scene.camera, width, height, pinhole);
+	cl_int err;
+	scene.objects = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+		sphere_buffer_size(RAY_TEST_SPHERE_LAYOUT, n), packed, &err);
+	scene.nodes = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+		sizeof(bvh_node_t) * n_nodes, nodes, &err);
+	free(nodes);
+	free(packed);
+	int failed = check_cl_err(err, "failed to upload scene");
+	if (!failed && progressive->max_samples > 0){
+		failed = render_progressive_image(context, queue, program, &scene, width, height,
+			progressive, path);
+	}
+	else if (!failed && bounces > 0){
+		failed = render_wavefront_image(context, device, queue, program, &scene, width, height,
+			bounces, path);
+	}
+	else if (!failed){
+		double start = wall_time();
+		failed = render_to_file(context, device, queue, program, &scene, width, height, path, 0);
+		if (!failed){
+			printf("Rendered %dx%d with %lu spheres to %s in %.2fms\n", width, height,
+				(unsigned long)n, path, (wall_time() - start) * 1000.0);
+		}
+	}
+	clReleaseMemObject(scene.objects);
+	clReleaseMemObject(scene.nodes);
+	return failed;
+}
+/*
+ * Render a width x height image of n random spheres to path in tiles spread over up to
+ * max_devices of the fastest devices, printing how many tiles each one took. Pass 0 for
+ * tile_size to pick one from the image size and device count
+ * returns 1 on failure
+ */
+static int render_image_tiles(size_t max_devices, const char *path, int width, int height,
+	size_t n, int pinhole, int tile_size)
+{
+	image_format_t format;
+	if (image_format_from_path(path, &format)){
+		fprintf(stderr, "Can't tell the image format of %s, use .pfm or .ppm\n", path);
+		return 1;
+	}
+	device_t *devices = malloc(sizeof(device_t) * max_devices);
+	size_t n_devices = select_devices(devices, max_devices);
 	char *prog_src = read_file(CL_PROGRAM("ray_test.cl"), NULL);
-	cl_program program = build_program(prog_src, context, device, NULL);
-	free(prog_src);
-	cl_int err = CL_SUCCESS;
-	cl_kernel kernel = clCreateKernel(program, "cast_rays", &err);
-	check_cl_err(err, "failed to create kernel");
-
-	cl_mem mem_ray_start = clCreateBuffer(context, CL_MEM_READ_ONLY,
-		IMG_DIM * IMG_DIM * sizeof(cl_float3), NULL, &err);
-	check_cl_err(err, "failed to create buffer");
-
-	cl_mem mem_spheres = clCreateBuffer(context, CL_MEM_READ_ONLY,
-		N_OBJS * sizeof(sphere_t), NULL, &err);
-	check_cl_err(err, "failed to create buffer");
+	if (n_devices == 0 || !prog_src){
+		free(devices);
+		free(prog_src);
+		return 1;
+	}
+	printf("Selected devices:\n");
+	print_devices(devices, n_devices);
+	if (tile_size <= 0){
+		tile_size = pick_tile_size(width, height, n_devices);
+	}
 
-	cl_mem mem_img = clCreateBuffer(context, CL_MEM_WRITE_ONLY, IMG_DIM * IMG_DIM * sizeof(cl_char),
-		NULL, &err);
-	check_cl_err(err, "failed to create buffer");
+	tile_scene_t scene = {
+		.objects_size = sphere_buffer_size(RAY_TEST_SPHERE_LAYOUT, n),
+		.n_objs = n
+	};
+	bvh_node_t *nodes = NULL;
+	scene.objects = random_scene(n, width, height, &nodes, &scene.n_nodes);
+	scene.nodes = nodes;
+	scene_camera(&scene.camera, width, height, pinhole);
 
-	cl_float3 *ray_starts = clEnqueueMapBuffer(queue, mem_ray_start, CL_FALSE, CL_MAP_WRITE,
-		0, IMG_DIM * IMG_DIM * sizeof(cl_float3), 0, NULL, NULL, &err);
-	check_cl_err(err, "failed to create buffer");
+	const size_t px_size = format == IMAGE_PFM ? sizeof(cl_float4) : sizeof(cl_uchar4);
+	void *img = malloc(px_size * width * height);
+	tile_report_t *report = malloc(sizeof(tile_report_t) * n_devices);
+	double start = wall_time();
+	int failed = render_tiles(devices, n_devices, prog_src,
+		sphere_layout_options(RAY_TEST_SPHERE_LAYOUT), &scene, format, width, height, tile_size,
+		img, report);
+	if (!failed){
+		printf("Rendered %dx%d with %lu spheres in %dx%d tiles on %lu devices in %.2fms\n",
+			width, height, (unsigned long)n, tile_size, tile_size, (unsigned long)n_devices,
+			(wall_time() - start) * 1000.0);
+		print_tile_report(report, n_devices);
+		failed = write_image(path, img, width, height);
+	}
+	free((void*)scene.objects);
+	free(nodes);
+	free(img);
+	free(report);
+	free(prog_src);
+	free(devices);
+	return failed;
+}
+//Print the ASCII image with a border
+static void print_image(const char *img){
+	for (int i = 0; i < IMG_DIM; ++i){
+		printf("| ");
+		for (int j = 0; j < IMG_DIM; ++j){
+			printf("%c", img[i * IMG_DIM + j]);
+		}
+		printf(" |\n");
+	}
+}
 
-	sphere_t *spheres = clEnqueueMapBuffer(queue, mem_spheres, CL_TRUE, CL_MAP_WRITE,
-		0, N_OBJS * sizeof(sphere_t), 0, NULL, NULL, &err);
-	check_cl_err(err, "failed to map buffer");
+int main(int argc, char **argv){
+	int pinhole = 0;
+	const char *render_path = NULL;
+	int render_width = 0, render_height = 0;
+	size_t render_spheres = 1024;
+	size_t render_devices = 1;
+	int tile_size = 0;
+	int bounces = 0;
+	progressive_opts_t progressive = { .max_samples = 0, .spp = 1, .readback = 16 };
+	for (int i = 1; i < argc; ++i){
+		if (strcmp(argv[i], "-pinhole") == 0){
+			pinhole = 1;
+		}
+		else if (strcmp(argv[i], "-render") == 0 && i + 3 < argc){
+			render_path = argv[++i];
+			render_width = atoi(argv[++i]);
+			render_height = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-spheres") == 0 && i + 1 < argc){
+			render_spheres = strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "-devices") == 0 && i + 1 < argc){
+			render_devices = strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "-tile") == 0 && i + 1 < argc){
+			tile_size = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-wavefront") == 0 && i + 1 < argc){
+			bounces = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-progressive") == 0 && i + 1 < argc){
+			progressive.max_samples = strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "-spp") == 0 && i + 1 < argc){
+			progressive.spp = strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "-readback") == 0 && i + 1 < argc){
+			progressive.readback = atoi(argv[++i]);
+		}
+		else {
+			fprintf(stderr, "Usage: %s [-pinhole] [-render out.ppm|out.pfm width height]"
+				" [-spheres n] [-devices n] [-tile size] [-wavefront bounces]"
+				" [-progressive max_spp [-spp n] [-readback iterations]]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (render_path && (render_width <= 0 || render_height <= 0 || render_spheres == 0
+		|| render_devices == 0))
+	{
+		fprintf(stderr, "Render size, sphere and device counts must be positive\n");
+		return 1;
+	}
+	if (bounces < 0 || bounces > WAVEFRONT_MAX_BOUNCES || (bounces && render_devices > 1)){
+		fprintf(stderr, "Wavefront rendering takes 1 to %d bounces on one device\n",
+			WAVEFRONT_MAX_BOUNCES);
+		return 1;
+	}
+	if (progressive.max_samples && (progressive.spp == 0 || progressive.readback <= 0
+		|| bounces || render_devices > 1))
+	{
+		fprintf(stderr, "Progressive rendering needs positive -spp and -readback on one device"
+			" without -wavefront\n");
+		return 1;
+	}
+	if (render_path && render_devices > 1){
+		return render_image_tiles(render_devices, render_path, render_width, render_height,
+			render_spheres, pinhole, tile_size);
+	}
+	sphere_t spheres[N_OBJS];
 	spheres[0] = (sphere_t){
 		.center = {{ IMG_DIM / 2 - 1, IMG_DIM / 2 - 1, 3 }},
 		.radius = 2.9
@@ -67,123 +373,112 @@ int main(int argc, char **argv){
 		.center = {{ IMG_DIM - 2, IMG_DIM - 4, 5 }},
 		.radius = 3.5
 	};
+	//Rays start on the z = 0 plane looking down +z, or from a pinhole camera behind it
+	camera_t camera;
+	if (pinhole){
+		const float pos[3] = { IMG_DIM / 2.0f, IMG_DIM / 2.0f, -IMG_DIM };
+		const float target[3] = { IMG_DIM / 2.0f, IMG_DIM / 2.0f, 0 };
+		const float up[3] = { 0, 1, 0 };
+		look_at_camera(&camera, CAMERA_PINHOLE, pos, target, up, 60, IMG_DIM, IMG_DIM);
+	}
+	else {
+		grid_camera(&camera, IMG_DIM, IMG_DIM);
+	}
 
-	cl_char background = ' ';
-	err = clEnqueueFillBuffer(queue, mem_img, &background, sizeof(cl_char), 0,
-		IMG_DIM * IMG_DIM * sizeof(cl_char), 0, 0, NULL);
-	check_cl_err(err, "failed to fill buffer");
-
-	for (int i = 0; i < IMG_DIM; ++i){
-		for (int j = 0; j < IMG_DIM; ++j){
-			ray_starts[i * IMG_DIM + j].s[0] = i;
-			ray_starts[i * IMG_DIM + j].s[1] = j;
-			ray_starts[i * IMG_DIM + j].s[3] = 0;
+	cl_device_id device = 0;
+	cl_context context;
+	if (select_backend(&context, &device)){
+		if (render_path){
+			fprintf(stderr, "Rendering needs an OpenCL device\n");
+			return 1;
 		}
+		char img[IMG_DIM * IMG_DIM];
+		memset(img, ' ', sizeof(img));
+		thread_pool_t *pool = thread_pool_create(0);
+		cast_rays_host_simd(pool, &camera, spheres, N_OBJS, img, IMG_DIM, IMG_DIM);
+		thread_pool_destroy(pool);
+		print_image(img);
+		return 0;
+	}
+	cl_int err = CL_SUCCESS;
+	cl_command_queue queue = profile_create_queue(context, device, 0, &err);
+	if (check_cl_err(err, "failed to create command queue")){
+		return 1;
 	}
-	clEnqueueUnmapMemObject(queue, mem_ray_start, ray_starts, 0, 0, NULL);
-	clEnqueueUnmapMemObject(queue, mem_spheres, spheres, 0, 0, NULL);
+	char *prog_src = read_file(CL_PROGRAM("ray_test.cl"), NULL);
+	double build_start = wall_time();
+	cl_program program = build_program(prog_src, context, device,
+		sphere_layout_options(RAY_TEST_SPHERE_LAYOUT));
+	prog_cache_stats_t cache_stats = prog_cache_stats();
+	printf("Program ready in %.2fms (cache hits: %lu, misses: %lu)\n",
+		(wall_time() - build_start) * 1000.0, (unsigned long)cache_stats.hits,
+		(unsigned long)cache_stats.misses);
+	free(prog_src);
+	if (render_path){
+		int failed = render_image(context, device, queue, program, render_path, render_width,
+			render_height, render_spheres, pinhole, bounces, &progressive);
+		clReleaseProgram(program);
+		clReleaseCommandQueue(queue);
+		clReleaseContext(context);
+		return failed;
+	}
+	cl_kernel kernel = clCreateKernel(program, "cast_rays", &err);
+	check_cl_err(err, "failed to create kernel");
+
+	const size_t spheres_size = sphere_buffer_size(RAY_TEST_SPHERE_LAYOUT, N_OBJS);
+	cl_mem mem_spheres = clCreateBuffer(context, CL_MEM_READ_ONLY, spheres_size, NULL, &err);
+	check_cl_err(err, "failed to create buffer");
+
+	cl_mem mem_img = clCreateBuffer(context, CL_MEM_WRITE_ONLY, IMG_DIM * IMG_DIM * sizeof(cl_char),
+		NULL, &err);
+	check_cl_err(err, "failed to create buffer");
 
 	cl_uint n_objs = N_OBJS;
 	cl_uint2 dim = {{ IMG_DIM, IMG_DIM }};
-	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &mem_ray_start);
+	err = clSetKernelArg(kernel, 0, sizeof(camera_t), &camera);
 	err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &mem_spheres);
 	err |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &n_objs);
 	err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &mem_img);
 	err |= clSetKernelArg(kernel, 4, sizeof(cl_uint2), &dim);
 	check_cl_err(err, "failed to set one or more kernel args");
 
+	//Every ray tests every sphere, so the kernel can be tuned before the spheres are uploaded
 	size_t global_size[2] = { IMG_DIM, IMG_DIM };
-	size_t local_size[2] = { 2, 2 };
-	err = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global_size,
-		local_size, 0, NULL, NULL);
-	check_cl_err(err, "failed to run kernel");
-
-	cl_char *img = clEnqueueMapBuffer(queue, mem_img, CL_TRUE, CL_MAP_READ,
-		0, IMG_DIM * IMG_DIM * sizeof(cl_char), 0, NULL, NULL, &err);
-	check_cl_err(err, "failed to map img buffer");
+	size_t local_size[2], padded_size[2];
+	if (tune_local_size(queue, kernel, 2, global_size, NULL, NULL, local_size)){
+		return 1;
+	}
+	pad_global_size(2, global_size, local_size, padded_size);
 
-	for (int i = 0; i < IMG_DIM; ++i){
-		printf("| ");
-		for (int j = 0; j < IMG_DIM; ++j){
-			printf("%c", img[i * IMG_DIM + j]);
-		}
-		printf(" |\n");
+	//The sphere upload and image fill don't depend on each other so the graph overlaps them
+	task_graph_t *graph = task_graph_create(context, device, 0);
+	if (!graph){
+		return 1;
+	}
+	void *scene = malloc(spheres_size);
+	pack_spheres(spheres, N_OBJS, RAY_TEST_SPHERE_LAYOUT, scene);
+	cl_char background = ' ';
+	char img[IMG_DIM * IMG_DIM];
+	int failed = task_graph_write(graph, mem_spheres, 0, spheres_size, scene, "write spheres") < 0
+		|| task_graph_fill(graph, mem_img, &background, sizeof(cl_char), 0, sizeof(img),
+			"fill img") < 0
+		|| task_graph_kernel(graph, kernel, 2, padded_size, local_size, &mem_spheres, 1,
+			&mem_img, 1, "cast_rays") < 0
+		|| task_graph_read(graph, mem_img, 0, sizeof(img), img, "read img") < 0;
+	failed |= check_cl_err(task_graph_finish(graph), "failed to run task graph");
+	if (!failed){
+		print_image(img);
+		task_graph_stats_t stats = task_graph_stats(graph);
+		task_graph_print_stats(graph, &stats);
 	}
-	clEnqueueUnmapMemObject(queue, mem_img, img, 0, 0, NULL);
-	clFinish(queue);
+	task_graph_destroy(graph);
+	free(scene);
 
-	clReleaseMemObject(mem_ray_start);
 	clReleaseMemObject(mem_spheres);
 	clReleaseMemObject(mem_img);
 	clReleaseKernel(kernel);
 	clReleaseProgram(program);
 	clReleaseCommandQueue(queue);
 	clReleaseContext(context);
-	return 0;
-}
-cl_context get_platform(cl_device_type type){
-	cl_uint num_platforms;
-	cl_int err = clGetPlatformIDs(0, NULL, &num_platforms);
-	cl_platform_id *platforms = malloc(sizeof(cl_platform_id) * num_platforms);
-	err = clGetPlatformIDs(num_platforms, platforms, NULL);
-	if (check_cl_err(err, "Failed to find platforms") || num_platforms < 1){
-		return NULL;
-	}
-	cl_context_properties properties[] = {
-		CL_CONTEXT_PLATFORM, 0, 0
-	};
-	cl_context context = NULL;
-	for (size_t i = 0; i < num_platforms; ++i){
-		properties[1] = (cl_context_properties)platforms[i];
-		context = clCreateContextFromType(properties, type, cl_err_callback, NULL, &err);
-		if (err == CL_SUCCESS){
-			char name[64];
-			clGetPlatformInfo(platforms[i], CL_PLATFORM_NAME, 64, name, NULL);
-			printf("Selected platform: %s\n", name);
-			break;
-		}
-	}
-	free(platforms);
-	return context;
-}
-void CL_CALLBACK cl_err_callback(const char *err_info, const void *priv_info, size_t cb, void *user){
-	printf("OpenCL context error: %s\n", err_info);
-	exit(EXIT_FAILURE);
-}
-cl_command_queue get_first_device(cl_context context, cl_device_id *device){
-	size_t num_devices;
-	cl_int err = clGetContextInfo(context, CL_CONTEXT_NUM_DEVICES,
-		sizeof(num_devices), &num_devices, NULL);
-	if (check_cl_err(err, "Failed to get number of devices")){
-		return NULL;
-	}
-	if (num_devices < 1){
-		fprintf(stderr, "No devices available\n");
-		return NULL;
-	}
-
-	cl_device_id *devices = malloc(sizeof(cl_device_id) * num_devices);
-	err = clGetContextInfo(context, CL_CONTEXT_DEVICES, sizeof(cl_device_id) * num_devices,
-		devices, NULL);
-	if (check_cl_err(err, "Failed to get devices for context")){
-		free(devices);
-		return NULL;
-	}
-
-	//Create a command queue on the first device we can and use that device
-	for (size_t i = 0; i < num_devices; ++i){
-		cl_command_queue queue = clCreateCommandQueue(context, devices[i], 0, &err);
-		if (err == CL_SUCCESS){
-			*device = devices[i];
-			char name[64];
-			clGetDeviceInfo(*device, CL_DEVICE_NAME, 64, name, NULL);
-			printf("Selected device: %s\n", name);
-			free(devices);
-			return queue;
-		}
-	}
-	fprintf(stderr, "Failed to create a command queue for any device\n");
-	free(devices);
-	return NULL;
+	return failed;
 }
-
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "profile.h"
+#include "progressive.h"
+
+//Arguments of accumulate_samples that change between iterations
+#define ARG_CAMERA 0
+#define ARG_FRAME 6
+#define ARG_SPP 7
+
+struct progressive_t {
+	cl_command_queue queue;
+	cl_kernel kernel;
+	cl_mem accum;
+	int width, height;
+	cl_uint frame;
+	//Samples per pixel the kernel argument is set to, 0 before the first step
+	cl_uint spp;
+	size_t samples;
+};
+
+//Clear the accumulation buffer, returns the error from enqueuing the fill
+static cl_int clear_samples(progressive_t *prog){
+	const cl_float4 zero = {{ 0, 0, 0, 0 }};
+	prog->samples = 0;
+	return clEnqueueFillBuffer(prog->queue, prog->accum, &zero, sizeof(zero), 0,
+		sizeof(cl_float4) * prog->width * prog->height, 0, NULL, profile_event("clear samples"));
+}
+progressive_t* progressive_create(cl_context context, cl_command_queue queue,
+	cl_program program, const render_scene_t *scene, int width, int height)
+{
+	cl_int err, buf_err;
+	progressive_t *prog = calloc(1, sizeof(progressive_t));
+	prog->queue = queue;
+	prog->width = width;
+	prog->height = height;
+	prog->kernel = clCreateKernel(program, "accumulate_samples", &err);
+	prog->accum = clCreateBuffer(context, CL_MEM_READ_WRITE,
+		sizeof(cl_float4) * width * height, NULL, &buf_err);
+	err |= buf_err;
+	if (err == CL_SUCCESS){
+		const cl_uint2 dim = {{ width, height }};
+		err = clSetKernelArg(prog->kernel, ARG_CAMERA, sizeof(camera_t), &scene->camera);
+		err |= clSetKernelArg(prog->kernel, 1, sizeof(cl_mem), &scene->objects);
+		err |= clSetKernelArg(prog->kernel, 2, sizeof(cl_uint), &scene->n_objs);
+		err |= clSetKernelArg(prog->kernel, 3, sizeof(cl_mem), &scene->nodes);
+		err |= clSetKernelArg(prog->kernel, 4, sizeof(cl_mem), &prog->accum);
+		err |= clSetKernelArg(prog->kernel, 5, sizeof(cl_uint2), &dim);
+		err |= clear_samples(prog);
+	}
+	if (check_cl_err(err, "failed to set up progressive rendering")){
+		progressive_destroy(prog);
+		return NULL;
+	}
+	return prog;
+}
+int progressive_step(progressive_t *prog, cl_uint spp){
+	cl_int err = clSetKernelArg(prog->kernel, ARG_FRAME, sizeof(cl_uint), &prog->frame);
+	if (spp != prog->spp){
+		err |= clSetKernelArg(prog->kernel, ARG_SPP, sizeof(cl_uint), &spp);
+		prog->spp = spp;
+	}
+	const size_t global_size[2] = { prog->width, prog->height };
+	err |= clEnqueueNDRangeKernel(prog->queue, prog->kernel, 2, NULL, global_size, NULL, 0, NULL,
+		profile_event("accumulate_samples"));
+	//Get the work going without waiting for it
+	err |= clFlush(prog->queue);
+	if (check_cl_err(err, "failed to enqueue progressive iteration")){
+		return 1;
+	}
+	++prog->frame;
+	prog->samples += spp;
+	return 0;
+}
+int progressive_set_camera(progressive_t *prog, const camera_t *camera){
+	cl_int err = clSetKernelArg(prog->kernel, ARG_CAMERA, sizeof(camera_t), camera);
+	err |= clear_samples(prog);
+	return check_cl_err(err, "failed to move progressive camera");
+}
+size_t progressive_samples(const progressive_t *prog){
+	return prog->samples;
+}
+int progressive_read(progressive_t *prog, cl_float4 *img){
+	const size_t n_px = (size_t)prog->width * prog->height;
+	cl_int err = clEnqueueReadBuffer(prog->queue, prog->accum, CL_TRUE, 0,
+		sizeof(cl_float4) * n_px, img, 0, NULL, profile_event("read samples"));
+	if (check_cl_err(err, "failed to read back samples")){
+		return 1;
+	}
+	for (size_t i = 0; i < n_px; ++i){
+		const float n = img[i].s[3];
+		for (int c = 0; c < 3; ++c){
+			img[i].s[c] = n > 0 ? img[i].s[c] / n : 0;
+		}
+		img[i].s[3] = 1;
+	}
+	return 0;
+}
+void progressive_destroy(progressive_t *prog){
+	if (!prog){
+		return;
+	}
+	if (prog->kernel){
+		clReleaseKernel(prog->kernel);
+	}
+	if (prog->accum){
+		clReleaseMemObject(prog->accum);
+	}
+	free(prog);
+}
+
@@ -0,0 +1,56 @@
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include <stddef.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "render.h"
+
+/*
+ * Progressive rendering state kept on the device between iterations. The kernel's scene,
+ * camera and accumulation buffer arguments are set once, each iteration only updates the
+ * frame number seeding the jitter and the samples per pixel if they changed, then adds its
+ * samples to the float sums in the accumulation buffer without waiting on the device.
+ * Nothing is read back until progressive_read is called
+ */
+typedef struct progressive_t progressive_t;
+
+/*
+ * Set up progressive rendering of a width x height image of the scene with the program's
+ * accumulate_samples kernel. The scene's buffers must outlive the state
+ * returns NULL on failure
+ */
+progressive_t* progressive_create(cl_context context, cl_command_queue queue,
+	cl_program program, const render_scene_t *scene, int width, int height);
+/*
+ * Enqueue an iteration adding spp jittered samples to each pixel
+ * returns 1 on failure
+ */
+int progressive_step(progressive_t *prog, cl_uint spp);
+/*
+ * Move the camera, clearing the samples taken so far
+ * returns 1 on failure
+ */
+int progressive_set_camera(progressive_t *prog, const camera_t *camera);
+/*
+ * Get the samples per pixel taken so far
+ */
+size_t progressive_samples(const progressive_t *prog);
+/*
+ * Wait for the iterations enqueued so far and read back the average of each pixel's samples
+ * into img, width * height float4 pixels with row 0 at the bottom and alpha 1
+ * returns 1 on failure
+ */
+int progressive_read(progressive_t *prog, cl_float4 *img);
+/*
+ * Release the kernel and accumulation buffer and free the state
+ */
+void progressive_destroy(progressive_t *prog);
+
+#endif
+
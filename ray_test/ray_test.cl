@@ -8,14 +8,111 @@ typedef struct sphere_t {
 	float radius;
 } sphere_t;
 
+/*
+ * Layout of the spheres in the objects buffer, picked at build time with -DSPHERE_LAYOUT.
+ * SPHERE_AOS is an array of sphere_t, which pads out to 32 bytes since float3 is 16 bytes.
+ * SPHERE_PACKED is a float4 per sphere with the radius in w. SPHERE_SOA is the centers
+ * as tightly packed xyz floats followed by the radii, see sphere_layout_t in scene.h
+ */
+#define SPHERE_AOS 0
+#define SPHERE_PACKED 1
+#define SPHERE_SOA 2
+#ifndef SPHERE_LAYOUT
+#define SPHERE_LAYOUT SPHERE_AOS
+#endif
+#if SPHERE_LAYOUT == SPHERE_AOS
+typedef sphere_t scene_t;
+#elif SPHERE_LAYOUT == SPHERE_PACKED
+typedef float4 scene_t;
+#elif SPHERE_LAYOUT == SPHERE_SOA
+typedef float scene_t;
+#else
+#error "Unknown SPHERE_LAYOUT"
+#endif
+
+#define CAMERA_ORTHO 0
+#define CAMERA_PINHOLE 1
+
+/*
+ * Camera to generate the primary rays from, see camera_t in scene.h. Pixel (x, y) gets the
+ * offset x * du + y * dv, an orthographic camera moves the ray origin from pos by it while
+ * a pinhole camera adds it to dir and normalizes
+ */
+typedef struct camera_t {
+	float3 pos, dir, du, dv;
+	uint type;
+} camera_t;
+
+//Size of the BVH traversal stack, must match BVH_MAX_DEPTH in bvh.h
+#ifndef BVH_MAX_DEPTH
+#define BVH_MAX_DEPTH 32
+#endif
+
+/*
+ * A node of the flattened BVH, see bvh.h. Interior nodes have count 0, their left child
+ * is the next node and offset is the right child. Leaves hold objects [offset, offset + count)
+ */
+typedef struct bvh_node_t {
+	float min[3];
+	uint offset;
+	float max[3];
+	uint count;
+} bvh_node_t;
+
+/*
+ * State of a ray in wavefront rendering, where each bounce runs as separate kernels over a
+ * queue of the rays still alive. hit is the object the last intersect found or -1, t its
+ * distance and throughput what the ray's shading is scaled by when added to its pixel.
+ * Must stay 64 bytes, see WAVEFRONT_RAY_SIZE in wavefront.h
+ */
+typedef struct wf_ray_t {
+	float3 orig, dir, throughput;
+	float t;
+	int hit;
+} wf_ray_t;
+
+//Fraction of the light reflected rays carry on to the next bounce in wavefront rendering
+#define WF_REFLECTANCE 0.5f
+//How far secondary rays start off the surface so they don't hit it again
+#define WF_EPSILON 1e-3f
+
+//Get the primary ray through pixel id
+ray_t camera_ray(const camera_t *camera, uint2 id);
+//Get the ray through a point on the image plane in pixels, pixel centers are whole numbers
+ray_t camera_ray_at(const camera_t *camera, float2 pos);
+//Read sphere i of the n_objs in the scene
+sphere_t load_sphere(const global scene_t *objects, uint n_objs, uint i);
 //Check the ray for intersection against the sphere, true if intersects
-bool intersect_sphere(ray_t *ray, const global sphere_t *objects);
+bool intersect_sphere(ray_t *ray, const sphere_t *sphere);
+//Slab test the ray against the node, returns the entry distance or FLT_MAX if it's missed or further than ray->t
+float intersect_node(const ray_t *ray, const global bvh_node_t *node);
+//Get the character to write for a hit at distance t
+char hit_char(float t);
+/*
+ * Find the closest object the ray hits by traversing the BVH, objects must be in the order
+ * bvh_build left them. Children are visited nearest first and nodes further than the closest
+ * hit so far are skipped. returns the index of the object hit, with ray->t its distance, or -1
+ */
+int trace_bvh(ray_t *ray, const global scene_t *objects, uint n_objs,
+	const global bvh_node_t *nodes);
+//Shade a hit with the surface normal by a ray in direction dir
+float3 shade_hit(float3 normal, float3 dir);
+//Trace the ray through the BVH and shade what it hits, black if it misses
+float3 shade_ray(ray_t *ray, const global scene_t *objects, uint n_objs,
+	const global bvh_node_t *nodes);
+//Advance the random number state and return a float in [0, 1)
+float rand_float(uint *state);
+//Scramble the bits of x, for seeding rand_float
+uint hash_uint(uint x);
+//Trace and shade the ray through pixel px, returning its color
+float3 render_pixel(const camera_t *camera, const global scene_t *objects, uint n_objs,
+	const global bvh_node_t *nodes, uint2 px);
 
 /*
- * Cast rays from positions listed in start and test for intersections against the objects
- * start should contain dim.x * dim.y vectors and img should be dim.x * dim.y chars
+ * Cast a ray from the camera through each pixel and test for intersections against the objects
+ * img should be dim.x * dim.y chars
  */
-kernel void cast_rays(const global float3 *start, const global sphere_t *objects, const uint n_objs,
+kernel void cast_rays(const camera_t camera, const global scene_t *objects, const uint n_objs,
 	global char *img, const uint2 dim)
 {
 	uint2 id = (uint2)(get_global_id(0), get_global_id(1));
@@ -23,22 +120,245 @@ kernel void cast_rays(const global float3 *start, const global sphere_t *objects
 	if (id.x >= dim.x || id.y >= dim.y){
 		return;
 	}
-	ray_t ray = { .orig = start[id.y * dim.x + id.x], .dir = (float3)(0, 0, 1), .t = FLT_MAX };
+	ray_t ray = camera_ray(&camera, id);
 	for (uint i = 0; i < n_objs; ++i){
-		if (intersect_sphere(&ray, &objects[i])){
-			if (ray.t < 0.5){
-				img[id.y * dim.x + id.x] = '@';
+		sphere_t sphere = load_sphere(objects, n_objs, i);
+		if (intersect_sphere(&ray, &sphere)){
+			img[id.y * dim.x + id.x] = hit_char(ray.t);
+		}
+	}
+}
+/*
+ * Same as cast_rays but only tests the objects in the BVH leaves the ray passes through,
+ * see trace_bvh
+ */
+kernel void cast_rays_bvh(const camera_t camera, const global scene_t *objects,
+	const uint n_objs, const global bvh_node_t *nodes, global char *img, const uint2 dim)
+{
+	uint2 id = (uint2)(get_global_id(0), get_global_id(1));
+	if (id.x >= dim.x || id.y >= dim.y){
+		return;
+	}
+	ray_t ray = camera_ray(&camera, id);
+	if (trace_bvh(&ray, objects, n_objs, nodes) >= 0){
+		img[id.y * dim.x + id.x] = hit_char(ray.t);
+	}
+}
+/*
+ * Render the tile_dim pixels starting at offset in the full image, shading the closest
+ * hit through the BVH. img holds just the tile, tile_dim.x * tile_dim.y pixels, as RGBA
+ * floats in render_tile_f32 or 8 bit RGBA in render_tile_rgba8
+ */
+kernel void render_tile_f32(const camera_t camera, const global scene_t *objects,
+	const uint n_objs, const global bvh_node_t *nodes, global float4 *img, const uint2 offset,
+	const uint2 tile_dim)
+{
+	uint2 id = (uint2)(get_global_id(0), get_global_id(1));
+	if (id.x >= tile_dim.x || id.y >= tile_dim.y){
+		return;
+	}
+	float3 color = render_pixel(&camera, objects, n_objs, nodes, id + offset);
+	img[id.y * tile_dim.x + id.x] = (float4)(color, 1.0f);
+}
+kernel void render_tile_rgba8(const camera_t camera, const global scene_t *objects,
+	const uint n_objs, const global bvh_node_t *nodes, global uchar4 *img, const uint2 offset,
+	const uint2 tile_dim)
+{
+	uint2 id = (uint2)(get_global_id(0), get_global_id(1));
+	if (id.x >= tile_dim.x || id.y >= tile_dim.y){
+		return;
+	}
+	float3 color = render_pixel(&camera, objects, n_objs, nodes, id + offset);
+	img[id.y * tile_dim.x + id.x] = convert_uchar4_sat_rte((float4)(color, 1.0f) * 255.0f);
+}
+/*
+ * Start wavefront rendering n pixels from pixel first of an image width pixels wide, making
+ * the primary ray for each one, queueing them all and clearing their colors. rays, queue
+ * and color hold the n pixels
+ */
+kernel void wf_generate(const camera_t camera, global wf_ray_t *rays, global uint *queue,
+	global float4 *color, const uint first, const uint n, const uint width)
+{
+	uint i = get_global_id(0);
+	if (i >= n){
+		return;
+	}
+	uint px = first + i;
+	ray_t ray = camera_ray(&camera, (uint2)(px % width, px / width));
+	rays[i].orig = ray.orig;
+	rays[i].dir = ray.dir;
+	rays[i].throughput = (float3)(1);
+	queue[i] = i;
+	color[i] = (float4)(0, 0, 0, 1);
+}
+//Find the closest hit through the BVH for each of the n_active queued rays
+kernel void wf_intersect(const global scene_t *objects, const uint n_objs,
+	const global bvh_node_t *nodes, global wf_ray_t *rays, const global uint *queue,
+	const uint n_active)
+{
+	uint q = get_global_id(0);
+	if (q >= n_active){
+		return;
+	}
+	global wf_ray_t *r = &rays[queue[q]];
+	ray_t ray = { .orig = r->orig, .dir = r->dir, .t = FLT_MAX };
+	r->hit = trace_bvh(&ray, objects, n_objs, nodes);
+	r->t = ray.t;
+}
+/*
+ * Add the shading of each queued ray's hit to its pixel and reflect it off the surface for
+ * the next bounce unless this is the last one. alive[q] is set to 1 for the queued rays that
+ * carry on and 0 for those that missed, for compacting the queue
+ */
+kernel void wf_shade(const global scene_t *objects, const uint n_objs, global wf_ray_t *rays,
+	const global uint *queue, const uint n_active, global float4 *color, global uint *alive,
+	const int last)
+{
+	uint q = get_global_id(0);
+	if (q >= n_active){
+		return;
+	}
+	uint i = queue[q];
+	global wf_ray_t *r = &rays[i];
+	alive[q] = 0;
+	if (r->hit < 0){
+		return;
+	}
+	sphere_t sphere = load_sphere(objects, n_objs, r->hit);
+	float3 p = r->orig + r->t * r->dir;
+	float3 normal = normalize(p - sphere.center);
+	color[i].xyz += r->throughput * shade_hit(normal, r->dir);
+	if (!last){
+		r->orig = p + WF_EPSILON * normal;
+		r->dir = r->dir - 2 * dot(r->dir, normal) * normal;
+		r->throughput *= WF_REFLECTANCE;
+		alive[q] = 1;
+	}
+}
+//Convert the n accumulated colors to 8 bit RGBA
+kernel void wf_resolve_rgba8(const global float4 *color, global uchar4 *img, const uint n){
+	uint i = get_global_id(0);
+	if (i < n){
+		img[i] = convert_uchar4_sat_rte(color[i] * 255.0f);
+	}
+}
+/*
+ * Add spp samples at random points within each pixel to its running sum in accum, with the
+ * sample count in w. frame seeds the jitter so each call adds different samples
+ */
+kernel void accumulate_samples(const camera_t camera, const global scene_t *objects,
+	const uint n_objs, const global bvh_node_t *nodes, global float4 *accum, const uint2 dim,
+	const uint frame, const uint spp)
+{
+	uint2 id = (uint2)(get_global_id(0), get_global_id(1));
+	if (id.x >= dim.x || id.y >= dim.y){
+		return;
+	}
+	uint i = id.y * dim.x + id.x;
+	uint rng = hash_uint(i ^ hash_uint(frame));
+	float3 sum = (float3)(0);
+	for (uint s = 0; s < spp; ++s){
+		float2 pos = (float2)(id.x + rand_float(&rng) - 0.5f, id.y + rand_float(&rng) - 0.5f);
+		ray_t ray = camera_ray_at(&camera, pos);
+		sum += shade_ray(&ray, objects, n_objs, nodes);
+	}
+	accum[i] += (float4)(sum, spp);
+}
+int trace_bvh(ray_t *ray, const global scene_t *objects, uint n_objs,
+	const global bvh_node_t *nodes)
+{
+	if (intersect_node(ray, &nodes[0]) == FLT_MAX){
+		return -1;
+	}
+	int hit = -1;
+	uint stack[BVH_MAX_DEPTH];
+	uint stack_size = 0;
+	uint current = 0;
+	while (true){
+		const global bvh_node_t *node = &nodes[current];
+		if (node->count > 0){
+			for (uint i = node->offset; i < node->offset + node->count; ++i){
+				sphere_t sphere = load_sphere(objects, n_objs, i);
+				if (intersect_sphere(ray, &sphere)){
+					hit = i;
+				}
 			}
-			else if (ray.t < 1){
-				img[id.y * dim.x + id.x] = '0';
+		}
+		else {
+			uint l = current + 1, r = node->offset;
+			float tl = intersect_node(ray, &nodes[l]);
+			float tr = intersect_node(ray, &nodes[r]);
+			if (tl != FLT_MAX && tr != FLT_MAX){
+				current = tl <= tr ? l : r;
+				stack[stack_size++] = tl <= tr ? r : l;
+				continue;
 			}
-			else {
-				img[id.y * dim.x + id.x] = '.';
+			if (tl != FLT_MAX || tr != FLT_MAX){
+				current = tl != FLT_MAX ? l : r;
+				continue;
 			}
 		}
+		//Pop until we find a node that's still closer than the closest hit
+		bool found = false;
+		while (stack_size > 0 && !found){
+			current = stack[--stack_size];
+			found = intersect_node(ray, &nodes[current]) != FLT_MAX;
+		}
+		if (!found){
+			break;
+		}
+	}
+	return hit;
+}
+float3 render_pixel(const camera_t *camera, const global scene_t *objects, uint n_objs,
+	const global bvh_node_t *nodes, uint2 px)
+{
+	ray_t ray = camera_ray(camera, px);
+	return shade_ray(&ray, objects, n_objs, nodes);
+}
+float3 shade_ray(ray_t *ray, const global scene_t *objects, uint n_objs,
+	const global bvh_node_t *nodes)
+{
+	int hit = trace_bvh(ray, objects, n_objs, nodes);
+	if (hit < 0){
+		return (float3)(0);
 	}
+	sphere_t sphere = load_sphere(objects, n_objs, hit);
+	float3 normal = normalize(ray->orig + ray->t * ray->dir - sphere.center);
+	return shade_hit(normal, ray->dir);
 }
-bool intersect_sphere(ray_t *ray, const global sphere_t *sphere){
+float3 shade_hit(float3 normal, float3 dir){
+	//Light from the camera, colored by the normal so neighbouring spheres stand apart
+	float light = 0.2f + 0.8f * fmax(-dot(normal, dir), 0.0f);
+	return (normal * 0.5f + 0.5f) * light;
+}
+ray_t camera_ray(const camera_t *camera, uint2 id){
+	return camera_ray_at(camera, convert_float2(id));
+}
+ray_t camera_ray_at(const camera_t *camera, float2 pos){
+	float3 offset = pos.x * camera->du + pos.y * camera->dv;
+	ray_t ray = { .orig = camera->pos, .dir = camera->dir, .t = FLT_MAX };
+	if (camera->type == CAMERA_ORTHO){
+		ray.orig += offset;
+	}
+	else {
+		ray.dir = normalize(ray.dir + offset);
+	}
+	return ray;
+}
+sphere_t load_sphere(const global scene_t *objects, uint n_objs, uint i){
+#if SPHERE_LAYOUT == SPHERE_PACKED
+	float4 s = objects[i];
+	sphere_t sphere = { .center = s.xyz, .radius = s.w };
+	return sphere;
+#elif SPHERE_LAYOUT == SPHERE_SOA
+	sphere_t sphere = { .center = vload3(i, objects), .radius = objects[3 * n_objs + i] };
+	return sphere;
+#else
+	return objects[i];
+#endif
+}
+bool intersect_sphere(ray_t *ray, const sphere_t *sphere){
 	float3 l = sphere->center - ray->orig;
 	float l_sqr = dot(l, l);
 	float s = dot(l, ray->dir);
@@ -60,4 +380,37 @@ bool intersect_sphere(ray_t *ray, const global sphere_t *sphere){
 	}	
 	return false;
 }
+float intersect_node(const ray_t *ray, const global bvh_node_t *node){
+	float3 bmin = (float3)(node->min[0], node->min[1], node->min[2]);
+	float3 bmax = (float3)(node->max[0], node->max[1], node->max[2]);
+	//Rays parallel to a slab never cross it so they must start inside it
+	int3 flat = ray->dir == 0;
+	if (any(flat & (ray->orig < bmin | ray->orig > bmax))){
+		return FLT_MAX;
+	}
+	float3 inv_dir = 1.0f / ray->dir;
+	float3 t0 = select((bmin - ray->orig) * inv_dir, (float3)(-FLT_MAX), flat);
+	float3 t1 = select((bmax - ray->orig) * inv_dir, (float3)(FLT_MAX), flat);
+	float3 t_near = fmin(t0, t1);
+	float3 t_far = fmax(t0, t1);
+	float t_enter = fmax(fmax(t_near.x, t_near.y), fmax(t_near.z, 0.0f));
+	float t_exit = fmin(fmin(t_far.x, t_far.y), t_far.z);
+	return t_enter <= t_exit && t_enter <= ray->t ? t_enter : FLT_MAX;
+}
+uint hash_uint(uint x){
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+float rand_float(uint *state){
+	*state = hash_uint(*state + 0x9e3779b9u);
+	//The top 24 bits fit a float exactly
+	return (*state >> 8) * (1.0f / 16777216.0f);
+}
+char hit_char(float t){
+	return t < 0.5f ? '@' : t < 1 ? '0' : '.';
+}
 
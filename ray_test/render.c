@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "profile.h"
+#include "render.h"
+
+#define DEFAULT_STRIP_BYTES (64 * 1024 * 1024)
+
+typedef struct strip_t {
+	cl_mem mem;
+	void *host;
+	cl_event read_done;
+	size_t y0, rows;
+} strip_t;
+
+int image_format_from_path(const char *path, image_format_t *format){
+	const char *ext = strrchr(path, '.');
+	if (ext && strcmp(ext, ".pfm") == 0){
+		*format = IMAGE_PFM;
+		return 0;
+	}
+	if (ext && strcmp(ext, ".ppm") == 0){
+		*format = IMAGE_PPM;
+		return 0;
+	}
+	return 1;
+}
+/*
+ * Write the strip's rows to the file, dropping alpha. PFM is stored bottom row first and
+ * PPM top row first, image row 0 being the bottom of the view
+ */
+static int write_strip(FILE *f, const strip_t *strip, image_format_t format, int width, void *row){
+	for (size_t i = 0; i < strip->rows; ++i){
+		const size_t r = format == IMAGE_PFM ? i : strip->rows - 1 - i;
+		size_t row_bytes;
+		if (format == IMAGE_PFM){
+			const cl_float4 *px = (const cl_float4*)strip->host + r * width;
+			float *out = row;
+			for (int x = 0; x < width; ++x){
+				out[3 * x] = px[x].s[0];
+				out[3 * x + 1] = px[x].s[1];
+				out[3 * x + 2] = px[x].s[2];
+			}
+			row_bytes = 3 * sizeof(float) * width;
+		}
+		else {
+			const cl_uchar4 *px = (const cl_uchar4*)strip->host + r * width;
+			unsigned char *out = row;
+			for (int x = 0; x < width; ++x){
+				out[3 * x] = px[x].s[0];
+				out[3 * x + 1] = px[x].s[1];
+				out[3 * x + 2] = px[x].s[2];
+			}
+			row_bytes = 3 * width;
+		}
+		if (fwrite(row, 1, row_bytes, f) != row_bytes){
+			return 1;
+		}
+	}
+	return 0;
+}
+static void write_header(FILE *f, image_format_t format, int width, int height){
+	//A negative PFM scale marks the floats as little endian
+	if (format == IMAGE_PFM){
+		fprintf(f, "PF\n%d %d\n-1.0\n", width, height);
+	}
+	else {
+		fprintf(f, "P6\n%d %d\n255\n", width, height);
+	}
+}
+int write_image(const char *path, const void *img, int width, int height){
+	image_format_t format;
+	if (image_format_from_path(path, &format)){
+		fprintf(stderr, "Can't tell the image format of %s, use .pfm or .ppm\n", path);
+		return 1;
+	}
+	FILE *f = fopen(path, "wb");
+	if (!f){
+		fprintf(stderr, "Failed to open %s for writing\n", path);
+		return 1;
+	}
+	write_header(f, format, width, height);
+	strip_t strip = { .host = (void*)img, .rows = height };
+	void *row = malloc(3 * sizeof(float) * width);
+	int failed = write_strip(f, &strip, format, width, row);
+	failed |= fclose(f) != 0;
+	if (failed){
+		fprintf(stderr, "Failed to write to %s\n", path);
+	}
+	free(row);
+	return failed;
+}
+int render_to_file(cl_context context, cl_device_id device, cl_command_queue queue,
+	cl_program program, const render_scene_t *scene, int width, int height, const char *path,
+	size_t max_strip_bytes)
+{
+	image_format_t format;
+	if (image_format_from_path(path, &format)){
+		fprintf(stderr, "Can't tell the image format of %s, use .pfm or .ppm\n", path);
+		return 1;
+	}
+	const size_t px_size = format == IMAGE_PFM ? sizeof(cl_float4) : sizeof(cl_uchar4);
+	const size_t row_bytes = px_size * width;
+	size_t budget = max_strip_bytes ? max_strip_bytes : DEFAULT_STRIP_BYTES;
+	cl_ulong max_alloc = 0;
+	clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &max_alloc, NULL);
+	if (max_alloc && budget > max_alloc){
+		budget = max_alloc;
+	}
+	size_t strip_rows = budget / row_bytes;
+	strip_rows = strip_rows == 0 ? 1 : strip_rows > (size_t)height ? (size_t)height : strip_rows;
+	const size_t n_strips = (height + strip_rows - 1) / strip_rows;
+
+	cl_int err, mem_err;
+	cl_kernel kernel = clCreateKernel(program, format == IMAGE_PFM ? "render_tile_f32"
+		: "render_tile_rgba8", &err);
+	if (check_cl_err(err, "failed to create render kernel")){
+		return 1;
+	}
+	FILE *f = fopen(path, "wb");
+	if (!f){
+		fprintf(stderr, "Failed to open %s for writing\n", path);
+		clReleaseKernel(kernel);
+		return 1;
+	}
+	write_header(f, format, width, height);
+
+	strip_t strips[2] = { { 0 } };
+	for (int i = 0; i < 2; ++i){
+		strips[i].mem = clCreateBuffer(context, CL_MEM_WRITE_ONLY, row_bytes * strip_rows, NULL,
+			&mem_err);
+		err |= mem_err;
+		strips[i].host = malloc(row_bytes * strip_rows);
+	}
+	void *row = malloc(3 * sizeof(float) * width);
+	err |= clSetKernelArg(kernel, 0, sizeof(camera_t), &scene->camera);
+	err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &scene->objects);
+	err |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &scene->n_objs);
+	err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &scene->nodes);
+	int failed = check_cl_err(err, "failed to set up render kernel");
+
+	//Render strip s while strip s - 1 is written out, PPM starts from the top of the image
+	for (size_t s = 0; s <= n_strips && !failed; ++s){
+		if (s < n_strips){
+			strip_t *strip = &strips[s % 2];
+			strip->y0 = s * strip_rows;
+			strip->rows = strip->y0 + strip_rows > (size_t)height ? height - strip->y0 : strip_rows;
+			if (format == IMAGE_PPM){
+				strip->y0 = height - strip->y0 - strip->rows;
+			}
+			cl_uint2 offset = {{ 0, strip->y0 }};
+			cl_uint2 tile_dim = {{ width, strip->rows }};
+			size_t global_size[2] = { width, strip->rows };
+			err = clSetKernelArg(kernel, 4, sizeof(cl_mem), &strip->mem);
+			err |= clSetKernelArg(kernel, 5, sizeof(cl_uint2), &offset);
+			err |= clSetKernelArg(kernel, 6, sizeof(cl_uint2), &tile_dim);
+			err |= clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global_size, NULL, 0, NULL,
+				profile_event("render strip"));
+			err |= clEnqueueReadBuffer(queue, strip->mem, CL_FALSE, 0, row_bytes * strip->rows,
+				strip->host, 0, NULL, &strip->read_done);
+			err |= clFlush(queue);
+			if (check_cl_err(err, "failed to render strip")){
+				failed = 1;
+				break;
+			}
+		}
+		if (s > 0){
+			strip_t *prev = &strips[(s - 1) % 2];
+			err = clWaitForEvents(1, &prev->read_done);
+			clReleaseEvent(prev->read_done);
+			prev->read_done = NULL;
+			if (check_cl_err(err, "failed to read back strip")){
+				failed = 1;
+			}
+			else if (write_strip(f, prev, format, width, row)){
+				fprintf(stderr, "Failed to write to %s\n", path);
+				failed = 1;
+			}
+		}
+	}
+	clFinish(queue);
+	for (int i = 0; i < 2; ++i){
+		if (strips[i].read_done){
+			clReleaseEvent(strips[i].read_done);
+		}
+		if (strips[i].mem){
+			clReleaseMemObject(strips[i].mem);
+		}
+		free(strips[i].host);
+	}
+	free(row);
+	fclose(f);
+	clReleaseKernel(kernel);
+	return failed;
+}
+
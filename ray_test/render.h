@@ -0,0 +1,56 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stddef.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "scene.h"
+
+typedef enum image_format_t {
+	//Binary RGB floats, written with render_tile_f32
+	IMAGE_PFM,
+	//Binary 8 bit RGB, written with render_tile_rgba8
+	IMAGE_PPM
+} image_format_t;
+
+/*
+ * A scene uploaded for rendering, objects holds the spheres in the layout the program was
+ * built for and in the order bvh_build left them, nodes holds the BVH
+ */
+typedef struct render_scene_t {
+	camera_t camera;
+	cl_mem objects;
+	cl_uint n_objs;
+	cl_mem nodes;
+} render_scene_t;
+
+/*
+ * Pick the image format from the extension of path, .pfm or .ppm
+ * returns 1 if the extension isn't one of them
+ */
+int image_format_from_path(const char *path, image_format_t *format);
+/*
+ * Write the width x height image to path in the format picked from its extension,
+ * img holds float4 pixels for PFM or uchar4 pixels for PPM with row 0 at the bottom
+ * returns 1 on failure
+ */
+int write_image(const char *path, const void *img, int width, int height);
+/*
+ * Render a width x height image of the scene to the file at path in strips of whole rows.
+ * Each strip is read back and written out while the next one renders, so only two strips
+ * of at most max_strip_bytes are ever allocated on the host and device however big the
+ * image is. Pass 0 for max_strip_bytes to use a default, it's also capped by the device's
+ * largest allowed allocation
+ * returns 1 on failure
+ */
+int render_to_file(cl_context context, cl_device_id device, cl_command_queue queue,
+	cl_program program, const render_scene_t *scene, int width, int height, const char *path,
+	size_t max_strip_bytes);
+
+#endif
+
@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "scene.h"
+
+//Uniform random float in [lo, hi) from a simple LCG, so scenes don't depend on rand()
+static float rand_range(unsigned *state, float lo, float hi){
+	*state = *state * 1664525u + 1013904223u;
+	return lo + (hi - lo) * ((*state >> 8) / 16777216.0f);
+}
+void random_spheres(sphere_t *spheres, size_t n, int width, int height, unsigned seed){
+	unsigned state = seed;
+	//Shrink the spheres as the count goes up so big scenes aren't a solid wall
+	float max_radius = (width < height ? width : height) / (2.0f * sqrtf(n > 16 ? n : 16));
+	if (max_radius < 1.5f){
+		max_radius = 1.5f;
+	}
+	for (size_t i = 0; i < n; ++i){
+		spheres[i].center.s[0] = rand_range(&state, 0, width);
+		spheres[i].center.s[1] = rand_range(&state, 0, height);
+		spheres[i].center.s[2] = rand_range(&state, 2, 2 + 4 * max_radius);
+		spheres[i].center.s[3] = 0;
+		spheres[i].radius = rand_range(&state, 0.5f, max_radius);
+	}
+}
+static float dot(const float a[3], const float b[3]){
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+static void cross(const float a[3], const float b[3], float out[3]){
+	out[0] = a[1] * b[2] - a[2] * b[1];
+	out[1] = a[2] * b[0] - a[0] * b[2];
+	out[2] = a[0] * b[1] - a[1] * b[0];
+}
+static void normalize(float v[3]){
+	float len = sqrtf(dot(v, v));
+	for (int i = 0; i < 3; ++i){
+		v[i] /= len;
+	}
+}
+void look_at_camera(camera_t *cam, camera_type_t type, const float pos[3], const float target[3],
+	const float up[3], float size, int width, int height)
+{
+	float forward[3], right[3], cam_up[3];
+	for (int i = 0; i < 3; ++i){
+		forward[i] = target[i] - pos[i];
+	}
+	normalize(forward);
+	cross(up, forward, right);
+	normalize(right);
+	cross(forward, right, cam_up);
+	//Spacing between pixels on the view plane, one unit in front of a pinhole camera
+	float pixel = type == CAMERA_ORTHO ? size / width
+		: 2.0f * tanf(size * 3.14159265f / 360.0f) / height;
+	memset(cam, 0, sizeof(camera_t));
+	cam->type = type;
+	for (int i = 0; i < 3; ++i){
+		cam->du.s[i] = right[i] * pixel;
+		cam->dv.s[i] = cam_up[i] * pixel;
+		//Offset to the center of pixel (0, 0)
+		float corner = -cam->du.s[i] * (width - 1) / 2.0f - cam->dv.s[i] * (height - 1) / 2.0f;
+		if (type == CAMERA_ORTHO){
+			cam->pos.s[i] = pos[i] + corner;
+			cam->dir.s[i] = forward[i];
+		}
+		else {
+			cam->pos.s[i] = pos[i];
+			cam->dir.s[i] = forward[i] + corner;
+		}
+	}
+}
+void grid_camera(camera_t *cam, int width, int height){
+	const float pos[3] = { (width - 1) / 2.0f, (height - 1) / 2.0f, 0 };
+	const float target[3] = { pos[0], pos[1], 1 };
+	const float up[3] = { 0, 1, 0 };
+	look_at_camera(cam, CAMERA_ORTHO, pos, target, up, width, width, height);
+}
+void camera_ray(const camera_t *cam, int x, int y, float orig[3], float dir[3]){
+	for (int i = 0; i < 3; ++i){
+		float offset = x * cam->du.s[i] + y * cam->dv.s[i];
+		orig[i] = cam->pos.s[i] + (cam->type == CAMERA_ORTHO ? offset : 0);
+		dir[i] = cam->dir.s[i] + (cam->type == CAMERA_ORTHO ? 0 : offset);
+	}
+	if (cam->type != CAMERA_ORTHO){
+		normalize(dir);
+	}
+}
+size_t sphere_buffer_size(sphere_layout_t layout, size_t n){
+	return layout == SPHERE_AOS ? sizeof(sphere_t) * n : sizeof(cl_float4) * n;
+}
+void pack_spheres(const sphere_t *spheres, size_t n, sphere_layout_t layout, void *out){
+	if (layout == SPHERE_AOS){
+		memcpy(out, spheres, sizeof(sphere_t) * n);
+	}
+	else if (layout == SPHERE_PACKED){
+		cl_float4 *packed = out;
+		for (size_t i = 0; i < n; ++i){
+			packed[i].s[0] = spheres[i].center.s[0];
+			packed[i].s[1] = spheres[i].center.s[1];
+			packed[i].s[2] = spheres[i].center.s[2];
+			packed[i].s[3] = spheres[i].radius;
+		}
+	}
+	else {
+		cl_float *centers = out;
+		cl_float *radii = centers + 3 * n;
+		for (size_t i = 0; i < n; ++i){
+			for (int j = 0; j < 3; ++j){
+				centers[3 * i + j] = spheres[i].center.s[j];
+			}
+			radii[i] = spheres[i].radius;
+		}
+	}
+}
+const char* sphere_layout_options(sphere_layout_t layout){
+	static const char *options[] = {
+		"-DSPHERE_LAYOUT=SPHERE_AOS", "-DSPHERE_LAYOUT=SPHERE_PACKED", "-DSPHERE_LAYOUT=SPHERE_SOA"
+	};
+	return options[layout];
+}
+const char* sphere_layout_name(sphere_layout_t layout){
+	static const char *names[] = { "aos", "packed", "soa" };
+	return names[layout];
+}
+int intersect_sphere(const float orig[3], const float dir[3], float *t_max, const sphere_t *sphere){
+	float l[3];
+	for (int i = 0; i < 3; ++i){
+		l[i] = sphere->center.s[i] - orig[i];
+	}
+	float l_sqr = dot(l, l);
+	float s = dot(l, dir);
+	float r_sqr = sphere->radius * sphere->radius;
+	if (s < 0 && l_sqr > r_sqr){
+		return 0;
+	}
+	float m_sqr = l_sqr - s * s;
+	if (m_sqr > r_sqr){
+		return 0;
+	}
+	float q = sqrtf(r_sqr - m_sqr);
+	float t = l_sqr > r_sqr ? s - q : s + q;
+	if (t < *t_max){
+		*t_max = t;
+		return 1;
+	}
+	return 0;
+}
+char hit_char(float t){
+	return t < 0.5f ? '@' : t < 1 ? '0' : '.';
+}
+void cast_rays_host(const camera_t *cam, const sphere_t *spheres, size_t n_objs, char *img,
+	int width, int height)
+{
+	for (size_t px = 0; px < (size_t)width * height; ++px){
+		float orig[3], dir[3];
+		camera_ray(cam, px % width, px / width, orig, dir);
+		float t = FLT_MAX;
+		for (size_t i = 0; i < n_objs; ++i){
+			if (intersect_sphere(orig, dir, &t, &spheres[i])){
+				img[px] = hit_char(t);
+			}
+		}
+	}
+}
+
@@ -0,0 +1,110 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stddef.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "thread_pool.h"
+
+//Matches the layout of sphere_t in ray_test.cl
+typedef struct sphere_t {
+	cl_float3 center;
+	float radius;
+} sphere_t;
+
+/*
+ * Layouts the kernels can read the spheres in, matching SPHERE_LAYOUT in ray_test.cl.
+ * SPHERE_AOS is an array of sphere_t at 32 bytes a sphere, since cl_float3 is padded to
+ * 16 bytes. SPHERE_PACKED is a cl_float4 per sphere with the radius in w and SPHERE_SOA
+ * is the n centers as packed xyz floats followed by the n radii, both 16 bytes a sphere
+ */
+typedef enum sphere_layout_t {
+	SPHERE_AOS,
+	SPHERE_PACKED,
+	SPHERE_SOA
+} sphere_layout_t;
+
+typedef enum camera_type_t {
+	CAMERA_ORTHO,
+	CAMERA_PINHOLE
+} camera_type_t;
+
+/*
+ * Camera the kernels generate their primary rays from, matches camera_t in ray_test.cl.
+ * Pixel (x, y) gets the offset x * du + y * dv, an orthographic camera moves the ray
+ * origin from pos by it while a pinhole camera adds it to dir and normalizes
+ */
+typedef struct camera_t {
+	cl_float3 pos, dir, du, dv;
+	cl_uint type;
+} camera_t;
+
+/*
+ * Fill spheres with n random spheres in front of the width x height grid camera,
+ * the same seed always gives the same scene. The spheres get smaller as n grows
+ * so large scenes stay mostly open
+ */
+void random_spheres(sphere_t *spheres, size_t n, int width, int height, unsigned seed);
+/*
+ * Set up a camera at pos looking at target for a width x height image. For an orthographic
+ * camera size is the width of the view in world units, for a pinhole camera it's the
+ * vertical field of view in degrees
+ */
+void look_at_camera(camera_t *cam, camera_type_t type, const float pos[3], const float target[3],
+	const float up[3], float size, int width, int height);
+/*
+ * Set up the orthographic camera looking down +z that starts the ray for pixel (x, y) at (x, y, 0)
+ */
+void grid_camera(camera_t *cam, int width, int height);
+/*
+ * Get the ray camera_ray in ray_test.cl generates for pixel (x, y)
+ */
+void camera_ray(const camera_t *cam, int x, int y, float orig[3], float dir[3]);
+/*
+ * Same test as intersect_sphere in ray_test.cl, if the sphere is hit closer than
+ * t_max it's updated to the hit distance. dir must be normalized
+ * returns 1 if t_max was updated
+ */
+int intersect_sphere(const float orig[3], const float dir[3], float *t_max, const sphere_t *sphere);
+/*
+ * Get the character cast_rays writes for a hit at distance t
+ */
+char hit_char(float t);
+/*
+ * Get the size in bytes of the buffer holding n spheres in the layout
+ */
+size_t sphere_buffer_size(sphere_layout_t layout, size_t n);
+/*
+ * Write the n spheres into out in the layout, out must hold sphere_buffer_size bytes
+ */
+void pack_spheres(const sphere_t *spheres, size_t n, sphere_layout_t layout, void *out);
+/*
+ * Get the build options to compile ray_test.cl for the layout
+ */
+const char* sphere_layout_options(sphere_layout_t layout);
+/*
+ * Get a short name for the layout, aos, packed or soa
+ */
+const char* sphere_layout_name(sphere_layout_t layout);
+/*
+ * Cast the rays on the host the same way cast_rays does, writing the character
+ * for each pixel's closest hit into img or leaving it untouched if there's no hit
+ */
+void cast_rays_host(const camera_t *cam, const sphere_t *spheres, size_t n_objs, char *img,
+	int width, int height);
+/*
+ * The host backend's cast_rays, for when there's no OpenCL device and as a native
+ * baseline for the kernel. Rows are split across the pool's threads, or run on the caller
+ * if pool is NULL, and rays are traced 8 at a time with AVX2 or SSE4.1 as simd_level
+ * picks. The image is the same as cast_rays_host gives
+ */
+void cast_rays_host_simd(thread_pool_t *pool, const camera_t *cam, const sphere_t *spheres,
+	size_t n_objs, char *img, int width, int height);
+
+#endif
+
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "tile_sched.h"
+
+#define MIN_TILE 64
+#define MAX_TILE 256
+#define TILES_PER_DEVICE 16
+
+//The tiles shared between the workers
+typedef struct tile_queue_t {
+	//Index of the next tile to hand out, only touched with atomic increments
+	size_t next;
+	size_t n_tiles;
+	int tiles_x, tile_size, width, height;
+	size_t px_size;
+	char *img;
+} tile_queue_t;
+
+typedef struct tile_t {
+	int x, y, width, height;
+} tile_t;
+
+typedef struct tile_worker_t {
+	cl_device_id device;
+	cl_context context;
+	cl_command_queue queue;
+	cl_program program;
+	cl_kernel kernel;
+	cl_mem objects, nodes;
+	//Tiles are double buffered so one renders while the last is read back
+	cl_mem tiles[2];
+	tile_queue_t *work;
+	tile_report_t *report;
+	int failed;
+} tile_worker_t;
+
+int pick_tile_size(int width, int height, size_t n_devices){
+	int size = MAX_TILE;
+	while (size > MIN_TILE && (size_t)((width + size - 1) / size) * ((height + size - 1) / size)
+		< TILES_PER_DEVICE * n_devices)
+	{
+		size /= 2;
+	}
+	return size;
+}
+//Claim the next tile, returns 0 once they've all been handed out
+static int next_tile(tile_queue_t *work, tile_t *tile){
+	const size_t t = __sync_fetch_and_add(&work->next, 1);
+	if (t >= work->n_tiles){
+		return 0;
+	}
+	tile->x = (t % work->tiles_x) * work->tile_size;
+	tile->y = (t / work->tiles_x) * work->tile_size;
+	tile->width = tile->x + work->tile_size > work->width ? work->width - tile->x
+		: work->tile_size;
+	tile->height = tile->y + work->tile_size > work->height ? work->height - tile->y
+		: work->tile_size;
+	return 1;
+}
+/*
+ * Render tiles on the worker's device until there are none left. Each tile is read straight
+ * into its spot in the image, the tiles don't overlap so the workers never write the same
+ * bytes. Only the worker's own kernel and queue are used so no locking is needed
+ */
+static void* tile_worker(void *arg){
+	tile_worker_t *w = arg;
+	tile_queue_t *work = w->work;
+	cl_event read_done[2] = { NULL, NULL };
+	cl_int err = CL_SUCCESS;
+	const double start = wall_time();
+	for (int i = 0; err == CL_SUCCESS; ++i){
+		const int b = i % 2;
+		//The tile before last was read from this buffer, the last one is still queued behind it
+		if (read_done[b]){
+			err = clWaitForEvents(1, &read_done[b]);
+			clReleaseEvent(read_done[b]);
+			read_done[b] = NULL;
+		}
+		tile_t tile;
+		if (err != CL_SUCCESS || !next_tile(work, &tile)){
+			break;
+		}
+		cl_uint2 offset = {{ tile.x, tile.y }};
+		cl_uint2 tile_dim = {{ tile.width, tile.height }};
+		size_t global_size[2] = { tile.width, tile.height };
+		err = clSetKernelArg(w->kernel, 4, sizeof(cl_mem), &w->tiles[b]);
+		err |= clSetKernelArg(w->kernel, 5, sizeof(cl_uint2), &offset);
+		err |= clSetKernelArg(w->kernel, 6, sizeof(cl_uint2), &tile_dim);
+		err |= clEnqueueNDRangeKernel(w->queue, w->kernel, 2, NULL, global_size, NULL, 0, NULL,
+			NULL);
+		const size_t buffer_origin[3] = { 0, 0, 0 };
+		const size_t host_origin[3] = { work->px_size * tile.x, tile.y, 0 };
+		const size_t region[3] = { work->px_size * tile.width, tile.height, 1 };
+		err |= clEnqueueReadBufferRect(w->queue, w->tiles[b], CL_FALSE, buffer_origin, host_origin,
+			region, work->px_size * tile.width, 0, work->px_size * work->width, 0, work->img, 0,
+			NULL, &read_done[b]);
+		err |= clFlush(w->queue);
+		++w->report->tiles;
+		w->report->pixels += (size_t)tile.width * tile.height;
+	}
+	err |= clFinish(w->queue);
+	for (int i = 0; i < 2; ++i){
+		if (read_done[i]){
+			clReleaseEvent(read_done[i]);
+		}
+	}
+	w->report->busy_ms = (wall_time() - start) * 1000.0;
+	w->failed = check_cl_err(err, "failed to render tile");
+	return NULL;
+}
+//Set up the worker's context, queue, program and buffers. returns 1 on failure
+static int setup_worker(tile_worker_t *w, const char *src, const char *options,
+	const tile_scene_t *scene, image_format_t format, int tile_size, size_t px_size)
+{
+	w->context = create_context(w->device);
+	if (!w->context){
+		return 1;
+	}
+	cl_int err, mem_err;
+	w->queue = clCreateCommandQueue(w->context, w->device, 0, &err);
+	if (check_cl_err(err, "failed to create command queue")){
+		return 1;
+	}
+	w->program = build_program(src, w->context, w->device, options);
+	if (!w->program){
+		return 1;
+	}
+	w->kernel = clCreateKernel(w->program, format == IMAGE_PFM ? "render_tile_f32"
+		: "render_tile_rgba8", &err);
+	if (check_cl_err(err, "failed to create render kernel")){
+		return 1;
+	}
+	w->objects = clCreateBuffer(w->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+		scene->objects_size, (void*)scene->objects, &err);
+	w->nodes = clCreateBuffer(w->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+		sizeof(bvh_node_t) * scene->n_nodes, (void*)scene->nodes, &mem_err);
+	err |= mem_err;
+	for (int i = 0; i < 2; ++i){
+		w->tiles[i] = clCreateBuffer(w->context, CL_MEM_WRITE_ONLY,
+			px_size * tile_size * tile_size, NULL, &mem_err);
+		err |= mem_err;
+	}
+	if (check_cl_err(err, "failed to upload scene")){
+		return 1;
+	}
+	err = clSetKernelArg(w->kernel, 0, sizeof(camera_t), &scene->camera);
+	err |= clSetKernelArg(w->kernel, 1, sizeof(cl_mem), &w->objects);
+	err |= clSetKernelArg(w->kernel, 2, sizeof(cl_uint), &scene->n_objs);
+	err |= clSetKernelArg(w->kernel, 3, sizeof(cl_mem), &w->nodes);
+	return check_cl_err(err, "failed to set up render kernel");
+}
+static void release_worker(tile_worker_t *w){
+	cl_mem mems[4] = { w->objects, w->nodes, w->tiles[0], w->tiles[1] };
+	for (int i = 0; i < 4; ++i){
+		if (mems[i]){
+			clReleaseMemObject(mems[i]);
+		}
+	}
+	if (w->kernel){
+		clReleaseKernel(w->kernel);
+	}
+	if (w->program){
+		clReleaseProgram(w->program);
+	}
+	if (w->queue){
+		clReleaseCommandQueue(w->queue);
+	}
+	if (w->context){
+		clReleaseContext(w->context);
+	}
+}
+int render_tiles(const device_t *devices, size_t n_devices, const char *src,
+	const char *options, const tile_scene_t *scene, image_format_t format, int width,
+	int height, int tile_size, void *img, tile_report_t *report)
+{
+	tile_queue_t work = {
+		.next = 0,
+		.tiles_x = (width + tile_size - 1) / tile_size,
+		.tile_size = tile_size,
+		.width = width,
+		.height = height,
+		.px_size = format == IMAGE_PFM ? sizeof(cl_float4) : sizeof(cl_uchar4),
+		.img = img
+	};
+	work.n_tiles = (size_t)work.tiles_x * ((height + tile_size - 1) / tile_size);
+
+	tile_worker_t *workers = calloc(n_devices, sizeof(tile_worker_t));
+	pthread_t *threads = malloc(sizeof(pthread_t) * n_devices);
+	int failed = 0;
+	//Programs are built up front on this thread so the workers only enqueue
+	for (size_t i = 0; i < n_devices && !failed; ++i){
+		memset(&report[i], 0, sizeof(tile_report_t));
+		strncpy(report[i].name, devices[i].name, sizeof(report[i].name) - 1);
+		workers[i].device = devices[i].id;
+		workers[i].work = &work;
+		workers[i].report = &report[i];
+		failed = setup_worker(&workers[i], src, options, scene, format, tile_size, work.px_size);
+	}
+	size_t started = 0;
+	for (; started < n_devices && !failed; ++started){
+		if (pthread_create(&threads[started], NULL, tile_worker, &workers[started])){
+			fprintf(stderr, "Failed to start worker thread for %s\n", devices[started].name);
+			failed = 1;
+			break;
+		}
+	}
+	//If a thread failed to start the ones running still finish every tile
+	for (size_t i = 0; i < started; ++i){
+		pthread_join(threads[i], NULL);
+		failed |= workers[i].failed;
+	}
+	for (size_t i = 0; i < n_devices; ++i){
+		release_worker(&workers[i]);
+	}
+	free(workers);
+	free(threads);
+	return failed;
+}
+void print_tile_report(const tile_report_t *report, size_t n_devices){
+	size_t total = 0;
+	for (size_t i = 0; i < n_devices; ++i){
+		total += report[i].pixels;
+	}
+	printf("%-40s %8s %8s %10s %10s\n", "Device", "Tiles", "Share", "Busy ms", "Mpix/s");
+	for (size_t i = 0; i < n_devices; ++i){
+		const tile_report_t *r = &report[i];
+		printf("%-40s %8lu %7.1f%% %10.2f %10.2f\n", r->name, (unsigned long)r->tiles,
+			total ? 100.0 * r->pixels / total : 0.0, r->busy_ms,
+			r->busy_ms > 0 ? r->pixels / (r->busy_ms * 1000.0) : 0.0);
+	}
+}
+
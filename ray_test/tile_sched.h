@@ -0,0 +1,69 @@
+#ifndef TILE_SCHED_H
+#define TILE_SCHED_H
+
+#include <stddef.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "device.h"
+#include "scene.h"
+#include "bvh.h"
+#include "render.h"
+
+/*
+ * Rendering across several devices at once. The image is cut into square tiles and each
+ * device gets its own context, queue and copy of the scene, fed by a host thread that
+ * claims the next tile from a shared counter with an atomic increment. Faster devices come
+ * back for tiles sooner and so end up rendering more of them
+ */
+
+/*
+ * A scene on the host to upload to each device, objects holds objects_size bytes of
+ * spheres packed in the layout the program is built for, in the order bvh_build left them
+ */
+typedef struct tile_scene_t {
+	camera_t camera;
+	const void *objects;
+	size_t objects_size;
+	cl_uint n_objs;
+	const bvh_node_t *nodes;
+	size_t n_nodes;
+} tile_scene_t;
+
+/*
+ * What one device did in render_tiles
+ */
+typedef struct tile_report_t {
+	char name[128];
+	size_t tiles, pixels;
+	//Time from the device's worker starting to its last tile being read back, in ms
+	double busy_ms;
+} tile_report_t;
+
+/*
+ * Pick the tile size for rendering the image on n_devices, small enough that there are
+ * several tiles per device to balance the load but at least 64x64 so each launch has
+ * enough work to hide its overhead
+ */
+int pick_tile_size(int width, int height, size_t n_devices);
+/*
+ * Render the width x height image of the scene on the devices in tile_size x tile_size
+ * tiles, building the program from src with the options on each of them. img must hold
+ * width * height float4 pixels for PFM or uchar4 pixels for PPM, row 0 being the bottom
+ * of the view as write_image expects. report must hold n_devices entries
+ * returns 1 on failure
+ */
+int render_tiles(const device_t *devices, size_t n_devices, const char *src,
+	const char *options, const tile_scene_t *scene, image_format_t format, int width,
+	int height, int tile_size, void *img, tile_report_t *report);
+/*
+ * Print how many tiles and pixels each device rendered and how fast
+ */
+void print_tile_report(const tile_report_t *report, size_t n_devices);
+
+#endif
+
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "util.h"
+#include "profile.h"
+#include "primitives.h"
+#include "wavefront.h"
+
+//Pixels rendered at a time, 64MB of rays
+#define CHUNK_PIXELS (1 << 20)
+
+typedef struct wf_kernels_t {
+	cl_kernel generate, intersect, shade, resolve;
+} wf_kernels_t;
+
+typedef struct wf_buffers_t {
+	cl_mem rays, color, alive, count, resolved;
+	//The queue being traced and the one the survivors are compacted into
+	cl_mem queues[2];
+} wf_buffers_t;
+
+static void release_kernels(wf_kernels_t *k){
+	cl_kernel *kernels[4] = { &k->generate, &k->intersect, &k->shade, &k->resolve };
+	for (int i = 0; i < 4; ++i){
+		if (*kernels[i]){
+			clReleaseKernel(*kernels[i]);
+		}
+	}
+}
+static void release_buffers(wf_buffers_t *buf){
+	cl_mem *mems[7] = { &buf->rays, &buf->color, &buf->alive, &buf->count, &buf->resolved,
+		&buf->queues[0], &buf->queues[1] };
+	for (int i = 0; i < 7; ++i){
+		if (*mems[i]){
+			clReleaseMemObject(*mems[i]);
+		}
+	}
+}
+//Trace the bounces of the n rays generated for a chunk, returns the first error hit
+static cl_int trace_chunk(cl_command_queue queue, primitives_t *prim, const wf_kernels_t *k,
+	const wf_buffers_t *buf, cl_uint n, int bounces, wavefront_stats_t *stats)
+{
+	cl_uint n_active = n;
+	int cur = 0;
+	cl_int err = CL_SUCCESS;
+	for (int b = 0; b < bounces && n_active > 0 && err == CL_SUCCESS; ++b){
+		if (stats){
+			stats->active[b] += n_active;
+			stats->rays += n_active;
+		}
+		const cl_int last = b == bounces - 1;
+		const size_t global_size = n_active;
+		err = clSetKernelArg(k->intersect, 4, sizeof(cl_mem), &buf->queues[cur]);
+		err |= clSetKernelArg(k->intersect, 5, sizeof(cl_uint), &n_active);
+		err |= clEnqueueNDRangeKernel(queue, k->intersect, 1, NULL, &global_size, NULL, 0, NULL,
+			profile_event("wf_intersect"));
+		err |= clSetKernelArg(k->shade, 3, sizeof(cl_mem), &buf->queues[cur]);
+		err |= clSetKernelArg(k->shade, 4, sizeof(cl_uint), &n_active);
+		err |= clSetKernelArg(k->shade, 7, sizeof(cl_int), &last);
+		err |= clEnqueueNDRangeKernel(queue, k->shade, 1, NULL, &global_size, NULL, 0, NULL,
+			profile_event("wf_shade"));
+		if (!last && err == CL_SUCCESS){
+			//The next bounce's launch size depends on how many survived, so wait for the count
+			err = primitives_compact(prim, queue, PRIM_UINT, buf->queues[cur], buf->alive, n_active,
+				buf->queues[!cur], buf->count, profile_event("wf_compact"));
+			err |= clEnqueueReadBuffer(queue, buf->count, CL_TRUE, 0, sizeof(cl_uint), &n_active,
+				0, NULL, NULL);
+			cur = !cur;
+		}
+	}
+	return err;
+}
+int render_wavefront(cl_context context, cl_device_id device, cl_command_queue queue,
+	cl_program program, primitives_t *prim, const render_scene_t *scene, int width, int height,
+	int bounces, image_format_t format, void *img, wavefront_stats_t *stats)
+{
+	if (bounces < 1 || bounces > WAVEFRONT_MAX_BOUNCES){
+		fprintf(stderr, "Wavefront rendering takes 1 to %d bounces\n", WAVEFRONT_MAX_BOUNCES);
+		return 1;
+	}
+	const size_t n_px = (size_t)width * height;
+	size_t chunk = CHUNK_PIXELS;
+	cl_ulong max_alloc = 0;
+	clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &max_alloc, NULL);
+	if (max_alloc && chunk * WAVEFRONT_RAY_SIZE > max_alloc){
+		chunk = max_alloc / WAVEFRONT_RAY_SIZE;
+	}
+	chunk = chunk < n_px ? chunk : n_px;
+
+	cl_int err = CL_SUCCESS, kernel_err;
+	wf_kernels_t k = { NULL };
+	k.generate = clCreateKernel(program, "wf_generate", &kernel_err);
+	err |= kernel_err;
+	k.intersect = clCreateKernel(program, "wf_intersect", &kernel_err);
+	err |= kernel_err;
+	k.shade = clCreateKernel(program, "wf_shade", &kernel_err);
+	err |= kernel_err;
+	k.resolve = clCreateKernel(program, "wf_resolve_rgba8", &kernel_err);
+	err |= kernel_err;
+	if (check_cl_err(err, "failed to create wavefront kernels")){
+		release_kernels(&k);
+		return 1;
+	}
+	const size_t px_size = format == IMAGE_PFM ? sizeof(cl_float4) : sizeof(cl_uchar4);
+	wf_buffers_t buf = { NULL };
+	cl_int buf_err;
+	buf.rays = clCreateBuffer(context, CL_MEM_READ_WRITE, WAVEFRONT_RAY_SIZE * chunk, NULL, &err);
+	buf.color = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_float4) * chunk, NULL,
+		&buf_err);
+	err |= buf_err;
+	buf.alive = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * chunk, NULL, &buf_err);
+	err |= buf_err;
+	buf.count = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, &buf_err);
+	err |= buf_err;
+	for (int i = 0; i < 2; ++i){
+		buf.queues[i] = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * chunk, NULL,
+			&buf_err);
+		err |= buf_err;
+	}
+	if (format == IMAGE_PPM){
+		buf.resolved = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(cl_uchar4) * chunk, NULL,
+			&buf_err);
+		err |= buf_err;
+	}
+	const cl_uint width_arg = width;
+	err |= clSetKernelArg(k.generate, 0, sizeof(camera_t), &scene->camera);
+	err |= clSetKernelArg(k.generate, 1, sizeof(cl_mem), &buf.rays);
+	err |= clSetKernelArg(k.generate, 2, sizeof(cl_mem), &buf.queues[0]);
+	err |= clSetKernelArg(k.generate, 3, sizeof(cl_mem), &buf.color);
+	err |= clSetKernelArg(k.generate, 6, sizeof(cl_uint), &width_arg);
+	err |= clSetKernelArg(k.intersect, 0, sizeof(cl_mem), &scene->objects);
+	err |= clSetKernelArg(k.intersect, 1, sizeof(cl_uint), &scene->n_objs);
+	err |= clSetKernelArg(k.intersect, 2, sizeof(cl_mem), &scene->nodes);
+	err |= clSetKernelArg(k.intersect, 3, sizeof(cl_mem), &buf.rays);
+	err |= clSetKernelArg(k.shade, 0, sizeof(cl_mem), &scene->objects);
+	err |= clSetKernelArg(k.shade, 1, sizeof(cl_uint), &scene->n_objs);
+	err |= clSetKernelArg(k.shade, 2, sizeof(cl_mem), &buf.rays);
+	err |= clSetKernelArg(k.shade, 5, sizeof(cl_mem), &buf.color);
+	err |= clSetKernelArg(k.shade, 6, sizeof(cl_mem), &buf.alive);
+	err |= clSetKernelArg(k.resolve, 0, sizeof(cl_mem), &buf.color);
+	err |= clSetKernelArg(k.resolve, 1, sizeof(cl_mem), &buf.resolved);
+	int failed = check_cl_err(err, "failed to set up wavefront buffers");
+
+	if (stats){
+		memset(stats, 0, sizeof(wavefront_stats_t));
+		stats->bounces = bounces;
+	}
+	for (size_t first = 0; first < n_px && !failed; first += chunk){
+		const cl_uint n = first + chunk > n_px ? n_px - first : chunk;
+		const cl_uint first_arg = first;
+		const size_t global_size = n;
+		err = clSetKernelArg(k.generate, 4, sizeof(cl_uint), &first_arg);
+		err |= clSetKernelArg(k.generate, 5, sizeof(cl_uint), &n);
+		err |= clEnqueueNDRangeKernel(queue, k.generate, 1, NULL, &global_size, NULL, 0, NULL,
+			profile_event("wf_generate"));
+		if (err == CL_SUCCESS){
+			err = trace_chunk(queue, prim, &k, &buf, n, bounces, stats);
+		}
+		char *out = (char*)img + px_size * first;
+		if (err == CL_SUCCESS && format == IMAGE_PFM){
+			err = clEnqueueReadBuffer(queue, buf.color, CL_TRUE, 0, px_size * n, out, 0, NULL,
+				profile_event("read wavefront"));
+		}
+		else if (err == CL_SUCCESS){
+			err = clSetKernelArg(k.resolve, 2, sizeof(cl_uint), &n);
+			err |= clEnqueueNDRangeKernel(queue, k.resolve, 1, NULL, &global_size, NULL, 0, NULL,
+				profile_event("wf_resolve_rgba8"));
+			err |= clEnqueueReadBuffer(queue, buf.resolved, CL_TRUE, 0, px_size * n, out, 0, NULL,
+				profile_event("read wavefront"));
+		}
+		failed = check_cl_err(err, "failed to render wavefront chunk");
+	}
+	release_buffers(&buf);
+	release_kernels(&k);
+	return failed;
+}
+void print_wavefront_stats(const wavefront_stats_t *stats){
+	for (int b = 0; b < stats->bounces && stats->active[b] > 0; ++b){
+		printf("Bounce %2d: %10lu rays (%5.1f%% of primary)\n", b,
+			(unsigned long)stats->active[b], 100.0 * stats->active[b] / stats->active[0]);
+	}
+	printf("%lu rays traced\n", (unsigned long)stats->rays);
+}
+
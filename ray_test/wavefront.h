@@ -0,0 +1,49 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include <stddef.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "primitives.h"
+#include "render.h"
+
+//Bytes per ray in the wavefront ray buffer, sizeof(wf_ray_t) in ray_test.cl
+#define WAVEFRONT_RAY_SIZE 64
+//Most bounces render_wavefront will trace
+#define WAVEFRONT_MAX_BOUNCES 16
+
+/*
+ * Rays traced by render_wavefront, active[b] is the number of rays still alive at the
+ * start of bounce b summed over the chunks
+ */
+typedef struct wavefront_stats_t {
+	size_t active[WAVEFRONT_MAX_BOUNCES];
+	int bounces;
+	size_t rays;
+} wavefront_stats_t;
+
+/*
+ * Render a width x height image of the scene into img as wavefronts, a chunk of pixels at a
+ * time. Each chunk's primary rays go in a queue on the device and every bounce runs the
+ * wf_intersect and wf_shade kernels over the queue, then the rays that hit something are
+ * reflected and compacted into the next bounce's queue with primitives_compact, so later
+ * bounces only launch work-items for rays that are still alive. A single bounce gives the
+ * same image as render_to_file. img holds float4 pixels for PFM or uchar4 pixels for PPM,
+ * row 0 at the bottom, stats can be NULL
+ * returns 1 on failure
+ */
+int render_wavefront(cl_context context, cl_device_id device, cl_command_queue queue,
+	cl_program program, primitives_t *prim, const render_scene_t *scene, int width, int height,
+	int bounces, image_format_t format, void *img, wavefront_stats_t *stats);
+/*
+ * Print the rays alive at each bounce
+ */
+void print_wavefront_stats(const wavefront_stats_t *stats);
+
+#endif
+
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <CL/cl.h>
+#include "util.h"
+#include "buffer_pool.h"
+
+//Smallest size class is 256 bytes
+#define MIN_CLASS_SHIFT 8
+#define NUM_CLASSES 48
+//Only size classes up to this fraction of a slab are carved from slabs
+#define SLAB_FRACTION 8
+
+typedef struct slab_t {
+	cl_mem mem;
+	cl_mem_flags flags;
+	//Bytes carved off the front of the slab so far
+	size_t used;
+	//Sub-buffers carved from the slab that haven't been released yet, and how many of them
+	//are sitting on the free lists
+	size_t blocks, cached;
+	struct slab_t *next;
+} slab_t;
+
+typedef struct block_t {
+	cl_mem mem;
+	int size_class;
+	cl_mem_flags flags;
+	//The slab the block was carved from, NULL if it's a buffer of its own
+	slab_t *slab;
+	struct block_t *next;
+} block_t;
+
+struct buffer_pool_t {
+	cl_context context;
+	size_t slab_size;
+	//Sub-buffer origins must be a multiple of the device's base address alignment
+	size_t align;
+	block_t *free_lists[NUM_CLASSES];
+	block_t *live;
+	slab_t *slabs;
+	buffer_pool_stats_t stats;
+};
+
+static size_t class_bytes(int size_class){
+	return (size_t)1 << (size_class + MIN_CLASS_SHIFT);
+}
+//Get the smallest size class holding size bytes, or -1 if it's too big for any
+static int size_class(size_t size){
+	for (int c = 0; c < NUM_CLASSES; ++c){
+		if (class_bytes(c) >= size){
+			return c;
+		}
+	}
+	return -1;
+}
+buffer_pool_t* buffer_pool_create(cl_context context, cl_device_id device, size_t slab_size){
+	buffer_pool_t *pool = calloc(1, sizeof(buffer_pool_t));
+	if (!pool){
+		return NULL;
+	}
+	pool->context = context;
+	pool->slab_size = slab_size;
+	cl_uint align_bits = 0;
+	clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(cl_uint), &align_bits, NULL);
+	pool->align = align_bits >= 8 ? align_bits / 8 : 1;
+	return pool;
+}
+/*
+ * Carve a sub-buffer for the size class out of a slab with the flags, making a new slab if
+ * they're all full. The slab it came from is written to from
+ */
+static cl_mem slab_alloc(buffer_pool_t *pool, int c, cl_mem_flags flags, slab_t **from,
+	cl_int *err)
+{
+	const size_t size = class_bytes(c);
+	slab_t *slab = pool->slabs;
+	while (slab && (slab->flags != flags
+		|| round_up(slab->used, pool->align) + size > pool->slab_size))
+	{
+		slab = slab->next;
+	}
+	if (!slab){
+		cl_mem mem = clCreateBuffer(pool->context, flags, pool->slab_size, NULL, err);
+		if (*err != CL_SUCCESS){
+			return NULL;
+		}
+		++pool->stats.allocations;
+		slab = malloc(sizeof(slab_t));
+		slab->mem = mem;
+		slab->flags = flags;
+		slab->used = 0;
+		slab->blocks = 0;
+		slab->cached = 0;
+		slab->next = pool->slabs;
+		pool->slabs = slab;
+	}
+	cl_buffer_region region = { round_up(slab->used, pool->align), size };
+	//Sub-buffers inherit the slab's flags
+	cl_mem mem = clCreateSubBuffer(slab->mem, 0, CL_BUFFER_CREATE_TYPE_REGION, &region, err);
+	if (*err == CL_SUCCESS){
+		slab->used = region.origin + size;
+		++slab->blocks;
+		++pool->stats.allocations;
+		*from = slab;
+	}
+	return mem;
+}
+cl_mem buffer_pool_get(buffer_pool_t *pool, size_t size, cl_mem_flags flags, cl_int *err){
+	const int c = size_class(size);
+	if (c < 0 || (flags & (CL_MEM_USE_HOST_PTR | CL_MEM_COPY_HOST_PTR))){
+		*err = CL_INVALID_VALUE;
+		return NULL;
+	}
+	block_t **prev = &pool->free_lists[c];
+	while (*prev && (*prev)->flags != flags){
+		prev = &(*prev)->next;
+	}
+	block_t *block = *prev;
+	if (block){
+		*prev = block->next;
+		pool->stats.cached_bytes -= class_bytes(c);
+		++pool->stats.hits;
+		if (block->slab){
+			--block->slab->cached;
+		}
+	}
+	else {
+		++pool->stats.misses;
+		cl_mem mem;
+		slab_t *slab = NULL;
+		if (pool->slab_size && class_bytes(c) <= pool->slab_size / SLAB_FRACTION){
+			mem = slab_alloc(pool, c, flags, &slab, err);
+		}
+		else {
+			mem = clCreateBuffer(pool->context, flags, class_bytes(c), NULL, err);
+			pool->stats.allocations += *err == CL_SUCCESS;
+		}
+		if (*err != CL_SUCCESS){
+			return NULL;
+		}
+		block = malloc(sizeof(block_t));
+		block->mem = mem;
+		block->size_class = c;
+		block->flags = flags;
+		block->slab = slab;
+	}
+	block->next = pool->live;
+	pool->live = block;
+	pool->stats.live_bytes += class_bytes(c);
+	if (pool->stats.live_bytes > pool->stats.high_water){
+		pool->stats.high_water = pool->stats.live_bytes;
+	}
+	*err = CL_SUCCESS;
+	return block->mem;
+}
+int buffer_pool_put(buffer_pool_t *pool, cl_mem mem){
+	block_t **prev = &pool->live;
+	while (*prev && (*prev)->mem != mem){
+		prev = &(*prev)->next;
+	}
+	block_t *block = *prev;
+	if (!block){
+		fprintf(stderr, "buffer_pool_put error: buffer isn't from this pool\n");
+		return 1;
+	}
+	*prev = block->next;
+	block->next = pool->free_lists[block->size_class];
+	pool->free_lists[block->size_class] = block;
+	pool->stats.live_bytes -= class_bytes(block->size_class);
+	pool->stats.cached_bytes += class_bytes(block->size_class);
+	if (block->slab){
+		++block->slab->cached;
+	}
+	return 0;
+}
+static void release_blocks(block_t *block){
+	while (block){
+		block_t *next = block->next;
+		clReleaseMemObject(block->mem);
+		free(block);
+		block = next;
+	}
+}
+void buffer_pool_trim(buffer_pool_t *pool){
+	//Sub-buffers of a slab with one still handed out are kept, releasing them wouldn't give
+	//any memory back and the next requests would carve fresh ranges instead of reusing them
+	for (int c = 0; c < NUM_CLASSES; ++c){
+		block_t **prev = &pool->free_lists[c];
+		while (*prev){
+			block_t *block = *prev;
+			if (block->slab && block->slab->cached < block->slab->blocks){
+				prev = &block->next;
+				continue;
+			}
+			*prev = block->next;
+			pool->stats.cached_bytes -= class_bytes(c);
+			if (block->slab){
+				--block->slab->blocks;
+				--block->slab->cached;
+			}
+			clReleaseMemObject(block->mem);
+			free(block);
+		}
+	}
+	//Slabs with nothing left carved from them are released
+	slab_t **prev = &pool->slabs;
+	while (*prev){
+		slab_t *slab = *prev;
+		if (slab->blocks == 0){
+			*prev = slab->next;
+			clReleaseMemObject(slab->mem);
+			free(slab);
+		}
+		else {
+			prev = &slab->next;
+		}
+	}
+}
+buffer_pool_stats_t buffer_pool_stats(const buffer_pool_t *pool){
+	buffer_pool_stats_t stats = pool->stats;
+	size_t requests = stats.hits + stats.misses;
+	stats.hit_rate = requests ? (double)stats.hits / requests : 0;
+	return stats;
+}
+void buffer_pool_destroy(buffer_pool_t *pool){
+	if (!pool){
+		return;
+	}
+	for (int c = 0; c < NUM_CLASSES; ++c){
+		release_blocks(pool->free_lists[c]);
+	}
+	release_blocks(pool->live);
+	//Sub-buffers have to go before the slabs they're carved from
+	while (pool->slabs){
+		slab_t *next = pool->slabs->next;
+		clReleaseMemObject(pool->slabs->mem);
+		free(pool->slabs);
+		pool->slabs = next;
+	}
+	free(pool);
+}
+
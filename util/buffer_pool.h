@@ -0,0 +1,66 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+#include <CL/cl.h>
+
+/*
+ * A pool of cl_mem buffers for loops that keep allocating buffers of similar sizes.
+ * Requests are rounded up to a power of two size class and released buffers go on a
+ * free list for their class and flags, so later requests reuse them instead of
+ * creating new ones. Buffers handed out may be bigger than requested. The pool
+ * isn't thread safe
+ */
+typedef struct buffer_pool_t buffer_pool_t;
+
+typedef struct buffer_pool_stats_t {
+	//Bytes in buffers handed out and not yet returned, counted by size class
+	size_t live_bytes;
+	//Most live_bytes there's been
+	size_t high_water;
+	//Bytes in buffers sitting on the free lists
+	size_t cached_bytes;
+	//Requests served from a free list and requests that had to create a buffer
+	size_t hits, misses;
+	//Buffers and slabs created with clCreateBuffer or clCreateSubBuffer
+	size_t allocations;
+	double hit_rate;
+} buffer_pool_stats_t;
+
+/*
+ * Create a pool for the device's buffers in the context. If slab_size is non-zero, size
+ * classes up to slab_size / 8 are carved out of slab_size byte slabs as sub-buffers
+ * instead of being created individually
+ * returns NULL on failure
+ */
+buffer_pool_t* buffer_pool_create(cl_context context, cl_device_id device, size_t slab_size);
+/*
+ * Get a buffer of at least size bytes with the flags, which can't include
+ * CL_MEM_USE_HOST_PTR or CL_MEM_COPY_HOST_PTR since pooled buffers are reused
+ * returns NULL on failure, setting err
+ */
+cl_mem buffer_pool_get(buffer_pool_t *pool, size_t size, cl_mem_flags flags, cl_int *err);
+/*
+ * Return a buffer from buffer_pool_get to the pool for reuse, commands using it must
+ * be enqueued before it's returned since the next user may overwrite it
+ * returns 1 if the buffer didn't come from the pool
+ */
+int buffer_pool_put(buffer_pool_t *pool, cl_mem mem);
+/*
+ * Release the buffers on the free lists and the slabs with no buffers handed out. Free
+ * buffers carved from a slab that still has one handed out stay on the free lists to be
+ * reused, since releasing them wouldn't give back any memory
+ */
+void buffer_pool_trim(buffer_pool_t *pool);
+/*
+ * Get the pool's statistics
+ */
+buffer_pool_stats_t buffer_pool_stats(const buffer_pool_t *pool);
+/*
+ * Release every buffer the pool has made and free it, buffers still handed out
+ * are released too
+ */
+void buffer_pool_destroy(buffer_pool_t *pool);
+
+#endif
+
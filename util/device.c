@@ -0,0 +1,419 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <CL/cl.h>
+#include "util.h"
+#include "prog_cache.h"
+#include "device.h"
+#include "simd.h"
+
+#define SCORE_FILE "device_scores.txt"
+//Bytes copied by the bandwidth kernel, clamped to what the device can allocate
+#define CALIBRATE_BYTES (64 * 1024 * 1024)
+//Work-items per compute unit for the FLOP kernel
+#define CALIBRATE_ITEMS_PER_CU 4096
+//Iterations of the FLOP kernel loop, each does 4 float4 mads (32 flops)
+#define CALIBRATE_ITERS 256
+#define CALIBRATE_RUNS 3
+
+static const char *calibrate_src =
+	"kernel void copy(const global float4 *in, global float4 *out){\n"
+	"	size_t i = get_global_id(0);\n"
+	"	out[i] = in[i];\n"
+	"}\n"
+	"kernel void flops(global float *out, const int iters){\n"
+	"	float4 a = (float4)(get_global_id(0) * 1e-6f), b = a + 0.1f, c = a + 0.2f, d = a + 0.3f;\n"
+	"	const float4 k = (float4)(0.999f), o = (float4)(0.001f);\n"
+	"	for (int i = 0; i < iters; ++i){\n"
+	"		a = mad(a, k, o);\n"
+	"		b = mad(b, k, o);\n"
+	"		c = mad(c, k, o);\n"
+	"		d = mad(d, k, o);\n"
+	"	}\n"
+	"	float4 r = a + b + c + d;\n"
+	"	out[get_global_id(0)] = r.x + r.y + r.z + r.w;\n"
+	"}\n";
+
+static void CL_CALLBACK device_err_callback(const char *err_info, const void *priv_info, size_t cb,
+	void *user)
+{
+	fprintf(stderr, "OpenCL context error: %s\n", err_info);
+}
+size_t list_devices(device_t **devices){
+	*devices = NULL;
+	cl_uint num_platforms;
+	cl_int err = clGetPlatformIDs(0, NULL, &num_platforms);
+	if (check_cl_err(err, "Failed to find platforms") || num_platforms < 1){
+		return 0;
+	}
+	cl_platform_id *platforms = malloc(sizeof(cl_platform_id) * num_platforms);
+	err = clGetPlatformIDs(num_platforms, platforms, NULL);
+	if (check_cl_err(err, "Failed to get platforms")){
+		free(platforms);
+		return 0;
+	}
+	size_t n = 0;
+	for (cl_uint p = 0; p < num_platforms; ++p){
+		cl_uint num_devices;
+		err = clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, 0, NULL, &num_devices);
+		//Platforms with no devices report CL_DEVICE_NOT_FOUND, just skip them
+		if (err != CL_SUCCESS || num_devices < 1){
+			continue;
+		}
+		cl_device_id *ids = malloc(sizeof(cl_device_id) * num_devices);
+		err = clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, num_devices, ids, NULL);
+		if (check_cl_err(err, "Failed to get devices for platform")){
+			free(ids);
+			continue;
+		}
+		*devices = realloc(*devices, sizeof(device_t) * (n + num_devices));
+		for (cl_uint d = 0; d < num_devices; ++d, ++n){
+			device_t *dev = &(*devices)[n];
+			memset(dev, 0, sizeof(device_t));
+			dev->platform = platforms[p];
+			dev->id = ids[d];
+			dev->platform_idx = p;
+			dev->device_idx = d;
+			clGetDeviceInfo(ids[d], CL_DEVICE_TYPE, sizeof(cl_device_type), &dev->type, NULL);
+			clGetDeviceInfo(ids[d], CL_DEVICE_NAME, sizeof(dev->name), dev->name, NULL);
+			clGetPlatformInfo(platforms[p], CL_PLATFORM_NAME, sizeof(dev->platform_name),
+				dev->platform_name, NULL);
+		}
+		free(ids);
+	}
+	free(platforms);
+	return n;
+}
+static const char* type_name(cl_device_type type){
+	if (type & CL_DEVICE_TYPE_GPU){
+		return "GPU";
+	}
+	if (type & CL_DEVICE_TYPE_CPU){
+		return "CPU";
+	}
+	if (type & CL_DEVICE_TYPE_ACCELERATOR){
+		return "accelerator";
+	}
+	return "other";
+}
+void print_devices(const device_t *devices, size_t n){
+	for (size_t i = 0; i < n; ++i){
+		printf("%u:%u %s (%s, %s): %.1f GB/s, %.1f GFLOP/s, score %.1f\n",
+			devices[i].platform_idx, devices[i].device_idx, devices[i].name,
+			devices[i].platform_name, type_name(devices[i].type), devices[i].bandwidth,
+			devices[i].gflops, devices[i].score);
+	}
+}
+//Build the key identifying a device and driver in the score file
+static void score_key(const device_t *dev, char *key, size_t sz){
+	char driver[128];
+	if (clGetDeviceInfo(dev->id, CL_DRIVER_VERSION, sizeof(driver), driver, NULL) != CL_SUCCESS){
+		driver[0] = '\0';
+	}
+	snprintf(key, sz, "%s/%s/%s", dev->platform_name, dev->name, driver);
+}
+//Look for cached scores for the device, returns 1 if they were found
+static int load_scores(device_t *dev){
+	const char *dir = prog_cache_dir();
+	if (!dir || getenv("OCLP_RECALIBRATE")){
+		return 0;
+	}
+	char path[1100], key[512], line[640], file_key[512];
+	snprintf(path, sizeof(path), "%s/" SCORE_FILE, dir);
+	FILE *fp = fopen(path, "r");
+	if (!fp){
+		return 0;
+	}
+	score_key(dev, key, sizeof(key));
+	int found = 0;
+	double bw, gflops;
+	while (fgets(line, sizeof(line), fp)){
+		if (sscanf(line, "%lf %lf %511[^\n]", &bw, &gflops, file_key) == 3
+			&& strcmp(file_key, key) == 0)
+		{
+			//Keep going so the latest entry for the device wins
+			dev->bandwidth = bw;
+			dev->gflops = gflops;
+			found = 1;
+		}
+	}
+	fclose(fp);
+	return found;
+}
+static void store_scores(const device_t *dev){
+	const char *dir = prog_cache_dir();
+	if (!dir){
+		return;
+	}
+	char path[1100], key[512];
+	snprintf(path, sizeof(path), "%s/" SCORE_FILE, dir);
+	FILE *fp = fopen(path, "a");
+	if (!fp){
+		return;
+	}
+	score_key(dev, key, sizeof(key));
+	fprintf(fp, "%f %f %s\n", dev->bandwidth, dev->gflops, key);
+	fclose(fp);
+}
+//Run the kernel a few times and return the fastest run in seconds, or a negative value on failure
+static double time_kernel(cl_command_queue queue, cl_kernel kernel, size_t global_size){
+	double best = -1;
+	//One extra run up front to warm up
+	for (int i = 0; i < CALIBRATE_RUNS + 1; ++i){
+		cl_event evt;
+		cl_int err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, NULL,
+			0, NULL, &evt);
+		if (check_cl_err(err, "calibrate_device: failed to run kernel")){
+			return -1;
+		}
+		clWaitForEvents(1, &evt);
+		cl_ulong start, end;
+		err = clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+		err |= clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+		clReleaseEvent(evt);
+		if (check_cl_err(err, "calibrate_device: failed to get profiling info")){
+			return -1;
+		}
+		double t = (end - start) * 1e-9;
+		if (i > 0 && (best < 0 || t < best)){
+			best = t;
+		}
+	}
+	return best;
+}
+static void compute_score(device_t *dev){
+	//Geometric mean so neither memory or compute bound devices dominate
+	dev->score = sqrt(dev->bandwidth * dev->gflops);
+}
+int calibrate_device(device_t *dev){
+	if (load_scores(dev)){
+		compute_score(dev);
+		return 0;
+	}
+	cl_context context = create_context(dev->id);
+	if (!context){
+		return 1;
+	}
+	int ret = 1;
+	cl_int err;
+	cl_program program = NULL;
+	cl_kernel copy = NULL, flops = NULL;
+	cl_mem bufs[2] = { NULL, NULL };
+	cl_command_queue queue = clCreateCommandQueue(context, dev->id, CL_QUEUE_PROFILING_ENABLE, &err);
+	if (check_cl_err(err, "calibrate_device: failed to create command queue")){
+		goto cleanup;
+	}
+	program = build_program(calibrate_src, context, dev->id, NULL);
+	if (!program){
+		goto cleanup;
+	}
+	copy = clCreateKernel(program, "copy", &err);
+	if (check_cl_err(err, "calibrate_device: failed to create copy kernel")){
+		goto cleanup;
+	}
+	flops = clCreateKernel(program, "flops", &err);
+	if (check_cl_err(err, "calibrate_device: failed to create flops kernel")){
+		goto cleanup;
+	}
+
+	cl_ulong max_alloc;
+	cl_uint compute_units;
+	clGetDeviceInfo(dev->id, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, NULL);
+	clGetDeviceInfo(dev->id, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(compute_units), &compute_units, NULL);
+	size_t bytes = CALIBRATE_BYTES;
+	if (bytes > max_alloc / 2){
+		bytes = max_alloc / 2;
+	}
+	bytes -= bytes % (16 * 256);
+	for (int i = 0; i < 2; ++i){
+		bufs[i] = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+		if (check_cl_err(err, "calibrate_device: failed to create buffer")){
+			goto cleanup;
+		}
+	}
+	float zero = 0;
+	err = clEnqueueFillBuffer(queue, bufs[0], &zero, sizeof(float), 0, bytes, 0, NULL, NULL);
+	err |= clSetKernelArg(copy, 0, sizeof(cl_mem), &bufs[0]);
+	err |= clSetKernelArg(copy, 1, sizeof(cl_mem), &bufs[1]);
+	if (check_cl_err(err, "calibrate_device: failed to set up copy kernel")){
+		goto cleanup;
+	}
+	double t = time_kernel(queue, copy, bytes / 16);
+	if (t <= 0){
+		goto cleanup;
+	}
+	//Each byte is read once and written once
+	dev->bandwidth = 2.0 * bytes / t * 1e-9;
+
+	size_t items = compute_units * CALIBRATE_ITEMS_PER_CU;
+	if (items * sizeof(float) > bytes){
+		items = bytes / sizeof(float);
+	}
+	cl_int iters = CALIBRATE_ITERS;
+	err = clSetKernelArg(flops, 0, sizeof(cl_mem), &bufs[1]);
+	err |= clSetKernelArg(flops, 1, sizeof(cl_int), &iters);
+	if (check_cl_err(err, "calibrate_device: failed to set up flops kernel")){
+		goto cleanup;
+	}
+	t = time_kernel(queue, flops, items);
+	if (t <= 0){
+		goto cleanup;
+	}
+	dev->gflops = (double)items * iters * 32 / t * 1e-9;
+	compute_score(dev);
+	store_scores(dev);
+	ret = 0;
+
+cleanup:
+	for (int i = 0; i < 2; ++i){
+		if (bufs[i]){
+			clReleaseMemObject(bufs[i]);
+		}
+	}
+	if (copy){
+		clReleaseKernel(copy);
+	}
+	if (flops){
+		clReleaseKernel(flops);
+	}
+	if (program){
+		clReleaseProgram(program);
+	}
+	if (queue){
+		clReleaseCommandQueue(queue);
+	}
+	clReleaseContext(context);
+	return ret;
+}
+//Case-insensitive substring search
+static int contains(const char *str, const char *sub){
+	size_t n = strlen(sub);
+	for (; *str; ++str){
+		size_t i = 0;
+		while (i < n && str[i] && tolower((unsigned char)str[i]) == tolower((unsigned char)sub[i])){
+			++i;
+		}
+		if (i == n){
+			return 1;
+		}
+	}
+	return n == 0;
+}
+//Check if the device is picked by the OCLP_DEVICE override
+static int matches_override(const device_t *dev, const char *sel){
+	unsigned p, d;
+	char tail;
+	if (sscanf(sel, "%u:%u%c", &p, &d, &tail) == 2){
+		return dev->platform_idx == p && dev->device_idx == d;
+	}
+	if (strcmp(sel, "gpu") == 0 || strcmp(sel, "GPU") == 0){
+		return (dev->type & CL_DEVICE_TYPE_GPU) != 0;
+	}
+	if (strcmp(sel, "cpu") == 0 || strcmp(sel, "CPU") == 0){
+		return (dev->type & CL_DEVICE_TYPE_CPU) != 0;
+	}
+	if (strcmp(sel, "accelerator") == 0){
+		return (dev->type & CL_DEVICE_TYPE_ACCELERATOR) != 0;
+	}
+	return contains(dev->name, sel) || contains(dev->platform_name, sel);
+}
+static int cmp_score(const void *a, const void *b){
+	double sa = ((const device_t*)a)->score, sb = ((const device_t*)b)->score;
+	return sa < sb ? 1 : sa > sb ? -1 : 0;
+}
+size_t select_devices(device_t *out, size_t n){
+	device_t *devices;
+	size_t num_devices = list_devices(&devices);
+	if (num_devices == 0){
+		fprintf(stderr, "No OpenCL devices available\n");
+		return 0;
+	}
+	const char *sel = getenv("OCLP_DEVICE");
+	if (sel && *sel){
+		size_t matched = 0;
+		for (size_t i = 0; i < num_devices; ++i){
+			if (matches_override(&devices[i], sel)){
+				devices[matched++] = devices[i];
+			}
+		}
+		if (matched){
+			num_devices = matched;
+		}
+		else {
+			fprintf(stderr, "OCLP_DEVICE=%s matched no devices, ignoring it\n", sel);
+		}
+	}
+	//Devices we can't calibrate keep a score of 0 and only get picked if nothing else works
+	for (size_t i = 0; i < num_devices; ++i){
+		if (calibrate_device(&devices[i])){
+			fprintf(stderr, "Failed to calibrate %s\n", devices[i].name);
+		}
+	}
+	qsort(devices, num_devices, sizeof(device_t), cmp_score);
+	if (n > num_devices){
+		n = num_devices;
+	}
+	memcpy(out, devices, sizeof(device_t) * n);
+	free(devices);
+	return n;
+}
+cl_context create_context(cl_device_id device){
+	cl_platform_id platform;
+	cl_int err = clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, NULL);
+	if (check_cl_err(err, "Failed to get device platform")){
+		return NULL;
+	}
+	cl_context_properties properties[] = {
+		CL_CONTEXT_PLATFORM, (cl_context_properties)platform, 0
+	};
+	cl_context context = clCreateContext(properties, 1, &device, device_err_callback, NULL, &err);
+	if (check_cl_err(err, "Failed to create context")){
+		return NULL;
+	}
+	return context;
+}
+cl_context select_device(cl_device_id *device){
+	device_t best;
+	if (select_devices(&best, 1) == 0){
+		return NULL;
+	}
+	printf("Selected device: ");
+	print_devices(&best, 1);
+	*device = best.id;
+	return create_context(best.id);
+}
+int select_backend(cl_context *context, cl_device_id *device){
+	const char *backend = getenv("OCLP_BACKEND");
+	const int host = backend && strcmp(backend, "host") == 0;
+	*context = host ? NULL : select_device(device);
+	if (*context){
+		return 0;
+	}
+	if (!host){
+		fprintf(stderr, "No usable OpenCL device, falling back to the host backend\n");
+	}
+	printf("Using the host backend with %s\n", simd_level_name(simd_level()));
+	return 1;
+}
+int device_has_extension(cl_device_id device, const char *extension){
+	size_t size = 0;
+	cl_int err = clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, 0, NULL, &size);
+	if (err != CL_SUCCESS || size == 0){
+		return 0;
+	}
+	char *extensions = malloc(size);
+	err = clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, size, extensions, NULL);
+	//Match whole names so an extension isn't found as the prefix of a longer one
+	const size_t len = strlen(extension);
+	int found = 0;
+	for (const char *p = extensions; err == CL_SUCCESS && !found && (p = strstr(p, extension));
+		p += len)
+	{
+		found = (p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0');
+	}
+	free(extensions);
+	return found;
+}
+
@@ -0,0 +1,75 @@
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include <stddef.h>
+#include <CL/cl.h>
+
+/*
+ * Device enumeration and selection by measured throughput. Each device is scored
+ * by running short bandwidth and FLOP calibration kernels on it, the results are
+ * cached on disk next to the program cache so later runs don't re-measure.
+ * Setting OCLP_DEVICE overrides the choice, it can be a device type (cpu, gpu or
+ * accelerator), a platform:device index pair as printed by print_devices or a
+ * case-insensitive substring of the device or platform name.
+ * Setting OCLP_RECALIBRATE ignores any cached scores
+ */
+typedef struct device_t {
+	cl_platform_id platform;
+	cl_device_id id;
+	cl_device_type type;
+	//Index of the platform and of the device within the platform
+	cl_uint platform_idx, device_idx;
+	char name[128];
+	char platform_name[128];
+	//Measured copy bandwidth in GB/s and float throughput in GFLOP/s, 0 if not calibrated
+	double bandwidth, gflops;
+	//Combined score used to rank the devices, higher is faster
+	double score;
+} device_t;
+
+/*
+ * List every device on every platform, the caller must free the returned array
+ * returns the number of devices found, 0 if none
+ */
+size_t list_devices(device_t **devices);
+/*
+ * Print the devices along with their scores to stdout
+ */
+void print_devices(const device_t *devices, size_t n);
+/*
+ * Score the device by measuring its bandwidth and FLOP throughput, using the
+ * cached result if there is one
+ * returns 1 on failure
+ */
+int calibrate_device(device_t *device);
+/*
+ * Select up to n of the fastest devices, sorted by descending score, honoring
+ * the OCLP_DEVICE override
+ * returns the number of devices written to out
+ */
+size_t select_devices(device_t *out, size_t n);
+/*
+ * Create a context for a single device which logs errors reported by the runtime
+ * returns NULL on failure
+ */
+cl_context create_context(cl_device_id device);
+/*
+ * Select the fastest device and create a context for it
+ * returns NULL if no device could be used
+ */
+cl_context select_device(cl_device_id *device);
+/*
+ * Pick between OpenCL and the host backend. Unless OCLP_BACKEND is set to host this
+ * selects the device and creates its context like select_device, falling back to the
+ * host backend if no device could be used
+ * returns 1 if the host backend should be used, setting context to NULL
+ */
+int select_backend(cl_context *context, cl_device_id *device);
+/*
+ * Check if the device supports the extension, eg. cl_khr_fp16
+ * returns 1 if it's in the device's extension list
+ */
+int device_has_extension(cl_device_id device, const char *extension);
+
+#endif
+
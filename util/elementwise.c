@@ -0,0 +1,387 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <CL/cl.h>
+#include "util.h"
+#include "elementwise.h"
+
+#define MAX_NAMES 16
+#define MAX_NAME 32
+//The grid-stride loop is launched with at most this many work-groups per compute unit
+#define GROUPS_PER_CU 8
+#define MAX_LOCAL_SIZE 256
+
+typedef struct names_t {
+	char name[MAX_NAMES][MAX_NAME];
+	size_t n;
+} names_t;
+
+//A growing string for building the kernel source
+typedef struct str_t {
+	char *s;
+	size_t len, cap;
+} str_t;
+
+struct elementwise_kernel_t {
+	//The expression and scalar list with whitespace removed
+	char *signature;
+	char *source;
+	cl_program program;
+	cl_kernel kernel;
+	size_t n_arrays, n_scalars;
+	//Floats per vector load and store
+	int width;
+	size_t local_size, max_groups;
+};
+
+struct elementwise_cache_t {
+	cl_context context;
+	cl_device_id device;
+	int width;
+	size_t max_groups;
+	elementwise_kernel_t **kernels;
+	size_t n, cap;
+};
+
+static void str_append(str_t *str, const char *fmt, ...){
+	for (;;){
+		va_list args;
+		va_start(args, fmt);
+		int n = vsnprintf(str->s + str->len, str->cap - str->len, fmt, args);
+		va_end(args);
+		if (n < 0){
+			return;
+		}
+		if (str->len + n < str->cap){
+			str->len += n;
+			return;
+		}
+		str->cap = 2 * (str->len + n + 1);
+		str->s = realloc(str->s, str->cap);
+	}
+}
+static int find_name(const names_t *names, const char *name, size_t len){
+	for (size_t i = 0; i < names->n; ++i){
+		if (strlen(names->name[i]) == len && strncmp(names->name[i], name, len) == 0){
+			return i;
+		}
+	}
+	return -1;
+}
+//Add the name if it's not there yet, returns its index or -1 if it doesn't fit
+static int add_name(names_t *names, const char *name, size_t len){
+	int i = find_name(names, name, len);
+	if (i >= 0){
+		return i;
+	}
+	if (names->n == MAX_NAMES || len >= MAX_NAME){
+		fprintf(stderr, "elementwise_get error: more than %d names or a name longer than %d\n",
+			MAX_NAMES, MAX_NAME - 1);
+		return -1;
+	}
+	memcpy(names->name[names->n], name, len);
+	names->name[names->n][len] = '\0';
+	return names->n++;
+}
+static int is_name_start(char c){
+	return isalpha((unsigned char)c) || c == '_';
+}
+static size_t name_length(const char *s){
+	size_t len = 0;
+	while (isalnum((unsigned char)s[len]) || s[len] == '_'){
+		++len;
+	}
+	return len;
+}
+static const char* skip_space(const char *s){
+	while (isspace((unsigned char)*s)){
+		++s;
+	}
+	return s;
+}
+//Parse the comma separated scalar names, returns 1 on failure
+static int parse_scalars(const char *list, names_t *scalars){
+	const char *s = skip_space(list);
+	while (*s){
+		size_t len = name_length(s);
+		if (!is_name_start(*s) || add_name(scalars, s, len) < 0){
+			fprintf(stderr, "elementwise_get error: bad scalar list '%s'\n", list);
+			return 1;
+		}
+		s = skip_space(s + len);
+		if (*s == ','){
+			s = skip_space(s + 1);
+		}
+		else if (*s){
+			fprintf(stderr, "elementwise_get error: bad scalar list '%s'\n", list);
+			return 1;
+		}
+	}
+	return 0;
+}
+/*
+ * Parse the expression, writing the arrays to arrays with the output first and the right
+ * hand side to rhs with the arrays renamed to v_name, the scalars to s_name and the float
+ * literals given an f suffix. reads_output is set if the output is also an input
+ * returns 1 on failure
+ */
+static int parse_expr(const char *expr, const names_t *scalars, names_t *arrays, str_t *rhs,
+	int *reads_output)
+{
+	const char *s = skip_space(expr);
+	size_t len = name_length(s);
+	if (!is_name_start(*s) || find_name(scalars, s, len) >= 0 || add_name(arrays, s, len) < 0){
+		fprintf(stderr, "elementwise_get error: '%s' doesn't start with an output array\n", expr);
+		return 1;
+	}
+	s = skip_space(s + len);
+	if (*s != '='){
+		fprintf(stderr, "elementwise_get error: expected '=' after the output in '%s'\n", expr);
+		return 1;
+	}
+	s = skip_space(s + 1);
+	if (!*s){
+		fprintf(stderr, "elementwise_get error: '%s' has nothing to compute\n", expr);
+		return 1;
+	}
+	*reads_output = 0;
+	while (*s){
+		if (isspace((unsigned char)*s)){
+			str_append(rhs, " ");
+			s = skip_space(s);
+		}
+		else if (is_name_start(*s)){
+			len = name_length(s);
+			if (*skip_space(s + len) == '('){
+				//Built-in functions are left as they are
+				str_append(rhs, "%.*s", (int)len, s);
+			}
+			else if (find_name(scalars, s, len) >= 0){
+				str_append(rhs, "s_%.*s", (int)len, s);
+			}
+			else {
+				int i = add_name(arrays, s, len);
+				if (i < 0){
+					return 1;
+				}
+				*reads_output |= i == 0;
+				str_append(rhs, "v_%.*s", (int)len, s);
+			}
+			s += len;
+		}
+		else if (isdigit((unsigned char)*s) || (*s == '.' && isdigit((unsigned char)s[1]))){
+			//Literals are made floats so they don't promote the math to double or int
+			len = strspn(s, "0123456789");
+			int fraction = s[len] == '.';
+			if (fraction){
+				len += 1 + strspn(s + len + 1, "0123456789");
+			}
+			int exponent = 0;
+			if (s[len] == 'e' || s[len] == 'E'){
+				size_t sign = s[len + 1] == '+' || s[len + 1] == '-';
+				size_t digits = strspn(s + len + 1 + sign, "0123456789");
+				if (digits){
+					exponent = 1;
+					len += 1 + sign + digits;
+				}
+			}
+			str_append(rhs, "%.*s%sf", (int)len, s, fraction || exponent ? "" : ".0");
+			s += len;
+			if (*s == 'f' || *s == 'F'){
+				++s;
+			}
+		}
+		else if (strchr("+-*/(),", *s)){
+			str_append(rhs, "%c", *s);
+			++s;
+		}
+		else {
+			fprintf(stderr, "elementwise_get error: unexpected '%c' in '%s'\n", *s, expr);
+			return 1;
+		}
+	}
+	return 0;
+}
+//Write the loads of each input array for a loop over vectors of width floats, 1 for the tail
+static void append_loads(str_t *src, const names_t *arrays, int reads_output, int width){
+	for (size_t i = reads_output ? 0 : 1; i < arrays->n; ++i){
+		if (width == 1){
+			str_append(src, "\t\tconst float v_%s = p_%s[i];\n", arrays->name[i], arrays->name[i]);
+		}
+		else {
+			str_append(src, "\t\tconst float%d v_%s = vload%d(i, p_%s);\n", width, arrays->name[i],
+				width, arrays->name[i]);
+		}
+	}
+}
+static char* generate_source(const names_t *arrays, const names_t *scalars, const char *rhs,
+	int reads_output, int width)
+{
+	str_t src = { malloc(1024), 0, 1024 };
+	str_append(&src, "kernel void elementwise(global float *p_%s", arrays->name[0]);
+	for (size_t i = 1; i < arrays->n; ++i){
+		str_append(&src, ", global const float *p_%s", arrays->name[i]);
+	}
+	for (size_t i = 0; i < scalars->n; ++i){
+		str_append(&src, ", const float s_%s", scalars->name[i]);
+	}
+	str_append(&src, ", const uint n){\n"
+		"\tconst size_t stride = get_global_size(0);\n"
+		"\tconst size_t vectors = n / %d;\n"
+		"\tfor (size_t i = get_global_id(0); i < vectors; i += stride){\n", width);
+	append_loads(&src, arrays, reads_output, width);
+	str_append(&src, "\t\tvstore%d(%s, i, p_%s);\n\t}\n", width, rhs, arrays->name[0]);
+	str_append(&src, "\tfor (size_t i = vectors * %d + get_global_id(0); i < n; i += stride){\n",
+		width);
+	append_loads(&src, arrays, reads_output, 1);
+	str_append(&src, "\t\tp_%s[i] = %s;\n\t}\n}\n", arrays->name[0], rhs);
+	return src.s;
+}
+//Get the expression and scalar list with whitespace removed
+static char* make_signature(const char *expr, const char *scalars){
+	str_t sig = { malloc(128), 0, 128 };
+	for (const char *s = expr; *s; ++s){
+		if (!isspace((unsigned char)*s)){
+			str_append(&sig, "%c", *s);
+		}
+	}
+	str_append(&sig, "|");
+	for (const char *s = scalars ? scalars : ""; *s; ++s){
+		if (!isspace((unsigned char)*s)){
+			str_append(&sig, "%c", *s);
+		}
+	}
+	return sig.s;
+}
+static void free_kernel(elementwise_kernel_t *k){
+	if (k->kernel){
+		clReleaseKernel(k->kernel);
+	}
+	if (k->program){
+		clReleaseProgram(k->program);
+	}
+	free(k->signature);
+	free(k->source);
+	free(k);
+}
+elementwise_cache_t* elementwise_cache_create(cl_context context, cl_device_id device){
+	cl_uint vec_width = 1, compute_units = 1;
+	cl_int err = clGetDeviceInfo(device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT,
+		sizeof(vec_width), &vec_width, NULL);
+	err |= clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(compute_units),
+		&compute_units, NULL);
+	if (check_cl_err(err, "elementwise_cache_create: failed to query device")){
+		return NULL;
+	}
+	elementwise_cache_t *cache = calloc(1, sizeof(elementwise_cache_t));
+	if (!cache){
+		return NULL;
+	}
+	cache->context = context;
+	cache->device = device;
+	cache->width = vec_width >= 8 ? 8 : 4;
+	cache->max_groups = (size_t)compute_units * GROUPS_PER_CU;
+	return cache;
+}
+const elementwise_kernel_t* elementwise_get(elementwise_cache_t *cache, const char *expr,
+	const char *scalars)
+{
+	char *signature = make_signature(expr, scalars);
+	for (size_t i = 0; i < cache->n; ++i){
+		if (strcmp(cache->kernels[i]->signature, signature) == 0){
+			free(signature);
+			return cache->kernels[i];
+		}
+	}
+	names_t scalar_names = { .n = 0 }, arrays = { .n = 0 };
+	str_t rhs = { malloc(256), 0, 256 };
+	int reads_output = 0;
+	if ((scalars && parse_scalars(scalars, &scalar_names))
+		|| parse_expr(expr, &scalar_names, &arrays, &rhs, &reads_output))
+	{
+		free(signature);
+		free(rhs.s);
+		return NULL;
+	}
+	elementwise_kernel_t *k = calloc(1, sizeof(elementwise_kernel_t));
+	k->signature = signature;
+	k->n_arrays = arrays.n;
+	k->n_scalars = scalar_names.n;
+	k->width = cache->width;
+	k->max_groups = cache->max_groups;
+	k->source = generate_source(&arrays, &scalar_names, rhs.s, reads_output, k->width);
+	free(rhs.s);
+
+	k->program = build_program(k->source, cache->context, cache->device, NULL);
+	if (!k->program){
+		fprintf(stderr, "elementwise_get error: failed to build '%s' from:\n%s", expr, k->source);
+		free_kernel(k);
+		return NULL;
+	}
+	cl_int err;
+	k->kernel = clCreateKernel(k->program, "elementwise", &err);
+	if (check_cl_err(err, "elementwise_get: failed to create kernel")){
+		free_kernel(k);
+		return NULL;
+	}
+	size_t max_local = 1;
+	clGetKernelWorkGroupInfo(k->kernel, cache->device, CL_KERNEL_WORK_GROUP_SIZE,
+		sizeof(max_local), &max_local, NULL);
+	k->local_size = max_local < MAX_LOCAL_SIZE ? max_local : MAX_LOCAL_SIZE;
+
+	if (cache->n == cache->cap){
+		cache->cap = cache->cap ? 2 * cache->cap : 8;
+		cache->kernels = realloc(cache->kernels, sizeof(elementwise_kernel_t*) * cache->cap);
+	}
+	cache->kernels[cache->n++] = k;
+	return k;
+}
+size_t elementwise_arrays(const elementwise_kernel_t *kernel){
+	return kernel->n_arrays;
+}
+size_t elementwise_scalars(const elementwise_kernel_t *kernel){
+	return kernel->n_scalars;
+}
+const char* elementwise_source(const elementwise_kernel_t *kernel){
+	return kernel->source;
+}
+cl_int elementwise_enqueue(cl_command_queue queue, const elementwise_kernel_t *kernel,
+	const cl_mem *arrays, const cl_float *scalars, size_t n, cl_event *evt)
+{
+	if (n > CL_UINT_MAX){
+		return CL_INVALID_GLOBAL_WORK_SIZE;
+	}
+	cl_int err = CL_SUCCESS;
+	cl_uint arg = 0;
+	for (size_t i = 0; i < kernel->n_arrays; ++i){
+		err |= clSetKernelArg(kernel->kernel, arg++, sizeof(cl_mem), &arrays[i]);
+	}
+	for (size_t i = 0; i < kernel->n_scalars; ++i){
+		err |= clSetKernelArg(kernel->kernel, arg++, sizeof(cl_float), &scalars[i]);
+	}
+	const cl_uint count = n;
+	err |= clSetKernelArg(kernel->kernel, arg, sizeof(cl_uint), &count);
+	if (err != CL_SUCCESS){
+		return err;
+	}
+	//Enough groups to give each work-item one vector, up to what keeps the device busy
+	const size_t vectors = n / kernel->width ? n / kernel->width : 1;
+	size_t groups = (vectors + kernel->local_size - 1) / kernel->local_size;
+	groups = groups < kernel->max_groups ? groups : kernel->max_groups;
+	const size_t global_size = groups * kernel->local_size;
+	return clEnqueueNDRangeKernel(queue, kernel->kernel, 1, NULL, &global_size,
+		&kernel->local_size, 0, NULL, evt);
+}
+void elementwise_cache_destroy(elementwise_cache_t *cache){
+	if (!cache){
+		return;
+	}
+	for (size_t i = 0; i < cache->n; ++i){
+		free_kernel(cache->kernels[i]);
+	}
+	free(cache->kernels);
+	free(cache);
+}
+
@@ -0,0 +1,61 @@
+#ifndef ELEMENTWISE_H
+#define ELEMENTWISE_H
+
+#include <stddef.h>
+#include <CL/cl.h>
+
+/*
+ * Fused element-wise kernels generated from an expression such as "d = a*b + c" or
+ * "y = alpha*x + y". Names on the right are float arrays unless they're listed as scalars
+ * and the name on the left is the output array, which the right can also read. The right
+ * can use + - * /, parentheses, float literals and OpenCL built-in functions like sqrt or
+ * fma. The generated kernel walks the arrays in a grid-stride loop of float4 or float8 loads
+ * and stores, float8 if the device prefers vectors that wide, with a scalar loop for the
+ * tail, so a chain of operations takes one launch and no intermediate buffers. Kernels are
+ * cached by their expression's signature. The cache isn't thread safe, and since the
+ * arguments are set when enqueuing neither is sharing one kernel between threads
+ */
+typedef struct elementwise_cache_t elementwise_cache_t;
+typedef struct elementwise_kernel_t elementwise_kernel_t;
+
+/*
+ * Create a cache for kernels built for the device in the context
+ * returns NULL on failure
+ */
+elementwise_cache_t* elementwise_cache_create(cl_context context, cl_device_id device);
+/*
+ * Get the kernel for the expression, generating and building it if it's not cached yet.
+ * scalars is a comma separated list of the names that are float scalars, or NULL if
+ * there are none. Expressions that differ only in whitespace share a kernel
+ * returns NULL if the expression couldn't be parsed or built
+ */
+const elementwise_kernel_t* elementwise_get(elementwise_cache_t *cache, const char *expr,
+	const char *scalars);
+/*
+ * Get the number of arrays the kernel takes, including the output
+ */
+size_t elementwise_arrays(const elementwise_kernel_t *kernel);
+/*
+ * Get the number of scalars the kernel takes
+ */
+size_t elementwise_scalars(const elementwise_kernel_t *kernel);
+/*
+ * Get the generated OpenCL source of the kernel
+ */
+const char* elementwise_source(const elementwise_kernel_t *kernel);
+/*
+ * Enqueue the kernel over the first n elements of the arrays. arrays holds the output
+ * followed by the inputs in the order they first appear in the expression, and scalars
+ * holds the scalars in the order they were listed. The output can't be passed as an input
+ * under another name since the vectors are loaded and stored independently
+ * returns the error from setting the arguments or enqueuing the kernel
+ */
+cl_int elementwise_enqueue(cl_command_queue queue, const elementwise_kernel_t *kernel,
+	const cl_mem *arrays, const cl_float *scalars, size_t n, cl_event *evt);
+/*
+ * Release every kernel built by the cache and free it
+ */
+void elementwise_cache_destroy(elementwise_cache_t *cache);
+
+#endif
+
@@ -0,0 +1,379 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <CL/cl.h>
+#include "util.h"
+#include "primitives.h"
+
+//Largest work-group used, scans work on blocks of twice this many elements
+#define MAX_LOCAL_SIZE 256
+#define N_TYPES 3
+//Scans recurse once per level of block totals, 32 levels covers CL_UINT_MAX elements even
+//with one work-item groups
+#define MAX_SCAN_LEVELS 32
+
+static const char *prim_src =
+	"//Combine two values with op, 0 is sum, 1 min and 2 max\n"
+	"T combine(const int op, const T a, const T b){\n"
+	"	return op == 0 ? a + b : op == 1 ? min(a, b) : max(a, b);\n"
+	"}\n"
+	"T identity(const int op){\n"
+	"	return op == 0 ? (T)0 : op == 1 ? T_HIGHEST : T_LOWEST;\n"
+	"}\n"
+	"//Each work-group writes the reduction of its share of in to out[group]\n"
+	"kernel void reduce(const global T *in, const uint n, global T *out, local T *scratch,\n"
+	"	const int op)\n"
+	"{\n"
+	"	const uint lid = get_local_id(0);\n"
+	"	T acc = identity(op);\n"
+	"	for (size_t i = get_global_id(0); i < n; i += get_global_size(0)){\n"
+	"		acc = combine(op, acc, in[i]);\n"
+	"	}\n"
+	"	scratch[lid] = acc;\n"
+	"	for (uint s = get_local_size(0) / 2; s > 0; s /= 2){\n"
+	"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"		if (lid < s){\n"
+	"			scratch[lid] = combine(op, scratch[lid], scratch[lid + s]);\n"
+	"		}\n"
+	"	}\n"
+	"	if (lid == 0){\n"
+	"		out[get_group_id(0)] = scratch[0];\n"
+	"	}\n"
+	"}\n"
+	"//Scan a block of two elements per work-item, writing its total to sums if there is one\n"
+	"kernel void scan_blocks(const global T *in, const uint n, global T *out, global T *sums,\n"
+	"	local T *scratch, const int inclusive)\n"
+	"{\n"
+	"	const uint lid = get_local_id(0), group_size = get_local_size(0);\n"
+	"	const uint block = 2 * group_size;\n"
+	"	const size_t a = get_group_id(0) * block + lid, b = a + group_size;\n"
+	"	const T in_a = a < n ? in[a] : 0, in_b = b < n ? in[b] : 0;\n"
+	"	scratch[lid] = in_a;\n"
+	"	scratch[lid + group_size] = in_b;\n"
+	"	//Up sweep, leaving the partial sums of each subtree at its root\n"
+	"	uint offset = 1;\n"
+	"	for (uint d = group_size; d > 0; d /= 2, offset *= 2){\n"
+	"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"		if (lid < d){\n"
+	"			scratch[offset * (2 * lid + 2) - 1] += scratch[offset * (2 * lid + 1) - 1];\n"
+	"		}\n"
+	"	}\n"
+	"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"	if (lid == 0){\n"
+	"		if (sums){\n"
+	"			sums[get_group_id(0)] = scratch[block - 1];\n"
+	"		}\n"
+	"		scratch[block - 1] = 0;\n"
+	"	}\n"
+	"	//Down sweep, pushing each subtree's prefix down to its children\n"
+	"	for (uint d = 1; d < block; d *= 2){\n"
+	"		offset /= 2;\n"
+	"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"		if (lid < d){\n"
+	"			const uint i = offset * (2 * lid + 1) - 1, j = offset * (2 * lid + 2) - 1;\n"
+	"			const T t = scratch[i];\n"
+	"			scratch[i] = scratch[j];\n"
+	"			scratch[j] += t;\n"
+	"		}\n"
+	"	}\n"
+	"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+	"	if (a < n){\n"
+	"		out[a] = scratch[lid] + (inclusive ? in_a : 0);\n"
+	"	}\n"
+	"	if (b < n){\n"
+	"		out[b] = scratch[lid + group_size] + (inclusive ? in_b : 0);\n"
+	"	}\n"
+	"}\n"
+	"//Add the scanned total of the blocks before each block to its elements\n"
+	"kernel void add_block_sums(global T *out, const uint n, const global T *sums){\n"
+	"	const uint group_size = get_local_size(0);\n"
+	"	const size_t a = get_group_id(0) * 2 * group_size + get_local_id(0);\n"
+	"	const size_t b = a + group_size;\n"
+	"	const T s = sums[get_group_id(0)];\n"
+	"	if (a < n){\n"
+	"		out[a] += s;\n"
+	"	}\n"
+	"	if (b < n){\n"
+	"		out[b] += s;\n"
+	"	}\n"
+	"}\n"
+	"//Scatter the flagged elements, or their indices if in is NULL, to their scanned positions\n"
+	"kernel void compact(const global T *in, const global uint *flags, const global uint *pos,\n"
+	"	const uint n, global T *out, global uint *count)\n"
+	"{\n"
+	"	const size_t i = get_global_id(0);\n"
+	"	if (i >= n){\n"
+	"		return;\n"
+	"	}\n"
+	"	if (flags[i]){\n"
+	"		out[pos[i]] = in ? in[i] : (T)i;\n"
+	"	}\n"
+	"	if (i == n - 1){\n"
+	"		*count = pos[i] + flags[i];\n"
+	"	}\n"
+	"}\n";
+
+static const char *type_options[N_TYPES] = {
+	"-D T=uint -D T_LOWEST=0 -D T_HIGHEST=UINT_MAX",
+	"-D T=int -D T_LOWEST=INT_MIN -D T_HIGHEST=INT_MAX",
+	"-D T=float -D T_LOWEST=-INFINITY -D T_HIGHEST=INFINITY"
+};
+static const size_t type_sizes[N_TYPES] = { sizeof(cl_uint), sizeof(cl_int), sizeof(cl_float) };
+
+typedef struct prim_program_t {
+	cl_program program;
+	cl_kernel reduce, scan_blocks, add_block_sums, compact;
+	//Power of two work-group size every kernel can run with
+	size_t local_size;
+	size_t elem_size;
+} prim_program_t;
+
+//Device buffer kept between calls, it's only replaced when a call needs a bigger one
+typedef struct scratch_t {
+	cl_mem mem;
+	size_t capacity;
+} scratch_t;
+
+struct primitives_t {
+	cl_context context;
+	cl_device_id device;
+	prim_program_t programs[N_TYPES];
+	//Reduce's per group partials, each scan level's block totals and compact's positions
+	scratch_t partials, sums[MAX_SCAN_LEVELS], pos;
+};
+
+static void release_program(prim_program_t *p){
+	cl_kernel *kernels[4] = { &p->reduce, &p->scan_blocks, &p->add_block_sums, &p->compact };
+	for (int i = 0; i < 4; ++i){
+		if (*kernels[i]){
+			clReleaseKernel(*kernels[i]);
+			*kernels[i] = NULL;
+		}
+	}
+	if (p->program){
+		clReleaseProgram(p->program);
+		p->program = NULL;
+	}
+}
+//Get the program for the type, building it if it hasn't been yet, returns NULL on failure
+static prim_program_t* get_program(primitives_t *prim, prim_type_t type){
+	prim_program_t *p = &prim->programs[type];
+	if (p->program){
+		return p;
+	}
+	p->program = build_program(prim_src, prim->context, prim->device, type_options[type]);
+	if (!p->program){
+		return NULL;
+	}
+	const char *names[4] = { "reduce", "scan_blocks", "add_block_sums", "compact" };
+	cl_kernel *kernels[4] = { &p->reduce, &p->scan_blocks, &p->add_block_sums, &p->compact };
+	size_t max_local = MAX_LOCAL_SIZE;
+	cl_int err = CL_SUCCESS;
+	for (int i = 0; i < 4 && err == CL_SUCCESS; ++i){
+		*kernels[i] = clCreateKernel(p->program, names[i], &err);
+		size_t kernel_max = 0;
+		if (err == CL_SUCCESS){
+			err = clGetKernelWorkGroupInfo(*kernels[i], prim->device, CL_KERNEL_WORK_GROUP_SIZE,
+				sizeof(kernel_max), &kernel_max, NULL);
+		}
+		max_local = kernel_max < max_local ? kernel_max : max_local;
+	}
+	if (check_cl_err(err, "primitives: failed to create kernels")){
+		release_program(p);
+		return NULL;
+	}
+	//The trees need a power of two
+	p->local_size = 1;
+	while (p->local_size * 2 <= max_local){
+		p->local_size *= 2;
+	}
+	p->elem_size = type_sizes[type];
+	return p;
+}
+//Make sure the scratch buffer holds at least size bytes, returns the buffer or NULL on failure
+static cl_mem get_scratch(primitives_t *prim, scratch_t *scratch, size_t size, cl_int *err){
+	*err = CL_SUCCESS;
+	if (scratch->mem && scratch->capacity >= size){
+		return scratch->mem;
+	}
+	//Kernels already enqueued with the old buffer keep it alive until they're done
+	if (scratch->mem){
+		clReleaseMemObject(scratch->mem);
+	}
+	scratch->mem = clCreateBuffer(prim->context, CL_MEM_READ_WRITE, size, NULL, err);
+	scratch->capacity = *err == CL_SUCCESS ? size : 0;
+	if (*err != CL_SUCCESS){
+		scratch->mem = NULL;
+	}
+	return scratch->mem;
+}
+static void release_scratch(scratch_t *scratch){
+	if (scratch->mem){
+		clReleaseMemObject(scratch->mem);
+	}
+	scratch->mem = NULL;
+	scratch->capacity = 0;
+}
+primitives_t* primitives_create(cl_context context, cl_device_id device){
+	primitives_t *prim = calloc(1, sizeof(primitives_t));
+	if (!prim){
+		return NULL;
+	}
+	prim->context = context;
+	prim->device = device;
+	return prim;
+}
+static cl_int enqueue_reduce(const prim_program_t *p, cl_command_queue queue, prim_op_t op,
+	cl_mem in, size_t n, cl_mem out, size_t groups, cl_event *evt)
+{
+	const cl_uint count = n;
+	const cl_int op_arg = op;
+	cl_int err = clSetKernelArg(p->reduce, 0, sizeof(cl_mem), &in);
+	err |= clSetKernelArg(p->reduce, 1, sizeof(cl_uint), &count);
+	err |= clSetKernelArg(p->reduce, 2, sizeof(cl_mem), &out);
+	err |= clSetKernelArg(p->reduce, 3, p->elem_size * p->local_size, NULL);
+	err |= clSetKernelArg(p->reduce, 4, sizeof(cl_int), &op_arg);
+	if (err != CL_SUCCESS){
+		return err;
+	}
+	const size_t global_size = groups * p->local_size;
+	return clEnqueueNDRangeKernel(queue, p->reduce, 1, NULL, &global_size, &p->local_size, 0,
+		NULL, evt);
+}
+cl_int primitives_reduce(primitives_t *prim, cl_command_queue queue, prim_type_t type,
+	prim_op_t op, cl_mem in, size_t n, cl_mem out, cl_event *evt)
+{
+	if (n == 0 || n > CL_UINT_MAX){
+		return CL_INVALID_VALUE;
+	}
+	const prim_program_t *p = get_program(prim, type);
+	if (!p){
+		return CL_BUILD_PROGRAM_FAILURE;
+	}
+	//No more groups than the second pass can reduce in one group
+	size_t groups = (n + p->local_size - 1) / p->local_size;
+	groups = groups < p->local_size ? groups : p->local_size;
+	if (groups == 1){
+		return enqueue_reduce(p, queue, op, in, n, out, 1, evt);
+	}
+	cl_int err;
+	cl_mem partials = get_scratch(prim, &prim->partials, p->elem_size * groups, &err);
+	if (err != CL_SUCCESS){
+		return err;
+	}
+	err = enqueue_reduce(p, queue, op, in, n, partials, groups, NULL);
+	if (err == CL_SUCCESS){
+		err = enqueue_reduce(p, queue, op, partials, groups, out, 1, evt);
+	}
+	return err;
+}
+/*
+ * Scan the blocks of in, then scan their totals and add them back if there's more than one.
+ * The totals go in the level's scratch buffer, the next level's scan uses the one after it
+ */
+static cl_int scan_pass(primitives_t *prim, const prim_program_t *p, cl_command_queue queue,
+	cl_mem in, size_t n, cl_mem out, int inclusive, int level, cl_event *evt)
+{
+	const size_t blocks = (n + 2 * p->local_size - 1) / (2 * p->local_size);
+	cl_int err = CL_SUCCESS;
+	cl_mem sums = NULL;
+	if (blocks > 1){
+		sums = get_scratch(prim, &prim->sums[level], p->elem_size * blocks, &err);
+		if (err != CL_SUCCESS){
+			return err;
+		}
+	}
+	const cl_uint count = n;
+	const cl_int inclusive_arg = inclusive;
+	const size_t global_size = blocks * p->local_size;
+	err = clSetKernelArg(p->scan_blocks, 0, sizeof(cl_mem), &in);
+	err |= clSetKernelArg(p->scan_blocks, 1, sizeof(cl_uint), &count);
+	err |= clSetKernelArg(p->scan_blocks, 2, sizeof(cl_mem), &out);
+	err |= clSetKernelArg(p->scan_blocks, 3, sizeof(cl_mem), &sums);
+	err |= clSetKernelArg(p->scan_blocks, 4, 2 * p->elem_size * p->local_size, NULL);
+	err |= clSetKernelArg(p->scan_blocks, 5, sizeof(cl_int), &inclusive_arg);
+	if (err == CL_SUCCESS){
+		err = clEnqueueNDRangeKernel(queue, p->scan_blocks, 1, NULL, &global_size,
+			&p->local_size, 0, NULL, blocks > 1 ? NULL : evt);
+	}
+	if (blocks == 1){
+		return err;
+	}
+	if (err == CL_SUCCESS){
+		err = scan_pass(prim, p, queue, sums, blocks, sums, 0, level + 1, NULL);
+	}
+	if (err == CL_SUCCESS){
+		err = clSetKernelArg(p->add_block_sums, 0, sizeof(cl_mem), &out);
+		err |= clSetKernelArg(p->add_block_sums, 1, sizeof(cl_uint), &count);
+		err |= clSetKernelArg(p->add_block_sums, 2, sizeof(cl_mem), &sums);
+	}
+	if (err == CL_SUCCESS){
+		err = clEnqueueNDRangeKernel(queue, p->add_block_sums, 1, NULL, &global_size,
+			&p->local_size, 0, NULL, evt);
+	}
+	return err;
+}
+cl_int primitives_scan(primitives_t *prim, cl_command_queue queue, prim_type_t type, cl_mem in,
+	size_t n, cl_mem out, int inclusive, cl_event *evt)
+{
+	if (n == 0 || n > CL_UINT_MAX){
+		return CL_INVALID_VALUE;
+	}
+	const prim_program_t *p = get_program(prim, type);
+	if (!p){
+		return CL_BUILD_PROGRAM_FAILURE;
+	}
+	return scan_pass(prim, p, queue, in, n, out, inclusive, 0, evt);
+}
+cl_int primitives_compact(primitives_t *prim, cl_command_queue queue, prim_type_t type,
+	cl_mem in, cl_mem flags, size_t n, cl_mem out, cl_mem count, cl_event *evt)
+{
+	if (n > CL_UINT_MAX || (!in && type == PRIM_FLOAT)){
+		return CL_INVALID_VALUE;
+	}
+	if (n == 0){
+		const cl_uint zero = 0;
+		return clEnqueueFillBuffer(queue, count, &zero, sizeof(zero), 0, sizeof(zero), 0, NULL,
+			evt);
+	}
+	const prim_program_t *p = get_program(prim, type);
+	const prim_program_t *u = get_program(prim, PRIM_UINT);
+	if (!p || !u){
+		return CL_BUILD_PROGRAM_FAILURE;
+	}
+	cl_int err;
+	cl_mem pos = get_scratch(prim, &prim->pos, sizeof(cl_uint) * n, &err);
+	if (err != CL_SUCCESS){
+		return err;
+	}
+	err = scan_pass(prim, u, queue, flags, n, pos, 0, 0, NULL);
+	if (err == CL_SUCCESS){
+		const cl_uint n_arg = n;
+		err = clSetKernelArg(p->compact, 0, sizeof(cl_mem), &in);
+		err |= clSetKernelArg(p->compact, 1, sizeof(cl_mem), &flags);
+		err |= clSetKernelArg(p->compact, 2, sizeof(cl_mem), &pos);
+		err |= clSetKernelArg(p->compact, 3, sizeof(cl_uint), &n_arg);
+		err |= clSetKernelArg(p->compact, 4, sizeof(cl_mem), &out);
+		err |= clSetKernelArg(p->compact, 5, sizeof(cl_mem), &count);
+	}
+	if (err == CL_SUCCESS){
+		const size_t global_size = round_up(n, p->local_size);
+		err = clEnqueueNDRangeKernel(queue, p->compact, 1, NULL, &global_size, &p->local_size, 0,
+			NULL, evt);
+	}
+	return err;
+}
+void primitives_destroy(primitives_t *prim){
+	if (!prim){
+		return;
+	}
+	for (int i = 0; i < N_TYPES; ++i){
+		release_program(&prim->programs[i]);
+	}
+	release_scratch(&prim->partials);
+	release_scratch(&prim->pos);
+	for (int i = 0; i < MAX_SCAN_LEVELS; ++i){
+		release_scratch(&prim->sums[i]);
+	}
+	free(prim);
+}
+
@@ -0,0 +1,65 @@
+#ifndef PRIMITIVES_H
+#define PRIMITIVES_H
+
+#include <stddef.h>
+#include <CL/cl.h>
+
+/*
+ * Device-wide reduce, scan and stream compaction over buffers of uint, int or float. Reduce
+ * has each work-item fold a grid-strided run of the input before a local memory tree
+ * combines the work-group's values, then a second single work-group pass combines the
+ * groups. Scans are work-efficient up and down sweeps over blocks of two elements per
+ * work-item, the block totals are scanned the same way and added back, recursing until
+ * they fit in one block. Compaction scans the keep flags to find where each kept element
+ * goes. Each call enqueues several kernels and relies on the queue being in order, evt is
+ * set to the last of them. The programs for each type are built the first time it's used.
+ * The temporary buffers calls need are kept and grown as needed, so calls sharing the
+ * primitives must go on the same in order queue
+ */
+typedef struct primitives_t primitives_t;
+
+typedef enum prim_type_t {
+	PRIM_UINT,
+	PRIM_INT,
+	PRIM_FLOAT
+} prim_type_t;
+
+typedef enum prim_op_t {
+	PRIM_SUM,
+	PRIM_MIN,
+	PRIM_MAX
+} prim_op_t;
+
+/*
+ * Create the primitives for the device in the context
+ * returns NULL on failure
+ */
+primitives_t* primitives_create(cl_context context, cl_device_id device);
+/*
+ * Reduce the n elements of in with op, writing the result to the first element of out
+ * returns the first error hit, CL_INVALID_VALUE if n is 0
+ */
+cl_int primitives_reduce(primitives_t *prim, cl_command_queue queue, prim_type_t type,
+	prim_op_t op, cl_mem in, size_t n, cl_mem out, cl_event *evt);
+/*
+ * Write the prefix sums of the n elements of in to out, excluding each element from its
+ * own sum unless inclusive is set. in and out can be the same buffer
+ * returns the first error hit, CL_INVALID_VALUE if n is 0
+ */
+cl_int primitives_scan(primitives_t *prim, cl_command_queue queue, prim_type_t type, cl_mem in,
+	size_t n, cl_mem out, int inclusive, cl_event *evt);
+/*
+ * Copy the elements of in whose uint flag is 1 to the front of out in order, flags must
+ * be 0 or 1. If in is NULL the indices of the flagged elements are written instead, which
+ * needs a uint or int type. The number of elements kept is written to count as a uint
+ * returns the first error hit
+ */
+cl_int primitives_compact(primitives_t *prim, cl_command_queue queue, prim_type_t type,
+	cl_mem in, cl_mem flags, size_t n, cl_mem out, cl_mem count, cl_event *evt);
+/*
+ * Release the programs and temporary buffers and free the primitives
+ */
+void primitives_destroy(primitives_t *prim);
+
+#endif
+
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CL/cl.h>
+#include "util.h"
+#include "profile.h"
+
+#define NAME_LEN 48
+#define CHUNK_SIZE 256
+#define MAX_QUEUES 64
+
+typedef struct record_t {
+	char name[NAME_LEN];
+	cl_event evt;
+} record_t;
+
+//Records are kept in fixed size chunks so the event pointers handed out stay valid
+typedef struct chunk_t {
+	record_t records[CHUNK_SIZE];
+	size_t n;
+	struct chunk_t *next;
+} chunk_t;
+
+typedef struct timing_t {
+	const char *name;
+	cl_command_queue queue;
+	cl_ulong queued, submit, start, end;
+} timing_t;
+
+//-1 until OCLP_PROFILE has been checked
+static int enabled = -1;
+static const char *trace_path;
+static chunk_t *head, *tail;
+
+int profile_enabled(void){
+	if (enabled == -1){
+		trace_path = getenv("OCLP_PROFILE");
+		enabled = trace_path && *trace_path;
+		if (enabled){
+			atexit(profile_report);
+		}
+	}
+	return enabled;
+}
+cl_command_queue profile_create_queue(cl_context context, cl_device_id device,
+	cl_command_queue_properties properties, cl_int *err)
+{
+	if (profile_enabled()){
+		properties |= CL_QUEUE_PROFILING_ENABLE;
+	}
+	return clCreateCommandQueue(context, device, properties, err);
+}
+cl_event* profile_event(const char *name){
+	if (!profile_enabled()){
+		return NULL;
+	}
+	if (!tail || tail->n == CHUNK_SIZE){
+		chunk_t *c = malloc(sizeof(chunk_t));
+		if (!c){
+			return NULL;
+		}
+		c->n = 0;
+		c->next = NULL;
+		if (tail){
+			tail->next = c;
+		}
+		else {
+			head = c;
+		}
+		tail = c;
+	}
+	record_t *r = &tail->records[tail->n++];
+	strncpy(r->name, name, NAME_LEN - 1);
+	r->name[NAME_LEN - 1] = '\0';
+	//Stays NULL if the enqueue fails, we skip those when reporting
+	r->evt = NULL;
+	return &r->evt;
+}
+void profile_record(cl_event evt, const char *name){
+	if (!evt){
+		return;
+	}
+	cl_event *slot = profile_event(name);
+	if (slot){
+		clRetainEvent(evt);
+		*slot = evt;
+	}
+}
+//Sort by name then duration so each command's durations are contiguous and ordered
+static int cmp_timing(const void *a, const void *b){
+	const timing_t *ta = a, *tb = b;
+	int c = strcmp(ta->name, tb->name);
+	if (c != 0){
+		return c;
+	}
+	cl_ulong da = ta->end - ta->start, db = tb->end - tb->start;
+	return da < db ? -1 : da > db ? 1 : 0;
+}
+static void print_summary(const timing_t *timings, size_t n){
+	fprintf(stderr, "Profile summary (times in ms):\n%-32s %8s %12s %10s %10s %10s\n",
+		"command", "count", "total", "min", "median", "p99");
+	for (size_t i = 0; i < n;){
+		size_t j = i;
+		double total = 0;
+		while (j < n && strcmp(timings[j].name, timings[i].name) == 0){
+			total += (timings[j].end - timings[j].start) * 1e-6;
+			++j;
+		}
+		size_t count = j - i;
+		//Nearest-rank percentiles on the sorted durations
+		size_t p99 = (count * 99 + 99) / 100 - 1;
+		fprintf(stderr, "%-32s %8lu %12.3f %10.3f %10.3f %10.3f\n", timings[i].name,
+			(unsigned long)count, total, (timings[i].end - timings[i].start) * 1e-6,
+			(timings[i + count / 2].end - timings[i + count / 2].start) * 1e-6,
+			(timings[i + p99].end - timings[i + p99].start) * 1e-6);
+		i = j;
+	}
+}
+static void write_trace(const timing_t *timings, size_t n){
+	FILE *fp = fopen(trace_path, "w");
+	if (!fp){
+		fprintf(stderr, "profile: failed to open trace file %s\n", trace_path);
+		return;
+	}
+	cl_ulong origin = timings[0].queued;
+	for (size_t i = 1; i < n; ++i){
+		if (timings[i].queued < origin){
+			origin = timings[i].queued;
+		}
+	}
+	//Each queue gets its own track in the trace
+	cl_command_queue queues[MAX_QUEUES];
+	size_t num_queues = 0;
+	fprintf(fp, "{\"traceEvents\":[\n");
+	for (size_t i = 0; i < n; ++i){
+		size_t tid = 0;
+		while (tid < num_queues && queues[tid] != timings[i].queue){
+			++tid;
+		}
+		if (tid == num_queues && num_queues < MAX_QUEUES){
+			queues[num_queues++] = timings[i].queue;
+		}
+		fprintf(fp, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f,"
+			"\"args\":{\"queued_to_submit_us\":%.3f,\"submit_to_start_us\":%.3f}}%s\n",
+			timings[i].name, (unsigned long)tid, (timings[i].start - origin) * 1e-3,
+			(timings[i].end - timings[i].start) * 1e-3,
+			(timings[i].submit - timings[i].queued) * 1e-3,
+			(timings[i].start - timings[i].submit) * 1e-3, i + 1 < n ? "," : "");
+	}
+	fprintf(fp, "],\"displayTimeUnit\":\"ns\"}\n");
+	fclose(fp);
+	fprintf(stderr, "profile: wrote trace of %lu commands to %s\n", (unsigned long)n, trace_path);
+}
+void profile_report(void){
+	if (!profile_enabled() || !head){
+		return;
+	}
+	size_t n = 0;
+	for (chunk_t *c = head; c; c = c->next){
+		n += c->n;
+	}
+	timing_t *timings = malloc(sizeof(timing_t) * n);
+	n = 0;
+	for (chunk_t *c = head; c; c = c->next){
+		for (size_t i = 0; i < c->n; ++i){
+			record_t *r = &c->records[i];
+			if (!r->evt){
+				continue;
+			}
+			timing_t *t = &timings[n];
+			t->name = r->name;
+			clWaitForEvents(1, &r->evt);
+			cl_int err = clGetEventInfo(r->evt, CL_EVENT_COMMAND_QUEUE, sizeof(cl_command_queue),
+				&t->queue, NULL);
+			err |= clGetEventProfilingInfo(r->evt, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong),
+				&t->queued, NULL);
+			err |= clGetEventProfilingInfo(r->evt, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong),
+				&t->submit, NULL);
+			err |= clGetEventProfilingInfo(r->evt, CL_PROFILING_COMMAND_START, sizeof(cl_ulong),
+				&t->start, NULL);
+			err |= clGetEventProfilingInfo(r->evt, CL_PROFILING_COMMAND_END, sizeof(cl_ulong),
+				&t->end, NULL);
+			//Commands on queues created without profiling can't be timed
+			if (err == CL_SUCCESS){
+				++n;
+			}
+			clReleaseEvent(r->evt);
+			r->evt = NULL;
+		}
+	}
+	if (n > 0){
+		qsort(timings, n, sizeof(timing_t), cmp_timing);
+		print_summary(timings, n);
+		write_trace(timings, n);
+	}
+	free(timings);
+	while (head){
+		chunk_t *next = head->next;
+		free(head);
+		head = next;
+	}
+	tail = NULL;
+}
+
@@ -0,0 +1,42 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <CL/cl.h>
+
+/*
+ * Event based profiling of enqueued commands. Profiling is turned on by setting
+ * OCLP_PROFILE to the path to write a Chrome trace (chrome://tracing) JSON file to,
+ * at exit a per-command summary is printed to stderr and the trace is written.
+ * When OCLP_PROFILE isn't set queues are created without profiling and
+ * profile_event returns NULL, so no events are ever created
+ */
+
+/*
+ * Check if profiling is turned on
+ */
+int profile_enabled(void);
+/*
+ * Create a command queue with the properties passed, adding CL_QUEUE_PROFILING_ENABLE
+ * if profiling is on
+ */
+cl_command_queue profile_create_queue(cl_context context, cl_device_id device,
+	cl_command_queue_properties properties, cl_int *err);
+/*
+ * Get an event to pass to a clEnqueue* call so the command is recorded under name
+ * returns NULL if profiling is off
+ */
+cl_event* profile_event(const char *name);
+/*
+ * Record an event the caller already has under name, for commands whose events are also
+ * needed for wait lists. The event is retained so the caller can release its reference
+ * as usual, nothing is done if profiling is off or evt is NULL
+ */
+void profile_record(cl_event evt, const char *name);
+/*
+ * Print the per-command summary of the events recorded so far and write the trace
+ * file, this is called automatically at exit
+ */
+void profile_report(void);
+
+#endif
+
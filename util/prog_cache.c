@@ -0,0 +1,282 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <CL/cl.h>
+#include "util.h"
+#include "prog_cache.h"
+
+#define CACHE_MAGIC "OCLPBIN1"
+#define CACHE_EXT ".clbin"
+
+static prog_cache_stats_t stats;
+//-1 until the cache directory has been looked up, then 1 if usable and 0 if not
+static int cache_enabled = -1;
+static char cache_dir[1024];
+
+//Create the directory and any missing parents, returns 1 on failure
+static int make_dirs(char *path){
+	for (char *c = path + 1; *c; ++c){
+		if (*c == '/'){
+			*c = '\0';
+			if (mkdir(path, 0755) != 0 && errno != EEXIST){
+				*c = '/';
+				return 1;
+			}
+			*c = '/';
+		}
+	}
+	return mkdir(path, 0755) != 0 && errno != EEXIST;
+}
+//Find and create the cache directory the first time the cache is used
+static int cache_ready(void){
+	if (cache_enabled != -1){
+		return cache_enabled;
+	}
+	cache_enabled = 0;
+	if (getenv("OCLP_NO_CACHE")){
+		return 0;
+	}
+	const char *dir = getenv("OCLP_CACHE_DIR");
+	const char *xdg = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	int n;
+	if (dir && *dir){
+		n = snprintf(cache_dir, sizeof(cache_dir), "%s", dir);
+	}
+	else if (xdg && *xdg){
+		n = snprintf(cache_dir, sizeof(cache_dir), "%s/opencl_practice", xdg);
+	}
+	else if (home && *home){
+		n = snprintf(cache_dir, sizeof(cache_dir), "%s/.cache/opencl_practice", home);
+	}
+	else {
+		return 0;
+	}
+	if (n < 0 || (size_t)n >= sizeof(cache_dir)){
+		fprintf(stderr, "prog_cache: cache directory path too long, caching disabled\n");
+		return 0;
+	}
+	if (make_dirs(cache_dir)){
+		fprintf(stderr, "prog_cache: failed to create %s, caching disabled\n", cache_dir);
+		return 0;
+	}
+	cache_enabled = 1;
+	if (getenv("OCLP_CACHE_CLEAR")){
+		prog_cache_clear();
+	}
+	return 1;
+}
+//64-bit FNV-1a, fed the key fields one after the other
+static unsigned long long fnv1a(unsigned long long h, const char *s){
+	//Hash the terminator too so "ab","c" and "a","bc" give different keys
+	do {
+		h ^= (unsigned char)*s;
+		h *= 1099511628211ULL;
+	} while (*s++);
+	return h;
+}
+//Compute the cache key and the path of the entry for it, returns 1 on failure
+static int entry_path(const char *src, cl_device_id device, const char *options,
+	char *path, size_t path_sz, unsigned long long *key)
+{
+	char dev_name[256], driver[256], dev_version[256], plat_name[256], plat_version[256];
+	cl_platform_id platform;
+	cl_int err = clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(dev_name), dev_name, NULL);
+	err |= clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(driver), driver, NULL);
+	err |= clGetDeviceInfo(device, CL_DEVICE_VERSION, sizeof(dev_version), dev_version, NULL);
+	err |= clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, NULL);
+	err |= clGetPlatformInfo(platform, CL_PLATFORM_NAME, sizeof(plat_name), plat_name, NULL);
+	err |= clGetPlatformInfo(platform, CL_PLATFORM_VERSION, sizeof(plat_version),
+		plat_version, NULL);
+	if (err != CL_SUCCESS){
+		return 1;
+	}
+	unsigned long long h = 14695981039346656037ULL;
+	h = fnv1a(h, src);
+	h = fnv1a(h, options ? options : "");
+	h = fnv1a(h, dev_name);
+	h = fnv1a(h, driver);
+	h = fnv1a(h, dev_version);
+	h = fnv1a(h, plat_name);
+	h = fnv1a(h, plat_version);
+	*key = h;
+	int n = snprintf(path, path_sz, "%s/%016llx" CACHE_EXT, cache_dir, h);
+	return n < 0 || (size_t)n >= path_sz;
+}
+cl_program prog_cache_load(const char *src, cl_context context, cl_device_id device,
+	const char *options)
+{
+	if (!cache_ready()){
+		return NULL;
+	}
+	char path[1100];
+	unsigned long long key;
+	if (entry_path(src, device, options, path, sizeof(path), &key)){
+		++stats.misses;
+		return NULL;
+	}
+	//Check the entry exists first since read_file complains about missing files
+	FILE *fp = fopen(path, "rb");
+	if (!fp){
+		++stats.misses;
+		return NULL;
+	}
+	fclose(fp);
+	size_t sz;
+	unsigned char *content = (unsigned char*)read_file(path, &sz);
+	if (!content){
+		++stats.misses;
+		return NULL;
+	}
+	size_t header = sizeof(CACHE_MAGIC) - 1 + sizeof(key);
+	unsigned long long file_key;
+	if (sz > header){
+		memcpy(&file_key, content + sizeof(CACHE_MAGIC) - 1, sizeof(file_key));
+	}
+	if (sz <= header || memcmp(content, CACHE_MAGIC, sizeof(CACHE_MAGIC) - 1) != 0
+		|| file_key != key)
+	{
+		free(content);
+		remove(path);
+		++stats.rejected;
+		++stats.misses;
+		return NULL;
+	}
+	const unsigned char *binary = content + header;
+	size_t binary_sz = sz - header;
+	cl_int status, err;
+	cl_program program = clCreateProgramWithBinary(context, 1, &device, &binary_sz,
+		&binary, &status, &err);
+	free(content);
+	if (err == CL_SUCCESS && status == CL_SUCCESS){
+		//Binaries still need to be built, though this is just a load for most runtimes
+		err = clBuildProgram(program, 1, &device, options, NULL, NULL);
+		if (err == CL_SUCCESS){
+			++stats.hits;
+			return program;
+		}
+	}
+	if (program){
+		clReleaseProgram(program);
+	}
+	//The runtime won't take the binary, drop it so we rebuild and store a fresh one
+	remove(path);
+	++stats.rejected;
+	++stats.misses;
+	return NULL;
+}
+int prog_cache_store(cl_program program, const char *src, cl_device_id device,
+	const char *options)
+{
+	if (!cache_ready()){
+		return 1;
+	}
+	char path[1100];
+	unsigned long long key;
+	if (entry_path(src, device, options, path, sizeof(path), &key)){
+		return 1;
+	}
+	cl_uint num_devices;
+	cl_int err = clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof(num_devices),
+		&num_devices, NULL);
+	if (check_cl_err(err, "prog_cache: failed to get program device count")){
+		return 1;
+	}
+	cl_device_id *devices = malloc(sizeof(cl_device_id) * num_devices);
+	size_t *sizes = malloc(sizeof(size_t) * num_devices);
+	unsigned char **binaries = calloc(num_devices, sizeof(unsigned char*));
+	err = clGetProgramInfo(program, CL_PROGRAM_DEVICES, sizeof(cl_device_id) * num_devices,
+		devices, NULL);
+	err |= clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t) * num_devices,
+		sizes, NULL);
+	int ret = 1;
+	cl_uint idx = 0;
+	if (err != CL_SUCCESS){
+		goto cleanup;
+	}
+	while (idx < num_devices && devices[idx] != device){
+		++idx;
+	}
+	if (idx == num_devices || sizes[idx] == 0){
+		goto cleanup;
+	}
+	//We only want the binary for our device but must pass buffers for all of them
+	binaries[idx] = malloc(sizes[idx]);
+	err = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(unsigned char*) * num_devices,
+		binaries, NULL);
+	if (check_cl_err(err, "prog_cache: failed to get program binary")){
+		goto cleanup;
+	}
+	//Write to a temp file and rename so concurrent runs never see a partial entry
+	char tmp_path[1200];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", path, (long)getpid());
+	FILE *fp = fopen(tmp_path, "wb");
+	if (!fp){
+		goto cleanup;
+	}
+	int ok = fwrite(CACHE_MAGIC, 1, sizeof(CACHE_MAGIC) - 1, fp) == sizeof(CACHE_MAGIC) - 1
+		&& fwrite(&key, sizeof(key), 1, fp) == 1
+		&& fwrite(binaries[idx], 1, sizes[idx], fp) == sizes[idx];
+	ok = fclose(fp) == 0 && ok;
+	if (ok && rename(tmp_path, path) == 0){
+		++stats.stores;
+		ret = 0;
+	}
+	else {
+		remove(tmp_path);
+	}
+
+cleanup:
+	free(binaries[idx < num_devices ? idx : 0]);
+	free(binaries);
+	free(sizes);
+	free(devices);
+	return ret;
+}
+int prog_cache_invalidate(const char *src, cl_device_id device, const char *options){
+	if (!cache_ready()){
+		return 0;
+	}
+	char path[1100];
+	unsigned long long key;
+	if (entry_path(src, device, options, path, sizeof(path), &key)){
+		return 0;
+	}
+	return remove(path) == 0;
+}
+size_t prog_cache_clear(void){
+	if (!cache_ready()){
+		return 0;
+	}
+	DIR *dir = opendir(cache_dir);
+	if (!dir){
+		return 0;
+	}
+	size_t removed = 0;
+	size_t ext_len = strlen(CACHE_EXT);
+	struct dirent *entry;
+	while ((entry = readdir(dir))){
+		size_t len = strlen(entry->d_name);
+		if (len > ext_len && strcmp(entry->d_name + len - ext_len, CACHE_EXT) == 0){
+			char path[1400];
+			snprintf(path, sizeof(path), "%s/%s", cache_dir, entry->d_name);
+			if (remove(path) == 0){
+				++removed;
+			}
+		}
+	}
+	closedir(dir);
+	return removed;
+}
+const char* prog_cache_dir(void){
+	return cache_ready() ? cache_dir : NULL;
+}
+prog_cache_stats_t prog_cache_stats(void){
+	return stats;
+}
+
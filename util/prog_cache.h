@@ -0,0 +1,59 @@
+#ifndef PROG_CACHE_H
+#define PROG_CACHE_H
+
+#include <stddef.h>
+#include <CL/cl.h>
+
+/*
+ * On-disk cache of built program binaries used by build_program. Entries are keyed
+ * on a hash of the source, build options, device name, driver version and platform.
+ * The cache lives in $OCLP_CACHE_DIR, or $XDG_CACHE_HOME/opencl_practice or
+ * $HOME/.cache/opencl_practice if that isn't set. Setting OCLP_NO_CACHE disables
+ * the cache and setting OCLP_CACHE_CLEAR wipes it before its first use
+ */
+typedef struct prog_cache_stats_t {
+	//Programs loaded from a cached binary
+	size_t hits;
+	//Lookups that had to fall back to a source build
+	size_t misses;
+	//Cached binaries that existed but were rejected by the runtime
+	size_t rejected;
+	//Binaries written to the cache
+	size_t stores;
+} prog_cache_stats_t;
+
+/*
+ * Try to load a built program for the source, options and device from the cache
+ * returns NULL on a cache miss or if the cached binary was rejected, in which
+ * case the stale entry is removed
+ */
+cl_program prog_cache_load(const char *src, cl_context context, cl_device_id device,
+	const char *options);
+/*
+ * Write the binary of a program built for device from src and options to the cache
+ * returns 1 if the binary couldn't be stored
+ */
+int prog_cache_store(cl_program program, const char *src, cl_device_id device,
+	const char *options);
+/*
+ * Remove the cached binary for the source, options and device if there is one
+ * returns 1 if an entry was removed
+ */
+int prog_cache_invalidate(const char *src, cl_device_id device, const char *options);
+/*
+ * Remove every binary in the cache directory
+ * returns the number of entries removed
+ */
+size_t prog_cache_clear(void);
+/*
+ * Get the directory the cache is stored in, for other on-disk caches to share
+ * returns NULL if caching is disabled
+ */
+const char* prog_cache_dir(void);
+/*
+ * Get the hit/miss counters for the cache since the process started
+ */
+prog_cache_stats_t prog_cache_stats(void);
+
+#endif
+
@@ -0,0 +1,36 @@
+#include <stdlib.h>
+#include <string.h>
+#include "simd.h"
+
+static const char *level_names[] = { "scalar", "sse4.1", "avx2" };
+
+static simd_level_t cpu_level(void){
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")){
+		return SIMD_AVX2;
+	}
+	if (__builtin_cpu_supports("sse4.1")){
+		return SIMD_SSE41;
+	}
+#endif
+	return SIMD_SCALAR;
+}
+simd_level_t simd_level(void){
+	static int level = -1;
+	if (level == -1){
+		simd_level_t supported = cpu_level();
+		level = supported;
+		const char *env = getenv("OCLP_SIMD");
+		for (int i = 0; env && i < (int)supported; ++i){
+			if (strcmp(env, level_names[i]) == 0){
+				level = i;
+			}
+		}
+	}
+	return level;
+}
+const char* simd_level_name(simd_level_t level){
+	return level_names[level];
+}
+
@@ -0,0 +1,25 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/*
+ * Runtime selection of the SIMD instruction set used by the host backend. The widest
+ * one the CPU supports is picked, setting OCLP_SIMD to avx2, sse4.1 or scalar lowers
+ * it, eg. to compare them. Without GCC style x86 intrinsics only scalar is available
+ */
+typedef enum simd_level_t {
+	SIMD_SCALAR,
+	SIMD_SSE41,
+	SIMD_AVX2
+} simd_level_t;
+
+/*
+ * Get the SIMD level the host backend should use
+ */
+simd_level_t simd_level(void);
+/*
+ * Get the name of the level, as OCLP_SIMD takes it
+ */
+const char* simd_level_name(simd_level_t level);
+
+#endif
+
@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CL/cl.h>
+#include "util.h"
+#include "profile.h"
+#include "task_graph.h"
+
+#define TASK_NAME_MAX 32
+
+typedef struct task_t {
+	cl_event evt;
+	int queue;
+	char name[TASK_NAME_MAX];
+} task_t;
+
+//The tasks the next users of a buffer have to wait on
+typedef struct mem_deps_t {
+	cl_mem mem;
+	//Last task to write the buffer, -1 if none has
+	int writer;
+	//Tasks reading the buffer since the last write
+	int *readers;
+	int n_readers, readers_cap;
+} mem_deps_t;
+
+struct task_graph_t {
+	cl_command_queue *queues;
+	int n_queues, out_of_order;
+	//Queue the next task without dependencies goes on
+	int next_queue;
+	task_t *tasks;
+	int n_tasks, tasks_cap;
+	mem_deps_t *mems;
+	int n_mems, mems_cap;
+	//The tasks the one being added waits on and their events
+	int *wait_tasks;
+	cl_event *wait;
+	int n_wait;
+};
+
+//An event starting or ending a command, for sweeping over the commands' run times
+typedef struct edge_t {
+	cl_ulong time;
+	int delta;
+} edge_t;
+
+task_graph_t* task_graph_create(cl_context context, cl_device_id device, int n_queues){
+	cl_command_queue_properties supported = 0;
+	cl_int err = clGetDeviceInfo(device, CL_DEVICE_QUEUE_PROPERTIES, sizeof(supported),
+		&supported, NULL);
+	if (check_cl_err(err, "task_graph: failed to query queue properties")){
+		return NULL;
+	}
+	task_graph_t *graph = calloc(1, sizeof(task_graph_t));
+	graph->out_of_order = n_queues == 0 && (supported & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+	graph->n_queues = graph->out_of_order ? 1 : n_queues > 0 ? n_queues : TASK_GRAPH_QUEUES;
+	graph->queues = calloc(graph->n_queues, sizeof(cl_command_queue));
+	const cl_command_queue_properties properties = CL_QUEUE_PROFILING_ENABLE
+		| (graph->out_of_order ? CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE : 0);
+	for (int i = 0; i < graph->n_queues && err == CL_SUCCESS; ++i){
+		graph->queues[i] = profile_create_queue(context, device, properties, &err);
+	}
+	if (check_cl_err(err, "task_graph: failed to create command queues")){
+		task_graph_destroy(graph);
+		return NULL;
+	}
+	return graph;
+}
+int task_graph_out_of_order(const task_graph_t *graph){
+	return graph->out_of_order;
+}
+int task_graph_queues(const task_graph_t *graph){
+	return graph->n_queues;
+}
+//Find the buffer's dependencies, adding an entry for it if it hasn't been used yet
+static mem_deps_t* find_mem(task_graph_t *graph, cl_mem mem){
+	for (int i = 0; i < graph->n_mems; ++i){
+		if (graph->mems[i].mem == mem){
+			return &graph->mems[i];
+		}
+	}
+	if (graph->n_mems == graph->mems_cap){
+		graph->mems_cap = graph->mems_cap ? 2 * graph->mems_cap : 8;
+		graph->mems = realloc(graph->mems, sizeof(mem_deps_t) * graph->mems_cap);
+	}
+	mem_deps_t *deps = &graph->mems[graph->n_mems++];
+	memset(deps, 0, sizeof(mem_deps_t));
+	deps->mem = mem;
+	deps->writer = -1;
+	return deps;
+}
+static void add_wait(task_graph_t *graph, int task){
+	for (int i = 0; i < graph->n_wait; ++i){
+		if (graph->wait_tasks[i] == task){
+			return;
+		}
+	}
+	graph->wait_tasks[graph->n_wait] = task;
+	graph->wait[graph->n_wait++] = graph->tasks[task].evt;
+}
+/*
+ * Build the wait list for a task using the buffers, waiting on their last writers and
+ * for the ones it writes on their readers too
+ * returns the queue to put the task on
+ */
+static int begin_task(task_graph_t *graph, const cl_mem *reads, int n_reads,
+	const cl_mem *writes, int n_writes)
+{
+	graph->n_wait = 0;
+	//Every earlier task is the most that can be waited on
+	graph->wait_tasks = realloc(graph->wait_tasks, sizeof(int) * (graph->n_tasks + 1));
+	graph->wait = realloc(graph->wait, sizeof(cl_event) * (graph->n_tasks + 1));
+	int latest = -1;
+	for (int i = 0; i < n_reads + n_writes; ++i){
+		const mem_deps_t *deps = find_mem(graph, i < n_reads ? reads[i] : writes[i - n_reads]);
+		if (deps->writer >= 0){
+			add_wait(graph, deps->writer);
+			latest = deps->writer > latest ? deps->writer : latest;
+		}
+		for (int r = 0; i >= n_reads && r < deps->n_readers; ++r){
+			add_wait(graph, deps->readers[r]);
+			latest = deps->readers[r] > latest ? deps->readers[r] : latest;
+		}
+	}
+	if (graph->out_of_order){
+		return 0;
+	}
+	//Chains stay on one in-order queue, independent work goes on the next one
+	if (latest >= 0){
+		return graph->tasks[latest].queue;
+	}
+	const int queue = graph->next_queue;
+	graph->next_queue = (graph->next_queue + 1) % graph->n_queues;
+	return queue;
+}
+/*
+ * Record the task that was enqueued with the error code and event and make it the last
+ * writer or a reader of the buffers it uses
+ * returns the task's index or -1 if it failed to enqueue
+ */
+static int end_task(task_graph_t *graph, int queue, cl_int err, cl_event evt,
+	const cl_mem *reads, int n_reads, const cl_mem *writes, int n_writes, const char *name)
+{
+	if (check_cl_err(err, "task_graph: failed to enqueue command")){
+		return -1;
+	}
+	if (graph->n_tasks == graph->tasks_cap){
+		graph->tasks_cap = graph->tasks_cap ? 2 * graph->tasks_cap : 16;
+		graph->tasks = realloc(graph->tasks, sizeof(task_t) * graph->tasks_cap);
+	}
+	const int id = graph->n_tasks++;
+	task_t *task = &graph->tasks[id];
+	task->evt = evt;
+	task->queue = queue;
+	snprintf(task->name, sizeof(task->name), "%s", name);
+	for (int i = 0; i < n_reads; ++i){
+		mem_deps_t *deps = find_mem(graph, reads[i]);
+		if (deps->n_readers == deps->readers_cap){
+			deps->readers_cap = deps->readers_cap ? 2 * deps->readers_cap : 4;
+			deps->readers = realloc(deps->readers, sizeof(int) * deps->readers_cap);
+		}
+		deps->readers[deps->n_readers++] = id;
+	}
+	for (int i = 0; i < n_writes; ++i){
+		mem_deps_t *deps = find_mem(graph, writes[i]);
+		deps->writer = id;
+		deps->n_readers = 0;
+	}
+	profile_record(evt, name);
+	//Submit it now so tasks on other queues waiting on it aren't held up
+	clFlush(graph->queues[queue]);
+	return id;
+}
+int task_graph_write(task_graph_t *graph, cl_mem mem, size_t offset, size_t size,
+	const void *ptr, const char *name)
+{
+	const int queue = begin_task(graph, NULL, 0, &mem, 1);
+	cl_event evt = NULL;
+	cl_int err = clEnqueueWriteBuffer(graph->queues[queue], mem, CL_FALSE, offset, size, ptr,
+		graph->n_wait, graph->n_wait ? graph->wait : NULL, &evt);
+	return end_task(graph, queue, err, evt, NULL, 0, &mem, 1, name);
+}
+int task_graph_fill(task_graph_t *graph, cl_mem mem, const void *pattern, size_t pattern_size,
+	size_t offset, size_t size, const char *name)
+{
+	const int queue = begin_task(graph, NULL, 0, &mem, 1);
+	cl_event evt = NULL;
+	cl_int err = clEnqueueFillBuffer(graph->queues[queue], mem, pattern, pattern_size, offset,
+		size, graph->n_wait, graph->n_wait ? graph->wait : NULL, &evt);
+	return end_task(graph, queue, err, evt, NULL, 0, &mem, 1, name);
+}
+int task_graph_kernel(task_graph_t *graph, cl_kernel kernel, cl_uint work_dim,
+	const size_t *global_size, const size_t *local_size, const cl_mem *reads, int n_reads,
+	const cl_mem *writes, int n_writes, const char *name)
+{
+	const int queue = begin_task(graph, reads, n_reads, writes, n_writes);
+	cl_event evt = NULL;
+	cl_int err = clEnqueueNDRangeKernel(graph->queues[queue], kernel, work_dim, NULL,
+		global_size, local_size, graph->n_wait, graph->n_wait ? graph->wait : NULL, &evt);
+	return end_task(graph, queue, err, evt, reads, n_reads, writes, n_writes, name);
+}
+int task_graph_read(task_graph_t *graph, cl_mem mem, size_t offset, size_t size, void *ptr,
+	const char *name)
+{
+	const int queue = begin_task(graph, &mem, 1, NULL, 0);
+	cl_event evt = NULL;
+	cl_int err = clEnqueueReadBuffer(graph->queues[queue], mem, CL_FALSE, offset, size, ptr,
+		graph->n_wait, graph->n_wait ? graph->wait : NULL, &evt);
+	return end_task(graph, queue, err, evt, &mem, 1, NULL, 0, name);
+}
+cl_int task_graph_finish(task_graph_t *graph){
+	cl_int err = CL_SUCCESS;
+	for (int i = 0; i < graph->n_queues; ++i){
+		err |= clFinish(graph->queues[i]);
+	}
+	return err;
+}
+//Order starts and ends by time with ends first, so commands that just touch don't overlap
+static int cmp_edge(const void *a, const void *b){
+	const edge_t *ea = a, *eb = b;
+	if (ea->time != eb->time){
+		return ea->time < eb->time ? -1 : 1;
+	}
+	return ea->delta - eb->delta;
+}
+task_graph_stats_t task_graph_stats(const task_graph_t *graph){
+	task_graph_stats_t stats = { 0 };
+	edge_t *edges = malloc(sizeof(edge_t) * 2 * (graph->n_tasks ? graph->n_tasks : 1));
+	int n = 0;
+	cl_ulong busy = 0;
+	for (int i = 0; i < graph->n_tasks; ++i){
+		cl_ulong start, end;
+		cl_int err = clGetEventProfilingInfo(graph->tasks[i].evt, CL_PROFILING_COMMAND_START,
+			sizeof(start), &start, NULL);
+		err |= clGetEventProfilingInfo(graph->tasks[i].evt, CL_PROFILING_COMMAND_END,
+			sizeof(end), &end, NULL);
+		if (err != CL_SUCCESS || end < start){
+			continue;
+		}
+		busy += end - start;
+		edges[n].time = start;
+		edges[n++].delta = 1;
+		edges[n].time = end;
+		edges[n++].delta = -1;
+	}
+	qsort(edges, n, sizeof(edge_t), cmp_edge);
+	//Sweep the starts and ends keeping count of the commands running
+	cl_ulong active = 0;
+	int running = 0;
+	for (int i = 0; i < n; ++i){
+		if (running > 0){
+			active += edges[i].time - edges[i - 1].time;
+		}
+		running += edges[i].delta;
+		stats.max_concurrent = running > stats.max_concurrent ? running : stats.max_concurrent;
+	}
+	stats.tasks = n / 2;
+	stats.busy_ms = busy * 1e-6;
+	stats.span_ms = n ? (edges[n - 1].time - edges[0].time) * 1e-6 : 0;
+	stats.active_ms = active * 1e-6;
+	stats.overlap_ms = stats.busy_ms - stats.active_ms;
+	stats.concurrency = active ? (double)busy / active : 0;
+	free(edges);
+	return stats;
+}
+void task_graph_print_stats(const task_graph_t *graph, const task_graph_stats_t *stats){
+	printf("%d commands on %d %s queue%s: %.3fms span, %.3fms busy, %.3fms active\n",
+		stats->tasks, graph->n_queues, graph->out_of_order ? "out-of-order" : "in-order",
+		graph->n_queues > 1 ? "s" : "", stats->span_ms, stats->busy_ms, stats->active_ms);
+	printf("%.3fms overlapped (%.0f%% of busy), %.2f average and %d most commands at once\n",
+		stats->overlap_ms, stats->busy_ms > 0 ? 100.0 * stats->overlap_ms / stats->busy_ms : 0,
+		stats->concurrency, stats->max_concurrent);
+}
+void task_graph_reset(task_graph_t *graph){
+	for (int i = 0; i < graph->n_tasks; ++i){
+		if (graph->tasks[i].evt){
+			clReleaseEvent(graph->tasks[i].evt);
+		}
+	}
+	for (int i = 0; i < graph->n_mems; ++i){
+		free(graph->mems[i].readers);
+	}
+	graph->n_tasks = 0;
+	graph->n_mems = 0;
+	graph->next_queue = 0;
+}
+void task_graph_destroy(task_graph_t *graph){
+	if (!graph){
+		return;
+	}
+	task_graph_reset(graph);
+	for (int i = 0; i < graph->n_queues; ++i){
+		if (graph->queues[i]){
+			clReleaseCommandQueue(graph->queues[i]);
+		}
+	}
+	free(graph->queues);
+	free(graph->tasks);
+	free(graph->mems);
+	free(graph->wait_tasks);
+	free(graph->wait);
+	free(graph);
+}
+
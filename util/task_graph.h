@@ -0,0 +1,100 @@
+#ifndef TASK_GRAPH_H
+#define TASK_GRAPH_H
+
+#include <stddef.h>
+#include <CL/cl.h>
+
+//In-order queues used when the device doesn't have out-of-order ones
+#define TASK_GRAPH_QUEUES 3
+
+/*
+ * A graph of writes, fills, kernels and reads declared with the buffers they read and
+ * write. Each command waits on the events of the last command that wrote a buffer it uses,
+ * and writes also wait on the commands reading the buffer since then, so everything else
+ * is free to run at the same time. Commands are enqueued as they're added, on one
+ * out-of-order queue if the device has them or spread over several in-order queues
+ * otherwise, with the dependencies as explicit event wait lists. Writes and reads don't
+ * block, so their host memory must stay valid until task_graph_finish. The graph's queues
+ * are created with profiling on so the overlap it got can be measured. It isn't thread safe
+ */
+typedef struct task_graph_t task_graph_t;
+
+typedef struct task_graph_stats_t {
+	int tasks;
+	//Sum of the commands' run times, from the first start to the last end and the time
+	//at least one command was running, in ms
+	double busy_ms, span_ms, active_ms;
+	//Time commands spent running alongside others, busy_ms - active_ms
+	double overlap_ms;
+	//Average and most commands running at once while any were
+	double concurrency;
+	int max_concurrent;
+} task_graph_stats_t;
+
+/*
+ * Create a graph for the device. If n_queues is 0 one out-of-order queue is used if the
+ * device supports it and TASK_GRAPH_QUEUES in-order queues otherwise, a count forces that
+ * many in-order queues. One in-order queue runs everything in the order it was added
+ * returns NULL on failure
+ */
+task_graph_t* task_graph_create(cl_context context, cl_device_id device, int n_queues);
+/*
+ * Check if the graph runs on an out-of-order queue
+ */
+int task_graph_out_of_order(const task_graph_t *graph);
+/*
+ * Get the number of queues the graph spreads commands over
+ */
+int task_graph_queues(const task_graph_t *graph);
+/*
+ * Add a write of size bytes from ptr to mem at offset
+ * returns the task's index or -1 on failure
+ */
+int task_graph_write(task_graph_t *graph, cl_mem mem, size_t offset, size_t size,
+	const void *ptr, const char *name);
+/*
+ * Add a fill of size bytes of mem at offset with the pattern
+ * returns the task's index or -1 on failure
+ */
+int task_graph_fill(task_graph_t *graph, cl_mem mem, const void *pattern, size_t pattern_size,
+	size_t offset, size_t size, const char *name);
+/*
+ * Add a launch of the kernel with the arguments it has set now, global_size must be a
+ * multiple of local_size if it's given. reads and writes list the buffers the kernel uses
+ * returns the task's index or -1 on failure
+ */
+int task_graph_kernel(task_graph_t *graph, cl_kernel kernel, cl_uint work_dim,
+	const size_t *global_size, const size_t *local_size, const cl_mem *reads, int n_reads,
+	const cl_mem *writes, int n_writes, const char *name);
+/*
+ * Add a read of size bytes of mem at offset into ptr
+ * returns the task's index or -1 on failure
+ */
+int task_graph_read(task_graph_t *graph, cl_mem mem, size_t offset, size_t size, void *ptr,
+	const char *name);
+/*
+ * Wait for every command added so far to finish
+ * returns the error code of the first call that failed
+ */
+cl_int task_graph_finish(task_graph_t *graph);
+/*
+ * Measure the overlap of the commands added so far from their profiling info, after
+ * task_graph_finish
+ */
+task_graph_stats_t task_graph_stats(const task_graph_t *graph);
+/*
+ * Print the stats and how the commands were run
+ */
+void task_graph_print_stats(const task_graph_t *graph, const task_graph_stats_t *stats);
+/*
+ * Release the commands' events and forget the buffers' dependencies so the graph can be
+ * used again, after task_graph_finish
+ */
+void task_graph_reset(task_graph_t *graph);
+/*
+ * Release the queues and events and free the graph
+ */
+void task_graph_destroy(task_graph_t *graph);
+
+#endif
+
@@ -0,0 +1,124 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "thread_pool.h"
+
+struct thread_pool_t {
+	pthread_t *threads;
+	//Workers started, the caller makes one more thread
+	int n_workers;
+	pthread_mutex_t lock;
+	//Signalled when a new loop is posted and when the last worker finishes it
+	pthread_cond_t work, done;
+	//Bumped for each loop so the workers can tell a new one has been posted
+	unsigned generation;
+	int busy, stop;
+	thread_pool_fn fn;
+	void *arg;
+	size_t n, grain;
+	//First item of the next chunk, claimed with an atomic add
+	size_t next;
+};
+
+static void run_chunks(thread_pool_t *pool){
+	for (;;){
+		const size_t begin = __sync_fetch_and_add(&pool->next, pool->grain);
+		if (begin >= pool->n){
+			return;
+		}
+		pool->fn(pool->arg, begin, begin + pool->grain > pool->n ? pool->n : begin + pool->grain);
+	}
+}
+static void* pool_worker(void *arg){
+	thread_pool_t *pool = arg;
+	unsigned seen = 0;
+	pthread_mutex_lock(&pool->lock);
+	for (;;){
+		while (pool->generation == seen && !pool->stop){
+			pthread_cond_wait(&pool->work, &pool->lock);
+		}
+		if (pool->stop){
+			break;
+		}
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+		run_chunks(pool);
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy == 0){
+			pthread_cond_signal(&pool->done);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+thread_pool_t* thread_pool_create(int n_threads){
+	if (n_threads <= 0){
+		const char *env = getenv("OCLP_THREADS");
+		n_threads = env ? atoi(env) : 0;
+	}
+	if (n_threads <= 0){
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		n_threads = cores > 0 ? (int)cores : 1;
+	}
+	thread_pool_t *pool = calloc(1, sizeof(thread_pool_t));
+	if (!pool){
+		return NULL;
+	}
+	pool->threads = malloc(sizeof(pthread_t) * n_threads);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	for (; pool->n_workers < n_threads - 1; ++pool->n_workers){
+		if (pthread_create(&pool->threads[pool->n_workers], NULL, pool_worker, pool)){
+			fprintf(stderr, "thread_pool_create error: only started %d of %d threads\n",
+				pool->n_workers + 1, n_threads);
+			break;
+		}
+	}
+	return pool;
+}
+int thread_pool_size(const thread_pool_t *pool){
+	return pool->n_workers + 1;
+}
+void thread_pool_run(thread_pool_t *pool, size_t n, size_t grain, thread_pool_fn fn, void *arg){
+	if (n == 0){
+		return;
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->fn = fn;
+	pool->arg = arg;
+	pool->n = n;
+	pool->grain = grain ? grain : 1;
+	pool->next = 0;
+	pool->busy = pool->n_workers;
+	++pool->generation;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	run_chunks(pool);
+	pthread_mutex_lock(&pool->lock);
+	while (pool->busy > 0){
+		pthread_cond_wait(&pool->done, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+void thread_pool_destroy(thread_pool_t *pool){
+	if (!pool){
+		return;
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	for (int i = 0; i < pool->n_workers; ++i){
+		pthread_join(pool->threads[i], NULL);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work);
+	pthread_cond_destroy(&pool->done);
+	free(pool->threads);
+	free(pool);
+}
+
@@ -0,0 +1,40 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+
+/*
+ * A fixed pool of worker threads for the host backend, used to split loops over rows
+ * across the cores. The pool is created with one thread per core unless OCLP_THREADS
+ * sets the count, the thread calling thread_pool_run works too so a pool of one thread
+ * runs everything on the caller
+ */
+typedef struct thread_pool_t thread_pool_t;
+
+/*
+ * Run fn on the items in [begin, end)
+ */
+typedef void (*thread_pool_fn)(void *arg, size_t begin, size_t end);
+
+/*
+ * Create a pool of n_threads threads including the caller, pass 0 to use OCLP_THREADS
+ * or the number of cores
+ * returns NULL on failure
+ */
+thread_pool_t* thread_pool_create(int n_threads);
+/*
+ * Get the number of threads in the pool, including the caller
+ */
+int thread_pool_size(const thread_pool_t *pool);
+/*
+ * Split the n items into chunks of grain items and run fn on them across the pool,
+ * returning once they're all done. Only one thread may be running a loop at a time
+ */
+void thread_pool_run(thread_pool_t *pool, size_t n, size_t grain, thread_pool_fn fn, void *arg);
+/*
+ * Stop the workers and free the pool
+ */
+void thread_pool_destroy(thread_pool_t *pool);
+
+#endif
+
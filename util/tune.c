@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CL/cl.h>
+#include "util.h"
+#include "prog_cache.h"
+#include "tune.h"
+
+#define TUNE_FILE "local_sizes.txt"
+#define VARIANT_FILE "variants.txt"
+#define TUNE_RUNS 3
+
+//What enqueue_direct needs to enqueue the kernel as its arguments are set
+typedef struct direct_args_t {
+	cl_uint work_dim;
+	const size_t *global_size;
+} direct_args_t;
+
+void pad_global_size(cl_uint work_dim, const size_t *global_size, const size_t *local_size,
+	size_t *padded)
+{
+	for (cl_uint i = 0; i < work_dim; ++i){
+		padded[i] = round_up(global_size[i], local_size[i]);
+	}
+}
+static cl_int enqueue_direct(void *arg, cl_command_queue queue, cl_kernel kernel,
+	const size_t *local_size, cl_event *evt)
+{
+	const direct_args_t *direct = arg;
+	size_t padded[3];
+	pad_global_size(direct->work_dim, direct->global_size, local_size, padded);
+	return clEnqueueNDRangeKernel(queue, kernel, direct->work_dim, NULL, padded, local_size, 0,
+		NULL, evt);
+}
+static size_t pow2_ceil(size_t n){
+	size_t p = 1;
+	while (p < n){
+		p *= 2;
+	}
+	return p;
+}
+//Write the platform, device and driver part of the keys, returns its length or -1 on failure
+static int device_key(cl_device_id device, char *key, size_t sz){
+	cl_platform_id platform;
+	char device_name[128], platform_name[128], driver[128];
+	cl_int err = clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, NULL);
+	err |= clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+	err |= clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(driver), driver, NULL);
+	err |= clGetPlatformInfo(platform, CL_PLATFORM_NAME, sizeof(platform_name), platform_name,
+		NULL);
+	if (err != CL_SUCCESS){
+		return -1;
+	}
+	const int n = snprintf(key, sz, "%s/%s/%s", platform_name, device_name, driver);
+	return n < 0 || (size_t)n >= sz ? -1 : n;
+}
+//Build the key for the device, kernel and problem shape in the tuning file, returns 1 on failure
+static int tune_key(cl_device_id device, cl_kernel kernel, cl_uint work_dim,
+	const size_t *global_size, char *key, size_t sz)
+{
+	char kernel_name[128];
+	int n = device_key(device, key, sz);
+	cl_int err = clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(kernel_name),
+		kernel_name, NULL);
+	if (n < 0 || err != CL_SUCCESS){
+		return 1;
+	}
+	n += snprintf(key + n, sz - n, " %s ", kernel_name);
+	for (cl_uint i = 0; i < work_dim && n >= 0 && (size_t)n < sz; ++i){
+		n += snprintf(key + n, sz - n, i ? "x%lu" : "%lu", (unsigned long)pow2_ceil(global_size[i]));
+	}
+	return n < 0 || (size_t)n >= sz;
+}
+//Look for a stored local size for the key, returns 1 if one was found
+static int load_local_size(const char *key, cl_uint work_dim, size_t *local_size){
+	const char *dir = prog_cache_dir();
+	if (!dir || getenv("OCLP_RETUNE")){
+		return 0;
+	}
+	char path[1100], line[640], file_key[512];
+	snprintf(path, sizeof(path), "%s/" TUNE_FILE, dir);
+	FILE *fp = fopen(path, "r");
+	if (!fp){
+		return 0;
+	}
+	int found = 0;
+	unsigned long local[3];
+	double ms;
+	while (fgets(line, sizeof(line), fp)){
+		if (sscanf(line, "%lu %lu %lu %lf %511[^\n]", &local[0], &local[1], &local[2], &ms,
+			file_key) == 5 && strcmp(file_key, key) == 0)
+		{
+			//Keep going so the latest entry wins
+			for (cl_uint i = 0; i < work_dim; ++i){
+				local_size[i] = local[i];
+			}
+			found = 1;
+		}
+	}
+	fclose(fp);
+	return found;
+}
+static void store_local_size(const char *key, cl_uint work_dim, const size_t *local_size,
+	double ms)
+{
+	const char *dir = prog_cache_dir();
+	if (!dir){
+		return;
+	}
+	char path[1100];
+	snprintf(path, sizeof(path), "%s/" TUNE_FILE, dir);
+	FILE *fp = fopen(path, "a");
+	if (!fp){
+		return;
+	}
+	unsigned long local[3] = { 1, 1, 1 };
+	for (cl_uint i = 0; i < work_dim; ++i){
+		local[i] = local_size[i];
+	}
+	fprintf(fp, "%lu %lu %lu %f %s\n", local[0], local[1], local[2], ms, key);
+	fclose(fp);
+}
+/*
+ * Fill out with the power of two local sizes that fit the kernel and device limits and don't
+ * go past the global size rounded up to a power of two. If any are a multiple of the
+ * preferred work-group size multiple only those are kept. Unused dimensions are 1
+ * returns the number of candidates, the caller must free out
+ */
+static size_t local_size_candidates(cl_device_id device, cl_kernel kernel, cl_uint work_dim,
+	const size_t *global_size, size_t (**out)[3])
+{
+	size_t max_group = 1, multiple = 1;
+	cl_uint max_dims = 3;
+	cl_int err = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+		sizeof(max_group), &max_group, NULL);
+	err |= clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+		sizeof(multiple), &multiple, NULL);
+	err |= clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS, sizeof(max_dims),
+		&max_dims, NULL);
+	size_t *max_items = malloc(sizeof(size_t) * (max_dims > 3 ? max_dims : 3));
+	err |= clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(size_t) * max_dims,
+		max_items, NULL);
+	if (check_cl_err(err, "tune_local_size: failed to query work-group limits")){
+		free(max_items);
+		*out = NULL;
+		return 0;
+	}
+	size_t limit[3] = { 1, 1, 1 };
+	size_t max_candidates = 1;
+	for (cl_uint i = 0; i < work_dim; ++i){
+		limit[i] = pow2_ceil(global_size[i]);
+		limit[i] = limit[i] < max_items[i] ? limit[i] : max_items[i];
+		size_t powers = 0;
+		for (size_t l = 1; l <= limit[i]; l *= 2){
+			++powers;
+		}
+		max_candidates *= powers;
+	}
+	free(max_items);
+	size_t (*candidates)[3] = malloc(sizeof(size_t[3]) * max_candidates);
+	size_t n = 0, n_multiple = 0;
+	for (size_t z = 1; z <= limit[2]; z *= 2){
+		for (size_t y = 1; y <= limit[1]; y *= 2){
+			for (size_t x = 1; x <= limit[0] && x * y * z <= max_group; x *= 2){
+				const size_t c[3] = { x, y, z };
+				//Multiples of the preferred size are kept together at the front
+				if ((x * y * z) % multiple == 0){
+					memmove(candidates[n++], candidates[n_multiple], sizeof(c));
+					memcpy(candidates[n_multiple++], c, sizeof(c));
+				}
+				else {
+					memcpy(candidates[n++], c, sizeof(c));
+				}
+			}
+		}
+	}
+	*out = candidates;
+	return n_multiple ? n_multiple : n;
+}
+//Time the candidate, returning the fastest of its runs in seconds or -1 if it failed
+static double time_candidate(cl_command_queue queue, cl_kernel kernel, tune_enqueue_fn enqueue,
+	void *arg, const size_t *local_size)
+{
+	double best = -1;
+	//One extra run up front to warm up
+	for (int i = 0; i < TUNE_RUNS + 1; ++i){
+		cl_event evt = NULL;
+		double start = wall_time();
+		cl_int err = enqueue(arg, queue, kernel, local_size, &evt);
+		if (err == CL_SUCCESS){
+			err = clWaitForEvents(1, &evt);
+		}
+		double t = wall_time() - start;
+		if (evt){
+			clReleaseEvent(evt);
+		}
+		if (err != CL_SUCCESS){
+			return -1;
+		}
+		if (i > 0 && (best < 0 || t < best)){
+			best = t;
+		}
+	}
+	return best;
+}
+int tune_local_size(cl_command_queue queue, cl_kernel kernel, cl_uint work_dim,
+	const size_t *global_size, tune_enqueue_fn enqueue, void *arg, size_t *local_size)
+{
+	direct_args_t direct = { work_dim, global_size };
+	if (!enqueue){
+		enqueue = enqueue_direct;
+		arg = &direct;
+	}
+	cl_device_id device;
+	cl_int err = clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(device), &device, NULL);
+	if (check_cl_err(err, "tune_local_size: failed to get queue device")){
+		return 1;
+	}
+	char key[512];
+	const int have_key = !tune_key(device, kernel, work_dim, global_size, key, sizeof(key));
+	if (have_key && load_local_size(key, work_dim, local_size)){
+		return 0;
+	}
+	size_t (*candidates)[3];
+	size_t n = local_size_candidates(device, kernel, work_dim, global_size, &candidates);
+	double best = -1;
+	for (size_t i = 0; i < n; ++i){
+		double t = time_candidate(queue, kernel, enqueue, arg, candidates[i]);
+		if (t >= 0 && (best < 0 || t < best)){
+			best = t;
+			memcpy(local_size, candidates[i], sizeof(size_t) * work_dim);
+		}
+	}
+	free(candidates);
+	if (best < 0){
+		fprintf(stderr, "tune_local_size error: none of the %lu local sizes could run\n",
+			(unsigned long)n);
+		return 1;
+	}
+	if (have_key){
+		store_local_size(key, work_dim, local_size, best * 1000.0);
+	}
+	return 0;
+}
+//Look for the variant stored for the key, returns -1 if there isn't one
+static int load_variant(const char *key){
+	const char *dir = prog_cache_dir();
+	if (!dir || getenv("OCLP_RETUNE")){
+		return -1;
+	}
+	char path[1100], line[640], file_key[512];
+	snprintf(path, sizeof(path), "%s/" VARIANT_FILE, dir);
+	FILE *fp = fopen(path, "r");
+	if (!fp){
+		return -1;
+	}
+	int variant = -1, v;
+	double ms;
+	while (fgets(line, sizeof(line), fp)){
+		//Keep going so the latest entry wins
+		if (sscanf(line, "%d %lf %511[^\n]", &v, &ms, file_key) == 3 && strcmp(file_key, key) == 0){
+			variant = v;
+		}
+	}
+	fclose(fp);
+	return variant;
+}
+static void store_variant(const char *key, int variant, double ms){
+	const char *dir = prog_cache_dir();
+	if (!dir){
+		return;
+	}
+	char path[1100];
+	snprintf(path, sizeof(path), "%s/" VARIANT_FILE, dir);
+	FILE *fp = fopen(path, "a");
+	if (!fp){
+		return;
+	}
+	fprintf(fp, "%d %f %s\n", variant, ms, key);
+	fclose(fp);
+}
+int tune_variant(cl_command_queue queue, const char *name, int n_variants, tune_variant_fn run,
+	void *arg)
+{
+	cl_device_id device;
+	cl_int err = clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(device), &device, NULL);
+	if (check_cl_err(err, "tune_variant: failed to get queue device")){
+		return -1;
+	}
+	char key[512];
+	const int n = device_key(device, key, sizeof(key));
+	const int have_key = n >= 0 && snprintf(key + n, sizeof(key) - n, " %s", name) > 0;
+	const int stored = have_key ? load_variant(key) : -1;
+	if (stored >= 0 && stored < n_variants){
+		return stored;
+	}
+	int fastest = -1;
+	double best = -1;
+	for (int v = 0; v < n_variants; ++v){
+		//One extra run up front to warm up
+		double variant_best = -1;
+		for (int i = 0; i < TUNE_RUNS + 1; ++i){
+			double start = wall_time();
+			err = run(arg, queue, v);
+			err |= clFinish(queue);
+			double t = wall_time() - start;
+			if (err != CL_SUCCESS){
+				variant_best = -1;
+				break;
+			}
+			if (i > 0 && (variant_best < 0 || t < variant_best)){
+				variant_best = t;
+			}
+		}
+		if (variant_best >= 0 && (best < 0 || variant_best < best)){
+			best = variant_best;
+			fastest = v;
+		}
+	}
+	if (fastest < 0){
+		fprintf(stderr, "tune_variant error: none of the %d variants of %s could run\n",
+			n_variants, name);
+		return -1;
+	}
+	if (have_key){
+		store_variant(key, fastest, best * 1000.0);
+	}
+	return fastest;
+}
+
@@ -0,0 +1,57 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <stddef.h>
+#include <CL/cl.h>
+
+/*
+ * Local work-size auto-tuning. The candidates are power of two shapes within the kernel's
+ * CL_KERNEL_WORK_GROUP_SIZE and the device's per-dimension limits whose size is a multiple
+ * of CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, if any are. Each one is timed and the
+ * fastest is stored for the device, kernel and problem shape in local_sizes.txt next to
+ * the program cache, so later runs look it up instead of searching again. Problem shapes
+ * are the global size rounded up to a power of two in each dimension. Setting OCLP_RETUNE
+ * ignores the stored results
+ */
+
+/*
+ * Enqueue the kernel being tuned with the local size passed, padding the global size up
+ * to a multiple of it, and set evt to the kernel's event
+ */
+typedef cl_int (*tune_enqueue_fn)(void *arg, cl_command_queue queue, cl_kernel kernel,
+	const size_t *local_size, cl_event *evt);
+
+/*
+ * Run variant number variant of the work being picked between on the queue, the queue is
+ * finished after each run to time it
+ */
+typedef cl_int (*tune_variant_fn)(void *arg, cl_command_queue queue, int variant);
+
+/*
+ * Find the best local size for running the kernel over global_size on the queue's device,
+ * writing work_dim entries to local_size. If enqueue is NULL the kernel is enqueued as its
+ * arguments are set with the global size padded by pad_global_size, so it has to ignore
+ * work-items past global_size. Candidates that fail to enqueue, eg. because their local
+ * memory doesn't fit, are skipped
+ * returns 1 if none of them could run
+ */
+int tune_local_size(cl_command_queue queue, cl_kernel kernel, cl_uint work_dim,
+	const size_t *global_size, tune_enqueue_fn enqueue, void *arg, size_t *local_size);
+/*
+ * Round the global size up to a multiple of the local size in each of the work_dim dimensions
+ */
+void pad_global_size(cl_uint work_dim, const size_t *global_size, const size_t *local_size,
+	size_t *padded);
+/*
+ * Pick the fastest of n_variants ways of doing the same work on the queue's device, eg.
+ * different kernels or memory objects, timing each one end to end with run. The pick is
+ * stored for the device under name, which should include the problem shape, in variants.txt
+ * next to the program cache and later calls look it up instead of timing again unless
+ * OCLP_RETUNE is set. Variants that fail to run are skipped
+ * returns the index of the fastest variant or -1 if none of them could run
+ */
+int tune_variant(cl_command_queue queue, const char *name, int n_variants, tune_variant_fn run,
+	void *arg);
+
+#endif
+
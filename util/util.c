@@ -1,7 +1,15 @@
+#define _POSIX_C_SOURCE 200112L
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <CL/cl.h>
 #include "util.h"
+#include "prog_cache.h"
 
 char* read_file(const char *f_name, size_t *sz){
 	FILE *fp = fopen(f_name, "rb");
@@ -28,11 +36,61 @@ char* read_file(const char *f_name, size_t *sz){
 	content[size] = '\0';
 	return content;
 }
+int map_file(const char *f_name, mapped_file_t *file){
+	int fd = open(f_name, O_RDONLY);
+	if (fd < 0){
+		fprintf(stderr, "map_file error: failed to open file: %s\n", f_name);
+		return 1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0){
+		fprintf(stderr, "map_file error: can't map empty or unreadable file: %s\n", f_name);
+		close(fd);
+		return 1;
+	}
+	file->size = st.st_size;
+	file->mapped_size = round_up(file->size, sysconf(_SC_PAGESIZE));
+	void *data = mmap(NULL, file->mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	//The mapping keeps the file open
+	close(fd);
+	if (data == MAP_FAILED){
+		fprintf(stderr, "map_file error: mmap failed: %s\n", f_name);
+		return 1;
+	}
+	posix_madvise(data, file->mapped_size, POSIX_MADV_SEQUENTIAL);
+	file->data = data;
+	return 0;
+}
+void unmap_file(mapped_file_t *file){
+	if (file->data){
+		munmap((void*)file->data, file->mapped_size);
+		file->data = NULL;
+	}
+}
+cl_mem create_file_buffer(cl_context context, cl_device_id device, const mapped_file_t *file,
+	cl_int *err)
+{
+	cl_bool unified = CL_FALSE;
+	clGetDeviceInfo(device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &unified, NULL);
+	if (unified){
+		cl_mem mem = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+			file->mapped_size, (void*)file->data, err);
+		if (*err == CL_SUCCESS){
+			return mem;
+		}
+	}
+	return clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, file->size,
+		(void*)file->data, err);
+}
 cl_program build_program(const char *src, cl_context context, cl_device_id device,
 	const char *options)
 {
+	cl_program program = prog_cache_load(src, context, device, options);
+	if (program){
+		return program;
+	}
 	cl_int err;
-	cl_program program = clCreateProgramWithSource(context, 1, &src, NULL, &err);
+	program = clCreateProgramWithSource(context, 1, &src, NULL, &err);
 	if (check_cl_err(err, "Failed to create program from source")){
 		return NULL;
 	}
@@ -48,8 +106,79 @@ cl_program build_program(const char *src, cl_context context, cl_device_id devic
 		clReleaseProgram(program);
 		return NULL;
 	}
+	prog_cache_store(program, src, device, options);
 	return program;
 }
+size_t round_up(size_t n, size_t multiple){
+	return (n + multiple - 1) / multiple * multiple;
+}
+double wall_time(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+cl_half float_to_half(float f){
+	cl_uint x;
+	memcpy(&x, &f, sizeof(x));
+	const cl_uint sign = (x >> 16) & 0x8000;
+	const int f_exp = (x >> 23) & 0xff;
+	const int exp = f_exp - 127 + 15;
+	cl_uint mant = x & 0x7fffff;
+	if (f_exp == 0xff){
+		return sign | 0x7c00 | (mant ? 0x200 : 0);
+	}
+	if (exp >= 31){
+		return sign | 0x7c00;
+	}
+	//Denormal halves shift the implicit leading bit down into the mantissa
+	int shift = 13;
+	cl_uint h = sign | (exp << 10);
+	if (exp <= 0){
+		if (exp < -10){
+			return sign;
+		}
+		mant |= 0x800000;
+		shift = 14 - exp;
+		h = sign;
+	}
+	const cl_uint rem = mant & ((1u << shift) - 1);
+	const cl_uint halfway = 1u << (shift - 1);
+	h += mant >> shift;
+	//Round to nearest even, a carry out of the mantissa correctly bumps the exponent
+	if (rem > halfway || (rem == halfway && (h & 1))){
+		++h;
+	}
+	return h;
+}
+float half_to_float(cl_half h){
+	const cl_uint sign = (cl_uint)(h & 0x8000) << 16;
+	int exp = (h >> 10) & 0x1f;
+	cl_uint mant = h & 0x3ff;
+	cl_uint x;
+	if (exp == 0x1f){
+		x = sign | 0x7f800000 | (mant << 13);
+	}
+	else if (exp == 0){
+		if (mant == 0){
+			x = sign;
+		}
+		else {
+			//Normalize the denormal
+			exp = 1;
+			while (!(mant & 0x400)){
+				mant <<= 1;
+				--exp;
+			}
+			x = sign | ((cl_uint)(exp - 15 + 127) << 23) | ((mant & 0x3ff) << 13);
+		}
+	}
+	else {
+		x = sign | ((cl_uint)(exp - 15 + 127) << 23) | (mant << 13);
+	}
+	float f;
+	memcpy(&f, &x, sizeof(f));
+	return f;
+}
 int check_cl_err(cl_int err, const char *msg){
 	if (err == CL_SUCCESS){
 		return 0;
@@ -9,9 +9,39 @@
  * returns NULL if fails
  */
 char* read_file(const char *f_name, size_t *sz);
+/*
+ * A file mapped into memory by map_file, data is size bytes long and the mapping
+ * itself covers mapped_size bytes, size rounded up to whole pages. The pages past
+ * the end of the file read as zero
+ */
+typedef struct mapped_file_t {
+	const void *data;
+	size_t size, mapped_size;
+} mapped_file_t;
+/*
+ * Map the file for reading without copying it, pages are loaded from the page cache
+ * as they're touched. The mapping is private so nothing written through it, eg. by
+ * an OpenCL runtime using it as a host pointer, reaches the file
+ * returns 1 on failure
+ */
+int map_file(const char *f_name, mapped_file_t *file);
+/*
+ * Unmap a file mapped with map_file, any buffers created over it must be released first
+ */
+void unmap_file(mapped_file_t *file);
+/*
+ * Create a read only buffer holding the mapped file. If the device shares memory with
+ * the host the buffer wraps the mapping with CL_MEM_USE_HOST_PTR and covers the whole
+ * mapped_size, so CPU devices read the file pages directly, otherwise the file is
+ * copied in and the buffer is size bytes
+ * returns NULL on failure
+ */
+cl_mem create_file_buffer(cl_context context, cl_device_id device, const mapped_file_t *file,
+	cl_int *err);
 /*
  * Build an OpenCL program from the source for the context and device
- * and pass any desired compiler options
+ * and pass any desired compiler options. Built binaries are kept in the
+ * on-disk program cache (see prog_cache.h) and reused on later runs
  * returns NULL on failure
  */
 cl_program build_program(const char *src, cl_context context, cl_device_id device,
@@ -21,6 +51,20 @@ cl_program build_program(const char *src, cl_context context, cl_device_id devic
  * returns 1 if an error was logged
  */
 int check_cl_err(cl_int err, const char *msg);
+/*
+ * Round n up to the next multiple of multiple, for padding global work sizes
+ */
+size_t round_up(size_t n, size_t multiple);
+/*
+ * Get a monotonic wall clock time in seconds, for timing host-side work
+ */
+double wall_time(void);
+/*
+ * Convert between float and the IEEE half precision bits in a cl_half, rounding to
+ * nearest even like vstore_half does by default
+ */
+cl_half float_to_half(float f);
+float half_to_float(cl_half h);
 
 #endif
 